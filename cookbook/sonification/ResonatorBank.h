@@ -0,0 +1,245 @@
+#pragma once
+#ifndef ResonatorBank_H
+#define ResonatorBank_H
+
+// Shared bank of two-pole resonators for modal synthesis.
+//
+// Instead of every voice running its own vector of gam::Reson filters, the
+// modes of all voices live in one structure-of-arrays bank and are updated
+// together, kLanes modes per step. A voice acquires a slot, adds its modes
+// and writes its excitation signal into the slot's buffer once per block.
+// The app renders the whole bank after the voices, once per block.
+//
+// Modes whose energy has fallen below the cull threshold, and whose voice is
+// no longer exciting them, are removed from the active set, so a voice only
+// costs CPU while it is audible. States that underflow are flushed to zero
+// and render() runs with the CPU's flush-to-zero mode enabled where
+// available, so decaying tails never hit denormal arithmetic.
+//
+// All memory is allocated in the constructor.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+#include "Gamma/Domain.h"
+
+class ResonatorBank {
+public:
+  /// Modes updated together per step, 8 floats fill an AVX register
+  static const int kLanes = 8;
+
+  /**
+   * @param maxVoices maximum number of voices holding a slot at once
+   * @param maxModes maximum number of modes ringing at once
+   * @param maxFrames largest block size passed to render()
+   */
+  ResonatorBank(int maxVoices = 256, int maxModes = 4096, int maxFrames = 1024)
+      : mMaxFrames(maxFrames) {
+    int capacity = (maxModes + kLanes - 1) / kLanes * kLanes;
+    mB1.resize(capacity, 0.0f);
+    mB2.resize(capacity, 0.0f);
+    mGain.resize(capacity, 0.0f);
+    mAmp.resize(capacity, 0.0f);
+    mY1.resize(capacity, 0.0f);
+    mY2.resize(capacity, 0.0f);
+    mSlot.resize(capacity, maxVoices);
+    // One extra row of silence for the padding lanes
+    mExcitation.resize((maxVoices + 1) * maxFrames, 0.0f);
+    mExcited.resize(maxVoices, false);
+    mModeCount.resize(maxVoices, 0);
+    mFreeSlots.reserve(maxVoices);
+    for (int i = maxVoices - 1; i >= 0; i--) {
+      mFreeSlots.push_back(i);
+    }
+    mLaneOut.resize(maxFrames * kLanes, 0.0f);
+  }
+
+  /// Reserve a slot for a voice. Returns -1 if all slots are taken.
+  int acquire() {
+    if (mFreeSlots.empty()) {
+      return -1;
+    }
+    int slot = mFreeSlots.back();
+    mFreeSlots.pop_back();
+    return slot;
+  }
+
+  /// Return a slot. Any modes still ringing in it are removed.
+  void release(int slot) {
+    if (slot < 0) {
+      return;
+    }
+    for (int k = mActive - 1; k >= 0; k--) {
+      if (mSlot[k] == slot) {
+        remove(k);
+      }
+    }
+    mFreeSlots.push_back(slot);
+  }
+
+  /**
+   * @brief Add a mode to a slot
+   * @param slot slot returned by acquire()
+   * @param freq center frequency in Hz
+   * @param width bandwidth in Hz
+   * @param amp output amplitude
+   * @return false if the bank is full and the mode was dropped
+   */
+  bool addMode(int slot, float freq, float width, float amp) {
+    if (mActive == int(mB1.size())) {
+      return false;
+    }
+    const float pi = 3.14159265f;
+    float ups = float(1.0 / gam::sampleRate());
+    float r = std::exp(-pi * width * ups);
+    float theta = 2.0f * pi * freq * ups;
+    int k = mActive++;
+    mB1[k] = 2.0f * r * std::cos(theta);
+    mB2[k] = -r * r;
+    // Unity gain at the center frequency
+    mGain[k] = (1.0f - r) *
+               std::sqrt(1.0f - 2.0f * r * std::cos(2.0f * theta) + r * r);
+    mAmp[k] = amp;
+    mY1[k] = 0.0f;
+    mY2[k] = 0.0f;
+    mSlot[k] = slot;
+    mModeCount[slot]++;
+    return true;
+  }
+
+  /**
+   * @brief Excitation buffer of a slot for the current block
+   *
+   * A voice that calls this must fill all frames of the block it will be
+   * rendered with. Slots that are not written this block get no excitation.
+   */
+  float *excitation(int slot) {
+    mExcited[slot] = true;
+    return mExcitation.data() + slot * mMaxFrames;
+  }
+
+  /// Frames in an excitation buffer, the largest block the bank renders
+  int maxFrames() const { return mMaxFrames; }
+
+  /// Number of modes of a slot still ringing
+  int activeModes(int slot) const { return slot < 0 ? 0 : mModeCount[slot]; }
+  int activeModes() const { return mActive; }
+
+  /// Energy below which a mode that is not being excited is dropped
+  void cullThreshold(float threshold) { mCullThreshold = threshold; }
+
+  /// Add all active modes to out
+  void render(float *out, int frames) {
+    frames = std::min(frames, mMaxFrames);
+#if defined(__SSE__) || defined(_M_X64)
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040); // Flush to zero, denormals are zero
+#endif
+    std::memset(mLaneOut.data(), 0, sizeof(float) * frames * kLanes);
+    const int padded = (mActive + kLanes - 1) / kLanes * kLanes;
+    for (int k = 0; k < padded; k += kLanes) {
+      renderLanes(k, frames);
+    }
+    for (int i = 0; i < frames; i++) {
+      float sum = 0.0f;
+      for (int j = 0; j < kLanes; j++) {
+        sum += mLaneOut[i * kLanes + j];
+      }
+      out[i] += sum;
+    }
+    cull();
+    for (size_t slot = 0; slot < mExcited.size(); slot++) {
+      if (mExcited[slot]) {
+        std::memset(mExcitation.data() + slot * mMaxFrames, 0,
+                    sizeof(float) * mMaxFrames);
+        mExcited[slot] = false;
+      }
+    }
+#if defined(__SSE__) || defined(_M_X64)
+    _mm_setcsr(csr);
+#endif
+  }
+
+private:
+  // Run kLanes modes over the block, keeping their state in registers
+  void renderLanes(int k, int frames) {
+    float b1[kLanes], b2[kLanes], gain[kLanes], amp[kLanes];
+    float y1[kLanes], y2[kLanes];
+    const float *x[kLanes];
+    for (int j = 0; j < kLanes; j++) {
+      b1[j] = mB1[k + j];
+      b2[j] = mB2[k + j];
+      gain[j] = mGain[k + j];
+      amp[j] = mAmp[k + j];
+      y1[j] = mY1[k + j];
+      y2[j] = mY2[k + j];
+      x[j] = mExcitation.data() + mSlot[k + j] * mMaxFrames;
+    }
+    float *laneOut = mLaneOut.data();
+    for (int i = 0; i < frames; i++) {
+      for (int j = 0; j < kLanes; j++) {
+        float y = gain[j] * x[j][i] + b1[j] * y1[j] + b2[j] * y2[j];
+        y2[j] = y1[j];
+        y1[j] = y;
+        laneOut[i * kLanes + j] += amp[j] * y;
+      }
+    }
+    for (int j = 0; j < kLanes; j++) {
+      // Flush states that have decayed into the denormal range
+      mY1[k + j] = std::fabs(y1[j]) < 1e-20f ? 0.0f : y1[j];
+      mY2[k + j] = std::fabs(y2[j]) < 1e-20f ? 0.0f : y2[j];
+    }
+  }
+
+  void cull() {
+    for (int k = mActive - 1; k >= 0; k--) {
+      if (mExcited[mSlot[k]]) {
+        continue;
+      }
+      float energy = mAmp[k] * mAmp[k] * (mY1[k] * mY1[k] + mY2[k] * mY2[k]);
+      if (energy < mCullThreshold) {
+        remove(k);
+      }
+    }
+  }
+
+  // Move the last active mode into k and silence the freed lane
+  void remove(int k) {
+    int last = --mActive;
+    mModeCount[mSlot[k]]--;
+    mB1[k] = mB1[last];
+    mB2[k] = mB2[last];
+    mGain[k] = mGain[last];
+    mAmp[k] = mAmp[last];
+    mY1[k] = mY1[last];
+    mY2[k] = mY2[last];
+    mSlot[k] = mSlot[last];
+    mB1[last] = mB2[last] = mGain[last] = mAmp[last] = 0.0f;
+    mY1[last] = mY2[last] = 0.0f;
+    mSlot[last] = int(mExcited.size()); // Silent row
+  }
+
+  // Mode coefficients and state, structure of arrays
+  std::vector<float> mB1, mB2, mGain, mAmp;
+  std::vector<float> mY1, mY2;
+  std::vector<int> mSlot;
+  int mActive{0};
+
+  // Per slot
+  std::vector<float> mExcitation;
+  std::vector<bool> mExcited;
+  std::vector<int> mModeCount;
+  std::vector<int> mFreeSlots;
+
+  std::vector<float> mLaneOut;
+  int mMaxFrames;
+  float mCullThreshold{1e-12f};
+};
+
+#endif // ResonatorBank_H
@@ -1,3 +1,5 @@
+#include <cassert>
+
 #include "al/app/al_App.hpp"
 #include "al/scene/al_PolySynth.hpp"
 
@@ -6,6 +8,8 @@
 #include "Gamma/Filter.h"
 #include "Gamma/Noise.h"
 
+#include "ResonatorBank.h"
+
 using namespace al;
 
 // Frequency coefficients from:
@@ -39,63 +43,76 @@ std::vector<float> smallHandBell = {1,
                                     7.3188262195122,
                                     7.5551829268293};
 
+// The modes of all voices are rendered together by this bank. Voices only
+// generate the excitation and hold a slot while their modes ring.
+ResonatorBank modalBank;
+
 struct ModalVoice : public SynthVoice {
 
-  std::vector<gam::Reson<>> modes;
-  std::vector<float> amps;
   float globalAmp = 10.;
 
   gam::NoisePink<> noise;
 
   gam::Env<3> residualEnv;
-  gam::EnvFollow<> envFollow; // track envelope to know when to turn off note.
 
   float fundamentalFreq = 440;
 
+  int slot = -1;
+  bool pendingTrigger = false;
+
   void init() override {
     residualEnv.levels(0.0f, 1.0f, 0.0f);
     residualEnv.lengths(0.002f, 0.07f);
   }
 
   void onProcess(AudioIOData &io) override {
-    while (io()) {
-      auto ampIt = amps.begin();
-      float excitation = noise() * residualEnv();
-      for (auto &mode : modes) {
-        float out = mode(excitation);
-        io.out(0) += *ampIt++ * globalAmp * out;
+    // Modes are added from the audio thread, as the bank is rendered there
+    if (pendingTrigger) {
+      pendingTrigger = false;
+      addModes();
+    }
+    if (slot < 0) {
+      free(); // All slots were taken, nothing to play
+      return;
+    }
+    if (!residualEnv.done()) {
+      assert(int(io.framesPerBuffer()) <= modalBank.maxFrames());
+      float *excitation = modalBank.excitation(slot);
+      while (io()) {
+        excitation[io.frame()] = noise() * residualEnv();
       }
-      envFollow(io.out(0));
     }
-    if (envFollow.done(0.0001)) {
+    // The bank drops modes once they have decayed below audibility
+    if (residualEnv.done() && modalBank.activeModes(slot) == 0) {
+      modalBank.release(slot);
+      slot = -1;
       free();
     }
   }
 
-  void onTriggerOn() override {
-    residualEnv.reset();
+  void addModes() {
+    modalBank.release(slot);
+    slot = modalBank.acquire();
+    if (slot < 0) {
+      return; // All slots taken, onProcess() frees the voice
+    }
     auto &freqs = smallHandBell;
-    modes.resize(freqs.size());
-    amps.resize(freqs.size());
-    auto modesIt = modes.begin();
-    auto ampsIt = amps.begin();
     int counter = 1;
     for (auto f : freqs) {
-      modesIt->freq(f * fundamentalFreq);
       //      xylo 0.006
       // aluminium 0.00012
       // tubularBell 0.0004
       // small handbell 0.0004
       // small handbell 0.005 // low frequencies sounds like a pot
-      modesIt->width(f * fundamentalFreq * 0.0004);
-      *ampsIt = 1.0 / counter++;
-      modesIt++;
-      ampsIt++;
+      modalBank.addMode(slot, f * fundamentalFreq,
+                        f * fundamentalFreq * 0.0004,
+                        globalAmp / counter++);
     }
+  }
 
-    for (auto &mode : modes) {
-      mode.zero();
-    }
+  void onTriggerOn() override {
+    residualEnv.reset();
+    pendingTrigger = true;
   }
 };
 
@@ -105,7 +122,10 @@ struct MyApp : public App {
 
   void onInit() override { gam::sampleRate(audioIO().framesPerSecond()); }
 
-  void onSound(AudioIOData &io) override { synth.render(io); }
+  void onSound(AudioIOData &io) override {
+    synth.render(io);
+    modalBank.render(io.outBuffer(0), io.framesPerBuffer());
+  }
 
   bool onKeyDown(const Keyboard &k) override {
     auto voice = synth.getVoice<ModalVoice>();
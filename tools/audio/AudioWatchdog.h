@@ -0,0 +1,434 @@
+#pragma once
+#ifndef AudioWatchdog_H
+#define AudioWatchdog_H
+
+// Real-time safety diagnostics for onSound().
+//
+// Heap allocation, locks, console output and file access on the audio
+// thread go unnoticed until a performance glitches. With the watchdog
+// enabled, code running inside an audio callback is checked as it runs:
+//
+//  - operator new and delete are replaced, and report allocations and frees
+//  - on Linux, pthread_mutex_lock and the blocking stdio and POSIX calls
+//    (write, read, fwrite, fputs, puts, printf, fflush, usleep, nanosleep)
+//    are interposed
+//  - the outputs are scanned for NaN, infinity and denormals after the
+//    callback
+//  - the callback duration is recorded in a histogram relative to the
+//    buffer deadline
+//
+// Each violation is recorded with its stack. The audio thread only stores
+// the return addresses in a fixed table of unique sites. Symbols are looked
+// up when the report is printed, on another thread.
+//
+//   void onSound(AudioIOData &io) override {
+//     AudioWatchdog::Callback watchdog(io);
+//     ...
+//   }
+//   void onAnimate(double dt) override { AudioWatchdog::report(); }
+//   void onExit() override { AudioWatchdog::summary(); }
+//
+// The watchdog is off unless AL_AUDIO_WATCHDOG is set in the environment or
+// AudioWatchdog::enable() is called. The hooks replace global functions, so
+// include this header from the app's one translation unit only.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <execinfo.h>
+#define AUDIO_WATCHDOG_BACKTRACE 1
+#endif
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#define AUDIO_WATCHDOG_INTERPOSE 1
+#endif
+
+#include "al/io/al_AudioIOData.hpp"
+
+class AudioWatchdog {
+public:
+  enum Violation {
+    ALLOCATION,
+    DEALLOCATION,
+    LOCK,
+    BLOCKING_CALL,
+    NAN_OUTPUT,
+    DENORMAL_OUTPUT,
+    DEADLINE_MISS,
+    kNumViolations
+  };
+
+  static const int kMaxSites = 256;
+  static const int kMaxFrames = 24;
+  /// Histogram buckets of 10% of the deadline, the last one is 200% and up
+  static const int kNumBuckets = 21;
+
+  static bool enabled() {
+    return state().enabled.load(std::memory_order_relaxed);
+  }
+
+  static void enable(bool enable = true) {
+#ifdef AUDIO_WATCHDOG_BACKTRACE
+    // backtrace() loads its unwinder on first use, do that here
+    void *frames[2];
+    backtrace(frames, 2);
+#endif
+    state().enabled = enable;
+  }
+
+  /// Marks the audio callback for the lifetime of the object
+  class Callback {
+  public:
+    Callback(al::AudioIOData &io) : mIO(io), mActive(enabled()) {
+      if (mActive) {
+        mStart = std::chrono::steady_clock::now();
+        inCallback() = true;
+      }
+    }
+
+    ~Callback() {
+      if (!mActive) {
+        return;
+      }
+      inCallback() = false;
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - mStart;
+      double deadline = mIO.framesPerBuffer() / mIO.framesPerSecond();
+      double load = deadline > 0.0 ? elapsed.count() / deadline : 0.0;
+      int bucket = std::min(int(load * 10.0), kNumBuckets - 1);
+      State &s = state();
+      s.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+      s.callbacks.fetch_add(1, std::memory_order_relaxed);
+      if (load > 1.0) {
+        s.counts[DEADLINE_MISS].fetch_add(1, std::memory_order_relaxed);
+      }
+      checkOutputs();
+    }
+
+  private:
+    void checkOutputs() {
+      bool nan = false, denormal = false;
+      for (int c = 0; c < int(mIO.channelsOut()); c++) {
+        const float *out = mIO.outBuffer(c);
+        for (int i = 0; i < int(mIO.framesPerBuffer()); i++) {
+          int kind = std::fpclassify(out[i]);
+          nan = nan || kind == FP_NAN || kind == FP_INFINITE;
+          denormal = denormal || kind == FP_SUBNORMAL;
+        }
+      }
+      if (nan) {
+        record(NAN_OUTPUT, "NaN or infinity output");
+      }
+      if (denormal) {
+        record(DENORMAL_OUTPUT, "denormal output");
+      }
+    }
+
+    al::AudioIOData &mIO;
+    bool mActive;
+    std::chrono::steady_clock::time_point mStart;
+  };
+
+  /// Called by the hooks. Records a violation if inside a callback.
+  static void check(Violation type, const char *what) {
+    if (inCallback() && !inRecord()) {
+      record(type, what);
+    }
+  }
+
+  /**
+   * @brief Print sites found since the last report
+   *
+   * Symbolizes stacks and prints, so call from a non-audio thread, for
+   * example onAnimate(). Prints at most once per second.
+   */
+  static void report(FILE *out = stdout) {
+    State &s = state();
+    auto now = std::chrono::steady_clock::now();
+    if (now - s.lastReport < std::chrono::seconds(1)) {
+      return;
+    }
+    s.lastReport = now;
+    int numSites = std::min(s.numSites.load(std::memory_order_acquire),
+                            int(kMaxSites));
+    for (int i = s.reported; i < numSites; i++) {
+      printSite(out, s.sites[i]);
+    }
+    s.reported = numSites;
+  }
+
+  /// Print every site with its count and the callback duration histogram
+  static void summary(FILE *out = stdout) {
+    State &s = state();
+    if (!enabled() && s.callbacks == 0) {
+      return;
+    }
+    std::fprintf(out, "Audio watchdog: %llu callbacks\n",
+                 (unsigned long long)s.callbacks.load());
+    const char *names[] = {"allocations", "frees",     "locks",
+                           "blocking calls", "NaN outputs", "denormal outputs",
+                           "deadline misses"};
+    for (int i = 0; i < kNumViolations; i++) {
+      std::fprintf(out, "  %-17s %llu\n", names[i],
+                   (unsigned long long)s.counts[i].load());
+    }
+    int numSites = std::min(s.numSites.load(), int(kMaxSites));
+    for (int i = 0; i < numSites; i++) {
+      printSite(out, s.sites[i]);
+    }
+    std::fprintf(out, "  callback duration, percent of buffer deadline:\n");
+    for (int i = 0; i < kNumBuckets; i++) {
+      uint64_t count = s.histogram[i].load();
+      if (count == 0) {
+        continue;
+      }
+      if (i == kNumBuckets - 1) {
+        std::fprintf(out, "    %3d%% and up  %llu\n", i * 10,
+                     (unsigned long long)count);
+      } else {
+        std::fprintf(out, "    %3d - %3d%%   %llu\n", i * 10, i * 10 + 10,
+                     (unsigned long long)count);
+      }
+    }
+  }
+
+private:
+  struct Site {
+    std::atomic<uint64_t> hash{0}; // Published last
+    Violation type;
+    const char *what;
+    void *frames[kMaxFrames];
+    int depth;
+    std::atomic<uint64_t> count{0};
+  };
+
+  struct State {
+    std::atomic<bool> enabled{false};
+    Site sites[kMaxSites];
+    std::atomic<int> numSites{0};
+    std::atomic<uint64_t> counts[kNumViolations];
+    std::atomic<uint64_t> histogram[kNumBuckets];
+    std::atomic<uint64_t> callbacks{0};
+    // Reporting thread only
+    int reported{0};
+    std::chrono::steady_clock::time_point lastReport;
+
+    State() {
+      for (auto &count : counts) {
+        count = 0;
+      }
+      for (auto &bucket : histogram) {
+        bucket = 0;
+      }
+    }
+  };
+
+  static State &state() {
+    static State s;
+    return s;
+  }
+
+  static bool &inCallback() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+  static bool &inRecord() {
+    static thread_local bool recording = false;
+    return recording;
+  }
+
+  // Audio thread. Only the audio thread adds sites, readers wait for hash.
+  static void record(Violation type, const char *what) {
+    inRecord() = true;
+    State &s = state();
+    s.counts[type].fetch_add(1, std::memory_order_relaxed);
+    void *frames[kMaxFrames];
+    int depth = 0;
+#ifdef AUDIO_WATCHDOG_BACKTRACE
+    depth = backtrace(frames, kMaxFrames);
+#endif
+    uint64_t hash = 1469598103934665603ull ^ uint64_t(type);
+    for (int i = 0; i < depth; i++) {
+      hash = (hash ^ uint64_t(uintptr_t(frames[i]))) * 1099511628211ull;
+    }
+    hash |= 1; // 0 marks an unpublished site
+    int numSites = s.numSites.load(std::memory_order_relaxed);
+    for (int i = 0; i < numSites && i < kMaxSites; i++) {
+      if (s.sites[i].hash.load(std::memory_order_relaxed) == hash) {
+        s.sites[i].count.fetch_add(1, std::memory_order_relaxed);
+        inRecord() = false;
+        return;
+      }
+    }
+    if (numSites < kMaxSites) {
+      Site &site = s.sites[numSites];
+      site.type = type;
+      site.what = what;
+      site.depth = depth;
+      for (int i = 0; i < depth; i++) {
+        site.frames[i] = frames[i];
+      }
+      site.count.store(1, std::memory_order_relaxed);
+      site.hash.store(hash, std::memory_order_release);
+      s.numSites.store(numSites + 1, std::memory_order_release);
+    }
+    inRecord() = false;
+  }
+
+  static void printSite(FILE *out, const Site &site) {
+    if (site.hash.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+    std::fprintf(out, "Audio watchdog: %s in audio callback (%llu times)\n",
+                 site.what, (unsigned long long)site.count.load());
+#ifdef AUDIO_WATCHDOG_BACKTRACE
+    // Skip record() and check()
+    int first = std::min(site.depth, 2);
+    char **symbols =
+        backtrace_symbols(const_cast<void **>(site.frames), site.depth);
+    for (int i = first; symbols && i < site.depth; i++) {
+      std::fprintf(out, "    %s\n", symbols[i]);
+    }
+    std::free(symbols);
+#endif
+  }
+};
+
+// Enabled from the environment before main(), off the audio thread
+static const bool audioWatchdogFromEnvironment = [] {
+  if (std::getenv("AL_AUDIO_WATCHDOG")) {
+    AudioWatchdog::enable();
+  }
+  return true;
+}();
+
+// Hooks. Replacement operator new and delete are standard C++.
+
+void *operator new(std::size_t size) {
+  AudioWatchdog::check(AudioWatchdog::ALLOCATION, "operator new");
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](std::size_t size) {
+  AudioWatchdog::check(AudioWatchdog::ALLOCATION, "operator new[]");
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p) {
+    AudioWatchdog::check(AudioWatchdog::DEALLOCATION, "operator delete");
+  }
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  if (p) {
+    AudioWatchdog::check(AudioWatchdog::DEALLOCATION, "operator delete[]");
+  }
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { operator delete[](p); }
+
+#ifdef AUDIO_WATCHDOG_INTERPOSE
+// Definitions in the executable take precedence over the C library. The
+// originals are looked up with RTLD_NEXT on first use.
+
+#define AUDIO_WATCHDOG_REAL(name)                                              \
+  static decltype(&name) real = nullptr;                                       \
+  if (!real) {                                                                 \
+    real = reinterpret_cast<decltype(&name)>(dlsym(RTLD_NEXT, #name));         \
+  }
+
+extern "C" {
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  AudioWatchdog::check(AudioWatchdog::LOCK, "pthread_mutex_lock");
+  AUDIO_WATCHDOG_REAL(pthread_mutex_lock);
+  return real(mutex);
+}
+
+ssize_t write(int fd, const void *buffer, size_t count) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "write");
+  AUDIO_WATCHDOG_REAL(write);
+  return real(fd, buffer, count);
+}
+
+ssize_t read(int fd, void *buffer, size_t count) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "read");
+  AUDIO_WATCHDOG_REAL(read);
+  return real(fd, buffer, count);
+}
+
+size_t fwrite(const void *buffer, size_t size, size_t count, FILE *file) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "fwrite");
+  AUDIO_WATCHDOG_REAL(fwrite);
+  return real(buffer, size, count, file);
+}
+
+int fputs(const char *s, FILE *file) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "fputs");
+  AUDIO_WATCHDOG_REAL(fputs);
+  return real(s, file);
+}
+
+int puts(const char *s) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "puts");
+  AUDIO_WATCHDOG_REAL(puts);
+  return real(s);
+}
+
+int printf(const char *format, ...) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "printf");
+  va_list args;
+  va_start(args, format);
+  int result = vfprintf(stdout, format, args);
+  va_end(args);
+  return result;
+}
+
+int fflush(FILE *file) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "fflush");
+  AUDIO_WATCHDOG_REAL(fflush);
+  return real(file);
+}
+
+int usleep(useconds_t microseconds) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "usleep");
+  AUDIO_WATCHDOG_REAL(usleep);
+  return real(microseconds);
+}
+
+int nanosleep(const struct timespec *duration, struct timespec *remaining) {
+  AudioWatchdog::check(AudioWatchdog::BLOCKING_CALL, "nanosleep");
+  AUDIO_WATCHDOG_REAL(nanosleep);
+  return real(duration, remaining);
+}
+
+} // extern "C"
+
+#undef AUDIO_WATCHDOG_REAL
+#endif // AUDIO_WATCHDOG_INTERPOSE
+
+#endif // AudioWatchdog_H
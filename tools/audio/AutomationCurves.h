@@ -0,0 +1,578 @@
+#pragma once
+#ifndef AutomationCurves_H
+#define AutomationCurves_H
+
+// Automation sequences compiled to curves and evaluated for all voices at
+// once.
+//
+// Each automated voice used to own a PresetSequencer and a PresetHandler.
+// On every trigger they parsed the voice's text sequence again, then a
+// sequencer thread per voice stepped through it once per audio block and
+// morphed the voice's pose. AutomationLibrary compiles each sequence file
+// once into piecewise linear curves, one per parameter address, shared by
+// every voice that plays it. AutomationEngine plays them all on the audio
+// thread. Once per block, each voice's curves move to the segment at its
+// time, and the values of every active voice are then interpolated in one
+// pass, four at a time with SSE or NEON. Any time can be jumped to, since a
+// segment is found by binary search.
+//
+//   AutomationLibrary library;
+//   library.compileDirectory("piece/");        // Ahead of playback
+//   AutomationEngine engine;
+//   int player = engine.start(library.get("piece/A"), initialValues);
+//   engine.process(seconds);                   // Audio thread, per block
+//   const float *values = engine.values(player);
+//   engine.stop(player);                       // Any thread, wait-free
+//
+// Sequence lines have the form "+delta:/address:v0,v1,...:morphTime". delta
+// is the time since the previous line. At that time the parameter starts
+// moving linearly from its current value to the new values and gets there
+// after morphTime. A line before the end of a morph starts from wherever the
+// morph got to. Values start from the voice's own, passed to start(), so a
+// curve is stored as a value plus a weight of the initial value.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1
+#include <xmmintrin.h>
+#define AUTOMATION_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUTOMATION_NEON 1
+#endif
+
+#include "al/io/al_File.hpp"
+#include "al/types/al_SingleRWRingBuffer.hpp"
+
+/// out[i] = v0[i] + delta[i] * clamp((time - start[i]) * inverse[i], 0, 1)
+inline void interpolateSegments(const float *start, const float *inverse,
+                                const float *v0, const float *delta,
+                                float time, float *out, int count) {
+  int i = 0;
+#if defined(AUTOMATION_SSE)
+  const __m128 t = _mm_set1_ps(time);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 f = _mm_mul_ps(_mm_sub_ps(t, _mm_loadu_ps(start + i)),
+                          _mm_loadu_ps(inverse + i));
+    f = _mm_min_ps(_mm_max_ps(f, zero), one);
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(v0 + i),
+                                      _mm_mul_ps(_mm_loadu_ps(delta + i), f)));
+  }
+#elif defined(AUTOMATION_NEON)
+  const float32x4_t t = vdupq_n_f32(time);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t f =
+        vmulq_f32(vsubq_f32(t, vld1q_f32(start + i)), vld1q_f32(inverse + i));
+    f = vminq_f32(vmaxq_f32(f, zero), one);
+    vst1q_f32(out + i,
+              vmlaq_f32(vld1q_f32(v0 + i), vld1q_f32(delta + i), f));
+  }
+#endif
+  for (; i < count; i++) {
+    float f = (time - start[i]) * inverse[i];
+    f = std::min(std::max(f, 0.0f), 1.0f);
+    out[i] = v0[i] + delta[i] * f;
+  }
+}
+
+/// The curves of one sequence file, immutable once compiled
+class AutomationCurves {
+public:
+  /// Breakpoints of one parameter, linear in between
+  struct Curve {
+    std::string address;
+    int dimensions{1};
+    int offset{0};              // Of its values among all curves' values
+    std::vector<float> times;   // Seconds from the start, ascending
+    std::vector<float> values;  // Per point, dimensions each
+    std::vector<float> weights; // Of the initial value, per value
+
+    /// The last point at or before time, by binary search
+    int find(float time) const {
+      auto next = std::upper_bound(times.begin(), times.end(), time);
+      return std::max(0, int(next - times.begin()) - 1);
+    }
+  };
+
+  /// Compile sequence text, see the top of AutomationCurves.h
+  static std::unique_ptr<AutomationCurves> compile(std::istream &in) {
+    struct Event {
+      double time;
+      std::string address;
+      std::vector<float> values;
+      double morph;
+    };
+    std::vector<Event> events;
+    std::map<std::string, int> dimensions;
+    double time = 0.0;
+    std::string line;
+    while (std::getline(in, line)) {
+      size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos || line[start] != '+') {
+        continue; // Comments, preset lines and the end marker
+      }
+      std::vector<std::string> fields;
+      std::stringstream fieldStream(line.substr(start + 1));
+      std::string field;
+      while (std::getline(fieldStream, field, ':')) {
+        fields.push_back(field);
+      }
+      if (fields.size() < 3) {
+        continue;
+      }
+      Event event;
+      time += std::atof(fields[0].c_str());
+      event.time = time;
+      event.address = fields[1];
+      std::stringstream valueStream(fields[2]);
+      while (std::getline(valueStream, field, ',')) {
+        event.values.push_back(float(std::atof(field.c_str())));
+      }
+      event.morph =
+          fields.size() > 3 ? std::max(0.0, std::atof(fields[3].c_str())) : 0.0;
+      if (event.values.empty()) {
+        continue;
+      }
+      int &count = dimensions[event.address];
+      count = std::max(count, int(event.values.size()));
+      events.push_back(std::move(event));
+    }
+
+    std::unique_ptr<AutomationCurves> curves(new AutomationCurves);
+    std::map<std::string, int> index;
+    int offset = 0;
+    for (const auto &entry : dimensions) {
+      Curve curve;
+      curve.address = entry.first;
+      curve.dimensions = entry.second;
+      curve.offset = offset;
+      offset += entry.second;
+      // Starts at the initial value
+      curve.times.push_back(0.0f);
+      curve.values.assign(entry.second, 0.0f);
+      curve.weights.assign(entry.second, 1.0f);
+      index[entry.first] = int(curves->mCurves.size());
+      curves->mCurves.push_back(std::move(curve));
+    }
+    curves->mChannels = offset;
+    for (const Event &event : events) {
+      curves->add(curves->mCurves[index[event.address]], event.time,
+                  event.values, event.morph);
+    }
+    for (const Curve &curve : curves->mCurves) {
+      curves->mDuration = std::max(curves->mDuration, curve.times.back());
+    }
+    return curves;
+  }
+
+  const std::vector<Curve> &curves() const { return mCurves; }
+
+  /// Values of all curves together
+  int channels() const { return mChannels; }
+
+  /// Time of the last breakpoint
+  float duration() const { return mDuration; }
+
+  /**
+   * @brief Values of all curves at time, without an engine
+   *
+   * initial and out hold channels() values.
+   */
+  void evaluate(float time, const float *initial, float *out) const {
+    for (const Curve &curve : mCurves) {
+      int k = curve.find(time);
+      for (int d = 0; d < curve.dimensions; d++) {
+        out[curve.offset + d] = value(curve, k, d, time, initial);
+      }
+    }
+  }
+
+  /// Value of dimension d at time, with k = curve.find(time)
+  static float value(const Curve &curve, int k, int d, float time,
+                     const float *initial) {
+    float a = point(curve, k, d, initial);
+    if (k + 1 >= int(curve.times.size())) {
+      return a;
+    }
+    float b = point(curve, k + 1, d, initial);
+    float f = (time - curve.times[k]) / (curve.times[k + 1] - curve.times[k]);
+    return a + (b - a) * std::min(std::max(f, 0.0f), 1.0f);
+  }
+
+  /// Value of point k of dimension d
+  static float point(const Curve &curve, int k, int d, const float *initial) {
+    size_t i = size_t(k) * curve.dimensions + d;
+    return curve.values[i] + curve.weights[i] * initial[curve.offset + d];
+  }
+
+private:
+  AutomationCurves() {}
+
+  // Move to values from time over morph, from wherever the curve is then
+  void add(Curve &curve, double time, const std::vector<float> &values,
+           double morph) {
+    int dims = curve.dimensions;
+    float t = float(time);
+    // The current value as value plus weight of the initial value
+    std::vector<float> value(dims), weight(dims);
+    int k = curve.find(t);
+    bool between = k + 1 < int(curve.times.size());
+    for (int d = 0; d < dims; d++) {
+      size_t i = size_t(k) * dims + d;
+      value[d] = curve.values[i];
+      weight[d] = curve.weights[i];
+      if (between) {
+        float f = (t - curve.times[k]) / (curve.times[k + 1] - curve.times[k]);
+        value[d] += (curve.values[i + dims] - curve.values[i]) * f;
+        weight[d] += (curve.weights[i + dims] - curve.weights[i]) * f;
+      }
+    }
+    // Cut an unfinished morph short
+    size_t keep = size_t(k) + 1;
+    curve.times.resize(keep);
+    curve.values.resize(keep * dims);
+    curve.weights.resize(keep * dims);
+    if (curve.times.back() < t) {
+      curve.times.push_back(t);
+      curve.values.insert(curve.values.end(), value.begin(), value.end());
+      curve.weights.insert(curve.weights.end(), weight.begin(), weight.end());
+    }
+    curve.times.push_back(float(time + morph));
+    for (int d = 0; d < dims; d++) {
+      // Components a line leaves out keep their value
+      bool given = d < int(values.size());
+      curve.values.push_back(given ? values[d] : value[d]);
+      curve.weights.push_back(given ? 0.0f : weight[d]);
+    }
+  }
+
+  std::vector<Curve> mCurves;
+  int mChannels{0};
+  float mDuration{0.0f};
+};
+
+/// Sequence files compiled once and kept for the session
+class AutomationLibrary {
+public:
+  /// Compile every .sequence file in directory, ahead of playback
+  void compileDirectory(const std::string &directory) {
+    auto files = al::filterInDir(
+        al::File::conformDirectory(directory), [](const al::FilePath &f) {
+          return al::checkExtension(f, ".sequence");
+        });
+    for (const auto &file : files) {
+      get(file.filepath());
+    }
+  }
+
+  /**
+   * @brief The curves of a sequence file, compiled on first use
+   *
+   * ".sequence" is appended to path if missing, as PresetSequencer does.
+   * Returns nullptr if the file can't be read. The curves live as long as
+   * the library.
+   */
+  const AutomationCurves *get(std::string path) {
+    const std::string extension = ".sequence";
+    if (path.size() < extension.size() ||
+        path.compare(path.size() - extension.size(), extension.size(),
+                     extension) != 0) {
+      path += extension;
+    }
+    std::lock_guard<std::mutex> lock(mLock);
+    auto entry = mCurves.find(path);
+    if (entry != mCurves.end()) {
+      return entry->second.get();
+    }
+    std::ifstream in(path);
+    std::unique_ptr<AutomationCurves> curves;
+    if (in) {
+      curves = AutomationCurves::compile(in);
+    }
+    const AutomationCurves *result = curves.get();
+    mCurves[path] = std::move(curves);
+    return result;
+  }
+
+private:
+  std::mutex mLock;
+  std::map<std::string, std::unique_ptr<AutomationCurves>> mCurves;
+};
+
+/// Plays AutomationCurves for many voices on the audio thread
+class AutomationEngine {
+public:
+  /// Values per player, curves beyond this are left out
+  static const int kMaxChannels = 32;
+
+  AutomationEngine(int maxPlayers = 64) : mMaxPlayers(maxPlayers) {
+    mQueue = std::make_unique<al::SingleRWRingBuffer>(
+        (size_t(maxPlayers) * 4 + 1) * sizeof(Command));
+    mPlayers.resize(maxPlayers);
+    size_t lanes = size_t(maxPlayers) * kMaxChannels;
+    mStart.assign(lanes, 0.0f);
+    mInverse.assign(lanes, 0.0f);
+    mV0.assign(lanes, 0.0f);
+    mDelta.assign(lanes, 0.0f);
+    mValues.assign(lanes, 0.0f);
+    mStates.reset(new std::atomic<uint32_t>[maxPlayers]);
+    for (int p = 0; p < maxPlayers; p++) {
+      mStates[p].store(FREE, std::memory_order_relaxed);
+    }
+  }
+
+  // Players are started and moved from any thread but the audio thread, and
+  // stopped from any thread. Changes take effect at the next process().
+
+  /**
+   * @brief Play curves from their start
+   *
+   * initial holds the voice's values before automation, curves->channels()
+   * of them. Returns the player, or -1 if all are playing.
+   */
+  int start(const AutomationCurves *curves, const float *initial) {
+    if (!curves) {
+      return -1;
+    }
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    if (mQueue->writeSpace() < sizeof(Command)) {
+      return -1;
+    }
+    // Only start() takes players that are FREE, under mWriteLock
+    int player = 0;
+    uint32_t state = 0;
+    for (; player < mMaxPlayers; player++) {
+      state = mStates[player].load(std::memory_order_acquire);
+      if (status(state) == FREE) {
+        break;
+      }
+    }
+    if (player == mMaxPlayers) {
+      return -1;
+    }
+    uint32_t generation = ((state >> 2) + 1) & (~0u >> 2);
+    mStates[player].store(generation << 2 | PLAYING,
+                          std::memory_order_release);
+    Command command;
+    command.type = Command::START;
+    command.player = player;
+    command.generation = generation;
+    command.curves = curves;
+    command.time = 0.0;
+    int channels = std::min(curves->channels(), int(kMaxChannels));
+    std::copy_n(initial, channels, command.initial);
+    pushLocked(command);
+    return player;
+  }
+
+  /**
+   * @brief Stop a player, wait-free
+   *
+   * The player is freed by the next process(). Call once per start().
+   */
+  void stop(int player) {
+    if (player < 0 || player >= mMaxPlayers) {
+      return;
+    }
+    uint32_t state = mStates[player].load(std::memory_order_relaxed);
+    while (status(state) == PLAYING &&
+           !mStates[player].compare_exchange_weak(
+               state, (state & ~3u) | STOPPING, std::memory_order_acq_rel)) {
+    }
+  }
+
+  /// Continue a player from seconds after its start
+  void seek(int player, double seconds) {
+    if (player < 0 || player >= mMaxPlayers) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    uint32_t state = mStates[player].load(std::memory_order_acquire);
+    if (status(state) != PLAYING) {
+      return;
+    }
+    Command command;
+    command.type = Command::SEEK;
+    command.player = player;
+    command.generation = state >> 2;
+    command.time = seconds;
+    pushLocked(command);
+  }
+
+  /**
+   * @brief Audio thread: evaluate every player, then advance by seconds
+   *
+   * Call once per block, before reading values().
+   */
+  void process(double seconds) {
+    applyCommands();
+    for (int p = 0; p < mMaxPlayers; p++) {
+      Player &player = mPlayers[p];
+      if (!player.curves) {
+        continue;
+      }
+      float time = float(player.time);
+      const auto &curves = player.curves->curves();
+      size_t lane = size_t(p) * kMaxChannels;
+      for (int c = 0; c < player.numCurves; c++) {
+        const AutomationCurves::Curve &curve = curves[c];
+        int &k = player.cursors[c];
+        int last = int(curve.times.size()) - 1;
+        bool moved = player.reset;
+        if (moved) {
+          k = curve.find(time);
+        }
+        while (k < last && curve.times[k + 1] <= time) {
+          k++;
+          moved = true;
+        }
+        if (moved) {
+          loadSegment(curve, k, player.initial, lane + curve.offset);
+        }
+      }
+      player.reset = false;
+      interpolateSegments(&mStart[lane], &mInverse[lane], &mV0[lane],
+                          &mDelta[lane], time, &mValues[lane],
+                          player.channels);
+      player.time += seconds;
+    }
+  }
+
+  /**
+   * @brief Audio thread: the values of a player, at the last process()
+   *
+   * Laid out as AutomationCurves::Curve::offset says. nullptr if the player
+   * isn't playing yet.
+   */
+  const float *values(int player) const {
+    if (player < 0 || player >= mMaxPlayers || !mPlayers[player].curves) {
+      return nullptr;
+    }
+    return &mValues[size_t(player) * kMaxChannels];
+  }
+
+  /// Audio thread: seconds since the player started
+  double time(int player) const {
+    return player >= 0 && player < mMaxPlayers ? mPlayers[player].time : 0.0;
+  }
+
+private:
+  // Player states hold a generation, bumped by start(), above the status
+  enum Status : uint32_t { FREE, PLAYING, STOPPING };
+  static Status status(uint32_t state) { return Status(state & 3u); }
+
+  struct Command {
+    enum Type { START, SEEK };
+    int32_t type;
+    int32_t player;
+    uint32_t generation; // Of the player's state when pushed
+    const AutomationCurves *curves{nullptr};
+    double time{0.0};
+    float initial[kMaxChannels];
+  };
+
+  struct Player {
+    const AutomationCurves *curves{nullptr};
+    double time{0.0};
+    bool reset{false}; // Find every segment again
+    int numCurves{0};  // That fit in kMaxChannels
+    int channels{0};
+    int cursors[kMaxChannels];
+    float initial[kMaxChannels];
+  };
+
+  // With mWriteLock held
+  bool pushLocked(const Command &command) {
+    if (mQueue->writeSpace() < sizeof(Command)) {
+      return false;
+    }
+    mQueue->write(reinterpret_cast<const char *>(&command), sizeof(Command));
+    return true;
+  }
+
+  void applyCommands() {
+    Command command;
+    while (mQueue->readSpace() >= sizeof(Command)) {
+      mQueue->read(reinterpret_cast<char *>(&command), sizeof(Command));
+      Player &player = mPlayers[command.player];
+      // Left from before the player was stopped, or stopped and started
+      uint32_t state = mStates[command.player].load(std::memory_order_acquire);
+      if (status(state) != PLAYING || state >> 2 != command.generation) {
+        continue;
+      }
+      if (command.type == Command::START) {
+        player.curves = command.curves;
+        player.time = command.time;
+        player.reset = true;
+        player.numCurves = 0;
+        player.channels = 0;
+        for (const auto &curve : command.curves->curves()) {
+          if (curve.offset + curve.dimensions > kMaxChannels) {
+            break;
+          }
+          player.numCurves++;
+          player.channels = curve.offset + curve.dimensions;
+        }
+        std::copy_n(command.initial, player.channels, player.initial);
+      } else if (player.curves) {
+        player.time = std::max(0.0, command.time);
+        player.reset = true;
+      }
+    }
+    // Free the players stop() marked
+    for (int p = 0; p < mMaxPlayers; p++) {
+      uint32_t state = mStates[p].load(std::memory_order_acquire);
+      if (status(state) == STOPPING) {
+        mPlayers[p].curves = nullptr;
+        mStates[p].store((state & ~3u) | FREE, std::memory_order_release);
+      }
+    }
+  }
+
+  // Set the lanes of a curve to its segment from point k
+  void loadSegment(const AutomationCurves::Curve &curve, int k,
+                   const float *initial, size_t lane) {
+    bool last = k + 1 >= int(curve.times.size());
+    float start = curve.times[k];
+    float length = last ? 0.0f : curve.times[k + 1] - start;
+    float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+    for (int d = 0; d < curve.dimensions; d++) {
+      float a = AutomationCurves::point(curve, k, d, initial);
+      float b = last ? a : AutomationCurves::point(curve, k + 1, d, initial);
+      mStart[lane + d] = start;
+      mInverse[lane + d] = inverse;
+      mV0[lane + d] = a;
+      mDelta[lane + d] = b - a;
+    }
+  }
+
+  int mMaxPlayers;
+  std::unique_ptr<al::SingleRWRingBuffer> mQueue;
+  std::mutex mWriteLock;
+  std::unique_ptr<std::atomic<uint32_t>[]> mStates;
+
+  // Audio thread
+  std::vector<Player> mPlayers;
+  // Lanes, kMaxChannels per player
+  std::vector<float> mStart;
+  std::vector<float> mInverse;
+  std::vector<float> mV0;
+  std::vector<float> mDelta;
+  std::vector<float> mValues;
+};
+
+#endif // AutomationCurves_H
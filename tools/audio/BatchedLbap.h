@@ -0,0 +1,483 @@
+#pragma once
+#ifndef BatchedLbap_H
+#define BatchedLbap_H
+
+// Layer-based amplitude panning of many moving sources in one pass.
+//
+// A spatializer renders one source at a time: the scene hands it a voice's
+// buffer and pose, and the voice's speaker gains are worked out and applied
+// speaker by speaker. With sources that move every frame the gains are
+// recomputed for every voice in every buffer, and each gain jumps at the
+// buffer boundary.
+//
+// BatchedLbap collects the sources of a buffer instead and mixes them all in
+// finalize(). A source's gains are recomputed only if it has turned by more
+// than a tolerance since they were last computed. Gains that changed are
+// interpolated linearly across the buffer. The mix is a sparse source by
+// speaker gain matrix, usually four speakers per source, sorted by speaker
+// and applied in blocks short enough for the source buffers to stay in the
+// cache. Each speaker block adds four sources at a time with MatrixMixer's
+// SSE or NEON kernels.
+//
+// The panning follows the layout's rings. Speakers with about the same
+// elevation form a layer. A source pans between the two speakers around its
+// azimuth in the layers above and below it. Above the top layer or below the
+// bottom one, it fades into all speakers of that layer at the pole.
+//
+//   mSpatializer = scene.setSpatializer<BatchedLbap>(speakerLayout);
+//
+// The scene identifies sources only by their order in a buffer. When a voice
+// starts or stops, the sources after it move to other slots. Their gains
+// then glide from their neighbour's, or jump if the neighbour was more than
+// kJumpDegrees away. A scene rendering voices on several audio threads
+// changes the order every buffer, so keep it to one. lbap_benchmark measures
+// 256 moving sources on the AlloSphere layout.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "al/sound/al_Spatializer.hpp"
+#include "al/sound/al_Speaker.hpp"
+#include "al/spatial/al_Pose.hpp"
+
+#include "MatrixMixer.h"
+
+/// LBAP gains for a direction, see the top of BatchedLbap.h
+class LbapPanner {
+public:
+  struct Gain {
+    int speaker; ///< Index in the layout
+    float gain;
+  };
+
+  LbapPanner(const al::Speakers &layout) {
+    std::vector<Direction> speakers;
+    for (const auto &speaker : layout) {
+      al::Vec3d v = speaker.vecGraphics();
+      speakers.push_back(direction(float(v[0]), float(v[1]), float(v[2])));
+    }
+    std::vector<int> order(layout.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = int(i);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+      return speakers[a].elevation < speakers[b].elevation;
+    });
+    for (int index : order) {
+      if (mLayers.empty() || speakers[index].elevation -
+                                     mLayers.back().elevation >
+                                 kLayerRadians) {
+        mLayers.push_back({speakers[index].elevation, {}, {}});
+      }
+      mLayers.back().speakers.push_back(index);
+    }
+    mMaxGains = 4;
+    for (Layer &layer : mLayers) {
+      std::sort(layer.speakers.begin(), layer.speakers.end(),
+                [&](int a, int b) {
+                  return speakers[a].azimuth < speakers[b].azimuth;
+                });
+      float sum = 0.0f;
+      for (int index : layer.speakers) {
+        layer.azimuths.push_back(speakers[index].azimuth);
+        sum += speakers[index].elevation;
+      }
+      layer.elevation = sum / layer.speakers.size();
+      mMaxGains = std::max(mMaxGains, int(layer.speakers.size()) + 2);
+    }
+  }
+
+  /// Most gains gains() returns
+  int maxGains() const { return mMaxGains; }
+
+  /// Gains for direction x, y, z in graphics space, returns their count
+  int gains(float x, float y, float z, Gain *out) const {
+    if (mLayers.empty()) {
+      return 0;
+    }
+    Direction source = direction(x, y, z);
+    int count = 0;
+    const Layer &top = mLayers.back();
+    const Layer &bottom = mLayers.front();
+    if (source.elevation >= top.elevation) {
+      float t = fraction(source.elevation, top.elevation, float(M_PI_2));
+      count = addRing(top, source.azimuth, std::cos(t * kQuarter), out, 0);
+      count = addPole(top, std::sin(t * kQuarter), out, count);
+    } else if (source.elevation <= bottom.elevation) {
+      float t = fraction(source.elevation, bottom.elevation, -float(M_PI_2));
+      count = addRing(bottom, source.azimuth, std::cos(t * kQuarter), out, 0);
+      count = addPole(bottom, std::sin(t * kQuarter), out, count);
+    } else {
+      size_t upper = 1;
+      while (mLayers[upper].elevation < source.elevation) {
+        upper++;
+      }
+      const Layer &above = mLayers[upper];
+      const Layer &below = mLayers[upper - 1];
+      float t = fraction(source.elevation, below.elevation, above.elevation);
+      count = addRing(below, source.azimuth, std::cos(t * kQuarter), out, 0);
+      count = addRing(above, source.azimuth, std::sin(t * kQuarter), out,
+                      count);
+    }
+    return count;
+  }
+
+private:
+  // Speakers within this elevation of a layer's lowest belong to it
+  static constexpr float kLayerRadians = float(10.0 * M_PI / 180.0);
+  static constexpr float kQuarter = float(M_PI_2);
+
+  struct Direction {
+    float azimuth;   // From the front towards the right, -pi to pi
+    float elevation; // Up from the horizon
+  };
+
+  struct Layer {
+    float elevation;
+    std::vector<int> speakers; // By azimuth
+    std::vector<float> azimuths;
+  };
+
+  // Graphics space: x right, y up, -z front
+  static Direction direction(float x, float y, float z) {
+    float length = std::sqrt(x * x + y * y + z * z);
+    if (length == 0.0f) {
+      return {0.0f, 0.0f};
+    }
+    return {std::atan2(x, -z), std::asin(std::max(-1.0f, y / length))};
+  }
+
+  static float fraction(float value, float from, float to) {
+    return from == to ? 0.0f
+                      : std::min(1.0f, std::max(0.0f, (value - from) /
+                                                          (to - from)));
+  }
+
+  // Add gain to a speaker, merging with an earlier gain for it
+  static int add(int speaker, float gain, Gain *out, int count) {
+    if (gain <= 0.0f) {
+      return count;
+    }
+    for (int i = 0; i < count; i++) {
+      if (out[i].speaker == speaker) {
+        out[i].gain =
+            std::sqrt(out[i].gain * out[i].gain + gain * gain); // Power
+        return count;
+      }
+    }
+    out[count] = {speaker, gain};
+    return count + 1;
+  }
+
+  // Equal-power pan between the two speakers of layer around azimuth
+  static int addRing(const Layer &layer, float azimuth, float gain, Gain *out,
+                     int count) {
+    const std::vector<float> &azimuths = layer.azimuths;
+    size_t n = azimuths.size();
+    if (n == 1) {
+      return add(layer.speakers[0], gain, out, count);
+    }
+    // First speaker at or past azimuth, wrapping around behind
+    size_t next = std::lower_bound(azimuths.begin(), azimuths.end(), azimuth) -
+                  azimuths.begin();
+    size_t previous = (next + n - 1) % n;
+    next %= n;
+    float span = azimuths[next] - azimuths[previous];
+    float offset = azimuth - azimuths[previous];
+    if (span <= 0.0f) {
+      span += float(2.0 * M_PI);
+    }
+    if (offset < 0.0f) {
+      offset += float(2.0 * M_PI);
+    }
+    float t = std::min(1.0f, offset / span);
+    count = add(layer.speakers[previous], gain * std::cos(t * kQuarter), out,
+                count);
+    return add(layer.speakers[next], gain * std::sin(t * kQuarter), out,
+               count);
+  }
+
+  // The same power in every speaker of layer
+  static int addPole(const Layer &layer, float gain, Gain *out, int count) {
+    float each = gain / std::sqrt(float(layer.speakers.size()));
+    for (int speaker : layer.speakers) {
+      count = add(speaker, each, out, count);
+    }
+    return count;
+  }
+
+  std::vector<Layer> mLayers;
+  int mMaxGains;
+};
+
+/// LBAP spatializer for many moving sources, see the top of BatchedLbap.h
+class BatchedLbap : public al::Spatializer {
+public:
+  /// Sources whose gains glide rather than jump to a new direction
+  static constexpr float kJumpDegrees = 45.0f;
+  /// Frames mixed per block
+  static const int kBlockFrames = 128;
+
+  /**
+   * @param maxSources sources mixed per buffer, later ones are dropped
+   * @param maxFrames largest audio buffer
+   * @param toleranceDegrees turn after which a source's gains are recomputed
+   */
+  BatchedLbap(const al::Speakers &sl, int maxSources = 256,
+              int maxFrames = 4096, float toleranceDegrees = 1.0f)
+      : al::Spatializer(sl), mPanner(sl), mMaxSources(maxSources),
+        mMaxFrames(maxFrames) {
+    mCosTolerance = float(std::cos(toleranceDegrees * M_PI / 180.0));
+    mCosJump = float(std::cos(kJumpDegrees * M_PI / 180.0));
+    mMaxGains = mPanner.maxGains();
+    mSources.resize(maxSources);
+    mGains.resize(size_t(maxSources) * mMaxGains * 2);
+    for (int s = 0; s < maxSources; s++) {
+      mSources[s].gains = &mGains[size_t(s) * mMaxGains * 2];
+      mSources[s].previous = mSources[s].gains + mMaxGains;
+    }
+    mSampleGains.resize(mMaxGains);
+    mBuffers.assign(size_t(maxSources) * maxFrames, 0.0f);
+    mEntries.reserve(size_t(maxSources) * mMaxGains * 2);
+    for (const auto &speaker : sl) {
+      mMaxChannel = std::max(mMaxChannel, int(speaker.deviceChannel));
+    }
+    mOuts.assign(mMaxChannel + 1, nullptr);
+  }
+
+  /// Start collecting the sources of a buffer
+  void beginBuffer(int frames) {
+    mFrames = std::min(frames, mMaxFrames);
+    mNumSources = 0;
+    mNumRecomputed = 0;
+    mEntries.clear();
+  }
+
+  /// Add a source heading towards x, y, z in graphics space
+  void addSource(float x, float y, float z, const float *samples) {
+    if (mNumSources >= mMaxSources) {
+      return;
+    }
+    int index = mNumSources++;
+    std::memcpy(&mBuffers[size_t(index) * mMaxFrames], samples,
+                mFrames * sizeof(float));
+    Source &source = mSources[index];
+    float length = std::sqrt(x * x + y * y + z * z);
+    float direction[3] = {0.0f, 0.0f, -1.0f};
+    if (length > 0.0f) {
+      direction[0] = x / length;
+      direction[1] = y / length;
+      direction[2] = z / length;
+    }
+    float cosine = direction[0] * source.direction[0] +
+                   direction[1] * source.direction[1] +
+                   direction[2] * source.direction[2];
+    bool glide = source.valid && cosine >= mCosJump;
+    std::swap(source.gains, source.previous);
+    std::swap(source.numGains, source.numPrevious);
+    if (source.valid && cosine >= mCosTolerance) {
+      // Close enough to the direction the gains were computed for
+      std::copy_n(source.previous, source.numPrevious, source.gains);
+      source.numGains = source.numPrevious;
+    } else {
+      source.numGains = mPanner.gains(direction[0], direction[1],
+                                      direction[2], source.gains);
+      std::copy_n(direction, 3, source.direction);
+      source.valid = true;
+      mNumRecomputed++;
+    }
+    if (!glide) {
+      std::copy_n(source.gains, source.numGains, source.previous);
+      source.numPrevious = source.numGains;
+    }
+    addEntries(index);
+  }
+
+  /**
+   * @brief Add the sources collected since beginBuffer() to outs
+   *
+   * outs[c] is the buffer of device channel c, nullptr to skip it.
+   */
+  void mix(float *const *outs) {
+    // Slots not filled this buffer start afresh next time
+    for (int s = mNumSources; s < mMaxSources && mSources[s].valid; s++) {
+      mSources[s].valid = false;
+    }
+    std::sort(mEntries.begin(), mEntries.end(),
+              [](const Entry &a, const Entry &b) {
+                if (a.channel != b.channel) {
+                  return a.channel < b.channel;
+                }
+                if ((a.start != a.end) != (b.start != b.end)) {
+                  return a.start == a.end;
+                }
+                return a.source < b.source;
+              });
+    const float rampScale = 1.0f / std::max(1, mFrames);
+    for (int start = 0; start < mFrames; start += kBlockFrames) {
+      int frames = std::min(int(kBlockFrames), mFrames - start);
+      size_t e = 0;
+      while (e < mEntries.size()) {
+        int channel = mEntries[e].channel;
+        float *out = outs[channel] ? outs[channel] + start : nullptr;
+        // Steady and ramping gains, four sources at a time
+        const float *inputs[2][4];
+        float gains[2][4];
+        float steps[4];
+        int n[2] = {0, 0};
+        for (; e < mEntries.size() && mEntries[e].channel == channel; e++) {
+          const Entry &entry = mEntries[e];
+          if (!out) {
+            continue;
+          }
+          int ramp = entry.start != entry.end ? 1 : 0;
+          int k = n[ramp]++;
+          inputs[ramp][k] =
+              &mBuffers[size_t(entry.source) * mMaxFrames] + start;
+          if (ramp) {
+            steps[k] = (entry.end - entry.start) * rampScale;
+            gains[ramp][k] = entry.start + start * steps[k];
+          } else {
+            gains[ramp][k] = entry.end;
+          }
+          if (n[ramp] == 4) {
+            accumulateGroup(out, inputs[ramp], gains[ramp], ramp, steps,
+                            frames, n[ramp]);
+          }
+        }
+        for (int ramp = 0; ramp < 2; ramp++) {
+          if (n[ramp] > 0) {
+            accumulateGroup(out, inputs[ramp], gains[ramp], ramp, steps,
+                            frames, n[ramp]);
+          }
+        }
+      }
+    }
+  }
+
+  /// Sources in the last buffer
+  int sources() const { return mNumSources; }
+  /// Sources whose gains were recomputed in the last buffer
+  int recomputed() const { return mNumRecomputed; }
+
+  // Spatializer
+
+  void prepare(al::AudioIOData &io) override {
+    beginBuffer(int(io.framesPerBuffer()));
+  }
+
+  void renderBuffer(al::AudioIOData &io, const al::Pose &listeningPose,
+                    const float *samples,
+                    const unsigned int &numFrames) override {
+    al::Vec3d position = listeningPose.vec();
+    addSource(float(position[0]), float(position[1]), float(position[2]),
+              samples);
+  }
+
+  /// Uncached, for scenes that render a sample at a time
+  void renderSample(al::AudioIOData &io, const al::Pose &listeningPose,
+                    const float &sample,
+                    const unsigned int &frameIndex) override {
+    al::Vec3d position = listeningPose.vec();
+    int count = mPanner.gains(float(position[0]), float(position[1]),
+                              float(position[2]), mSampleGains.data());
+    for (int g = 0; g < count; g++) {
+      const LbapPanner::Gain &gain = mSampleGains[g];
+      io.out(mSpeakers[gain.speaker].deviceChannel, frameIndex) +=
+          sample * gain.gain;
+    }
+  }
+
+  void finalize(al::AudioIOData &io) override {
+    for (int c = 0; c <= mMaxChannel; c++) {
+      mOuts[c] = c < int(io.channelsOut()) ? io.outBuffer(c) : nullptr;
+    }
+    mix(mOuts.data());
+  }
+
+private:
+  struct Source {
+    float direction[3]{0.0f, 0.0f, -1.0f}; // Of the current gains
+    bool valid{false};
+    LbapPanner::Gain *gains{nullptr}; // At the end of this buffer
+    int numGains{0};
+    LbapPanner::Gain *previous{nullptr}; // At the start
+    int numPrevious{0};
+  };
+
+  // One source's gain on one channel over the buffer
+  struct Entry {
+    int channel;
+    int source;
+    float start;
+    float end;
+  };
+
+  // Add n of four sources and reset n, padding with zero gains
+  static void accumulateGroup(float *out, const float **inputs, float *gains,
+                              int ramp, float *steps, int frames, int &n) {
+    for (int k = n; k < 4; k++) {
+      inputs[k] = inputs[0];
+      gains[k] = 0.0f;
+      if (ramp) {
+        steps[k] = 0.0f;
+      }
+    }
+    if (ramp) {
+      accumulateRamp4(out, inputs, gains, steps, frames);
+    } else {
+      accumulate4(out, inputs, gains, frames);
+    }
+    n = 0;
+  }
+
+  // Entries for the union of a source's previous and current speakers
+  void addEntries(int index) {
+    const Source &source = mSources[index];
+    for (int g = 0; g < source.numGains; g++) {
+      const LbapPanner::Gain &gain = source.gains[g];
+      float start = 0.0f;
+      for (int p = 0; p < source.numPrevious; p++) {
+        if (source.previous[p].speaker == gain.speaker) {
+          start = source.previous[p].gain;
+        }
+      }
+      mEntries.push_back({int(mSpeakers[gain.speaker].deviceChannel), index,
+                          start, gain.gain});
+    }
+    for (int p = 0; p < source.numPrevious; p++) {
+      const LbapPanner::Gain &gain = source.previous[p];
+      bool kept = false;
+      for (int g = 0; g < source.numGains; g++) {
+        kept |= source.gains[g].speaker == gain.speaker;
+      }
+      if (!kept) {
+        mEntries.push_back({int(mSpeakers[gain.speaker].deviceChannel),
+                            index, gain.gain, 0.0f});
+      }
+    }
+  }
+
+  LbapPanner mPanner;
+  int mMaxSources;
+  int mMaxFrames;
+  int mMaxGains;
+  int mMaxChannel{0};
+  float mCosTolerance;
+  float mCosJump;
+
+  // Audio thread
+  int mFrames{0};
+  int mNumSources{0};
+  int mNumRecomputed{0};
+  std::vector<Source> mSources;
+  std::vector<LbapPanner::Gain> mGains; // Two sets of mMaxGains per source
+  std::vector<float> mBuffers;          // mMaxFrames per source
+  std::vector<Entry> mEntries;
+  std::vector<float *> mOuts;
+  std::vector<LbapPanner::Gain> mSampleGains;
+};
+
+#endif // BatchedLbap_H
@@ -0,0 +1,217 @@
+#pragma once
+#ifndef ChannelStream_H
+#define ChannelStream_H
+
+// Channel-mapped mixing of interleaved sound file streams into io.
+//
+// A sound file source delivers interleaved frames. The playback tools used to
+// de-interleave them with one strided pass over the read buffer per file
+// channel, a sample at a time. For a 60-channel stem that is 60 passes with a
+// 240-byte stride. ChannelStream reads the file once per chunk into a buffer
+// allocated when the file is loaded, then walks it four channels at a time.
+// Four frames of four channels are loaded, transposed in registers and added,
+// scaled by the gain, to four contiguous frames of each output channel.
+// Nothing is allocated or printed in the audio callback. Reads that come up
+// short before the end of the file are counted in an atomic the GUI thread
+// can poll.
+//
+//   ChannelStream stream;
+//   stream.configure(file.channels(), outChannelMap); // when loading
+//   ...
+//   stream.mix(file, io, gain, mute);                   // in onSound()
+//   ImGui::Text("underruns: %llu", stream.underruns()); // anywhere
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1
+#include <xmmintrin.h>
+#define CHANNEL_STREAM_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHANNEL_STREAM_NEON 1
+#endif
+
+#include "al/io/al_AudioIOData.hpp"
+
+/**
+ * @brief Add gain * interleaved channel c to outs[c], for every channel
+ *
+ * in holds frames frames of numChannels channels. outs holds one pointer per
+ * channel, each with room for frames samples. Channels may share an output.
+ * If envelope is given, frame i is scaled by envelope[i] as well.
+ */
+inline void accumulateDeinterleaved(const float *in, int numChannels,
+                                    float *const *outs, float gain,
+                                    int frames,
+                                    const float *envelope = nullptr) {
+  const size_t stride = size_t(numChannels);
+  int c = 0;
+#if defined(CHANNEL_STREAM_SSE) || defined(CHANNEL_STREAM_NEON)
+  // Four channels at a time, so only four output streams are live. Output
+  // channels are one buffer apart and a frame of all of them would thrash
+  // the cache sets.
+  for (; c + 4 <= numChannels; c += 4) {
+    float *const *out = outs + c;
+    int frame = 0;
+    for (; frame + 4 <= frames; frame += 4) {
+      const float *p = in + size_t(frame) * stride + c;
+#ifdef CHANNEL_STREAM_SSE
+      __m128 g = _mm_set1_ps(gain);
+      if (envelope) {
+        g = _mm_mul_ps(g, _mm_loadu_ps(envelope + frame));
+      }
+      __m128 r0 = _mm_loadu_ps(p);
+      __m128 r1 = _mm_loadu_ps(p + stride);
+      __m128 r2 = _mm_loadu_ps(p + 2 * stride);
+      __m128 r3 = _mm_loadu_ps(p + 3 * stride);
+      // Rows are frames, columns channels. Afterwards rk is channel c + k.
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      __m128 channels[4] = {r0, r1, r2, r3};
+      for (int k = 0; k < 4; k++) {
+        float *o = out[k] + frame;
+        _mm_storeu_ps(o,
+                      _mm_add_ps(_mm_loadu_ps(o), _mm_mul_ps(channels[k], g)));
+      }
+#else
+      float32x4_t g = vdupq_n_f32(gain);
+      if (envelope) {
+        g = vmulq_f32(g, vld1q_f32(envelope + frame));
+      }
+      float32x4_t r0 = vld1q_f32(p);
+      float32x4_t r1 = vld1q_f32(p + stride);
+      float32x4_t r2 = vld1q_f32(p + 2 * stride);
+      float32x4_t r3 = vld1q_f32(p + 3 * stride);
+      float32x4x2_t t01 = vtrnq_f32(r0, r1);
+      float32x4x2_t t23 = vtrnq_f32(r2, r3);
+      float32x4_t channels[4] = {
+          vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])),
+          vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])),
+          vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])),
+          vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]))};
+      for (int k = 0; k < 4; k++) {
+        float *o = out[k] + frame;
+        vst1q_f32(o, vaddq_f32(vld1q_f32(o), vmulq_f32(channels[k], g)));
+      }
+#endif
+    }
+    for (; frame < frames; frame++) {
+      const float *p = in + size_t(frame) * stride + c;
+      float g = envelope ? gain * envelope[frame] : gain;
+      for (int k = 0; k < 4; k++) {
+        out[k][frame] += p[k] * g;
+      }
+    }
+  }
+#endif
+  for (; c < numChannels; c++) {
+    float *out = outs[c];
+    const float *p = in + c;
+    if (envelope) {
+      for (int frame = 0; frame < frames; frame++) {
+        out[frame] += p[size_t(frame) * stride] * (gain * envelope[frame]);
+      }
+    } else {
+      for (int frame = 0; frame < frames; frame++) {
+        out[frame] += p[size_t(frame) * stride] * gain;
+      }
+    }
+  }
+}
+
+/// Per-file playback state: read buffer, channel map and underrun count
+class ChannelStream {
+public:
+  /**
+   * @brief Allocate the read buffer and set the channel map
+   *
+   * File channel c plays on output outChannelMap[c]. File channels without an
+   * entry are read and dropped. Call before audio starts.
+   *
+   * @param maxFrames frames read per chunk, buffers larger than this are read
+   * in several chunks
+   */
+  void configure(int fileChannels, const std::vector<size_t> &outChannelMap,
+                 int maxFrames = 2048) {
+    mChannels = fileChannels;
+    mMaxFrames = maxFrames;
+    mOutChannelMap = outChannelMap;
+    mOutChannelMap.resize(fileChannels, SIZE_MAX);
+    mBuffer.assign(size_t(fileChannels) * maxFrames, 0.0f);
+    mDiscard.assign(maxFrames, 0.0f);
+    mOuts.assign(fileChannels, nullptr);
+    mChunkOuts.assign(fileChannels, nullptr);
+  }
+
+  /**
+   * @brief Audio thread: read a buffer from source and add it to io
+   *
+   * source is anything with SoundFileBuffered's
+   * read(float *interleaved, int frames), currentPosition() and frames(). A
+   * muted stream is still read so it keeps its place. Returns the frames
+   * read.
+   *
+   * @param envelope per-frame gain, e.g. a Transport fade, or nullptr
+   * @param frames frames to read, the whole buffer if negative
+   */
+  template <class TSource>
+  int mix(TSource &source, al::AudioIOData &io, float gain, bool mute,
+          const float *envelope = nullptr, int frames = -1) {
+    if (frames < 0 || frames > int(io.framesPerBuffer())) {
+      frames = int(io.framesPerBuffer());
+    }
+    // Outputs beyond the device's channels go to the discard buffer
+    for (int c = 0; c < mChannels; c++) {
+      size_t out = mOutChannelMap[c];
+      mOuts[c] = out < size_t(io.channelsOut()) ? io.outBuffer(int(out))
+                                                : nullptr;
+    }
+    int done = 0;
+    while (done < frames) {
+      int chunk = std::min(frames - done, mMaxFrames);
+      int read = int(source.read(mBuffer.data(), chunk));
+      read = std::max(0, std::min(read, chunk));
+      if (!mute) {
+        mixChunk(done, read, gain, envelope ? envelope + done : nullptr);
+      }
+      done += read;
+      if (read < chunk) {
+        // A file that doesn't loop stays short from its end on
+        if (source.currentPosition() < source.frames()) {
+          mUnderruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        break;
+      }
+    }
+    return done;
+  }
+
+  /// Reads before the end that returned fewer frames than the buffer needed
+  uint64_t underruns() const {
+    return mUnderruns.load(std::memory_order_relaxed);
+  }
+
+  int channels() const { return mChannels; }
+
+private:
+  void mixChunk(int offset, int frames, float gain, const float *envelope) {
+    for (int c = 0; c < mChannels; c++) {
+      mChunkOuts[c] = mOuts[c] ? mOuts[c] + offset : mDiscard.data();
+    }
+    accumulateDeinterleaved(mBuffer.data(), mChannels, mChunkOuts.data(), gain,
+                            frames, envelope);
+  }
+
+  int mChannels{0};
+  int mMaxFrames{0};
+  std::vector<size_t> mOutChannelMap;
+  std::vector<float> mBuffer;
+  std::vector<float> mDiscard;
+  std::vector<float *> mOuts;
+  std::vector<float *> mChunkOuts;
+  std::atomic<uint64_t> mUnderruns{0};
+};
+
+#endif // ChannelStream_H
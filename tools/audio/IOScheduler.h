@@ -0,0 +1,238 @@
+#pragma once
+#ifndef IOScheduler_H
+#define IOScheduler_H
+
+// One small pool of I/O threads for every streaming source in a session.
+//
+// A reader thread per file means a 40-file session has 40 threads competing
+// for the disk, each unaware of how close the others are to running dry.
+// IOScheduler serves all sources from a couple of threads instead. Each
+// source reports its deadline, the seconds of audio it has loaded ahead of
+// its play head. A free thread always serves the source with the earliest
+// deadline and loads one large contiguous batch of it, so adjacent reads in a
+// file become one request and the disk isn't asked to alternate between
+// files for every buffer. Sources also report how full their window is, and
+// stats() sums that up for a GUI.
+//
+// The same threads run one-off jobs, such as opening the files of a session
+// in parallel:
+//
+//   IOScheduler::instance().parallel(int(paths.size()), [&](int i) {
+//     files[i].open(paths[i]);
+//   });
+//
+// MappedSoundFile is a Source. Other sources implement deadline(), service()
+// and fill() and call add() and remove().
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class IOScheduler {
+public:
+  /// Something that loads data ahead of a play head
+  class Source {
+  public:
+    virtual ~Source() {}
+
+    /**
+     * @brief Seconds until the source runs out of loaded data
+     *
+     * Infinity if there is nothing to load. Called from scheduler threads,
+     * so it must only read atomics.
+     */
+    virtual double deadline() = 0;
+
+    /// Load the next maxBytes or fewer, returns the bytes loaded
+    virtual size_t service(size_t maxBytes) = 0;
+
+    /// How full the window ahead of the play head is, from 0 to 1
+    virtual float fill() = 0;
+
+  private:
+    friend class IOScheduler;
+    bool mBusy{false}; // Being served, guarded by the scheduler's lock
+  };
+
+  struct Stats {
+    int sources{0};
+    float minFill{1.0f};
+    float meanFill{1.0f};
+    uint64_t bytesLoaded{0};
+    uint64_t batches{0};
+  };
+
+  /// The scheduler shared by all sources
+  static IOScheduler &instance() {
+    static IOScheduler scheduler;
+    return scheduler;
+  }
+
+  /**
+   * @param threads I/O threads, 2 is enough to keep one disk busy
+   * @param batchBytes largest contiguous load per service() call
+   */
+  IOScheduler(int threads = 2, size_t batchBytes = size_t(4) << 20)
+      : mBatchBytes(batchBytes) {
+    for (int i = 0; i < std::max(1, threads); i++) {
+      mThreads.emplace_back(&IOScheduler::workerLoop, this);
+    }
+  }
+
+  ~IOScheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mRunning = false;
+    }
+    mWake.notify_all();
+    for (auto &thread : mThreads) {
+      thread.join();
+    }
+  }
+
+  void add(Source *source) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mSources.push_back(source);
+    mWake.notify_one();
+  }
+
+  /// Returns once source is no longer being served
+  void remove(Source *source) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mDone.wait(lock, [source]() { return !source->mBusy; });
+    mSources.erase(std::remove(mSources.begin(), mSources.end(), source),
+                   mSources.end());
+  }
+
+  /// Have a source's new deadline looked at now, e.g. after a seek
+  void wake() { mWake.notify_one(); }
+
+  /**
+   * @brief Run task(i) for i in [0, count) on the I/O threads and wait
+   *
+   * The calling thread takes tasks as well. Don't call from the audio thread
+   * or from a task.
+   */
+  void parallel(int count, const std::function<void(int)> &task) {
+    std::unique_lock<std::mutex> lock(mLock);
+    // One batch of tasks at a time
+    mDone.wait(lock, [this]() { return mTask == nullptr; });
+    mTask = &task;
+    mTaskCount = count;
+    mNextTask = 0;
+    mTasksRunning = 0;
+    mWake.notify_all();
+    while (runTask(lock)) {
+    }
+    mDone.wait(lock, [this]() {
+      return mNextTask >= mTaskCount && mTasksRunning == 0;
+    });
+    mTask = nullptr;
+    mDone.notify_all();
+  }
+
+  /// Fill levels over all sources and totals since startup
+  Stats stats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    Stats stats;
+    stats.sources = int(mSources.size());
+    float sum = 0.0f;
+    for (Source *source : mSources) {
+      float fill = source->fill();
+      stats.minFill = std::min(stats.minFill, fill);
+      sum += fill;
+    }
+    if (!mSources.empty()) {
+      stats.meanFill = sum / mSources.size();
+    }
+    stats.bytesLoaded = mBytesLoaded;
+    stats.batches = mBatches;
+    return stats;
+  }
+
+  int threads() const { return int(mThreads.size()); }
+
+private:
+  // Runs the next task of the current batch, if any, without the lock
+  bool runTask(std::unique_lock<std::mutex> &lock) {
+    if (!mTask || mNextTask >= mTaskCount) {
+      return false;
+    }
+    int index = mNextTask++;
+    mTasksRunning++;
+    const std::function<void(int)> &task = *mTask;
+    lock.unlock();
+    task(index);
+    lock.lock();
+    mTasksRunning--;
+    mDone.notify_all();
+    return true;
+  }
+
+  Source *earliestDeadline() {
+    Source *earliest = nullptr;
+    double deadline = std::numeric_limits<double>::infinity();
+    for (Source *source : mSources) {
+      if (!source->mBusy) {
+        double d = source->deadline();
+        if (d < deadline) {
+          deadline = d;
+          earliest = source;
+        }
+      }
+    }
+    return earliest;
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (mRunning) {
+      if (runTask(lock)) {
+        continue;
+      }
+      Source *source = earliestDeadline();
+      if (!source) {
+        // Play heads move on without telling, so look again soon
+        mWake.wait_for(lock, std::chrono::milliseconds(20));
+        continue;
+      }
+      source->mBusy = true;
+      lock.unlock();
+      size_t bytes = source->service(mBatchBytes);
+      lock.lock();
+      source->mBusy = false;
+      mBytesLoaded += bytes;
+      mBatches += bytes > 0 ? 1 : 0;
+      mDone.notify_all();
+      if (bytes == 0) {
+        // Nothing could be loaded, don't spin on the same deadline
+        mWake.wait_for(lock, std::chrono::milliseconds(20));
+      }
+    }
+  }
+
+  size_t mBatchBytes;
+  std::vector<std::thread> mThreads;
+  std::mutex mLock;
+  std::condition_variable mWake;
+  std::condition_variable mDone;
+  bool mRunning{true};
+
+  std::vector<Source *> mSources;
+  uint64_t mBytesLoaded{0};
+  uint64_t mBatches{0};
+
+  const std::function<void(int)> *mTask{nullptr};
+  int mTaskCount{0};
+  int mNextTask{0};
+  int mTasksRunning{0};
+};
+
+#endif // IOScheduler_H
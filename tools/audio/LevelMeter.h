@@ -0,0 +1,271 @@
+#pragma once
+#ifndef LevelMeter_H
+#define LevelMeter_H
+
+// Speaker level meters, measured on the audio thread and shaped on the
+// graphics thread.
+//
+// The meters used to convert every channel's peak to dB with log10(), apply
+// their release and resize their vectors inside onSound(). The primary then
+// copied 64 floats into the shared state every frame. Now the audio thread
+// only takes each channel's block peak and sum of squares, four samples at a
+// time with SSE or NEON, and publishes them through a lock-free triple
+// buffer. Blocks are accumulated until the graphics thread takes a snapshot,
+// so no peak is missed when the frame rate is lower than the buffer rate. The
+// graphics thread converts to dB and applies the release. Replicas receive
+// the finished levels as one byte (or two) per channel.
+//
+//   SpeakerMeter meter;
+//   meter.init(speakerLayout);                    // onCreate()
+//   meter.processSound(io);                       // onSound()
+//   meter.update(dt);                             // onAnimate(), primary
+//   meter.quantize(state().meterLevels, 64);      //
+//   meter.setQuantized(state().meterLevels, 64);  // onAnimate(), replicas
+//   meter.draw(g);                                // onDraw()
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1
+#include <xmmintrin.h>
+#define LEVEL_METER_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LEVEL_METER_NEON 1
+#endif
+
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_Shapes.hpp"
+#include "al/io/al_AudioIOData.hpp"
+#include "al/sound/al_Speaker.hpp"
+
+/// Largest absolute sample and sum of squares of in[0, frames)
+inline void peakAndSquares(const float *in, int frames, float &peak,
+                           float &squares) {
+  int i = 0;
+  float p = 0.0f, s = 0.0f;
+#if defined(LEVEL_METER_SSE)
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 maximum = _mm_setzero_ps();
+  __m128 sum = _mm_setzero_ps();
+  for (; i + 4 <= frames; i += 4) {
+    __m128 x = _mm_loadu_ps(in + i);
+    maximum = _mm_max_ps(maximum, _mm_andnot_ps(sign, x));
+    sum = _mm_add_ps(sum, _mm_mul_ps(x, x));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, maximum);
+  p = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+  _mm_storeu_ps(lanes, sum);
+  s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(LEVEL_METER_NEON)
+  float32x4_t maximum = vdupq_n_f32(0.0f);
+  float32x4_t sum = vdupq_n_f32(0.0f);
+  for (; i + 4 <= frames; i += 4) {
+    float32x4_t x = vld1q_f32(in + i);
+    maximum = vmaxq_f32(maximum, vabsq_f32(x));
+    sum = vmlaq_f32(sum, x, x);
+  }
+  float lanes[4];
+  vst1q_f32(lanes, maximum);
+  p = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+  vst1q_f32(lanes, sum);
+  s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+  for (; i < frames; i++) {
+    p = std::max(p, std::fabs(in[i]));
+    s += in[i] * in[i];
+  }
+  peak = p;
+  squares = s;
+}
+
+/// Block peak and RMS of each channel, from the audio to the graphics thread
+class LevelMeter {
+public:
+  /// Levels of all channels since the previous snapshot
+  struct Snapshot {
+    std::vector<float> peak;
+    std::vector<float> rms;
+  };
+
+  /// Allocates everything, meters the first channels output channels
+  LevelMeter(int channels = 64) : mChannels(channels) {
+    for (auto &slot : mSlots) {
+      slot.peak.assign(channels, 0.0f);
+      slot.squares.assign(channels, 0.0f);
+    }
+    mPeak.assign(channels, 0.0f);
+    mSquares.assign(channels, 0.0f);
+    mSnapshot.peak.assign(channels, 0.0f);
+    mSnapshot.rms.assign(channels, 0.0f);
+  }
+
+  int channels() const { return mChannels; }
+
+  /// Audio thread: measure the output channels of this buffer
+  void processSound(al::AudioIOData &io) {
+    if (!(mReady.load(std::memory_order_acquire) & kFresh)) {
+      // The last snapshot was taken, start a new one
+      std::fill(mPeak.begin(), mPeak.end(), 0.0f);
+      std::fill(mSquares.begin(), mSquares.end(), 0.0f);
+      mFrames = 0;
+    }
+    int channels = std::min(mChannels, int(io.channelsOut()));
+    for (int c = 0; c < channels; c++) {
+      float peak, squares;
+      peakAndSquares(io.outBuffer(c), io.framesPerBuffer(), peak, squares);
+      mPeak[c] = std::max(mPeak[c], peak);
+      mSquares[c] += squares;
+    }
+    mFrames += io.framesPerBuffer();
+
+    Slot &slot = mSlots[mBack];
+    std::copy(mPeak.begin(), mPeak.end(), slot.peak.begin());
+    std::copy(mSquares.begin(), mSquares.end(), slot.squares.begin());
+    slot.frames = mFrames;
+    mBack = mReady.exchange(mBack | kFresh, std::memory_order_acq_rel) &
+            ~kFresh;
+  }
+
+  /**
+   * @brief Graphics thread: the levels since the previous call
+   *
+   * Returns nullptr if the audio thread hasn't published a buffer since.
+   */
+  const Snapshot *take() {
+    if (!(mReady.load(std::memory_order_acquire) & kFresh)) {
+      return nullptr;
+    }
+    mFront = mReady.exchange(mFront, std::memory_order_acq_rel) & ~kFresh;
+    const Slot &slot = mSlots[mFront];
+    for (int c = 0; c < mChannels; c++) {
+      mSnapshot.peak[c] = slot.peak[c];
+      mSnapshot.rms[c] =
+          slot.frames > 0 ? std::sqrt(slot.squares[c] / slot.frames) : 0.0f;
+    }
+    return &mSnapshot;
+  }
+
+private:
+  static const int kFresh = 4;
+
+  struct Slot {
+    std::vector<float> peak;
+    std::vector<float> squares;
+    int64_t frames{0};
+  };
+
+  int mChannels;
+  Slot mSlots[3];
+  std::atomic<int> mReady{0}; // Slot last published, | kFresh until taken
+
+  // Audio thread
+  int mBack{1};
+  std::vector<float> mPeak;
+  std::vector<float> mSquares;
+  int64_t mFrames{0};
+
+  // Graphics thread
+  int mFront{2};
+  Snapshot mSnapshot;
+};
+
+/// Level meters drawn at the speakers of a layout
+class SpeakerMeter {
+public:
+  /**
+   * @param floorDb level shown as an empty meter
+   * @param releaseSeconds time for a falling level to drop by 63%
+   */
+  SpeakerMeter(int channels = 64, float floorDb = -60.0f,
+               float releaseSeconds = 0.2f)
+      : mLevelMeter(channels), mFloorDb(floorDb),
+        mReleaseSeconds(releaseSeconds) {
+    mPeaks.assign(channels, 0.0f);
+    mLevels.assign(channels, 0.0f);
+  }
+
+  void init(const al::Speakers &sl) {
+    al::addCube(mMesh);
+    mSl = sl;
+  }
+
+  /// Audio thread
+  void processSound(al::AudioIOData &io) { mLevelMeter.processSound(io); }
+
+  /// Graphics thread: read the audio thread's peaks and apply the release
+  void update(double dt) {
+    // Without a new buffer, keep falling towards the last peaks
+    if (const LevelMeter::Snapshot *snapshot = mLevelMeter.take()) {
+      for (size_t c = 0; c < mPeaks.size(); c++) {
+        float peak = snapshot->peak[c];
+        float db = peak > 0.0f ? 20.0f * std::log10(peak) : mFloorDb;
+        mPeaks[c] = std::min(1.0f, std::max(0.0f, 1.0f - db / mFloorDb));
+      }
+    }
+    float release = float(1.0 - std::exp(-dt / mReleaseSeconds));
+    for (size_t c = 0; c < mLevels.size(); c++) {
+      float level = mPeaks[c];
+      if (level >= mLevels[c]) {
+        mLevels[c] = level;
+      } else {
+        mLevels[c] -= release * (mLevels[c] - level);
+      }
+    }
+  }
+
+  /// Levels from 0 (floor) to 1 (full scale) by device channel
+  const std::vector<float> &levels() const { return mLevels; }
+
+  /// Write count levels as unsigned integers, e.g. for the shared state
+  template <class T> void quantize(T *levels, size_t count) const {
+    const float scale = float(std::numeric_limits<T>::max());
+    for (size_t c = 0; c < count; c++) {
+      levels[c] =
+          c < mLevels.size() ? T(std::lround(mLevels[c] * scale)) : T(0);
+    }
+  }
+
+  /// Show levels written by quantize()
+  template <class T> void setQuantized(const T *levels, size_t count) {
+    const float scale = 1.0f / float(std::numeric_limits<T>::max());
+    count = std::min(count, mLevels.size());
+    for (size_t c = 0; c < count; c++) {
+      mLevels[c] = levels[c] * scale;
+    }
+  }
+
+  void draw(al::Graphics &g) {
+    g.polygonLine();
+    g.color(1);
+    for (const auto &speaker : mSl) {
+      if (speaker.deviceChannel >= mLevels.size()) {
+        continue;
+      }
+      float level = mLevels[speaker.deviceChannel];
+      g.pushMatrix();
+      g.scale(1 / 5.0f);
+      g.translate(speaker.vecGraphics());
+      g.scale(0.15f + level * 1.5f);
+      g.draw(mMesh);
+      g.popMatrix();
+    }
+  }
+
+private:
+  LevelMeter mLevelMeter;
+  float mFloorDb;
+  float mReleaseSeconds;
+  // Graphics thread
+  std::vector<float> mPeaks; // Last peaks from 0 to 1
+  std::vector<float> mLevels;
+  al::Mesh mMesh;
+  al::Speakers mSl;
+};
+
+#endif // LevelMeter_H
@@ -0,0 +1,627 @@
+#pragma once
+#ifndef MappedSoundFile_H
+#define MappedSoundFile_H
+
+// Memory-mapped playback of uncompressed WAV and AIFF files.
+//
+// SoundFileBuffered streams a file through a ring buffer of a few thousand
+// frames filled by a reader thread per file. A seek throws the buffer away
+// and the next reads come up short until the thread has refilled it from
+// disk, so scrubbing through multi-GB 60-channel stems stutters.
+//
+// MappedSoundFile maps the whole file instead and read() converts frames
+// straight out of the mapping. A seek only moves the read position, and the
+// next read() starts at exactly that frame. The shared IOScheduler threads
+// keep a window ahead of each play head resident: they ask the kernel to read
+// it in with madvise(MADV_WILLNEED), touch its pages so the audio thread
+// doesn't fault on them, and release pages that have fallen behind. A seek
+// wakes them so the new window is loaded right away. Until they have made
+// the frames at the new position resident, read() outputs silence and the
+// play head advances as if it had played, so the audio thread never waits
+// for the disk and files seeked together stay in sync.
+//
+//   MappedSoundFile file;
+//   file.open("stem.wav"); // WAV, RF64, AIFF or AIFF-C
+//   file.seek(48000 * 90); // sample accurate, from the GUI thread
+//   file.read(buffer, io.framesPerBuffer()); // in onSound()
+//
+// The interface is SoundFileBuffered's, so it works with ChannelStream.
+// Formats that can't be mapped, such as FLAC or Ogg, are streamed with
+// SoundFileBuffered as before.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "al_ext/soundfile/al_SoundfileBuffered.hpp"
+
+#include "IOScheduler.h"
+
+class MappedSoundFile : public IOScheduler::Source {
+public:
+  /// @param bufferFrames buffer size for files streamed with SoundFileBuffered
+  MappedSoundFile(int bufferFrames = 8192) : mBufferFrames(bufferFrames) {}
+
+  MappedSoundFile(const std::string &path, bool loop = false,
+                  int bufferFrames = 8192)
+      : mBufferFrames(bufferFrames), mLoop(loop) {
+    open(path);
+  }
+
+  ~MappedSoundFile() { close(); }
+
+  MappedSoundFile(const MappedSoundFile &) = delete;
+  MappedSoundFile &operator=(const MappedSoundFile &) = delete;
+
+  bool open(const std::string &path) {
+    close();
+    if (map(path) && parse()) {
+      mPosition = 0;
+      mSeekTarget = -1;
+      mWaiting = true;
+      mWindowStart = mPrefetched = mWrapPrefetched = mReleased = 0;
+      IOScheduler::instance().add(this);
+      return true;
+    }
+    unmap();
+    mBuffered.reset(new al::SoundFileBuffered(path, mLoop, mBufferFrames));
+    if (!mBuffered->opened()) {
+      mBuffered.reset();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (mData) {
+      IOScheduler::instance().remove(this);
+      unmap();
+    }
+    if (mBuffered) {
+      mBuffered->close();
+      mBuffered.reset();
+    }
+  }
+
+  bool opened() const { return mData || mBuffered; }
+
+  /// True if the file is mapped, false if it is streamed by SoundFileBuffered
+  bool mapped() const { return mData != nullptr; }
+
+  /**
+   * @brief Read up to frames interleaved frames into buffer
+   *
+   * Wraps around at the end when looping. Returns the frames read, which is
+   * less than frames only at the end of a file that doesn't loop. After
+   * open() or a seek the frames are silent until the scheduler has made
+   * them resident.
+   */
+  size_t read(float *buffer, int frames) {
+    if (!mData) {
+      return mBuffered ? mBuffered->read(buffer, frames) : 0;
+    }
+    int64_t target = mSeekTarget.exchange(-1, std::memory_order_acq_rel);
+    if (target >= 0) {
+      mWaiting = true;
+    }
+    int64_t position =
+        target >= 0 ? target : mPosition.load(std::memory_order_relaxed);
+    int done = 0;
+    while (done < frames) {
+      if (position >= mFrames) {
+        if (!mLoop.load(std::memory_order_relaxed) || mFrames == 0) {
+          break;
+        }
+        position = 0;
+      }
+      int count = int(std::min<int64_t>(frames - done, mFrames - position));
+      float *out = buffer + size_t(done) * mChannels;
+      if (mWaiting && resident(position, position + count)) {
+        mWaiting = false;
+      }
+      if (mWaiting) {
+        std::fill(out, out + size_t(count) * mChannels, 0.0f);
+      } else {
+        convert(mData + mDataOffset + size_t(position) * mFrameBytes, out,
+                size_t(count) * mChannels);
+      }
+      position += count;
+      done += count;
+    }
+    mPosition.store(position, std::memory_order_release);
+    return size_t(done);
+  }
+
+  void loop(bool loop) {
+    mLoop = loop;
+    if (mBuffered) {
+      mBuffered->loop(loop);
+    }
+  }
+  bool loop() const { return mLoop; }
+
+  /**
+   * @brief Continue reading at frame
+   *
+   * Takes effect at the next read(), without waiting for the disk. That and
+   * the following reads are silent until the scheduler has read in the new
+   * position, usually for a buffer or two. Call from any thread, including
+   * the one calling read().
+   */
+  void seek(int64_t frame) {
+    if (mBuffered) {
+      mBuffered->seek(int(frame));
+      return;
+    }
+    frame = std::max<int64_t>(0, std::min(frame, mFrames));
+    mSeekTarget.store(frame, std::memory_order_release);
+    IOScheduler::instance().wake();
+  }
+
+  /// The frame the next read() starts at
+  int64_t currentPosition() const {
+    if (mBuffered) {
+      return mBuffered->currentPosition();
+    }
+    int64_t target = mSeekTarget.load(std::memory_order_acquire);
+    return target >= 0 ? target : mPosition.load(std::memory_order_acquire);
+  }
+
+  int channels() const {
+    return mBuffered ? mBuffered->channels() : mChannels;
+  }
+  double frameRate() const {
+    return mBuffered ? mBuffered->frameRate() : mFrameRate;
+  }
+  int64_t frames() const { return mBuffered ? mBuffered->frames() : mFrames; }
+
+  /// Seconds kept resident ahead of the play head, 2 by default
+  void prefetch(double seconds) { mPrefetchSeconds = seconds; }
+
+  // IOScheduler::Source
+
+  double deadline() override {
+    int64_t position = currentPosition();
+    int64_t prefetched = mPrefetched.load(std::memory_order_relaxed);
+    if (position < mWindowStart.load(std::memory_order_relaxed) ||
+        position > prefetched) {
+      return 0.0; // Seeked out of the window
+    }
+    int64_t ahead = aheadFrames();
+    if (prefetched < std::min(position + ahead, mFrames)) {
+      return (prefetched - position) / mFrameRate;
+    }
+    int64_t wrapped = position + ahead - mFrames;
+    int64_t wrapPrefetched = mWrapPrefetched.load(std::memory_order_relaxed);
+    if (mLoop && wrapped > 0 && wrapPrefetched < wrapped) {
+      return (mFrames - position + wrapPrefetched) / mFrameRate;
+    }
+    return std::numeric_limits<double>::infinity();
+  }
+
+  size_t service(size_t maxBytes) override {
+    int64_t position = currentPosition();
+    int64_t ahead = aheadFrames();
+    if (position < mWindowStart || position > mPrefetched) {
+      // Seeked out of the window, start over at the play head. Shrink the
+      // window first, read() may be checking it.
+      mPrefetched = position;
+      mWindowStart = position;
+    }
+    releaseBehind(position - ahead / 2);
+    int64_t batch = std::max<int64_t>(1, int64_t(maxBytes / mFrameBytes));
+    int64_t end = std::min(position + ahead, mFrames);
+    int64_t from = mPrefetched;
+    if (from < end) {
+      int64_t to = std::min(end, from + batch);
+      size_t bytes = touch(from, to);
+      mPrefetched = to; // Resident now, see resident()
+      return bytes;
+    }
+    // Have the beginning ready for the loop around
+    int64_t wrapped = position + ahead - mFrames;
+    from = mWrapPrefetched;
+    if (mLoop && wrapped > 0 && from < wrapped) {
+      int64_t to = std::min(wrapped, from + batch);
+      mWrapPrefetched = to;
+      return touch(from, to);
+    }
+    if (wrapped <= 0) {
+      mWrapPrefetched = 0;
+    }
+    return 0;
+  }
+
+  float fill() override {
+    if (!mData) {
+      return 1.0f;
+    }
+    int64_t position = currentPosition();
+    int64_t needed = std::min(aheadFrames(), mFrames - position);
+    if (needed <= 0) {
+      return 1.0f;
+    }
+    int64_t loaded = mPrefetched.load(std::memory_order_relaxed) - position;
+    return float(std::max<int64_t>(0, std::min(loaded, needed))) / needed;
+  }
+
+private:
+  enum Encoding { UINT8, INT8, INT16, INT24, INT32, FLOAT32, FLOAT64 };
+
+  static size_t pageSize() {
+#ifdef _WIN32
+    return 4096;
+#else
+    static size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+#endif
+  }
+
+  int64_t aheadFrames() const {
+    return std::max<int64_t>(1, int64_t(mPrefetchSeconds * mFrameRate));
+  }
+
+  // Whether the scheduler has made frames [from, to) resident
+  bool resident(int64_t from, int64_t to) const {
+    return from >= mWindowStart.load(std::memory_order_acquire) &&
+           to <= mPrefetched.load(std::memory_order_acquire);
+  }
+
+  // Returns the bytes made resident
+  size_t touch(int64_t fromFrame, int64_t toFrame) {
+    size_t page = pageSize();
+    size_t begin =
+        (mDataOffset + size_t(fromFrame) * mFrameBytes) / page * page;
+    size_t end = std::min(mSize, mDataOffset + size_t(toFrame) * mFrameBytes);
+    if (end <= begin) {
+      return 0;
+    }
+#ifndef _WIN32
+    // One request for the whole batch
+    madvise(const_cast<uint8_t *>(mData) + begin, end - begin, MADV_WILLNEED);
+#endif
+    uint8_t sum = 0;
+    for (size_t offset = begin; offset < end; offset += page) {
+      sum += static_cast<const volatile uint8_t *>(mData)[offset];
+    }
+    mTouched = sum;
+    return end - begin;
+  }
+
+  // Let the kernel reclaim the pages before toFrame
+  void releaseBehind(int64_t toFrame) {
+#ifndef _WIN32
+    size_t page = pageSize();
+    size_t begin =
+        (mDataOffset + size_t(mReleased) * mFrameBytes) / page * page;
+    size_t end = (mDataOffset + size_t(std::max<int64_t>(0, toFrame)) *
+                                    mFrameBytes) /
+                 page * page;
+    // In large steps, not every pass
+    if (end > begin + (size_t(16) << 20)) {
+      madvise(const_cast<uint8_t *>(mData) + begin, end - begin,
+              MADV_DONTNEED);
+      mReleased = toFrame;
+    } else if (toFrame < mReleased) {
+      mReleased = std::max<int64_t>(0, toFrame);
+    }
+#endif
+  }
+
+  bool map(const std::string &path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+      mapping =
+          CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(file);
+    if (!mapping) {
+      return false;
+    }
+    mData = static_cast<const uint8_t *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+    mSize = size_t(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+    void *data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    madvise(data, size_t(info.st_size), MADV_SEQUENTIAL);
+    mData = static_cast<const uint8_t *>(data);
+    mSize = size_t(info.st_size);
+#endif
+    return mData != nullptr;
+  }
+
+  void unmap() {
+    if (mData) {
+#ifdef _WIN32
+      UnmapViewOfFile(mData);
+#else
+      munmap(const_cast<uint8_t *>(mData), mSize);
+#endif
+    }
+    mData = nullptr;
+    mSize = 0;
+  }
+
+  static uint32_t le(const uint8_t *p, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+  static uint32_t be(const uint8_t *p, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+  static uint64_t le64(const uint8_t *p) {
+    return le(p, 4) | (uint64_t(le(p + 4, 4)) << 32);
+  }
+
+  bool parse() {
+    if (mSize < 12) {
+      return false;
+    }
+    if ((!std::memcmp(mData, "RIFF", 4) || !std::memcmp(mData, "RF64", 4)) &&
+        !std::memcmp(mData + 8, "WAVE", 4)) {
+      return parseWav();
+    }
+    bool aifc = !std::memcmp(mData + 8, "AIFC", 4);
+    if (!std::memcmp(mData, "FORM", 4) &&
+        (aifc || !std::memcmp(mData + 8, "AIFF", 4))) {
+      return parseAiff(aifc);
+    }
+    return false;
+  }
+
+  bool parseWav() {
+    uint64_t dataSize64 = 0;
+    size_t dataOffset = 0;
+    uint64_t dataSize = 0;
+    int format = 0, bits = 0;
+    for (size_t chunk = 12; chunk + 8 <= mSize;) {
+      const uint8_t *p = mData + chunk;
+      uint64_t size = le(p + 4, 4);
+      if (!std::memcmp(p, "ds64", 4) && size >= 16 && chunk + 24 <= mSize) {
+        dataSize64 = le64(p + 16);
+      } else if (!std::memcmp(p, "fmt ", 4) && size >= 16 &&
+                 chunk + 24 <= mSize) {
+        format = int(le(p + 8, 2));
+        mChannels = int(le(p + 10, 2));
+        mFrameRate = le(p + 12, 4);
+        mFrameBytes = le(p + 20, 2);
+        bits = int(le(p + 22, 2));
+        if (format == 0xfffe && size >= 40 && chunk + 34 <= mSize) {
+          format = int(le(p + 32, 2)); // First bytes of the subformat GUID
+        }
+      } else if (!std::memcmp(p, "data", 4)) {
+        dataOffset = chunk + 8;
+        dataSize = size == 0xffffffff ? dataSize64 : size;
+        break;
+      }
+      chunk += 8 + size + (size & 1);
+    }
+    bool integer = bits == 8 || bits == 16 || bits == 24 || bits == 32;
+    if (format == 1 && integer) {
+      mEncoding = bits == 8 ? UINT8 : bits == 16 ? INT16
+                                    : bits == 24 ? INT24
+                                                 : INT32;
+    } else if (format == 3 && (bits == 32 || bits == 64)) {
+      mEncoding = bits == 32 ? FLOAT32 : FLOAT64;
+    } else {
+      return false;
+    }
+    mBigEndian = false;
+    return setData(dataOffset, dataSize, bits);
+  }
+
+  bool parseAiff(bool compressed) {
+    size_t dataOffset = 0;
+    int64_t frames = 0;
+    int bits = 0;
+    char compression[4] = {'N', 'O', 'N', 'E'};
+    for (size_t chunk = 12; chunk + 8 <= mSize;) {
+      const uint8_t *p = mData + chunk;
+      uint64_t size = be(p + 4, 4);
+      if (!std::memcmp(p, "COMM", 4) && size >= 18 && chunk + 26 <= mSize) {
+        mChannels = int(be(p + 8, 2));
+        frames = be(p + 10, 4);
+        bits = int(be(p + 14, 2));
+        mFrameRate = extended(p + 16);
+        if (compressed && size >= 22 && chunk + 30 <= mSize) {
+          std::memcpy(compression, p + 26, 4);
+        }
+      } else if (!std::memcmp(p, "SSND", 4) && chunk + 16 <= mSize) {
+        dataOffset = chunk + 16 + be(p + 8, 4);
+      }
+      chunk += 8 + size + (size & 1);
+    }
+    mBigEndian = true;
+    if (!std::memcmp(compression, "NONE", 4) ||
+        !std::memcmp(compression, "twos", 4) ||
+        !std::memcmp(compression, "sowt", 4)) {
+      if (bits != 8 && bits != 16 && bits != 24 && bits != 32) {
+        return false;
+      }
+      mBigEndian = std::memcmp(compression, "sowt", 4) != 0;
+      mEncoding = bits == 8 ? INT8 : bits == 16 ? INT16
+                                   : bits == 24 ? INT24
+                                                : INT32;
+    } else if (!std::memcmp(compression, "fl32", 4) ||
+               !std::memcmp(compression, "FL32", 4)) {
+      mEncoding = FLOAT32;
+      bits = 32;
+    } else if (!std::memcmp(compression, "fl64", 4) ||
+               !std::memcmp(compression, "FL64", 4)) {
+      mEncoding = FLOAT64;
+      bits = 64;
+    } else {
+      return false;
+    }
+    mFrameBytes = size_t(mChannels) * (bits / 8);
+    return setData(dataOffset, uint64_t(frames) * mFrameBytes, bits);
+  }
+
+  // 80-bit IEEE extended, AIFF's sample rate
+  static double extended(const uint8_t *p) {
+    int exponent = int(be(p, 2) & 0x7fff) - 16383 - 63;
+    uint64_t mantissa = (uint64_t(be(p + 2, 4)) << 32) | be(p + 6, 4);
+    double value = double(mantissa);
+    for (; exponent > 0; exponent--) {
+      value *= 2.0;
+    }
+    for (; exponent < 0; exponent++) {
+      value *= 0.5;
+    }
+    return value;
+  }
+
+  bool setData(size_t offset, uint64_t size, int bits) {
+    if (mChannels <= 0 || mFrameRate <= 0 || offset == 0 || offset > mSize ||
+        mFrameBytes != size_t(mChannels) * (bits / 8)) {
+      return false;
+    }
+    mDataOffset = offset;
+    // Trust the file size over a truncated or unfinished header
+    size = std::min<uint64_t>(size, mSize - offset);
+    mFrames = int64_t(size / mFrameBytes);
+    return true;
+  }
+
+  static bool littleEndianHost() {
+    const uint16_t probe = 1;
+    return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+  }
+
+  void convert(const uint8_t *in, float *out, size_t samples) const {
+    if (mBigEndian) {
+      convert<true>(in, out, samples);
+    } else if (mEncoding == FLOAT32 && littleEndianHost()) {
+      std::memcpy(out, in, samples * sizeof(float));
+    } else {
+      convert<false>(in, out, samples);
+    }
+  }
+
+  template <bool kBigEndian>
+  void convert(const uint8_t *in, float *out, size_t samples) const {
+    auto get = [](const uint8_t *p, int bytes) {
+      return kBigEndian ? be(p, bytes) : le(p, bytes);
+    };
+    switch (mEncoding) {
+    case UINT8:
+      for (size_t i = 0; i < samples; i++) {
+        out[i] = (int(in[i]) - 128) * (1.0f / 128.0f);
+      }
+      break;
+    case INT8:
+      for (size_t i = 0; i < samples; i++) {
+        out[i] = int8_t(in[i]) * (1.0f / 128.0f);
+      }
+      break;
+    case INT16:
+      for (size_t i = 0; i < samples; i++) {
+        out[i] = int16_t(get(in + 2 * i, 2)) * (1.0f / 32768.0f);
+      }
+      break;
+    case INT24:
+      for (size_t i = 0; i < samples; i++) {
+        out[i] = int32_t(get(in + 3 * i, 3) << 8) * (1.0f / 2147483648.0f);
+      }
+      break;
+    case INT32:
+      for (size_t i = 0; i < samples; i++) {
+        out[i] = int32_t(get(in + 4 * i, 4)) * (1.0f / 2147483648.0f);
+      }
+      break;
+    case FLOAT32:
+      for (size_t i = 0; i < samples; i++) {
+        uint32_t bits = get(in + 4 * i, 4);
+        std::memcpy(out + i, &bits, sizeof(float));
+      }
+      break;
+    case FLOAT64:
+      for (size_t i = 0; i < samples; i++) {
+        const uint8_t *p = in + 8 * i;
+        uint64_t bits = kBigEndian ? (uint64_t(be(p, 4)) << 32) | be(p + 4, 4)
+                                   : le64(p);
+        double value;
+        std::memcpy(&value, &bits, sizeof(double));
+        out[i] = float(value);
+      }
+      break;
+    }
+  }
+
+  // File
+  const uint8_t *mData{nullptr};
+  size_t mSize{0};
+  size_t mDataOffset{0};
+  size_t mFrameBytes{0};
+  int mChannels{0};
+  double mFrameRate{0};
+  int64_t mFrames{0};
+  Encoding mEncoding{INT16};
+  bool mBigEndian{false};
+
+  // Fallback for files that can't be mapped
+  std::unique_ptr<al::SoundFileBuffered> mBuffered;
+  int mBufferFrames;
+
+  // Play head
+  std::atomic<int64_t> mPosition{0};
+  std::atomic<int64_t> mSeekTarget{-1};
+  std::atomic<bool> mLoop{false};
+  bool mWaiting{true}; // read() outputs silence, only used by read()
+
+  // Prefetch window, written by one scheduler thread at a time
+  std::atomic<double> mPrefetchSeconds{2.0};
+  std::atomic<int64_t> mWindowStart{0};
+  std::atomic<int64_t> mPrefetched{0};
+  std::atomic<int64_t> mWrapPrefetched{0};
+  int64_t mReleased{0};
+  uint8_t mTouched{0};
+};
+
+#endif // MappedSoundFile_H
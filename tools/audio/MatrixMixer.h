@@ -0,0 +1,512 @@
+#pragma once
+#ifndef MatrixMixer_H
+#define MatrixMixer_H
+
+// Routing of n input channels to m output channels through a gain matrix.
+//
+// DownMixer mixes one matrix cell at a time over the whole buffer, including
+// every zero cell, and jumps to a new matrix between buffers. MatrixMixer
+// keeps only the non-zero cells, sorted by output. The buffer is processed in
+// blocks of kBlockFrames frames so the inputs of a block stay in the cache
+// while every output reads them. Each output block is accumulated four
+// inputs at a time with SSE or NEON, so it is loaded and stored once per four
+// cells. Outputs are mixed into scratch blocks first, so a matrix may read and
+// write the same channels, as downmixing the outputs in place does.
+//
+// Gains are changed from any thread through a lock-free queue, like
+// Transport's commands. The audio thread ramps each changed cell linearly to
+// its new gain, so moving a fader or switching a matrix doesn't click.
+//
+//   MatrixMixer mixer;
+//   mixer.configure(60, 2);                     // before audio starts
+//   setLayoutToStereo(mixer, speakerLayout);    // any thread
+//   mixer.outsToBuses(io);                      // in onSound()
+//
+// matrix_mixer_benchmark measures 60 to 2, 60 to 8 and 64 to 64 matrices.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1
+#include <xmmintrin.h>
+#define MATRIX_MIXER_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MATRIX_MIXER_NEON 1
+#endif
+
+#include "al/io/al_AudioIOData.hpp"
+#include "al/sound/al_Speaker.hpp"
+#include "al/types/al_SingleRWRingBuffer.hpp"
+
+/// out[i] += sum of g[k] * in[k][i] over four inputs k
+inline void accumulate4(float *out, const float *const *in, const float *g,
+                        int frames) {
+  int i = 0;
+#if defined(MATRIX_MIXER_SSE)
+  __m128 g0 = _mm_set1_ps(g[0]), g1 = _mm_set1_ps(g[1]);
+  __m128 g2 = _mm_set1_ps(g[2]), g3 = _mm_set1_ps(g[3]);
+  for (; i + 4 <= frames; i += 4) {
+    __m128 a = _mm_add_ps(_mm_mul_ps(g0, _mm_loadu_ps(in[0] + i)),
+                          _mm_mul_ps(g1, _mm_loadu_ps(in[1] + i)));
+    __m128 b = _mm_add_ps(_mm_mul_ps(g2, _mm_loadu_ps(in[2] + i)),
+                          _mm_mul_ps(g3, _mm_loadu_ps(in[3] + i)));
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_loadu_ps(out + i), _mm_add_ps(a, b)));
+  }
+#elif defined(MATRIX_MIXER_NEON)
+  for (; i + 4 <= frames; i += 4) {
+    float32x4_t sum = vld1q_f32(out + i);
+    sum = vmlaq_n_f32(sum, vld1q_f32(in[0] + i), g[0]);
+    sum = vmlaq_n_f32(sum, vld1q_f32(in[1] + i), g[1]);
+    sum = vmlaq_n_f32(sum, vld1q_f32(in[2] + i), g[2]);
+    sum = vmlaq_n_f32(sum, vld1q_f32(in[3] + i), g[3]);
+    vst1q_f32(out + i, sum);
+  }
+#endif
+  for (; i < frames; i++) {
+    out[i] += g[0] * in[0][i] + g[1] * in[1][i] + g[2] * in[2][i] +
+              g[3] * in[3][i];
+  }
+}
+
+/// out[i] += (gain + i * step) * in[i]
+inline void accumulateRamp(float *out, const float *in, float gain,
+                           float step, int frames) {
+  int i = 0;
+#if defined(MATRIX_MIXER_SSE)
+  __m128 g = _mm_setr_ps(gain, gain + step, gain + 2 * step, gain + 3 * step);
+  __m128 step4 = _mm_set1_ps(4 * step);
+  for (; i + 4 <= frames; i += 4) {
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i),
+                                      _mm_mul_ps(g, _mm_loadu_ps(in + i))));
+    g = _mm_add_ps(g, step4);
+  }
+#elif defined(MATRIX_MIXER_NEON)
+  float start[4] = {gain, gain + step, gain + 2 * step, gain + 3 * step};
+  float32x4_t g = vld1q_f32(start);
+  float32x4_t step4 = vdupq_n_f32(4 * step);
+  for (; i + 4 <= frames; i += 4) {
+    vst1q_f32(out + i, vmlaq_f32(vld1q_f32(out + i), g, vld1q_f32(in + i)));
+    g = vaddq_f32(g, step4);
+  }
+#endif
+  for (; i < frames; i++) {
+    out[i] += (gain + i * step) * in[i];
+  }
+}
+
+/// out[i] += sum of (gain[k] + i * step[k]) * in[k][i] over four inputs k
+inline void accumulateRamp4(float *out, const float *const *in,
+                            const float *gain, const float *step, int frames) {
+  int i = 0;
+#if defined(MATRIX_MIXER_SSE)
+  // Separate variables, so the gains stay in registers
+  const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  __m128 s0 = _mm_set1_ps(step[0]), s1 = _mm_set1_ps(step[1]);
+  __m128 s2 = _mm_set1_ps(step[2]), s3 = _mm_set1_ps(step[3]);
+  __m128 g0 = _mm_add_ps(_mm_set1_ps(gain[0]), _mm_mul_ps(offsets, s0));
+  __m128 g1 = _mm_add_ps(_mm_set1_ps(gain[1]), _mm_mul_ps(offsets, s1));
+  __m128 g2 = _mm_add_ps(_mm_set1_ps(gain[2]), _mm_mul_ps(offsets, s2));
+  __m128 g3 = _mm_add_ps(_mm_set1_ps(gain[3]), _mm_mul_ps(offsets, s3));
+  const __m128 four = _mm_set1_ps(4.0f);
+  s0 = _mm_mul_ps(s0, four);
+  s1 = _mm_mul_ps(s1, four);
+  s2 = _mm_mul_ps(s2, four);
+  s3 = _mm_mul_ps(s3, four);
+  for (; i + 4 <= frames; i += 4) {
+    __m128 a = _mm_add_ps(_mm_mul_ps(g0, _mm_loadu_ps(in[0] + i)),
+                          _mm_mul_ps(g1, _mm_loadu_ps(in[1] + i)));
+    __m128 b = _mm_add_ps(_mm_mul_ps(g2, _mm_loadu_ps(in[2] + i)),
+                          _mm_mul_ps(g3, _mm_loadu_ps(in[3] + i)));
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_loadu_ps(out + i), _mm_add_ps(a, b)));
+    g0 = _mm_add_ps(g0, s0);
+    g1 = _mm_add_ps(g1, s1);
+    g2 = _mm_add_ps(g2, s2);
+    g3 = _mm_add_ps(g3, s3);
+  }
+#elif defined(MATRIX_MIXER_NEON)
+  const float offsetValues[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+  const float32x4_t offsets = vld1q_f32(offsetValues);
+  float32x4_t g0 = vmlaq_n_f32(vdupq_n_f32(gain[0]), offsets, step[0]);
+  float32x4_t g1 = vmlaq_n_f32(vdupq_n_f32(gain[1]), offsets, step[1]);
+  float32x4_t g2 = vmlaq_n_f32(vdupq_n_f32(gain[2]), offsets, step[2]);
+  float32x4_t g3 = vmlaq_n_f32(vdupq_n_f32(gain[3]), offsets, step[3]);
+  float32x4_t s0 = vdupq_n_f32(4 * step[0]), s1 = vdupq_n_f32(4 * step[1]);
+  float32x4_t s2 = vdupq_n_f32(4 * step[2]), s3 = vdupq_n_f32(4 * step[3]);
+  for (; i + 4 <= frames; i += 4) {
+    float32x4_t sum = vld1q_f32(out + i);
+    sum = vmlaq_f32(sum, g0, vld1q_f32(in[0] + i));
+    sum = vmlaq_f32(sum, g1, vld1q_f32(in[1] + i));
+    sum = vmlaq_f32(sum, g2, vld1q_f32(in[2] + i));
+    sum = vmlaq_f32(sum, g3, vld1q_f32(in[3] + i));
+    vst1q_f32(out + i, sum);
+    g0 = vaddq_f32(g0, s0);
+    g1 = vaddq_f32(g1, s1);
+    g2 = vaddq_f32(g2, s2);
+    g3 = vaddq_f32(g3, s3);
+  }
+#endif
+  for (; i < frames; i++) {
+    float sum = 0.0f;
+    for (int k = 0; k < 4; k++) {
+      sum += (gain[k] + i * step[k]) * in[k][i];
+    }
+    out[i] += sum;
+  }
+}
+
+class MatrixMixer {
+public:
+  /// Frames mixed per block
+  static const int kBlockFrames = 256;
+
+  /**
+   * @brief Set the matrix size and allocate everything the audio thread uses
+   *
+   * All gains start at 0. Call before audio starts.
+   *
+   * @param rampFrames frames over which a gain change is ramped
+   */
+  void configure(int inputs, int outputs, int rampFrames = 1024) {
+    mInputs = inputs;
+    mOutputs = outputs;
+    mRampFrames = std::max(1, rampFrames);
+    size_t cells = size_t(inputs) * outputs;
+    mQueue = std::make_unique<al::SingleRWRingBuffer>(
+        (cells + 1) * sizeof(Command));
+    mCells.clear();
+    mCells.reserve(cells);
+    mIndex.assign(cells, -1);
+    mGroups.clear();
+    mGroups.reserve(outputs);
+    mScratch.assign(size_t(outputs) * kBlockFrames, 0.0f);
+    mInPointers.assign(inputs, nullptr);
+    mOutPointers.assign(outputs, nullptr);
+  }
+
+  int inputs() const { return mInputs; }
+  int outputs() const { return mOutputs; }
+
+  // Gain changes, from any thread but the audio thread. They return false if
+  // the queue is full, which can only happen if the audio thread is not
+  // running.
+
+  /// Ramp the gain from input to output to gain
+  bool set(int input, int output, float gain) {
+    if (input < 0 || input >= mInputs || output < 0 || output >= mOutputs) {
+      return false;
+    }
+    return push({input, output, gain});
+  }
+  /// Ramp every gain to 0
+  bool clear() { return push({-1, -1, 0.0f}); }
+
+  /**
+   * @brief Audio thread: out[o] = sum of gain(i, o) * in[i]
+   *
+   * Outputs are overwritten. in and out may point to the same buffers.
+   */
+  void process(const float *const *in, float *const *out, int frames) {
+    applyCommands();
+    for (int start = 0; start < frames; start += kBlockFrames) {
+      int count = std::min(int(kBlockFrames), frames - start);
+      std::fill(mScratch.begin(), mScratch.end(), 0.0f);
+      for (const Group &group : mGroups) {
+        mixGroup(group, in, start, count);
+      }
+      for (int o = 0; o < mOutputs; o++) {
+        std::memcpy(out[o] + start, &mScratch[size_t(o) * kBlockFrames],
+                    count * sizeof(float));
+      }
+      advanceRamps(count);
+    }
+  }
+
+  /**
+   * @brief Audio thread: mix output channels to buses 0 to outputs() - 1
+   *
+   * Inputs are output channels 0 to inputs() - 1. Output channels are left
+   * as they are.
+   */
+  void outsToBuses(al::AudioIOData &io) {
+    for (int i = 0; i < mInputs; i++) {
+      mInPointers[i] = i < int(io.channelsOut()) ? io.outBuffer(i) : nullptr;
+    }
+    for (int o = 0; o < mOutputs; o++) {
+      mOutPointers[o] = io.busBuffer(o);
+    }
+    process(mInPointers.data(), mOutPointers.data(), io.framesPerBuffer());
+  }
+
+  /**
+   * @brief Audio thread: downmix the output channels in place
+   *
+   * Output o replaces output channel outChannels[o] and every other output
+   * channel is silenced. outChannels needs outputs() entries.
+   */
+  void outsToOuts(al::AudioIOData &io, const std::vector<int> &outChannels) {
+    for (int i = 0; i < mInputs; i++) {
+      mInPointers[i] = i < int(io.channelsOut()) ? io.outBuffer(i) : nullptr;
+    }
+    for (int o = 0; o < mOutputs; o++) {
+      mOutPointers[o] = io.outBuffer(outChannels[o]);
+    }
+    process(mInPointers.data(), mOutPointers.data(), io.framesPerBuffer());
+    silenceOthers(io, outChannels);
+  }
+
+  /// Audio thread: copy buses to outChannels and silence other outputs
+  static void busesToOuts(al::AudioIOData &io,
+                          const std::vector<int> &outChannels) {
+    for (size_t b = 0; b < outChannels.size(); b++) {
+      std::memcpy(io.outBuffer(outChannels[b]), io.busBuffer(int(b)),
+                  io.framesPerBuffer() * sizeof(float));
+    }
+    silenceOthers(io, outChannels);
+  }
+
+private:
+  struct Command {
+    int32_t input; ///< -1 to clear
+    int32_t output;
+    float gain;
+  };
+
+  // A non-zero or ramping matrix cell
+  struct Cell {
+    int input;
+    int output;
+    float gain;
+    float target;
+    float step;    // Per frame while ramping
+    int remaining; // Ramp frames left
+  };
+
+  // The cells of one output, steady ones first
+  struct Group {
+    int output;
+    int begin;
+    int steadyEnd;
+    int end;
+  };
+
+  bool push(const Command &command) {
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    if (!mQueue || mQueue->writeSpace() < sizeof(Command)) {
+      return false;
+    }
+    mQueue->write(reinterpret_cast<const char *>(&command), sizeof(Command));
+    return true;
+  }
+
+  void applyCommands() {
+    bool changed = false;
+    Command command;
+    while (mQueue->readSpace() >= sizeof(Command)) {
+      mQueue->read(reinterpret_cast<char *>(&command), sizeof(Command));
+      if (command.input < 0) {
+        for (Cell &cell : mCells) {
+          retarget(cell, 0.0f);
+        }
+      } else {
+        int &index = mIndex[size_t(command.input) * mOutputs + command.output];
+        if (index < 0) {
+          if (command.gain == 0.0f) {
+            continue;
+          }
+          // Capacity is reserved for every cell, so this doesn't allocate
+          index = int(mCells.size());
+          mCells.push_back({command.input, command.output, 0.0f, 0.0f, 0.0f,
+                            0});
+        }
+        retarget(mCells[index], command.gain);
+      }
+      changed = true;
+    }
+    if (changed) {
+      regroup();
+    }
+  }
+
+  void retarget(Cell &cell, float gain) {
+    cell.target = gain;
+    cell.remaining = mRampFrames;
+    cell.step = (gain - cell.gain) / mRampFrames;
+  }
+
+  // Sort the cells by output, steady before ramping, and drop silent ones
+  void regroup() {
+    mCells.erase(std::remove_if(mCells.begin(), mCells.end(),
+                                [](const Cell &cell) {
+                                  return cell.remaining == 0 &&
+                                         cell.gain == 0.0f;
+                                }),
+                 mCells.end());
+    std::sort(mCells.begin(), mCells.end(), [](const Cell &a, const Cell &b) {
+      if (a.output != b.output) {
+        return a.output < b.output;
+      }
+      if ((a.remaining > 0) != (b.remaining > 0)) {
+        return a.remaining == 0;
+      }
+      return a.input < b.input;
+    });
+    std::fill(mIndex.begin(), mIndex.end(), -1);
+    mGroups.clear();
+    for (int c = 0; c < int(mCells.size()); c++) {
+      const Cell &cell = mCells[c];
+      mIndex[size_t(cell.input) * mOutputs + cell.output] = c;
+      if (mGroups.empty() || mGroups.back().output != cell.output) {
+        mGroups.push_back({cell.output, c, c, c});
+      }
+      Group &group = mGroups.back();
+      group.end = c + 1;
+      if (cell.remaining == 0) {
+        group.steadyEnd = c + 1;
+      }
+    }
+    mRamping = false;
+    for (const Cell &cell : mCells) {
+      mRamping |= cell.remaining > 0;
+    }
+  }
+
+  void mixGroup(const Group &group, const float *const *in, int start,
+                int frames) {
+    float *out = &mScratch[size_t(group.output) * kBlockFrames];
+    const float *inputs[4];
+    float gains[4];
+    int n = 0;
+    for (int c = group.begin; c < group.steadyEnd; c++) {
+      const Cell &cell = mCells[c];
+      if (!in[cell.input]) {
+        continue;
+      }
+      inputs[n] = in[cell.input] + start;
+      gains[n] = cell.gain;
+      if (++n == 4) {
+        accumulate4(out, inputs, gains, frames);
+        n = 0;
+      }
+    }
+    if (n > 0) {
+      // Pad with zero gains on a real input
+      for (int k = n; k < 4; k++) {
+        inputs[k] = inputs[0];
+        gains[k] = 0.0f;
+      }
+      accumulate4(out, inputs, gains, frames);
+    }
+    for (int c = group.steadyEnd; c < group.end; c++) {
+      const Cell &cell = mCells[c];
+      if (!in[cell.input]) {
+        continue;
+      }
+      int ramp = std::min(frames, cell.remaining);
+      accumulateRamp(out, in[cell.input] + start, cell.gain, cell.step, ramp);
+      if (ramp < frames) {
+        float target[4] = {cell.target, 0.0f, 0.0f, 0.0f};
+        const float *tail[4] = {in[cell.input] + start + ramp,
+                                in[cell.input] + start + ramp,
+                                in[cell.input] + start + ramp,
+                                in[cell.input] + start + ramp};
+        accumulate4(out + ramp, tail, target, frames - ramp);
+      }
+    }
+  }
+
+  void advanceRamps(int frames) {
+    if (!mRamping) {
+      return;
+    }
+    bool finished = false;
+    for (Cell &cell : mCells) {
+      if (cell.remaining > 0) {
+        int ramp = std::min(frames, cell.remaining);
+        cell.remaining -= ramp;
+        cell.gain = cell.remaining > 0 ? cell.gain + ramp * cell.step
+                                       : cell.target;
+        finished |= cell.remaining == 0;
+      }
+    }
+    if (finished) {
+      regroup();
+    }
+  }
+
+  static void silenceOthers(al::AudioIOData &io,
+                            const std::vector<int> &outChannels) {
+    for (int c = 0; c < int(io.channelsOut()); c++) {
+      if (std::find(outChannels.begin(), outChannels.end(), c) ==
+          outChannels.end()) {
+        std::memset(io.outBuffer(c), 0, io.framesPerBuffer() * sizeof(float));
+      }
+    }
+  }
+
+  int mInputs{0};
+  int mOutputs{0};
+  int mRampFrames{1024};
+  std::unique_ptr<al::SingleRWRingBuffer> mQueue;
+  std::mutex mWriteLock;
+
+  // Audio thread
+  std::vector<Cell> mCells;
+  std::vector<int> mIndex; // Cell of input * mOutputs + output, or -1
+  std::vector<Group> mGroups;
+  bool mRamping{false};
+  std::vector<float> mScratch; // kBlockFrames per output
+  std::vector<const float *> mInPointers;
+  std::vector<float *> mOutPointers;
+};
+
+/**
+ * @brief Stereo downmix of a speaker layout
+ *
+ * Each speaker is panned by its azimuth with an equal-power law.
+ * Gains are scaled so each side's power sums to 1. Speakers are read from the
+ * mixer inputs at their device channels.
+ */
+inline void setLayoutToStereo(MatrixMixer &mixer, const al::Speakers &layout) {
+  std::vector<float> left, right;
+  double leftPower = 0.0, rightPower = 0.0;
+  for (const al::Speaker &speaker : layout) {
+    // Azimuth is in degrees from the front towards the right
+    double pan = std::sin(speaker.azimuth * M_PI / 180.0);
+    double angle = (pan + 1.0) * M_PI / 4.0;
+    left.push_back(float(std::cos(angle)));
+    right.push_back(float(std::sin(angle)));
+    leftPower += left.back() * left.back();
+    rightPower += right.back() * right.back();
+  }
+  float leftScale = leftPower > 0.0 ? float(1.0 / std::sqrt(leftPower)) : 0.0f;
+  float rightScale =
+      rightPower > 0.0 ? float(1.0 / std::sqrt(rightPower)) : 0.0f;
+  mixer.clear();
+  for (size_t s = 0; s < layout.size(); s++) {
+    int channel = layout[s].deviceChannel;
+    mixer.set(channel, 0, left[s] * leftScale);
+    mixer.set(channel, 1, right[s] * rightScale);
+  }
+}
+
+/// ITU 5.1 (L R C LFE Ls Rs) to stereo, the LFE is dropped
+inline void set5_1toStereo(MatrixMixer &mixer) {
+  const float kSide = float(M_SQRT1_2);
+  mixer.clear();
+  mixer.set(0, 0, 1.0f);
+  mixer.set(1, 1, 1.0f);
+  mixer.set(2, 0, kSide);
+  mixer.set(2, 1, kSide);
+  mixer.set(4, 0, kSide);
+  mixer.set(5, 1, kSide);
+}
+
+#endif // MatrixMixer_H
@@ -0,0 +1,365 @@
+#pragma once
+#ifndef Resampler_H
+#define Resampler_H
+
+// Streaming sample rate conversion between a sound file and the device.
+//
+// A session can mix files recorded at 44.1 and 48 kHz, but the device runs
+// at one rate and a file read at the wrong one plays at the wrong pitch.
+// ResampledSource wraps a source with SoundFileBuffered's interface and
+// converts its frames to the device rate as they are read.
+//
+// The conversion is a polyphase FIR filter. The rate ratio is reduced to
+// L/M, e.g. 160/147 for 44.1 to 48 kHz. Output frame n sits at input time
+// n * M / L, so it uses one of L phases of a Kaiser-windowed sinc filter.
+// The L phases are computed once per ratio and quality and shared by all
+// sources with that ratio. Each output frame is a dot product of one phase
+// with the last few input frames, computed four interleaved channels at a
+// time with SSE or NEON, or four taps at a time for mono and stereo.
+//
+//   ResampledSource<MappedSoundFile> source(file);
+//   source.configure(48000, PolyphaseFilterBank::MEDIUM); // before audio
+//   stream.mix(source, io, gain, mute); // reads 48 kHz frames
+//
+// Positions, seek() and frames() are in output frames. A source already at
+// the output rate is read directly. resampler_benchmark measures the cost
+// per channel for each quality.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1
+#include <xmmintrin.h>
+#define RESAMPLER_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#endif
+
+/// The filter phases for one rate ratio and quality
+class PolyphaseFilterBank {
+public:
+  enum Quality { LOW, MEDIUM, HIGH };
+
+  /// Shared filter bank for converting inRate to outRate
+  static std::shared_ptr<const PolyphaseFilterBank>
+  get(double inRate, double outRate, Quality quality) {
+    static std::mutex lock;
+    static std::map<std::tuple<int64_t, int64_t, int>,
+                    std::weak_ptr<const PolyphaseFilterBank>>
+        banks;
+    int64_t in = std::llround(inRate);
+    int64_t out = std::llround(outRate);
+    std::lock_guard<std::mutex> guard(lock);
+    auto key = std::make_tuple(in, out, int(quality));
+    std::shared_ptr<const PolyphaseFilterBank> bank = banks[key].lock();
+    if (!bank) {
+      bank = std::make_shared<PolyphaseFilterBank>(in, out, quality);
+      banks[key] = bank;
+    }
+    return bank;
+  }
+
+  PolyphaseFilterBank(int64_t inRate, int64_t outRate, Quality quality) {
+    int64_t divisor = gcd(inRate, outRate);
+    mPhases = int(outRate / divisor);
+    mStep = int(inRate / divisor);
+    if (mPhases > kMaxPhases) {
+      // Rates without a small common ratio, within a fraction of a cent
+      mStep = int(std::llround(double(inRate) * kMaxPhases / outRate));
+      mPhases = kMaxPhases;
+    }
+    const struct {
+      int taps;
+      double beta;
+      double bandwidth;
+    } kQuality[] = {{8, 5.0, 0.85}, {24, 7.0, 0.9}, {64, 9.0, 0.95}};
+    mTaps = kQuality[quality].taps;
+    double beta = kQuality[quality].beta;
+    // Cut off at the lower of the two Nyquist frequencies
+    double cutoff =
+        std::min(1.0, double(mPhases) / mStep) * kQuality[quality].bandwidth;
+    double half = mTaps / 2;
+    mCoefficients.resize(size_t(mPhases) * mTaps);
+    for (int p = 0; p < mPhases; p++) {
+      float *h = &mCoefficients[size_t(p) * mTaps];
+      double sum = 0.0;
+      for (int k = 0; k < mTaps; k++) {
+        // Tap k's distance from the output frame, in input frames
+        double x = k - (half - 1) - double(p) / mPhases;
+        double r = std::min(1.0, std::fabs(x) / half);
+        double window =
+            besselI0(beta * std::sqrt(1.0 - r * r)) / besselI0(beta);
+        h[k] = float(cutoff * sinc(cutoff * x) * window);
+        sum += h[k];
+      }
+      // Unity gain at DC for every phase
+      for (int k = 0; k < mTaps; k++) {
+        h[k] = float(h[k] / sum);
+      }
+    }
+  }
+
+  int taps() const { return mTaps; }
+  /// L, output frames per mStep input frames
+  int phases() const { return mPhases; }
+  /// M, input frames per mPhases output frames
+  int step() const { return mStep; }
+  const float *phase(int p) const { return &mCoefficients[size_t(p) * mTaps]; }
+
+private:
+  static const int kMaxPhases = 4096;
+
+  static int64_t gcd(int64_t a, int64_t b) {
+    while (b) {
+      int64_t t = a % b;
+      a = b;
+      b = t;
+    }
+    return a > 0 ? a : 1;
+  }
+
+  static double sinc(double x) {
+    return x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+  }
+
+  static double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  int mPhases;
+  int mStep;
+  int mTaps;
+  std::vector<float> mCoefficients;
+};
+
+/**
+ * @brief out[c] = sum of h[k] * in[k * channels + c] over taps k
+ *
+ * in and out are interleaved frames.
+ */
+inline void polyphaseFrame(const float *in, int channels, const float *h,
+                           int taps, float *out) {
+  const size_t stride = size_t(channels);
+  int c = 0;
+#if defined(RESAMPLER_SSE)
+  // Mono and stereo frames are contiguous, so go across the taps instead
+  if (channels <= 2 && taps % 4 == 0) {
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < taps; k += 4) {
+      __m128 coefficients = _mm_loadu_ps(h + k);
+      if (channels == 1) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(coefficients, _mm_loadu_ps(in + k)));
+      } else {
+        // L R L R times h0 h0 h1 h1, then h2 h2 h3 h3
+        const float *p = in + 2 * k;
+        __m128 low = _mm_unpacklo_ps(coefficients, coefficients);
+        __m128 high = _mm_unpackhi_ps(coefficients, coefficients);
+        sum = _mm_add_ps(sum, _mm_mul_ps(low, _mm_loadu_ps(p)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(high, _mm_loadu_ps(p + 4)));
+      }
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    if (channels == 1) {
+      out[0] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    } else {
+      out[0] = lanes[0] + lanes[2];
+      out[1] = lanes[1] + lanes[3];
+    }
+    return;
+  }
+  for (; c + 4 <= channels; c += 4) {
+    const float *p = in + c;
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < taps; k++) {
+      __m128 x = _mm_loadu_ps(p + k * stride);
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(h[k]), x));
+    }
+    _mm_storeu_ps(out + c, sum);
+  }
+#elif defined(RESAMPLER_NEON)
+  if (channels <= 2 && taps % 4 == 0) {
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int k = 0; k < taps; k += 4) {
+      float32x4_t coefficients = vld1q_f32(h + k);
+      if (channels == 1) {
+        sum = vmlaq_f32(sum, coefficients, vld1q_f32(in + k));
+      } else {
+        const float *p = in + 2 * k;
+        float32x4x2_t pairs = vzipq_f32(coefficients, coefficients);
+        sum = vmlaq_f32(sum, pairs.val[0], vld1q_f32(p));
+        sum = vmlaq_f32(sum, pairs.val[1], vld1q_f32(p + 4));
+      }
+    }
+    float lanes[4];
+    vst1q_f32(lanes, sum);
+    if (channels == 1) {
+      out[0] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    } else {
+      out[0] = lanes[0] + lanes[2];
+      out[1] = lanes[1] + lanes[3];
+    }
+    return;
+  }
+  for (; c + 4 <= channels; c += 4) {
+    const float *p = in + c;
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int k = 0; k < taps; k++) {
+      sum = vmlaq_n_f32(sum, vld1q_f32(p + k * stride), h[k]);
+    }
+    vst1q_f32(out + c, sum);
+  }
+#endif
+  for (; c < channels; c++) {
+    float sum = 0.0f;
+    for (int k = 0; k < taps; k++) {
+      sum += h[k] * in[k * stride + c];
+    }
+    out[c] = sum;
+  }
+}
+
+/// A source read at another rate, see the top of Resampler.h
+template <class TSource> class ResampledSource {
+public:
+  ResampledSource(TSource &source) : mSource(source) {}
+
+  /**
+   * @brief Set the output rate and allocate the buffers
+   *
+   * Call before audio starts.
+   */
+  void configure(double outRate,
+                 PolyphaseFilterBank::Quality quality =
+                     PolyphaseFilterBank::MEDIUM) {
+    mOutRate = outRate;
+    mChannels = mSource.channels();
+    if (std::llround(mSource.frameRate()) == std::llround(outRate)) {
+      mBank.reset();
+      return;
+    }
+    mBank = PolyphaseFilterBank::get(mSource.frameRate(), outRate, quality);
+    mIn.assign(size_t(mBank->taps() + kChunkFrames) * mChannels, 0.0f);
+    reset();
+  }
+
+  /// False if frames are read from the source as they are
+  bool resampling() const { return mBank != nullptr; }
+
+  size_t read(float *buffer, int frames) {
+    if (!mBank) {
+      return mSource.read(buffer, frames);
+    }
+    const int taps = mBank->taps();
+    int produced = 0;
+    while (produced < frames) {
+      if (mInIndex + taps > mInCount) {
+        if (!refill()) {
+          break;
+        }
+        continue;
+      }
+      polyphaseFrame(&mIn[size_t(mInIndex) * mChannels], mChannels,
+                     mBank->phase(mPhase), taps,
+                     buffer + size_t(produced) * mChannels);
+      produced++;
+      mPhase += mBank->step();
+      mInIndex += mPhase / mBank->phases();
+      mPhase %= mBank->phases();
+    }
+    mBuffered.store(mInCount - mInIndex, std::memory_order_relaxed);
+    return size_t(produced);
+  }
+
+  /// Seek to an output frame. From the thread calling read().
+  void seek(int64_t frame) {
+    if (!mBank) {
+      mSource.seek(frame);
+      return;
+    }
+    mSource.seek(toInput(frame));
+    reset();
+  }
+
+  void loop(bool loop) { mSource.loop(loop); }
+
+  /// frames() once the source has ended and every frame has been read
+  int64_t currentPosition() const {
+    if (!mBank) {
+      return mSource.currentPosition();
+    }
+    int64_t buffered = mBuffered.load(std::memory_order_relaxed);
+    int64_t source = int64_t(mSource.currentPosition());
+    // read() keeps at least taps frames unless the source had no more
+    if (buffered < mBank->taps() && source >= int64_t(mSource.frames())) {
+      return frames();
+    }
+    int64_t input = source - buffered + (mBank->taps() / 2 - 1);
+    return std::max<int64_t>(0, toOutput(input));
+  }
+
+  int channels() const { return mChannels; }
+  double frameRate() const { return mOutRate; }
+  int64_t frames() const { return toOutput(mSource.frames()); }
+
+private:
+  static const int kChunkFrames = 1024;
+
+  int64_t toInput(int64_t frame) const {
+    return frame * mBank->step() / mBank->phases();
+  }
+  int64_t toOutput(int64_t frame) const {
+    return mBank ? frame * mBank->phases() / mBank->step() : frame;
+  }
+
+  // Silence before the first input frame, so output frame 0 is input frame 0
+  void reset() {
+    std::fill(mIn.begin(), mIn.end(), 0.0f);
+    mInCount = mBank->taps() / 2 - 1;
+    mInIndex = 0;
+    mPhase = 0;
+    mBuffered.store(mInCount, std::memory_order_relaxed);
+  }
+
+  // Drop the frames before mInIndex and read more. False at the end.
+  bool refill() {
+    int start = std::min(mInIndex, mInCount);
+    std::memmove(mIn.data(), mIn.data() + size_t(start) * mChannels,
+                 size_t(mInCount - start) * mChannels * sizeof(float));
+    mInCount -= start;
+    mInIndex -= start;
+    int capacity = int(mIn.size() / mChannels);
+    int read = int(mSource.read(mIn.data() + size_t(mInCount) * mChannels,
+                                capacity - mInCount));
+    mInCount += std::max(0, read);
+    return read > 0;
+  }
+
+  TSource &mSource;
+  std::shared_ptr<const PolyphaseFilterBank> mBank;
+  double mOutRate{0.0};
+  int mChannels{0};
+
+  // Audio thread
+  std::vector<float> mIn; // Interleaved input, oldest first
+  int mInCount{0};
+  int mInIndex{0}; // First frame of the next output's taps
+  int mPhase{0};
+  std::atomic<int64_t> mBuffered{0};
+};
+
+#endif // Resampler_H
@@ -0,0 +1,510 @@
+#pragma once
+#ifndef SamplePool_H
+#define SamplePool_H
+
+// Sound files loaded ahead of playback and shared between voices.
+//
+// A voice that opens its file when it is triggered pays for the open and
+// for the first reads from disk right then, and a file triggered again is
+// opened again. SamplePool moves that work off the trigger path. preload()
+// scans the sequences of a directory on a background thread, and for every
+// sound file they reference decodes the first seconds into memory. A voice
+// then starts playing from memory straight away, and the rest of the file is
+// opened on the pool's thread while the beginning plays.
+//
+// Decoded beginnings are shared by refcount, so a file triggered by many
+// voices is decoded once. When they take more than the memory budget, the
+// least recently used ones that no voice is playing are dropped.
+//
+//   SamplePool pool;
+//   pool.preload("piece/");                  // Before playback
+//   PooledSoundFile file;
+//   file.open(pool, "piece/TRACK A.wav");     // onTriggerOn(), no I/O
+//   file.read(buffer, frames);               // Audio thread
+//   file.stop();                             // onTriggerOff(), any thread
+//   file.close();                            // onFree(), wait-free
+//
+// Files that weren't preloaded are loaded when first opened and stream from
+// the pool's thread until then, starting with silence.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "al/io/al_File.hpp"
+
+#include "MappedSoundFile.h"
+
+class SamplePool {
+public:
+  /// The decoded beginning of a sound file
+  struct Sample {
+    std::string path;
+    int channels{0}; // 0 if the file couldn't be opened
+    double frameRate{0};
+    int64_t frames{0};       // Of the whole file
+    std::vector<float> head; // First frames, interleaved
+
+    int64_t headFrames() const {
+      return channels > 0 ? int64_t(head.size()) / channels : 0;
+    }
+    size_t bytes() const { return head.size() * sizeof(float); }
+  };
+
+  /// The rest of a file, opened on the pool's thread
+  struct Stream {
+    MappedSoundFile file;
+    std::atomic<bool> ready{false};
+    std::atomic<bool> cancelled{false};
+  };
+
+  /**
+   * @param budgetBytes memory for decoded beginnings, exceeded only by
+   * files in use
+   * @param headSeconds seconds decoded at the beginning of each file
+   */
+  SamplePool(size_t budgetBytes = size_t(1) << 30, double headSeconds = 4.0)
+      : mBudget(budgetBytes), mHeadSeconds(headSeconds) {
+    mThread = std::thread(&SamplePool::workerLoop, this);
+  }
+
+  ~SamplePool() {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mRunning = false;
+    }
+    mWake.notify_all();
+    mThread.join();
+  }
+
+  SamplePool(const SamplePool &) = delete;
+  SamplePool &operator=(const SamplePool &) = delete;
+
+  /**
+   * @brief Load the files referenced by the sequences in directory
+   *
+   * Reads every .synthSequence file and loads the sound file named by the
+   * first quoted field of each '@' line, relative to directory. Returns
+   * immediately.
+   */
+  void preload(const std::string &directory) {
+    std::string root = al::File::conformDirectory(directory);
+    schedule(mBackground, [this, root]() {
+      std::set<std::string> paths;
+      auto sequences = al::filterInDir(root, [](const al::FilePath &f) {
+        return al::checkExtension(f, ".synthSequence");
+      });
+      for (const auto &sequence : sequences) {
+        referencedFiles(sequence.filepath(), root, paths);
+      }
+      for (const auto &path : paths) {
+        load(path);
+      }
+    });
+  }
+
+  /// Load path in the background unless it is loaded or loading
+  void load(const std::string &path) {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      if (mIndex.count(path) || !mLoading.insert(path).second) {
+        return;
+      }
+    }
+    schedule(mBackground, [this, path]() { decode(path); });
+  }
+
+  /**
+   * @brief The loaded beginning of path, without I/O
+   *
+   * Returns nullptr and loads it in the background if it isn't loaded. The
+   * sample stays in the pool while the returned pointer is held.
+   */
+  std::shared_ptr<const Sample> acquire(const std::string &path) {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      auto entry = mIndex.find(path);
+      if (entry != mIndex.end()) {
+        mLru.splice(mLru.begin(), mLru, entry->second);
+        return *entry->second;
+      }
+    }
+    load(path);
+    return nullptr;
+  }
+
+  /// Open path and seek to frame on the pool's thread
+  std::shared_ptr<Stream> openStream(const std::string &path, int64_t frame) {
+    auto stream = std::make_shared<Stream>();
+    schedule(mUrgent, [stream, path, frame]() {
+      if (stream->cancelled.load(std::memory_order_acquire)) {
+        return;
+      }
+      if (stream->file.open(path)) {
+        stream->file.seek(frame);
+        stream->ready.store(true, std::memory_order_release);
+      }
+    });
+    return stream;
+  }
+
+  /**
+   * @brief Release a voice's stream and sample on the pool's thread
+   *
+   * Wait-free and doesn't allocate, so it can be called from the audio
+   * thread. The pool's thread releases them within kRetirePeriod. If
+   * kRetireSlots are waiting already, falls back to dispose(), which locks.
+   */
+  void retire(std::shared_ptr<Stream> &stream,
+              std::shared_ptr<const Sample> &sample) {
+    if (stream) {
+      stream->cancelled.store(true, std::memory_order_release);
+    }
+    if (!stream && !sample) {
+      return;
+    }
+    for (int i = 0; i < kRetireSlots; i++) {
+      Retired &slot =
+          mRetired[mRetireNext.fetch_add(1, std::memory_order_relaxed) %
+                   kRetireSlots];
+      int expected = kSlotEmpty;
+      if (slot.state.compare_exchange_strong(expected, kSlotWriting,
+                                             std::memory_order_acquire)) {
+        slot.stream = std::move(stream);
+        slot.sample = std::move(sample);
+        slot.state.store(kSlotFull, std::memory_order_release);
+        return;
+      }
+    }
+    dispose(stream);
+    sample.reset();
+  }
+
+  /// Close a stream on the pool's thread, so the caller doesn't block
+  void dispose(std::shared_ptr<Stream> &stream) {
+    if (!stream) {
+      return;
+    }
+    stream->cancelled.store(true, std::memory_order_release);
+    std::shared_ptr<Stream> last = std::move(stream);
+    schedule(mUrgent, [last]() {});
+  }
+
+  /// Memory taken by decoded beginnings
+  size_t bytes() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mBytes;
+  }
+  size_t budget() const { return mBudget; }
+
+  /// Files loaded, and files waiting to be loaded
+  int loaded() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return int(mLru.size());
+  }
+  int loading() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return int(mLoading.size());
+  }
+
+  /// Milliseconds a retired stream may wait for the pool's thread
+  static const int kRetirePeriod = 50;
+  static const int kRetireSlots = 256;
+
+private:
+  typedef std::deque<std::function<void()>> Jobs;
+
+  // A stream and sample handed over by retire()
+  enum { kSlotEmpty, kSlotWriting, kSlotFull };
+  struct Retired {
+    std::atomic<int> state{kSlotEmpty};
+    std::shared_ptr<Stream> stream;
+    std::shared_ptr<const Sample> sample;
+  };
+
+  // Sound files named by a sequence, the first quoted field of '@' lines
+  static void referencedFiles(const std::string &sequence,
+                              const std::string &root,
+                              std::set<std::string> &paths) {
+    std::ifstream in(sequence);
+    std::string line;
+    while (std::getline(in, line)) {
+      size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos || line[start] != '@') {
+        continue;
+      }
+      size_t open = line.find('"', start);
+      size_t close =
+          open == std::string::npos ? open : line.find('"', open + 1);
+      if (close != std::string::npos && close > open + 1) {
+        paths.insert(al::File::conformPathToOS(root) +
+                     line.substr(open + 1, close - open - 1));
+      }
+    }
+  }
+
+  // Pool thread
+  void decode(const std::string &path) {
+    auto sample = std::make_shared<Sample>();
+    sample->path = path;
+    MappedSoundFile file;
+    if (file.open(path)) {
+      sample->channels = file.channels();
+      sample->frameRate = file.frameRate();
+      sample->frames = file.frames();
+      int64_t frames = std::min(
+          sample->frames, int64_t(mHeadSeconds * sample->frameRate + 0.5));
+      sample->head.resize(size_t(frames) * sample->channels);
+      int64_t done = 0;
+      int waits = 0;
+      while (done < frames) {
+        size_t count = file.read(
+            sample->head.data() + size_t(done) * sample->channels,
+            int(std::min<int64_t>(frames - done, 65536)));
+        if (count > 0) {
+          done += int64_t(count);
+          waits = 0;
+        } else if (file.mapped() || ++waits > 500) {
+          break;
+        } else {
+          // SoundFileBuffered is still filling
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+      }
+      sample->head.resize(size_t(done) * sample->channels);
+      sample->head.shrink_to_fit();
+    } else {
+      std::cerr << "ERROR: preloading sound file: " << path << std::endl;
+    }
+    file.close();
+
+    std::vector<std::shared_ptr<const Sample>> evicted;
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mLoading.erase(path);
+      mLru.push_front(sample);
+      mIndex[path] = mLru.begin();
+      mBytes += sample->bytes();
+      // Least recently used first, skipping samples held by voices. Files
+      // that failed take no memory and are kept to not try them again.
+      for (auto entry = mLru.end();
+           mBytes > mBudget && entry != mLru.begin();) {
+        --entry;
+        if (entry->use_count() == 1 && *entry != sample &&
+            (*entry)->bytes() > 0) {
+          mBytes -= (*entry)->bytes();
+          mIndex.erase((*entry)->path);
+          evicted.push_back(std::move(*entry));
+          entry = mLru.erase(entry);
+        }
+      }
+    }
+    // Freed here, outside the lock
+  }
+
+  void schedule(Jobs &jobs, std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      jobs.push_back(std::move(job));
+    }
+    mWake.notify_one();
+  }
+
+  // Pool thread: close what retire() handed over
+  void releaseRetired() {
+    for (Retired &slot : mRetired) {
+      if (slot.state.load(std::memory_order_acquire) != kSlotFull) {
+        continue;
+      }
+      std::shared_ptr<Stream> stream = std::move(slot.stream);
+      std::shared_ptr<const Sample> sample = std::move(slot.sample);
+      slot.state.store(kSlotEmpty, std::memory_order_release);
+    }
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (mRunning) {
+      lock.unlock();
+      releaseRetired();
+      lock.lock();
+      // Streams for playing voices go before loading ahead
+      Jobs &jobs = !mUrgent.empty() ? mUrgent : mBackground;
+      if (jobs.empty()) {
+        // retire() doesn't wake the thread, look again after a while
+        mWake.wait_for(lock, std::chrono::milliseconds(int(kRetirePeriod)));
+        continue;
+      }
+      std::function<void()> job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      job();
+      job = nullptr;
+      lock.lock();
+    }
+    // Release what's left outside the lock
+    Jobs urgent, background;
+    urgent.swap(mUrgent);
+    background.swap(mBackground);
+    lock.unlock();
+  }
+
+  size_t mBudget;
+  double mHeadSeconds;
+
+  mutable std::mutex mLock;
+  std::condition_variable mWake;
+  bool mRunning{true};
+  Jobs mUrgent;
+  Jobs mBackground;
+  std::list<std::shared_ptr<const Sample>> mLru; // Most recently used first
+  std::unordered_map<std::string,
+                     std::list<std::shared_ptr<const Sample>>::iterator>
+      mIndex;
+  std::set<std::string> mLoading;
+  size_t mBytes{0};
+  Retired mRetired[kRetireSlots];
+  std::atomic<unsigned> mRetireNext{0};
+  std::thread mThread;
+};
+
+/**
+ * @brief Plays a file from a SamplePool
+ *
+ * The beginning comes from memory, the rest from a MappedSoundFile opened
+ * on the pool's thread. open() and close() don't touch the disk. If the
+ * stream isn't open by the end of the beginning, read() plays silence and
+ * the stream catches up with the play head once it is.
+ *
+ * open() and close() must not run while read() may, so a voice closes the
+ * file once it is no longer rendered. stop() can be called from any thread.
+ */
+class PooledSoundFile {
+public:
+  PooledSoundFile() {}
+  ~PooledSoundFile() { close(); }
+
+  PooledSoundFile(const PooledSoundFile &) = delete;
+  PooledSoundFile &operator=(const PooledSoundFile &) = delete;
+
+  /**
+   * @brief Start playing path from the beginning
+   *
+   * Returns false if the pool already failed to open path.
+   */
+  bool open(SamplePool &pool, const std::string &path) {
+    close();
+    mStopped.store(false, std::memory_order_relaxed);
+    mPool = &pool;
+    mSample = pool.acquire(path);
+    mPosition = 0;
+    if (mSample && mSample->channels == 0) {
+      mSample.reset();
+      return false;
+    }
+    int64_t start = mSample ? mSample->headFrames() : 0;
+    if (!mSample || start < mSample->frames) {
+      mStream = pool.openStream(path, start);
+      mStreamPosition = start;
+    }
+    return true;
+  }
+
+  /// Wait-free, the stream is closed on the pool's thread
+  void close() {
+    if (mPool) {
+      mPool->retire(mStream, mSample);
+    }
+    mSample.reset();
+    mPool = nullptr;
+  }
+
+  bool opened() const { return mPool != nullptr; }
+
+  /// read() returns 0 from now on, until the next open(). Wait-free.
+  void stop() { mStopped.store(true, std::memory_order_release); }
+
+  /// Read up to frames interleaved frames into buffer
+  size_t read(float *buffer, int frames) {
+    if (mStopped.load(std::memory_order_acquire)) {
+      return 0;
+    }
+    if (!mSample) {
+      // Not loaded yet, the stream alone
+      if (!streamReady()) {
+        return 0;
+      }
+      size_t count = mStream->file.read(buffer, frames);
+      mPosition += int64_t(count);
+      return count;
+    }
+    int channels = mSample->channels;
+    int64_t end = std::min<int64_t>(mPosition + frames, mSample->frames);
+    int done = 0;
+    int64_t headFrames = mSample->headFrames();
+    if (mPosition < headFrames) {
+      int count = int(std::min(end, headFrames) - mPosition);
+      std::memcpy(buffer, mSample->head.data() + size_t(mPosition) * channels,
+                  size_t(count) * channels * sizeof(float));
+      mPosition += count;
+      done += count;
+    }
+    if (mPosition < end) {
+      int count = int(end - mPosition);
+      float *out = buffer + size_t(done) * channels;
+      size_t read = 0;
+      if (streamReady()) {
+        if (mStreamPosition != mPosition) {
+          mStream->file.seek(mPosition); // Was late
+        }
+        read = mStream->file.read(out, count);
+        mStreamPosition = mPosition + int64_t(read);
+      }
+      std::fill(out + read * channels, out + size_t(count) * channels, 0.0f);
+      mPosition += count;
+      done += count;
+    }
+    return size_t(done);
+  }
+
+  /// 0 until known
+  int channels() const {
+    if (mSample) {
+      return mSample->channels;
+    }
+    return mStream && mStream->ready.load(std::memory_order_acquire)
+               ? mStream->file.channels()
+               : 0;
+  }
+
+  int64_t currentPosition() const { return mPosition; }
+
+private:
+  bool streamReady() const {
+    return mStream && mStream->ready.load(std::memory_order_acquire);
+  }
+
+  SamplePool *mPool{nullptr};
+  std::shared_ptr<const SamplePool::Sample> mSample;
+  std::shared_ptr<SamplePool::Stream> mStream;
+  int64_t mPosition{0};
+  int64_t mStreamPosition{0};
+  std::atomic<bool> mStopped{false};
+};
+
+#endif // SamplePool_H
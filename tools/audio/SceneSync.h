@@ -0,0 +1,667 @@
+#pragma once
+#ifndef SceneSync_H
+#define SceneSync_H
+
+// Scene voice state sent to the renderers as one binary packet per frame.
+//
+// DistributedScene sends every registered voice parameter as its own OSC
+// message when it changes, and some change every frame for every voice, such
+// as a voice's envelope level or its pose while it moves. Each message
+// spells out its address and pays for its own UDP packet. SceneSync gathers
+// a frame's changes of all voices into packets of at most 1400 bytes
+// instead. Each voice that changed gets a record of its id, a mask of what
+// changed and the changed values only. Positions are 16-bit fixed point,
+// orientations take 32 bits ("smallest three"), and other values 8 or 16
+// bits within their range. A value is only sent when it has moved by more
+// than its tolerance from what the renderers last got.
+//
+// Values are sent whole, not as differences, so a lost packet only delays a
+// change. Every voice is also sent in full once every refreshFrames frames,
+// so renderers that missed something or joined late catch up. Packets carry
+// their frame number, and renderers keep the frame each value of a voice
+// was last set from, so a packet that arrives late can't undo a newer value.
+// Records for a voice that isn't active on a renderer yet, as right after
+// its trigger, are kept until it is, for up to kPendingFrames frames.
+//
+//   SceneSync sync;
+//   sync.codec().addField(0.0f, 4.0f);   // gain, field 0
+//   sync.receive(parameterServer());     // renderers, in onInit()
+//   // in onAnimate(), on the primary:
+//   sync.send(scene.getActiveVoices(), parameterServer());
+//   // and on the renderers:
+//   sync.apply(scene.getActiveVoices());
+//
+// The pose of PositionedVoices is always sent. Other values come from voices
+// that are also SyncedVoices, in the order of the fields. Such parameters
+// shouldn't be registered with registerParameters() as well.
+//
+// SceneStateCodec does the encoding and decoding without allolib's OSC, as
+// used by scene_sync_benchmark.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "al/protocol/al_OSC.hpp"
+#include "al/scene/al_SynthVoice.hpp"
+#include "al/ui/al_ParameterServer.hpp"
+
+/// Values of a voice, quantized as the renderers get them
+struct SceneVoiceState {
+  static const int kMaxFields = 16;
+
+  float position[3]{0.0f, 0.0f, 0.0f};
+  float quat[4]{1.0f, 0.0f, 0.0f, 0.0f}; // w, x, y, z
+  float values[kMaxFields]{};
+};
+
+/// Encodes frames of voice states into packets and decodes them
+class SceneStateCodec {
+public:
+  /// Bits of a record's mask, then kField << i for field i
+  enum Changed : uint32_t { kPosition = 1, kOrientation = 2, kField = 4 };
+
+  /**
+   * @param positionRange positions are sent within +-positionRange
+   * @param positionTolerance distance a voice moves before it is sent
+   * @param angleTolerance degrees a voice turns before it is sent
+   * @param refreshFrames frames between sending each voice in full, 0 never
+   * @param maxPacketBytes packet size, below the network's MTU
+   */
+  SceneStateCodec(float positionRange = 16.0f,
+                  float positionTolerance = 0.001f,
+                  float angleTolerance = 0.2f, int refreshFrames = 60,
+                  size_t maxPacketBytes = 1400)
+      : mPositionRange(positionRange), mPositionTolerance(positionTolerance),
+        mRefreshFrames(refreshFrames), mMaxPacketBytes(maxPacketBytes) {
+    mCosHalfAngle =
+        float(std::cos(angleTolerance * M_PI / 180.0 / 2.0));
+  }
+
+  /**
+   * @brief Add a value sent with each voice, returns its field index
+   *
+   * @param tolerance change before the value is sent, at least one step
+   * @param bits 8 or 16
+   */
+  int addField(float min, float max, float tolerance = 0.0f, int bits = 16) {
+    if (int(mFields.size()) >= SceneVoiceState::kMaxFields) {
+      return -1;
+    }
+    mFields.push_back({min, max, tolerance, bits == 8 ? 8 : 16});
+    return int(mFields.size()) - 1;
+  }
+  int fields() const { return int(mFields.size()); }
+
+  // Primary, once per frame: beginFrame(), addVoice() for each voice, then
+  // endFrame() and send each packet.
+
+  void beginFrame() {
+    mFrame++;
+    mData.clear();
+    mPacketEnds.clear();
+    mRecords = 0;
+  }
+
+  /**
+   * @brief Add a voice's values if they changed, quat as w, x, y, z
+   *
+   * values holds fields() values, or is nullptr if the voice has none.
+   */
+  void addVoice(uint32_t id, const float *position, const float *quat,
+                const float *values) {
+    Sent &sent = mSent[id];
+    bool refresh =
+        sent.frame == 0 ||
+        (mRefreshFrames > 0 && (id + mFrame) % uint32_t(mRefreshFrames) == 0);
+    sent.frame = mFrame;
+    uint32_t changed = 0;
+    SceneVoiceState &state = sent.state;
+
+    int16_t p[3];
+    float dx = 0.0f;
+    for (int i = 0; i < 3; i++) {
+      p[i] = quantizePosition(position[i]);
+      float d = position[i] - state.position[i];
+      dx += d * d;
+    }
+    if (refresh || (dx > mPositionTolerance * mPositionTolerance &&
+                    std::memcmp(p, sent.position, sizeof(p)) != 0)) {
+      changed |= kPosition;
+      std::memcpy(sent.position, p, sizeof(p));
+      for (int i = 0; i < 3; i++) {
+        state.position[i] = dequantizePosition(p[i]);
+      }
+    }
+
+    float dot = 0.0f;
+    for (int i = 0; i < 4; i++) {
+      dot += quat[i] * state.quat[i];
+    }
+    uint32_t q = packQuat(quat);
+    if (refresh || (std::fabs(dot) < mCosHalfAngle && q != sent.quat)) {
+      changed |= kOrientation;
+      sent.quat = q;
+      unpackQuat(q, state.quat);
+    }
+
+    uint16_t f[SceneVoiceState::kMaxFields];
+    int numFields = values ? int(mFields.size()) : 0;
+    for (int i = 0; i < numFields; i++) {
+      f[i] = quantizeField(i, values[i]);
+      if (refresh || (f[i] != sent.fields[i] &&
+                      std::fabs(values[i] - state.values[i]) >
+                          mFields[i].tolerance)) {
+        changed |= kField << i;
+        sent.fields[i] = f[i];
+        state.values[i] = dequantizeField(i, f[i]);
+      }
+    }
+
+    if (changed) {
+      writeRecord(id, changed, p, q, f, numFields);
+    }
+  }
+
+  /// Finish the frame's packets and forget voices that weren't added
+  void endFrame() {
+    if (mRecords > 0) {
+      finishPacket();
+    }
+    for (auto entry = mSent.begin(); entry != mSent.end();) {
+      if (entry->second.frame != mFrame) {
+        entry = mSent.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+  }
+
+  /// Packets of the last frame, none if nothing changed
+  int packets() const { return int(mPacketEnds.size()); }
+  const uint8_t *packetData(int i) const {
+    return mData.data() + (i > 0 ? mPacketEnds[i - 1] : 0);
+  }
+  size_t packetSize(int i) const {
+    return mPacketEnds[i] - (i > 0 ? mPacketEnds[i - 1] : 0);
+  }
+  /// Bytes of all packets of the last frame
+  size_t bytes() const { return mPacketEnds.empty() ? 0 : mPacketEnds.back(); }
+
+  /**
+   * @brief Renderers: decode a packet
+   *
+   * Calls apply(uint32_t id, uint32_t changed, const SceneVoiceState &) for
+   * each record, where changed has the kPosition, kOrientation and kField
+   * bits of the values the record holds. Returns false if the packet is
+   * malformed, after applying the records before the error.
+   */
+  template <class Apply>
+  bool decode(const uint8_t *data, size_t size, Apply &&apply) const {
+    const uint8_t *end = data + size;
+    if (size < kHeaderBytes || data[0] != kMagic || data[1] != kVersion) {
+      return false;
+    }
+    int records = int(data[6] | (data[7] << 8));
+    const uint8_t *p = data + kHeaderBytes;
+    SceneVoiceState state;
+    for (int r = 0; r < records; r++) {
+      uint32_t id, changed;
+      if (!readVarint(p, end, id) || !readVarint(p, end, changed)) {
+        return false;
+      }
+      if (changed & kPosition) {
+        if (end - p < 6) {
+          return false;
+        }
+        for (int i = 0; i < 3; i++) {
+          state.position[i] =
+              dequantizePosition(int16_t(uint16_t(p[0] | (p[1] << 8))));
+          p += 2;
+        }
+      }
+      if (changed & kOrientation) {
+        if (end - p < 4) {
+          return false;
+        }
+        unpackQuat(uint32_t(p[0]) | (uint32_t(p[1]) << 8) |
+                       (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24),
+                   state.quat);
+        p += 4;
+      }
+      for (int i = 0; i < int(mFields.size()); i++) {
+        if (!(changed & (kField << i))) {
+          continue;
+        }
+        int bytes = mFields[i].bits / 8;
+        if (end - p < bytes) {
+          return false;
+        }
+        uint16_t value = bytes == 1 ? p[0] : uint16_t(p[0] | (p[1] << 8));
+        state.values[i] = dequantizeField(i, value);
+        p += bytes;
+      }
+      apply(id, changed, state);
+    }
+    return true;
+  }
+
+  /// Frames encoded so far
+  uint32_t frame() const { return mFrame; }
+
+  /// Renderers: the frame a packet was encoded in. False if malformed.
+  static bool packetFrame(const uint8_t *data, size_t size, uint32_t &frame) {
+    if (size < kHeaderBytes || data[0] != kMagic || data[1] != kVersion) {
+      return false;
+    }
+    frame = uint32_t(data[2]) | (uint32_t(data[3]) << 8) |
+            (uint32_t(data[4]) << 16) | (uint32_t(data[5]) << 24);
+    return true;
+  }
+
+private:
+  static const uint8_t kMagic = 0x53;
+  static const uint8_t kVersion = 1;
+  static const size_t kHeaderBytes = 8; // magic, version, frame, records
+  static const size_t kMaxRecordBytes =
+      5 + 5 + 6 + 4 + 2 * SceneVoiceState::kMaxFields;
+
+  struct Field {
+    float min;
+    float max;
+    float tolerance;
+    int bits;
+  };
+
+  // What the renderers last got of a voice
+  struct Sent {
+    uint32_t frame{0}; // Last frame the voice was added, 0 if new
+    int16_t position[3]{0, 0, 0};
+    uint32_t quat{0};
+    uint16_t fields[SceneVoiceState::kMaxFields]{};
+    SceneVoiceState state;
+  };
+
+  int16_t quantizePosition(float x) const {
+    float scaled = std::round(x / mPositionRange * 32767.0f);
+    return int16_t(std::min(32767.0f, std::max(-32767.0f, scaled)));
+  }
+  float dequantizePosition(int16_t q) const {
+    return q * (mPositionRange / 32767.0f);
+  }
+
+  uint16_t quantizeField(int i, float value) const {
+    const Field &field = mFields[i];
+    float steps = field.bits == 8 ? 255.0f : 65535.0f;
+    float f = (value - field.min) / (field.max - field.min);
+    return uint16_t(std::lround(std::min(1.0f, std::max(0.0f, f)) * steps));
+  }
+  float dequantizeField(int i, uint16_t q) const {
+    const Field &field = mFields[i];
+    float steps = field.bits == 8 ? 255.0f : 65535.0f;
+    return field.min + (field.max - field.min) * (q / steps);
+  }
+
+  // Two bits for the largest component, ten for each of the others
+  static uint32_t packQuat(const float *quat) {
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+      if (std::fabs(quat[i]) > std::fabs(quat[largest])) {
+        largest = i;
+      }
+    }
+    float norm = std::sqrt(quat[0] * quat[0] + quat[1] * quat[1] +
+                           quat[2] * quat[2] + quat[3] * quat[3]);
+    float sign = quat[largest] < 0.0f ? -1.0f : 1.0f;
+    float scale = norm > 0.0f ? sign / norm : 1.0f;
+    uint32_t packed = uint32_t(largest) << 30;
+    int shift = 20;
+    for (int i = 0; i < 4; i++) {
+      if (i == largest) {
+        continue;
+      }
+      float c = quat[i] * scale * float(M_SQRT2); // -1 to 1
+      long q = std::lround((std::min(1.0f, std::max(-1.0f, c)) + 1.0f) *
+                           511.5f);
+      packed |= uint32_t(q) << shift;
+      shift -= 10;
+    }
+    return packed;
+  }
+  static void unpackQuat(uint32_t packed, float *quat) {
+    int largest = int(packed >> 30);
+    int shift = 20;
+    float squares = 0.0f;
+    for (int i = 0; i < 4; i++) {
+      if (i == largest) {
+        continue;
+      }
+      float c = ((packed >> shift) & 1023) / 511.5f - 1.0f;
+      quat[i] = c * float(M_SQRT1_2);
+      squares += quat[i] * quat[i];
+      shift -= 10;
+    }
+    quat[largest] = std::sqrt(std::max(0.0f, 1.0f - squares));
+  }
+
+  static void writeVarint(std::vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+      out.push_back(uint8_t(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+  }
+  static bool readVarint(const uint8_t *&p, const uint8_t *end,
+                         uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (p >= end) {
+        return false;
+      }
+      uint8_t byte = *p++;
+      value |= uint32_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void writeRecord(uint32_t id, uint32_t changed, const int16_t *position,
+                   uint32_t quat, const uint16_t *fields, int numFields) {
+    size_t packetStart = mPacketEnds.empty() ? 0 : mPacketEnds.back();
+    if (mRecords > 0 &&
+        mData.size() - packetStart + kMaxRecordBytes > mMaxPacketBytes) {
+      finishPacket();
+      packetStart = mData.size();
+    }
+    if (mRecords == 0) {
+      // Header, the record count is filled in by finishPacket()
+      uint8_t header[kHeaderBytes] = {kMagic,
+                                      kVersion,
+                                      uint8_t(mFrame),
+                                      uint8_t(mFrame >> 8),
+                                      uint8_t(mFrame >> 16),
+                                      uint8_t(mFrame >> 24),
+                                      0,
+                                      0};
+      mData.insert(mData.end(), header, header + kHeaderBytes);
+    }
+    writeVarint(mData, id);
+    writeVarint(mData, changed);
+    if (changed & kPosition) {
+      for (int i = 0; i < 3; i++) {
+        uint16_t u = uint16_t(position[i]);
+        mData.push_back(uint8_t(u));
+        mData.push_back(uint8_t(u >> 8));
+      }
+    }
+    if (changed & kOrientation) {
+      for (int shift = 0; shift < 32; shift += 8) {
+        mData.push_back(uint8_t(quat >> shift));
+      }
+    }
+    for (int i = 0; i < numFields; i++) {
+      if (changed & (kField << i)) {
+        mData.push_back(uint8_t(fields[i]));
+        if (mFields[i].bits == 16) {
+          mData.push_back(uint8_t(fields[i] >> 8));
+        }
+      }
+    }
+    mRecords++;
+  }
+
+  void finishPacket() {
+    size_t packetStart = mPacketEnds.empty() ? 0 : mPacketEnds.back();
+    mData[packetStart + 6] = uint8_t(mRecords);
+    mData[packetStart + 7] = uint8_t(mRecords >> 8);
+    mPacketEnds.push_back(mData.size());
+    mRecords = 0;
+  }
+
+  float mPositionRange;
+  float mPositionTolerance;
+  float mCosHalfAngle;
+  int mRefreshFrames;
+  size_t mMaxPacketBytes;
+  std::vector<Field> mFields;
+
+  // Primary
+  uint32_t mFrame{0};
+  std::unordered_map<uint32_t, Sent> mSent;
+  std::vector<uint8_t> mData; // Packets of this frame, back to back
+  std::vector<size_t> mPacketEnds;
+  int mRecords{0}; // In the packet being written
+};
+
+/// A voice with values for SceneSync besides its pose
+class SyncedVoice {
+public:
+  virtual ~SyncedVoice() {}
+
+  /// Primary: write the values of the SceneSync fields, in their order
+  virtual void syncValues(float *values) = 0;
+
+  /// Renderers: set the fields whose bit (1 << field) is in changed
+  virtual void setSyncValues(const float *values, uint32_t changed) = 0;
+};
+
+/// Sends SceneStateCodec packets from the primary to the renderers over OSC
+class SceneSync : public al::osc::PacketHandler {
+public:
+  /// Frames a record waits for its voice before it is dropped
+  static const int kPendingFrames = 120;
+  /// A packet this many frames older than the newest means a new primary
+  static const int kRestartFrames = 600;
+
+  SceneSync(const std::string &address = "/sceneSync") : mAddress(address) {}
+
+  /// Add fields before the first send() or apply()
+  SceneStateCodec &codec() { return mCodec; }
+
+  /// Primary, once per frame: send the changes of the voices in a list
+  void send(al::SynthVoice *voices, al::ParameterServer &server) {
+    mCodec.beginFrame();
+    float values[SceneVoiceState::kMaxFields];
+    for (al::SynthVoice *voice = voices; voice; voice = voice->next) {
+      auto *positioned = dynamic_cast<al::PositionedVoice *>(voice);
+      if (!positioned || !voice->active()) {
+        continue;
+      }
+      al::Pose pose = positioned->pose();
+      float position[3] = {float(pose.x()), float(pose.y()), float(pose.z())};
+      float quat[4] = {float(pose.quat().w), float(pose.quat().x),
+                       float(pose.quat().y), float(pose.quat().z)};
+      auto *synced = dynamic_cast<SyncedVoice *>(voice);
+      if (synced) {
+        synced->syncValues(values);
+      }
+      mCodec.addVoice(uint32_t(voice->id()), position, quat,
+                      synced ? values : nullptr);
+    }
+    mCodec.endFrame();
+    for (int i = 0; i < mCodec.packets(); i++) {
+      al::osc::Packet packet(int(mCodec.packetSize(i)) + 64);
+      packet.beginMessage(mAddress);
+      packet << al::osc::Blob(mCodec.packetData(i),
+                              int(mCodec.packetSize(i)));
+      packet.endMessage();
+      server.send(packet);
+    }
+  }
+
+  /// Renderers: get packets through the server
+  void receive(al::ParameterServer &server) {
+    server.registerOSCListener(this);
+  }
+
+  /// Renderers, graphics thread: apply the packets received since the last
+  /// call to the voices in a list
+  void apply(al::SynthVoice *voices) {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mApplying.swap(mReceived);
+    }
+    mVoices.clear();
+    for (al::SynthVoice *voice = voices; voice; voice = voice->next) {
+      mVoices[uint32_t(voice->id())] = voice;
+    }
+    for (const auto &packet : mApplying) {
+      uint32_t frame;
+      if (!SceneStateCodec::packetFrame(packet.data(), packet.size(),
+                                        frame)) {
+        continue;
+      }
+      if (mNewestFrame != 0 &&
+          int32_t(frame - mNewestFrame) < -kRestartFrames) {
+        // The primary started over, its frames are not older
+        mApplied.clear();
+        mPending.clear();
+        mNewestFrame = frame;
+      } else if (mNewestFrame == 0 || int32_t(frame - mNewestFrame) > 0) {
+        mNewestFrame = frame;
+      }
+      mCodec.decode(packet.data(), packet.size(),
+                    [this, frame](uint32_t id, uint32_t changed,
+                                  const SceneVoiceState &state) {
+                      merge(id, frame, changed, state);
+                    });
+    }
+    mApplying.clear();
+
+    for (auto entry = mPending.begin(); entry != mPending.end();) {
+      auto voice = mVoices.find(entry->first);
+      if (voice != mVoices.end()) {
+        Record &pending = entry->second;
+        applyRecord(voice->second, pending.changed, pending.state);
+        Record &applied = mApplied[entry->first];
+        for (int c = 0; c < kComponents; c++) {
+          if (pending.changed & (1u << c)) {
+            applied.frames[c] = pending.frames[c];
+          }
+        }
+        applied.changed |= pending.changed;
+        entry = mPending.erase(entry);
+      } else if (int32_t(mNewestFrame - entry->second.frame) >
+                 kPendingFrames) {
+        entry = mPending.erase(entry); // The voice never came
+      } else {
+        ++entry;
+      }
+    }
+    // Forget voices that ended
+    for (auto entry = mApplied.begin(); entry != mApplied.end();) {
+      if (!mVoices.count(entry->first)) {
+        entry = mApplied.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+  }
+
+  /// Bytes sent in the last frame
+  size_t bytes() const { return mCodec.bytes(); }
+
+  // OSC thread
+  void onMessage(al::osc::Message &m) override {
+    if (m.addressPattern() != mAddress || m.typeTags() != "b") {
+      return;
+    }
+    al::osc::Blob blob;
+    m >> blob;
+    const uint8_t *data = static_cast<const uint8_t *>(blob.data);
+    std::lock_guard<std::mutex> lock(mLock);
+    mReceived.emplace_back(data, data + blob.size);
+  }
+
+private:
+  // Position, orientation, then the fields, as the bits of a record's mask
+  static const int kComponents = 2 + SceneVoiceState::kMaxFields;
+
+  // Values of a voice with the frame each was sent in
+  struct Record {
+    uint32_t frame{0}; // Newest frame merged, for dropping pending records
+    uint32_t changed{0};
+    uint32_t frames[kComponents]{};
+    SceneVoiceState state;
+  };
+
+  // Keep the values of a record that are newer than what was applied or is
+  // pending already
+  void merge(uint32_t id, uint32_t frame, uint32_t changed,
+             const SceneVoiceState &state) {
+    auto applied = mApplied.find(id);
+    Record &pending = mPending[id];
+    for (int c = 0; c < kComponents; c++) {
+      uint32_t bit = 1u << c;
+      if (!(changed & bit)) {
+        continue;
+      }
+      if (applied != mApplied.end() && (applied->second.changed & bit) &&
+          int32_t(frame - applied->second.frames[c]) <= 0) {
+        continue;
+      }
+      if ((pending.changed & bit) &&
+          int32_t(frame - pending.frames[c]) <= 0) {
+        continue;
+      }
+      pending.changed |= bit;
+      pending.frames[c] = frame;
+      if (bit == SceneStateCodec::kPosition) {
+        std::copy(state.position, state.position + 3, pending.state.position);
+      } else if (bit == SceneStateCodec::kOrientation) {
+        std::copy(state.quat, state.quat + 4, pending.state.quat);
+      } else {
+        pending.state.values[c - 2] = state.values[c - 2];
+      }
+    }
+    if (pending.changed == 0) {
+      mPending.erase(id); // Nothing newer
+    } else if (pending.frame == 0 || int32_t(frame - pending.frame) > 0) {
+      pending.frame = frame;
+    }
+  }
+
+  static void applyRecord(al::SynthVoice *voice, uint32_t changed,
+                          const SceneVoiceState &state) {
+    auto *positioned = dynamic_cast<al::PositionedVoice *>(voice);
+    if (positioned && (changed & (SceneStateCodec::kPosition |
+                                  SceneStateCodec::kOrientation))) {
+      al::Pose pose = positioned->pose();
+      if (changed & SceneStateCodec::kPosition) {
+        pose.pos() = al::Vec3d(state.position[0], state.position[1],
+                               state.position[2]);
+      }
+      if (changed & SceneStateCodec::kOrientation) {
+        pose.quat() = al::Quatd(state.quat[0], state.quat[1], state.quat[2],
+                                state.quat[3]);
+      }
+      positioned->setPose(pose);
+    }
+    auto *synced = dynamic_cast<SyncedVoice *>(voice);
+    uint32_t fields = changed / SceneStateCodec::kField;
+    if (synced && fields) {
+      synced->setSyncValues(state.values, fields);
+    }
+  }
+
+  std::string mAddress;
+  SceneStateCodec mCodec;
+  std::mutex mLock;
+  std::vector<std::vector<uint8_t>> mReceived; // Guarded by mLock
+  std::vector<std::vector<uint8_t>> mApplying;
+
+  // Graphics thread
+  uint32_t mNewestFrame{0};
+  std::unordered_map<uint32_t, al::SynthVoice *> mVoices;
+  std::unordered_map<uint32_t, Record> mApplied; // Frames applied per voice
+  std::unordered_map<uint32_t, Record> mPending; // Not applied yet
+};
+
+#endif // SceneSync_H
@@ -0,0 +1,294 @@
+#pragma once
+#ifndef Transport_H
+#define Transport_H
+
+// Play, stop, seek and loop commands for multi-file playback, applied by the
+// audio thread.
+//
+// The players used to stop playback from the GUI thread, seek every file in
+// turn while the audio thread might still be reading them, and start again.
+// The files could resume at different frames and the audio glitched.
+//
+// A Transport takes commands from any thread (GUI, OSC, MIDI) and queues them
+// in a lock-free single-reader ring buffer. Writers are serialized by a mutex
+// that the audio thread never takes. At the start of each buffer the audio
+// thread collects the queued commands into at most two passes over all the
+// sources. A seek while playing becomes a pass that fades the old position
+// out and a pass that seeks every source to the same frame and fades in, so
+// the sources stay phase-locked and the jump is an equal-power crossfade.
+// Play and stop fade in and out the same way.
+//
+//   transport.seek(48000 * 60);   // any thread
+//
+//   void onSound(AudioIOData &io) override {
+//     transport.process(io.framesPerBuffer(), files[0].currentPosition());
+//     for (int p = 0; p < transport.passes(); p++) {
+//       const Transport::Pass &pass = transport.pass(p);
+//       for (auto &file : files) {
+//         pass.apply(file);                        // seek and loop
+//         if (pass.audible) {
+//           stream.mix(file, io, gain, mute, pass.envelope, pass.frames);
+//         }
+//       }
+//     }
+//   }
+//
+// TransportOSCHandler and TransportMIDIHandler feed a Transport from OSC
+// messages and MIDI start, continue and stop.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "al/io/al_MIDI.hpp"
+#include "al/protocol/al_OSC.hpp"
+#include "al/types/al_SingleRWRingBuffer.hpp"
+
+class Transport {
+public:
+  /// Work for the sources in one part of a buffer
+  struct Pass {
+    int64_t seek{-1}; ///< Frame to seek every source to first, or -1
+    int loop{-1};     ///< Loop setting for every source, or -1 to keep it
+    bool audible{false};
+    const float *envelope{nullptr}; ///< Per-frame gain, nullptr for 1
+    int frames{0};                  ///< Frames to mix
+
+    /// Apply seek and loop to a source
+    template <class TSource> void apply(TSource &source) const {
+      if (loop >= 0) {
+        source.loop(loop != 0);
+      }
+      if (seek >= 0) {
+        source.seek(seek);
+      }
+    }
+  };
+
+  /**
+   * @param fadeFrames length of the crossfade
+   * @param maxFrames largest audio buffer
+   * @param capacity commands that can be queued
+   */
+  Transport(int fadeFrames = 256, int maxFrames = 4096, size_t capacity = 256)
+      : mQueue(capacity * sizeof(Command)) {
+    mFadeFrames = std::max(1, std::min(fadeFrames, maxFrames));
+    mFadeIn.resize(maxFrames);
+    mFadeOut.resize(maxFrames);
+    for (int i = 0; i < maxFrames; i++) {
+      double x = std::min(1.0, (i + 0.5) / mFadeFrames);
+      mFadeIn[i] = float(std::sin(x * M_PI / 2.0));
+      mFadeOut[i] = float(std::cos(x * M_PI / 2.0));
+    }
+  }
+
+  // Commands, from any thread but the audio thread. They return false if the
+  // queue is full.
+  bool play() { return push({PLAY, 0}); }
+  bool stop() { return push({STOP, 0}); }
+  /// Seek to frame
+  bool seek(int64_t frame) { return push({SEEK, std::max<int64_t>(0, frame)}); }
+  /// Seek by frames relative to where the sources are when it is applied
+  bool seekBy(int64_t frames) { return push({SEEK_BY, frames}); }
+  bool loop(bool loop) { return push({LOOP, loop ? 1 : 0}); }
+
+  /// Playing as of the last buffer
+  bool playing() const { return mPlaying.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Audio thread: apply the queued commands to the next buffer
+   *
+   * position is the sources' current frame, for relative seeks. Afterwards
+   * passes() and pass() describe what to do with the sources.
+   */
+  void process(int frames, int64_t position) {
+    bool wasPlaying = mPlaying.load(std::memory_order_relaxed);
+    bool playing = wasPlaying;
+    int64_t seek = -1;
+    int loop = -1;
+    Command command;
+    while (mQueue.readSpace() >= sizeof(Command)) {
+      mQueue.read(reinterpret_cast<char *>(&command), sizeof(Command));
+      switch (command.type) {
+      case PLAY:
+        playing = true;
+        break;
+      case STOP:
+        playing = false;
+        break;
+      case SEEK:
+        seek = command.value;
+        break;
+      case SEEK_BY:
+        seek = std::max<int64_t>(0, (seek >= 0 ? seek : position) +
+                                        command.value);
+        break;
+      case LOOP:
+        loop = int(command.value);
+        break;
+      }
+    }
+    mNumPasses = 0;
+    frames = std::min(frames, int(mFadeIn.size()));
+    int fade = std::min(mFadeFrames, frames);
+    if (wasPlaying && playing) {
+      if (seek >= 0) {
+        addPass(-1, loop, true, mFadeOut.data(), fade);
+        addPass(seek, -1, true, mFadeIn.data(), frames);
+      } else {
+        addPass(-1, loop, true, nullptr, frames);
+      }
+    } else if (playing) {
+      addPass(seek, loop, true, mFadeIn.data(), frames);
+    } else if (wasPlaying) {
+      // Sources stop right after the fade, so play resumes from there
+      addPass(-1, loop, true, mFadeOut.data(), fade);
+      if (seek >= 0) {
+        addPass(seek, -1, false, nullptr, 0);
+      }
+    } else if (seek >= 0 || loop >= 0) {
+      addPass(seek, loop, false, nullptr, 0);
+    }
+    mPlaying.store(playing, std::memory_order_relaxed);
+  }
+
+  int passes() const { return mNumPasses; }
+  const Pass &pass(int index) const { return mPasses[index]; }
+
+private:
+  enum Type : int32_t { PLAY, STOP, SEEK, SEEK_BY, LOOP };
+
+  struct Command {
+    int32_t type;
+    int64_t value;
+  };
+
+  bool push(const Command &command) {
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    if (mQueue.writeSpace() < sizeof(Command)) {
+      return false;
+    }
+    mQueue.write(reinterpret_cast<const char *>(&command), sizeof(Command));
+    return true;
+  }
+
+  void addPass(int64_t seek, int loop, bool audible, const float *envelope,
+               int frames) {
+    Pass &pass = mPasses[mNumPasses++];
+    pass.seek = seek;
+    pass.loop = loop;
+    pass.audible = audible;
+    pass.envelope = envelope;
+    pass.frames = frames;
+  }
+
+  al::SingleRWRingBuffer mQueue;
+  std::mutex mWriteLock;
+  std::atomic<bool> mPlaying{false};
+
+  // Audio thread
+  int mFadeFrames;
+  std::vector<float> mFadeIn;
+  std::vector<float> mFadeOut;
+  Pass mPasses[2];
+  int mNumPasses{0};
+};
+
+/**
+ * @brief Transport commands over OSC
+ *
+ * /transport/play, /transport/stop, /transport/seek <seconds>,
+ * /transport/skip <seconds> (relative) and /transport/loop <0|1>. Register
+ * with App::parameterServer().registerOSCListener().
+ */
+class TransportOSCHandler : public al::osc::PacketHandler {
+public:
+  TransportOSCHandler(Transport &transport) : mTransport(transport) {}
+
+  /// Converts seconds to frames
+  void frameRate(double rate) { mFrameRate = rate; }
+
+  void onMessage(al::osc::Message &m) override {
+    const std::string &address = m.addressPattern();
+    if (address == "/transport/play") {
+      mTransport.play();
+    } else if (address == "/transport/stop") {
+      mTransport.stop();
+    } else if (address == "/transport/seek" || address == "/transport/skip") {
+      double seconds;
+      if (!readNumber(m, seconds)) {
+        return;
+      }
+      int64_t frames = int64_t(std::llround(seconds * mFrameRate));
+      if (address == "/transport/seek") {
+        mTransport.seek(frames);
+      } else {
+        mTransport.seekBy(frames);
+      }
+    } else if (address == "/transport/loop") {
+      double value;
+      if (readNumber(m, value)) {
+        mTransport.loop(value != 0.0);
+      }
+    }
+  }
+
+private:
+  static bool readNumber(al::osc::Message &m, double &value) {
+    if (m.typeTags() == "f") {
+      float v;
+      m >> v;
+      value = v;
+    } else if (m.typeTags() == "d") {
+      m >> value;
+    } else if (m.typeTags() == "i") {
+      int v;
+      m >> v;
+      value = v;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  Transport &mTransport;
+  double mFrameRate{48000.0};
+};
+
+/// MIDI start (from the top), continue and stop drive a Transport
+class TransportMIDIHandler : public al::MIDIMessageHandler {
+public:
+  TransportMIDIHandler(Transport &transport) : mTransport(transport) {}
+
+  void onMIDIMessage(const al::MIDIMessage &m) override {
+    if (m.type() != al::MIDIByte::SYSTEM_MSG) {
+      return;
+    }
+    switch (m.status()) {
+    case kStart:
+      mTransport.seek(0);
+      mTransport.play();
+      break;
+    case kContinue:
+      mTransport.play();
+      break;
+    case kStop:
+      mTransport.stop();
+      break;
+    }
+  }
+
+private:
+  // System real-time messages
+  static const unsigned char kStart = 0xfa;
+  static const unsigned char kContinue = 0xfb;
+  static const unsigned char kStop = 0xfc;
+
+  Transport &mTransport;
+};
+
+#endif // Transport_H
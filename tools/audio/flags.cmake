@@ -0,0 +1,6 @@
+# AudioWatchdog.h looks up the functions it interposes with dlsym() and
+# symbolizes stacks with backtrace_symbols(), which needs exported symbols.
+if(UNIX AND NOT APPLE)
+  set(app_link_libs ${CMAKE_DL_LIBS})
+  set(app_linker_flags -rdynamic)
+endif()
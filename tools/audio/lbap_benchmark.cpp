@@ -0,0 +1,147 @@
+// Cost of BatchedLbap against panning one source at a time.
+//
+//   lbap_benchmark [sources] [bufferFrames] [seconds]
+//
+// Pans moving noise sources (256 by default) onto the AlloSphere layout. Each
+// source circles at its own speed between 0.05 and 2 turns per second and
+// wobbles in elevation. The one-at-a-time mix recomputes every source's
+// gains each buffer and applies them with a scalar loop per speaker, as a
+// spatializer's renderBuffer() does. Times are per buffer, and load is the
+// share of one core that real-time playback needs.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "al/sphere/al_AlloSphereSpeakerLayout.hpp"
+
+#include "BatchedLbap.h"
+
+struct Motion {
+  float turnsPerSecond;
+  float wobblesPerSecond;
+  float azimuth{0.0f};
+  float wobble{0.0f};
+
+  // Step by seconds and return the direction in graphics space
+  void advance(double seconds, float *direction) {
+    azimuth += float(2.0 * M_PI * turnsPerSecond * seconds);
+    wobble += float(2.0 * M_PI * wobblesPerSecond * seconds);
+    float elevation = 0.6f * std::sin(wobble);
+    direction[0] = std::sin(azimuth) * std::cos(elevation);
+    direction[1] = std::sin(elevation);
+    direction[2] = -std::cos(azimuth) * std::cos(elevation);
+  }
+};
+
+int main(int argc, char *argv[]) {
+  int numSources = 256;
+  int frames = 512;
+  double seconds = 5.0;
+  if (argc > 1) {
+    numSources = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    frames = std::atoi(argv[2]);
+  }
+  if (argc > 3) {
+    seconds = std::atof(argv[3]);
+  }
+  if (numSources <= 0 || frames <= 0 || seconds <= 0.0) {
+    std::printf("Usage: %s [sources] [bufferFrames] [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  const double sampleRate = 48000.0;
+  const double bufferSeconds = frames / sampleRate;
+  const int buffers = std::max(1, int(seconds / bufferSeconds));
+  al::Speakers layout = al::AlloSphereSpeakerLayoutCompensated();
+  int channels = 0;
+  for (const auto &speaker : layout) {
+    channels = std::max(channels, int(speaker.deviceChannel) + 1);
+  }
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> speed(0.05f, 2.0f);
+  std::vector<std::vector<float>> samples(numSources,
+                                          std::vector<float>(frames));
+  std::vector<Motion> motions;
+  for (auto &source : samples) {
+    std::generate(source.begin(), source.end(),
+                  [&]() { return noise(random); });
+    motions.push_back({speed(random), speed(random) * 0.25f});
+  }
+  std::vector<std::vector<float>> outData(channels,
+                                          std::vector<float>(frames));
+  std::vector<float *> outs;
+  for (auto &channel : outData) {
+    outs.push_back(channel.data());
+  }
+  std::vector<std::vector<float>> directions(numSources,
+                                             std::vector<float>(3));
+
+  std::printf("%d sources, %d speakers, %d frames per buffer\n", numSources,
+              int(layout.size()), frames);
+
+  // One source at a time
+  LbapPanner panner(layout);
+  std::vector<LbapPanner::Gain> gains(panner.maxGains());
+  std::vector<Motion> serialMotions = motions;
+  auto start = std::chrono::steady_clock::now();
+  for (int b = 0; b < buffers; b++) {
+    for (auto &channel : outData) {
+      std::fill(channel.begin(), channel.end(), 0.0f);
+    }
+    for (int s = 0; s < numSources; s++) {
+      float *direction = directions[s].data();
+      serialMotions[s].advance(bufferSeconds, direction);
+      int count = panner.gains(direction[0], direction[1], direction[2],
+                               gains.data());
+      for (int g = 0; g < count; g++) {
+        float *out = outs[layout[gains[g].speaker].deviceChannel];
+        for (int i = 0; i < frames; i++) {
+          out[i] += samples[s][i] * gains[g].gain;
+        }
+      }
+    }
+  }
+  std::chrono::duration<double, std::micro> serial =
+      std::chrono::steady_clock::now() - start;
+
+  // Batched
+  BatchedLbap batched(layout, numSources, frames);
+  long long recomputed = 0;
+  start = std::chrono::steady_clock::now();
+  for (int b = 0; b < buffers; b++) {
+    for (auto &channel : outData) {
+      std::fill(channel.begin(), channel.end(), 0.0f);
+    }
+    batched.beginBuffer(frames);
+    for (int s = 0; s < numSources; s++) {
+      float *direction = directions[s].data();
+      motions[s].advance(bufferSeconds, direction);
+      batched.addSource(direction[0], direction[1], direction[2],
+                        samples[s].data());
+    }
+    batched.mix(outs.data());
+    recomputed += batched.recomputed();
+  }
+  std::chrono::duration<double, std::micro> batch =
+      std::chrono::steady_clock::now() - start;
+
+  double budget = bufferSeconds * 1e6;
+  std::printf("one at a time %9.1f us per buffer  load %5.1f%%\n",
+              serial.count() / buffers, 100.0 * serial.count() / buffers /
+                                            budget);
+  std::printf("batched       %9.1f us per buffer  load %5.1f%%  "
+              "(%.0f%% of gains recomputed)\n",
+              batch.count() / buffers,
+              100.0 * batch.count() / buffers / budget,
+              100.0 * recomputed / (double(buffers) * numSources));
+  return 0;
+}
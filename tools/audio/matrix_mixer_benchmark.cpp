@@ -0,0 +1,144 @@
+// Cost of MatrixMixer against a dense cell-by-cell mix, as DownMixer does.
+//
+//   matrix_mixer_benchmark [bufferFrames] [iterations]
+//
+// Mixes 60 to 2 (AlloSphere-sized layout to stereo), 60 to 8 (a ring of
+// eight) and 64 to 64 (a diagonal with a neighbour on each side) and prints
+// the time per buffer of each. The last column is the largest difference
+// between the two mixes.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "MatrixMixer.h"
+
+struct Case {
+  const char *name;
+  int inputs;
+  int outputs;
+  std::vector<float> gains; // inputs * outputs, row per input
+};
+
+// Every cell of the matrix, a frame at a time
+void denseMix(const Case &matrix, const std::vector<float *> &in,
+              const std::vector<float *> &out, int frames) {
+  for (int o = 0; o < matrix.outputs; o++) {
+    std::fill(out[o], out[o] + frames, 0.0f);
+  }
+  for (int i = 0; i < matrix.inputs; i++) {
+    for (int o = 0; o < matrix.outputs; o++) {
+      float gain = matrix.gains[size_t(i) * matrix.outputs + o];
+      for (int frame = 0; frame < frames; frame++) {
+        out[o][frame] += in[i][frame] * gain;
+      }
+    }
+  }
+}
+
+Case makeCase(const char *name, int inputs, int outputs) {
+  Case matrix{name, inputs, outputs,
+              std::vector<float>(size_t(inputs) * outputs, 0.0f)};
+  for (int i = 0; i < inputs; i++) {
+    float *row = &matrix.gains[size_t(i) * outputs];
+    if (outputs == 2) {
+      double angle = (std::sin(i * 2.0 * M_PI / inputs) + 1.0) * M_PI / 4.0;
+      row[0] = float(std::cos(angle));
+      row[1] = float(std::sin(angle));
+    } else if (outputs == inputs) {
+      row[i] = 1.0f;
+      row[(i + 1) % outputs] = 0.25f;
+      row[(i + outputs - 1) % outputs] = 0.25f;
+    } else {
+      // Panned between the two nearest of a ring of outputs
+      double position = double(i) * outputs / inputs;
+      int o = int(position);
+      double fraction = position - o;
+      row[o] = float(std::cos(fraction * M_PI / 2.0));
+      row[(o + 1) % outputs] = float(std::sin(fraction * M_PI / 2.0));
+    }
+  }
+  return matrix;
+}
+
+template <class TMix> double microsecondsPerBuffer(TMix mix, int iterations) {
+  mix();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    mix();
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  int frames = 512;
+  int iterations = 2000;
+  if (argc > 1) {
+    frames = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    iterations = std::atoi(argv[2]);
+  }
+  if (frames <= 0 || iterations <= 0) {
+    std::printf("Usage: %s [bufferFrames] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<Case> cases = {makeCase("60 to 2", 60, 2),
+                             makeCase("60 to 8", 60, 8),
+                             makeCase("64 to 64", 64, 64)};
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  std::printf("%d frames per buffer\n", frames);
+  std::printf("%-9s %12s %12s %8s %10s\n", "", "dense us", "matrix us",
+              "speedup", "max diff");
+  for (const Case &matrix : cases) {
+    // One allocation per channel, as io's channels are apart in memory
+    std::vector<std::vector<float>> inData(matrix.inputs,
+                                           std::vector<float>(frames));
+    std::vector<std::vector<float>> denseData(matrix.outputs,
+                                              std::vector<float>(frames));
+    std::vector<std::vector<float>> mixData(matrix.outputs,
+                                            std::vector<float>(frames));
+    std::vector<float *> in, dense, mixed;
+    for (auto &channel : inData) {
+      std::generate(channel.begin(), channel.end(),
+                    [&]() { return noise(random); });
+      in.push_back(channel.data());
+    }
+    for (int o = 0; o < matrix.outputs; o++) {
+      dense.push_back(denseData[o].data());
+      mixed.push_back(mixData[o].data());
+    }
+
+    MatrixMixer mixer;
+    mixer.configure(matrix.inputs, matrix.outputs, 1);
+    for (int i = 0; i < matrix.inputs; i++) {
+      for (int o = 0; o < matrix.outputs; o++) {
+        mixer.set(i, o, matrix.gains[size_t(i) * matrix.outputs + o]);
+      }
+    }
+
+    double denseTime = microsecondsPerBuffer(
+        [&]() { denseMix(matrix, in, dense, frames); }, iterations);
+    double mixerTime = microsecondsPerBuffer(
+        [&]() { mixer.process(in.data(), mixed.data(), frames); },
+        iterations);
+    float difference = 0.0f;
+    for (int o = 0; o < matrix.outputs; o++) {
+      for (int frame = 0; frame < frames; frame++) {
+        difference = std::max(difference,
+                              std::fabs(dense[o][frame] - mixed[o][frame]));
+      }
+    }
+    std::printf("%-9s %12.2f %12.2f %7.1fx %10.2g\n", matrix.name, denseTime,
+                mixerTime, denseTime / mixerTime, difference);
+  }
+  return 0;
+}
@@ -2,18 +2,27 @@
 #include "al/io/al_File.hpp"
 #include "al/io/al_Imgui.hpp"
 #include "al/io/al_Toml.hpp"
-#include "al/sound/al_DownMixer.hpp"
 #include "al/sound/al_SpeakerAdjustment.hpp"
 #include "al/sphere/al_AlloSphereSpeakerLayout.hpp"
 #include "al/sphere/al_SphereUtils.hpp"
 #include "al/ui/al_FileSelector.hpp"
 #include "al/ui/al_ParameterGUI.hpp"
-#include "al_ext/soundfile/al_SoundfileBuffered.hpp"
+
+#include "AudioWatchdog.h"
+#include "ChannelStream.h"
+#include "IOScheduler.h"
+#include "MappedSoundFile.h"
+#include "MatrixMixer.h"
+#include "Resampler.h"
+#include "Transport.h"
 
 using namespace al;
 
 struct MappedAudioFile {
-  std::unique_ptr<SoundFileBuffered> soundfile;
+  std::unique_ptr<MappedSoundFile> soundfile;
+  /// soundfile at the device rate
+  std::unique_ptr<ResampledSource<MappedSoundFile>> source;
+  std::unique_ptr<ChannelStream> stream;
   std::vector<size_t> outChannelMap;
   std::string fileInfoText;
   std::string fileName;
@@ -24,19 +33,54 @@ struct MappedAudioFile {
 class AudioPlayerApp : public App {
 public:
   std::string rootDir{""};
+  /// Device rate, 0 for the rate of the last file
+  double sampleRate{0.0};
+  PolyphaseFilterBank::Quality resampleQuality{PolyphaseFilterBank::MEDIUM};
 
   ParameterBool play{"play", "", 0.0};
+  ParameterBool loop{"loop", "", 0.0};
   ParameterBool downmixStereo{"downmixStereo", "", 0.0};
   Trigger rewind{"rewind"};
   Trigger fw{"fw"};
   Trigger back{"back"};
 
+  struct FileEntry {
+    std::string name;
+    std::vector<size_t> outChannels;
+    float gain;
+    bool loop;
+  };
+
+  /// Open the files in parallel on the I/O threads, then add them in order
+  bool loadFiles(const std::vector<FileEntry> &entries) {
+    std::vector<std::unique_ptr<MappedSoundFile>> files(entries.size());
+    IOScheduler::instance().parallel(int(entries.size()), [&](int i) {
+      files[i] = std::make_unique<MappedSoundFile>(
+          File::conformPathToOS(rootDir) + entries[i].name, false, 4096);
+    });
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (!loadFile(entries[i].name, entries[i].outChannels, entries[i].gain,
+                    entries[i].loop, std::move(files[i]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Add a file, opening it here unless soundfile is already open
   bool loadFile(std::string fileName, std::vector<size_t> channelMap,
-                float gain, bool loop) {
+                float gain, bool loop,
+                std::unique_ptr<MappedSoundFile> soundfile = nullptr) {
     soundfiles.push_back(MappedAudioFile());
-    soundfiles.back().soundfile = std::make_unique<SoundFileBuffered>(
-        File::conformPathToOS(rootDir) + fileName, false, 4096);
+    if (!soundfile) {
+      soundfile = std::make_unique<MappedSoundFile>(
+          File::conformPathToOS(rootDir) + fileName, false, 4096);
+    }
+    soundfiles.back().soundfile = std::move(soundfile);
     soundfiles.back().soundfile->loop(loop);
+    soundfiles.back().source =
+        std::make_unique<ResampledSource<MappedSoundFile>>(
+            *soundfiles.back().soundfile);
     if (!soundfiles.back().soundfile->opened()) {
       std::cerr << "ERROR: opening "
                 << File::conformPathToOS(rootDir) + fileName << std::endl;
@@ -48,6 +92,9 @@ public:
                 << channelMap.size() << " provided. Aborting." << std::endl;
     }
     soundfiles.back().outChannelMap = channelMap;
+    soundfiles.back().stream = std::make_unique<ChannelStream>();
+    soundfiles.back().stream->configure(
+        soundfiles.back().soundfile->channels(), channelMap);
     soundfiles.back().gain = gain;
     soundfiles.back().fileName = fileName;
     soundfiles.back().fileInfoText +=
@@ -60,33 +107,35 @@ public:
         "\n";
     soundfiles.back().fileInfoText +=
         " gain: " + std::to_string(soundfiles.back().gain) + "\n";
+    soundfiles.back().fileInfoText +=
+        soundfiles.back().soundfile->mapped() ? " memory-mapped\n"
+                                              : " streamed\n";
     return true;
   }
 
   // App callbacks
   void onInit() override {
-    rewind.registerChangeCallback([&](float /*value*/) {
-      play = 0.0;
-      for (auto &sf : soundfiles) {
-        sf.soundfile->seek(0);
+    // The audio thread applies transport commands to all files at once
+    play.registerChangeCallback([&](float value) {
+      if (value == 1.0f) {
+        transport.play();
+      } else {
+        transport.stop();
       }
-      play = 1.0;
+    });
+    loop.registerChangeCallback(
+        [&](float value) { transport.loop(value == 1.0f); });
+    rewind.registerChangeCallback([&](float /*value*/) {
+      transport.seek(0);
+      transport.play();
     });
     fw.registerChangeCallback([&](float /*value*/) {
-      play = 0.0;
-      for (auto &sf : soundfiles) {
-        sf.soundfile->seek(sf.soundfile->currentPosition() +
-                           5 * sf.soundfile->frameRate());
-      }
-      play = 1.0;
+      transport.seekBy(int64_t(5 * audioIO().framesPerSecond()));
+      transport.play();
     });
     back.registerChangeCallback([&](float /*value*/) {
-      play = 0.0;
-      for (auto &sf : soundfiles) {
-        sf.soundfile->seek(sf.soundfile->currentPosition() -
-                           5 * sf.soundfile->frameRate());
-      }
-      play = 1.0;
+      transport.seekBy(-int64_t(5 * audioIO().framesPerSecond()));
+      transport.play();
     });
 
     AudioDevice dev = AudioDevice::defaultOutput();
@@ -94,11 +143,27 @@ public:
       dev = AudioDevice("ECHO X5");
       gainAdjustment.configure(AlloSphereSpeakerLayoutCompensated(), 1.82);
     }
-    configureAudio(dev, soundfiles.back().soundfile->frameRate(), 1024,
-                   dev.channelsOutMax(), 0);
+    if (sampleRate <= 0.0) {
+      sampleRate = soundfiles.back().soundfile->frameRate();
+    }
+    configureAudio(dev, sampleRate, 1024, dev.channelsOutMax(), 0);
+
+    // Files at another rate are resampled to the device rate
+    for (auto &sf : soundfiles) {
+      sf.source->configure(audioIO().framesPerSecond(), resampleQuality);
+      if (sf.source->resampling()) {
+        sf.fileInfoText += " resampled to " +
+                           std::to_string(int(audioIO().framesPerSecond())) +
+                           "\n";
+      }
+    }
 
     audioIO().append(gainAdjustment);
 
+    transportOSC.frameRate(audioIO().framesPerSecond());
+    parameterServer().registerOSCListener(&transportOSC);
+    transportMIDI.bindTo(midiIn);
+
     int highestChannel = 0;
     for (const auto &sf : soundfiles) {
       for (const auto entry : sf.outChannelMap) {
@@ -109,20 +174,30 @@ public:
       }
     }
     audioIO().channelsOut(highestChannel + 1);
+    mDownMixer.configure(audioIO().channelsOut(), 2);
     if (soundfiles.size() == 6) {
       // assume 5.1 to stereo
-      mDownMixer.set5_1toStereo(audioIO());
-      mDownMixer.setOutputs({0, 1});
+      set5_1toStereo(mDownMixer);
     }
   }
 
   void onCreate() override { imguiInit(); }
 
+  void onAnimate(double dt) override {
+    AudioWatchdog::report();
+    // Show transport changes from OSC and MIDI
+    if (transport.playing() != mShownPlaying) {
+      mShownPlaying = transport.playing();
+      play.setNoCalls(mShownPlaying ? 1.0 : 0.0);
+    }
+  }
+
   void onDraw(Graphics &g) override {
     imguiBeginFrame();
 
     ImGui::Begin("Multichannel Player");
     ParameterGUI::draw(&play);
+    ParameterGUI::draw(&loop);
     ParameterGUI::draw(&downmixStereo);
     ParameterGUI::draw(&rewind);
 
@@ -133,10 +208,18 @@ public:
     ParameterGUI::drawParameterMeta(audioDomain()->parameters(),
                                     " (Global)##AudioIO");
     ParameterGUI::drawAudioIO(audioIO());
+    ParameterGUI::drawMIDIIn(&midiIn);
     if (soundfiles.size() > 0) {
-      ImGui::Text("Time: %f", soundfiles[0].soundfile->currentPosition() /
-                                  soundfiles[0].soundfile->frameRate());
+      ImGui::Text("Time: %f", soundfiles[0].source->currentPosition() /
+                                  soundfiles[0].source->frameRate());
     }
+    IOScheduler::Stats ioStats = IOScheduler::instance().stats();
+    ImGui::Text("I/O: %d threads, %d files, fill min %.0f%% mean %.0f%%, "
+                "%.1f MB in %llu batches",
+                IOScheduler::instance().threads(), ioStats.sources,
+                ioStats.minFill * 100.0f, ioStats.meanFill * 100.0f,
+                ioStats.bytesLoaded / 1048576.0,
+                (unsigned long long)ioStats.batches);
     ImGui::Separator();
     for (auto &sf : soundfiles) {
       ImGui::Text("*** %s", sf.fileName.c_str());
@@ -144,6 +227,11 @@ public:
       ImGui::PushID(sf.soundfile.get());
       ImGui::Checkbox("Mute", &sf.mute);
       ImGui::Text("%s", sf.fileInfoText.c_str());
+      ImGui::Text(" underruns: %llu",
+                  (unsigned long long)sf.stream->underruns());
+      if (sf.soundfile->mapped()) {
+        ImGui::ProgressBar(sf.soundfile->fill(), ImVec2(-1, 0), "prefetched");
+      }
       ImGui::PopID();
     }
 
@@ -154,31 +242,30 @@ public:
   }
 
   void onSound(AudioIOData &io) override {
-    float buffer[2048 * 60];
-    if (play.get() == 1.0f) {
+    // Checks this callback when AL_AUDIO_WATCHDOG is set
+    AudioWatchdog::Callback watchdog(io);
+    if (soundfiles.empty()) {
+      return;
+    }
+    transport.process(io.framesPerBuffer(),
+                      soundfiles[0].source->currentPosition());
+    for (int p = 0; p < transport.passes(); p++) {
+      const Transport::Pass &pass = transport.pass(p);
       for (auto &sf : soundfiles) {
-        int numChannels = sf.soundfile->channels();
-        int framesRead = sf.soundfile->read(buffer, io.framesPerBuffer());
-        if (framesRead != io.framesPerBuffer()) {
-          std::cout << "short buffer " << framesRead << std::endl;
-        }
-        for (size_t i = 0; i < sf.outChannelMap.size(); i++) {
-          size_t outIndex = sf.outChannelMap[i];
-          if (!sf.mute) {
-            for (uint64_t sample = 0; sample < framesRead; sample++) {
-              io.outBuffer(outIndex)[sample] +=
-                  sf.gain * buffer[sample * numChannels + i];
-            }
-          }
+        pass.apply(*sf.source);
+        if (pass.audible) {
+          sf.stream->mix(*sf.source, io, sf.gain, sf.mute, pass.envelope,
+                         pass.frames);
         }
       }
-      if (downmixStereo.get() == 1.0) {
-        mDownMixer.downMix(io);
-      }
+    }
+    if (downmixStereo.get() == 1.0) {
+      mDownMixer.outsToOuts(io, mStereoOutputs);
     }
   }
 
   void onExit() override {
+    AudioWatchdog::summary();
     for (auto &sf : soundfiles) {
       sf.soundfile->close();
     }
@@ -187,8 +274,14 @@ public:
 
 private:
   std::vector<MappedAudioFile> soundfiles;
+  Transport transport;
+  TransportOSCHandler transportOSC{transport};
+  TransportMIDIHandler transportMIDI{transport};
+  RtMidiIn midiIn;
+  bool mShownPlaying{false};
   SpeakerDistanceGainAdjustmentProcessor gainAdjustment;
-  DownMixer mDownMixer;
+  MatrixMixer mDownMixer;
+  std::vector<int> mStereoOutputs{0, 1};
 };
 
 int main(int argc, char *argv[]) {
@@ -219,12 +312,23 @@ gain = 1.2
   if (appConfig.hasKey<std::string>("rootDir")) {
     app.rootDir = appConfig.gets("rootDir");
   }
+  if (appConfig.hasKey<double>("sampleRate")) {
+    app.sampleRate = appConfig.getd("sampleRate");
+  }
+  if (appConfig.hasKey<std::string>("resampleQuality")) {
+    std::string quality = appConfig.gets("resampleQuality");
+    if (quality == "low") {
+      app.resampleQuality = PolyphaseFilterBank::LOW;
+    } else if (quality == "high") {
+      app.resampleQuality = PolyphaseFilterBank::HIGH;
+    }
+  }
   if (appConfig.hasKey<double>("globalGain")) {
     assert(app.audioDomain()->parameters()[0]->getName() == "gain");
     app.audioDomain()->parameters()[0]->fromFloat(appConfig.getd("globalGain"));
   }
   auto nodesTable = appConfig.root->get_table_array("file");
-  std::vector<std::string> filesToLoad;
+  std::vector<AudioPlayerApp::FileEntry> filesToLoad;
   if (nodesTable) {
     for (const auto &table : *nodesTable) {
       std::string name = *table->get_as<std::string>("name");
@@ -241,10 +345,11 @@ gain = 1.2
       for (auto channel : outChannelsToml) {
         outChannels.push_back(channel);
       }
-      // Load requested file into app. If any file fails, abort.
-      if (!app.loadFile(name, outChannels, gain, loop)) {
-        return -1;
-      }
+      filesToLoad.push_back({name, outChannels, gain, loop});
+    }
+    // Load requested files into app. If any file fails, abort.
+    if (!app.loadFiles(filesToLoad)) {
+      return -1;
     }
   } else {
     std::cout << "Error loading file. Aborting" << std::endl;
@@ -0,0 +1,113 @@
+// Cost of ResampledSource per channel, for each quality and channel count.
+//
+//   resampler_benchmark [inRate outRate] [seconds]
+//
+// Converts generated noise from inRate to outRate (44100 to 48000 by
+// default) in 1024-frame buffers, as multichannel_playback reads it, and
+// prints the time per output frame of one channel and how many times faster
+// than real time a file with that many channels is converted.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "Resampler.h"
+
+// An endless source of interleaved noise
+class NoiseSource {
+public:
+  NoiseSource(int channels, double frameRate)
+      : mChannels(channels), mFrameRate(frameRate) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    mNoise.resize(size_t(channels) * kFrames);
+    for (auto &sample : mNoise) {
+      sample = noise(random);
+    }
+  }
+
+  size_t read(float *buffer, int frames) {
+    for (int done = 0; done < frames;) {
+      int count = std::min(frames - done, kFrames - mOffset);
+      std::copy_n(&mNoise[size_t(mOffset) * mChannels],
+                  size_t(count) * mChannels,
+                  buffer + size_t(done) * mChannels);
+      done += count;
+      mOffset = (mOffset + count) % kFrames;
+      mPosition += count;
+    }
+    return size_t(frames);
+  }
+  void seek(int64_t frame) {
+    mPosition = frame;
+    mOffset = int(frame % kFrames);
+  }
+  void loop(bool) {}
+  int64_t currentPosition() const { return mPosition; }
+  int channels() const { return mChannels; }
+  double frameRate() const { return mFrameRate; }
+  int64_t frames() const { return INT64_MAX / 2; }
+
+private:
+  static const int kFrames = 65536;
+
+  int mChannels;
+  double mFrameRate;
+  std::vector<float> mNoise;
+  int mOffset{0};
+  int64_t mPosition{0};
+};
+
+int main(int argc, char *argv[]) {
+  double inRate = 44100.0;
+  double outRate = 48000.0;
+  double seconds = 10.0;
+  if (argc > 2) {
+    inRate = std::atof(argv[1]);
+    outRate = std::atof(argv[2]);
+  }
+  if (argc > 3) {
+    seconds = std::atof(argv[3]);
+  }
+  if (inRate <= 0.0 || outRate <= 0.0 || seconds <= 0.0) {
+    std::printf("Usage: %s [inRate outRate] [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  const int kBufferFrames = 1024;
+  const int kChannels[] = {1, 2, 8, 60};
+  const char *kNames[] = {"low", "medium", "high"};
+  std::printf("%.0f Hz to %.0f Hz, %.0f s per run\n", inRate, outRate,
+              seconds);
+  for (int q = PolyphaseFilterBank::LOW; q <= PolyphaseFilterBank::HIGH; q++) {
+    auto quality = PolyphaseFilterBank::Quality(q);
+    auto bank = PolyphaseFilterBank::get(inRate, outRate, quality);
+    std::printf("%-6s %2d taps, %d phases\n", kNames[q], bank->taps(),
+                bank->phases());
+    for (int channels : kChannels) {
+      NoiseSource noise(channels, inRate);
+      ResampledSource<NoiseSource> source(noise);
+      source.configure(outRate, quality);
+      std::vector<float> buffer(size_t(kBufferFrames) * channels);
+      int buffers = std::max(1, int(seconds * outRate / kBufferFrames));
+      float checksum = 0.0f;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < buffers; i++) {
+        source.read(buffer.data(), kBufferFrames);
+        checksum += buffer[size_t(i % kBufferFrames) * channels];
+      }
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      double samples = double(buffers) * kBufferFrames * channels;
+      double audio = double(buffers) * kBufferFrames / outRate;
+      std::printf("  %2d channels %8.2f ns per sample per channel  "
+                  "%8.1fx real time  (checksum %.3f)\n",
+                  channels, elapsed.count() * 1e9 / samples,
+                  audio / elapsed.count(), checksum);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,188 @@
+// Bytes per frame sent to the renderers, SceneSync against a message per
+// parameter.
+//
+//   scene_sync_benchmark [maxVoices] [seconds] [fps]
+//
+// Simulates scenes of 16 voices up to maxVoices (256 by default), doubling.
+// Three of four voices circle and turn at their own speed, and every voice's
+// level changes each frame, as the env of a playing AudioObject does. A
+// voice's gain changes about every two seconds. The message per parameter
+// is what DistributedScene sends for registered parameters: the pose and
+// level of each voice whose values changed, with an address like
+// /spatial_sequencer/voice/12/env. SceneSync sends the same changes through a
+// SceneStateCodec, and is decoded again in a loopback to check that the
+// renderers' copies stay within tolerance. Bytes include the 28 byte UDP and
+// IP headers of each packet.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "SceneSync.h"
+
+struct Motion {
+  float turnsPerSecond;
+  float wobblesPerSecond;
+  float azimuth{0.0f};
+  float wobble{0.0f};
+
+  // Step by seconds, facing the way the voice moves
+  void advance(double seconds, float *position, float *quat) {
+    azimuth += float(2.0 * M_PI * turnsPerSecond * seconds);
+    wobble += float(2.0 * M_PI * wobblesPerSecond * seconds);
+    float elevation = 0.6f * std::sin(wobble);
+    position[0] = 5.0f * std::sin(azimuth) * std::cos(elevation);
+    position[1] = 5.0f * std::sin(elevation);
+    position[2] = -5.0f * std::cos(azimuth) * std::cos(elevation);
+    quat[0] = std::cos(-azimuth / 2.0f);
+    quat[1] = 0.0f;
+    quat[2] = std::sin(-azimuth / 2.0f);
+    quat[3] = 0.0f;
+  }
+};
+
+struct Voice {
+  Motion motion;
+  bool moving;
+  float position[3];
+  float quat[4]{1.0f, 0.0f, 0.0f, 0.0f};
+  float values[2]{1.0f, 0.0f}; // gain, env
+};
+
+// Size of an OSC message of floats, padded to 4 bytes, in a UDP packet
+static size_t oscMessageBytes(const std::string &address, int floats) {
+  auto padded = [](size_t bytes) { return (bytes + 4) & ~size_t(3); };
+  return 28 + padded(address.size()) + padded(size_t(floats) + 1) +
+         4 * size_t(floats);
+}
+
+int main(int argc, char *argv[]) {
+  int maxVoices = 256;
+  double seconds = 10.0;
+  double fps = 60.0;
+  if (argc > 1) {
+    maxVoices = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    seconds = std::atof(argv[2]);
+  }
+  if (argc > 3) {
+    fps = std::atof(argv[3]);
+  }
+  if (maxVoices < 16 || seconds <= 0.0 || fps <= 0.0) {
+    std::printf("Usage: %s [maxVoices >= 16] [seconds] [fps]\n", argv[0]);
+    return 1;
+  }
+  const int frames = std::max(1, int(seconds * fps));
+
+  std::printf("%6s %9s %10s %8s %10s %7s %10s %9s %9s %9s %9s\n", "voices",
+              "osc msgs", "osc bytes", "packets", "sync bytes", "ratio",
+              "sync kB/s", "encode us", "decode us", "pos error",
+              "env error");
+  for (int numVoices = 16; numVoices <= maxVoices; numVoices *= 2) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> speed(0.05f, 0.5f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Voice> voices(numVoices);
+    std::vector<std::string> poseAddresses, envAddresses, gainAddresses;
+    for (int i = 0; i < numVoices; i++) {
+      Voice &voice = voices[i];
+      voice.motion = {speed(random), speed(random) * 0.25f};
+      voice.motion.azimuth = float(2.0 * M_PI) * unit(random);
+      voice.moving = i % 4 != 3;
+      voice.motion.advance(0.0, voice.position, voice.quat);
+      std::string prefix = "/spatial_sequencer/voice/" + std::to_string(i);
+      poseAddresses.push_back(prefix + "/_pose");
+      envAddresses.push_back(prefix + "/env");
+      gainAddresses.push_back(prefix + "/gain");
+    }
+
+    SceneStateCodec codec;
+    codec.addField(0.0f, 4.0f, 0.001f); // gain
+    codec.addField(0.00001f, 10.0f, 0.001f); // env, AudioObject::env's range
+    std::vector<SceneVoiceState> mirror(numVoices);
+
+    size_t oscMessages = 0, oscBytes = 0, packets = 0, syncBytes = 0;
+    double encodeSeconds = 0.0, decodeSeconds = 0.0;
+    float positionError = 0.0f, envError = 0.0f;
+    for (int frame = 0; frame < frames; frame++) {
+      for (int i = 0; i < numVoices; i++) {
+        Voice &voice = voices[i];
+        if (voice.moving) {
+          voice.motion.advance(1.0 / fps, voice.position, voice.quat);
+          oscMessages++;
+          oscBytes += oscMessageBytes(poseAddresses[i], 7);
+        }
+        voice.values[1] = 0.5f + 0.4f * std::sin(frame * 0.3f + i) *
+                                     unit(random);
+        oscMessages++;
+        oscBytes += oscMessageBytes(envAddresses[i], 1);
+        if (unit(random) < 0.5f / fps) {
+          voice.values[0] = 4.0f * unit(random);
+          oscMessages++;
+          oscBytes += oscMessageBytes(gainAddresses[i], 1);
+        }
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      codec.beginFrame();
+      for (int i = 0; i < numVoices; i++) {
+        codec.addVoice(uint32_t(i), voices[i].position, voices[i].quat,
+                       voices[i].values);
+      }
+      codec.endFrame();
+      auto encoded = std::chrono::steady_clock::now();
+      for (int p = 0; p < codec.packets(); p++) {
+        codec.decode(codec.packetData(p), codec.packetSize(p),
+                     [&](uint32_t id, uint32_t changed,
+                         const SceneVoiceState &state) {
+                       SceneVoiceState &copy = mirror[id];
+                       if (changed & SceneStateCodec::kPosition) {
+                         std::copy(state.position, state.position + 3,
+                                   copy.position);
+                       }
+                       if (changed & SceneStateCodec::kOrientation) {
+                         std::copy(state.quat, state.quat + 4, copy.quat);
+                       }
+                       for (int f = 0; f < 2; f++) {
+                         if (changed & (SceneStateCodec::kField << f)) {
+                           copy.values[f] = state.values[f];
+                         }
+                       }
+                     });
+      }
+      auto decoded = std::chrono::steady_clock::now();
+      encodeSeconds += std::chrono::duration<double>(encoded - start).count();
+      decodeSeconds += std::chrono::duration<double>(decoded - encoded).count();
+
+      packets += size_t(codec.packets());
+      // Wrapped in an OSC blob message, in a UDP packet
+      syncBytes += codec.bytes() + size_t(codec.packets()) * (28 + 24);
+      for (int i = 0; i < numVoices; i++) {
+        for (int d = 0; d < 3; d++) {
+          positionError =
+              std::max(positionError, std::fabs(voices[i].position[d] -
+                                                mirror[i].position[d]));
+        }
+        envError = std::max(
+            envError, std::fabs(voices[i].values[1] - mirror[i].values[1]));
+      }
+    }
+
+    double oscPerFrame = double(oscBytes) / frames;
+    double syncPerFrame = double(syncBytes) / frames;
+    std::printf("%6d %9.1f %10.0f %8.2f %10.0f %6.1fx %10.1f %9.2f %9.2f "
+                "%9.5f %9.5f\n",
+                numVoices, double(oscMessages) / frames, oscPerFrame,
+                double(packets) / frames, syncPerFrame,
+                oscPerFrame / syncPerFrame, syncPerFrame * fps / 1000.0,
+                encodeSeconds / frames * 1e6, decodeSeconds / frames * 1e6,
+                positionError, envError);
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+// Load time of a score as Tone.js JSON and as a memory-mapped .score file.
+//
+//   score_benchmark interstellar.json interstellar.score [iterations]
+//
+// Each iteration opens the file, reads every note and closes it again, as
+// playTune() in the tutorials does.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "../../tutorials/audiovisual/BinaryScore.h"
+
+using json = nlohmann::json;
+
+double loadJson(const std::string &path) {
+  std::ifstream file(path);
+  json music = json::parse(file);
+  double sum = 0.0;
+  for (auto &track : music["tracks"]) {
+    for (auto &note : track["notes"]) {
+      sum += note["time"].get<float>() + note["duration"].get<float>() +
+             note["midi"].get<int>();
+    }
+  }
+  return sum;
+}
+
+double loadBinary(const std::string &path) {
+  BinaryScore score(path);
+  double sum = 0.0;
+  for (int t = 0; t < score.numTracks(); t++) {
+    const ScoreNoteRecord *notes = score.notes(t);
+    for (int i = 0; i < score.numNotes(t); i++) {
+      sum += notes[i].time + notes[i].duration + notes[i].midi;
+    }
+  }
+  return sum;
+}
+
+template <class TLoad>
+double microsecondsPerLoad(TLoad load, const std::string &path, int iterations,
+                           double &checksum) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    checksum = load(path);
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  std::string jsonPath = "../../../tutorials/synthesis/interstellar.json";
+  std::string scorePath = "../../../tutorials/synthesis/interstellar.score";
+  int iterations = 200;
+  if (argc > 2) {
+    jsonPath = argv[1];
+    scorePath = argv[2];
+  }
+  if (argc > 3) {
+    iterations = std::max(1, std::atoi(argv[3]));
+  }
+  if (!std::ifstream(jsonPath) || !BinaryScore(scorePath).isOpen()) {
+    std::printf("Usage: %s <score.json> <score.score> [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  double jsonSum, binarySum;
+  double jsonTime = microsecondsPerLoad(loadJson, jsonPath, iterations, jsonSum);
+  double binaryTime =
+      microsecondsPerLoad(loadBinary, scorePath, iterations, binarySum);
+  std::printf("json   %10.1f us per load  (checksum %.1f)\n", jsonTime, jsonSum);
+  std::printf("binary %10.1f us per load  (checksum %.1f)\n", binaryTime,
+              binarySum);
+  std::printf("speedup %.0fx\n", jsonTime / binaryTime);
+  return 0;
+}
@@ -0,0 +1,304 @@
+// Converts a score to the binary .score format read by BinaryScore.
+//
+//   score_convert interstellar.json interstellar.score
+//   score_convert piece.mid piece.score
+//
+// Accepts the Tone.js MIDI JSON used by the tutorials and Standard MIDI
+// Files (format 0 and 1). For MIDI files every MTrk chunk with notes becomes
+// a track. Times come from the merged tempo map.
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "../../tutorials/audiovisual/BinaryScore.h"
+
+using json = nlohmann::json;
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool convertJson(const std::string &path, BinaryScoreWriter &writer) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  json music = json::parse(file, nullptr, false);
+  if (music.is_discarded()) {
+    std::printf("Could not parse %s\n", path.c_str());
+    return false;
+  }
+  const json &header = music["header"];
+  writer.ppq(header.value("PPQ", 480u));
+  if (header.count("tempo")) {
+    for (auto &tempo : header["tempo"]) {
+      writer.addTempo(tempo.value("absoluteTime", 0u),
+                      tempo.value("seconds", 0.0f), tempo.value("bpm", 120.0f));
+    }
+  } else if (header.count("bpm")) {
+    writer.addTempo(0, 0.0f, header["bpm"].get<float>());
+  }
+  for (auto &track : music["tracks"]) {
+    int index = writer.addTrack(track.value("name", std::string()),
+                                track.value("channelNumber", 0),
+                                track.value("instrumentNumber", 0),
+                                track.value("isPercussion", false));
+    for (auto &note : track["notes"]) {
+      writer.addNote(index, note["time"].get<float>(),
+                     note["duration"].get<float>(), note["midi"].get<int>(),
+                     note.value("velocity", 1.0f));
+    }
+  }
+  return true;
+}
+
+// Standard MIDI File reader, just enough for notes, names and tempo
+
+struct MidiNote {
+  uint32_t start, end;
+  int key, velocity, channel;
+};
+
+struct MidiTrack {
+  std::string name;
+  int channel{0};
+  int program{0};
+  std::vector<MidiNote> notes;
+};
+
+class MidiReader {
+public:
+  MidiReader(const std::vector<uint8_t> &data) : mData(data) {}
+
+  bool read(std::vector<MidiTrack> &tracks, std::map<uint32_t, double> &tempos,
+            int &division) {
+    if (!chunk("MThd") || mChunkSize < 6) {
+      return false;
+    }
+    size_t next = mPos + mChunkSize;
+    int format = read16();
+    int numTracks = read16();
+    division = read16();
+    mPos = next;
+    if (format > 1) {
+      std::printf("MIDI format %d is not supported\n", format);
+      return false;
+    }
+    for (int i = 0; i < numTracks && mPos < mData.size(); i++) {
+      if (!chunk("MTrk")) {
+        return false;
+      }
+      next = mPos + mChunkSize;
+      if (next > mData.size()) {
+        return false;
+      }
+      tracks.emplace_back();
+      readTrack(next, tracks.back(), tempos);
+      mPos = next;
+    }
+    return true;
+  }
+
+private:
+  bool chunk(const char *id) {
+    if (mPos + 8 > mData.size() ||
+        std::string(mData.begin() + mPos, mData.begin() + mPos + 4) != id) {
+      return false;
+    }
+    mPos += 4;
+    mChunkSize = read32();
+    return true;
+  }
+
+  uint32_t read32() {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+      value = (value << 8) | byte();
+    }
+    return value;
+  }
+  int read16() { return (byte() << 8) | byte(); }
+  int byte() { return mPos < mData.size() ? mData[mPos++] : 0; }
+
+  uint32_t variableLength(size_t end) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4 && mPos < end; i++) {
+      int b = byte();
+      value = (value << 7) | (b & 0x7f);
+      if (!(b & 0x80)) {
+        break;
+      }
+    }
+    return value;
+  }
+
+  void readTrack(size_t end, MidiTrack &track,
+                 std::map<uint32_t, double> &tempos) {
+    uint32_t ticks = 0;
+    int status = 0;
+    std::map<int, std::vector<MidiNote>> held; // By channel and key
+    bool programSet = false;
+    while (mPos < end) {
+      ticks += variableLength(end);
+      int b = byte();
+      if (b & 0x80) {
+        status = b;
+      } else {
+        mPos--; // Running status
+      }
+      if (status == 0xff) {
+        int type = byte();
+        uint32_t length = variableLength(end);
+        size_t next = mPos + length;
+        if (type == 0x51 && length == 3) {
+          uint32_t microseconds = (byte() << 16) | (byte() << 8) | byte();
+          tempos[ticks] = 60000000.0 / microseconds;
+        } else if (type == 0x03 && next <= end) {
+          track.name.assign(mData.begin() + mPos, mData.begin() + next);
+        } else if (type == 0x2f) {
+          break;
+        }
+        mPos = next;
+        status = 0;
+      } else if (status == 0xf0 || status == 0xf7) {
+        mPos += variableLength(end);
+        status = 0;
+      } else {
+        int type = status & 0xf0;
+        int channel = status & 0x0f;
+        int data1 = byte();
+        int data2 = (type == 0xc0 || type == 0xd0) ? 0 : byte();
+        int key = channel * 128 + data1;
+        if (type == 0x90 && data2 > 0) {
+          held[key].push_back({ticks, ticks, data1, data2, channel});
+        } else if (type == 0x80 || type == 0x90) {
+          auto it = held.find(key);
+          if (it != held.end() && !it->second.empty()) {
+            // Note offs close the oldest matching note
+            MidiNote note = it->second.front();
+            it->second.erase(it->second.begin());
+            note.end = ticks;
+            track.notes.push_back(note);
+          }
+        } else if (type == 0xc0 && !programSet) {
+          track.program = data1;
+          track.channel = channel;
+          programSet = true;
+        }
+      }
+    }
+    // Notes never released end with the track
+    for (auto &keyNotes : held) {
+      for (auto note : keyNotes.second) {
+        note.end = ticks;
+        track.notes.push_back(note);
+      }
+    }
+    if (!programSet && !track.notes.empty()) {
+      track.channel = track.notes.front().channel;
+    }
+  }
+
+  const std::vector<uint8_t> &mData;
+  size_t mPos{0};
+  uint32_t mChunkSize{0};
+};
+
+bool convertMidi(const std::string &path, BinaryScoreWriter &writer) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  std::vector<MidiTrack> tracks;
+  std::map<uint32_t, double> tempos;
+  int division = 480;
+  if (!MidiReader(data).read(tracks, tempos, division)) {
+    std::printf("Could not parse %s\n", path.c_str());
+    return false;
+  }
+
+  // Seconds per tick for each tempo segment. SMPTE divisions have a fixed
+  // tick rate and ignore tempo changes.
+  struct Segment {
+    uint32_t ticks;
+    double seconds;
+    double secondsPerTick;
+  };
+  std::vector<Segment> segments;
+  if (division & 0x8000) {
+    int fps = -int8_t(division >> 8);
+    int ticksPerFrame = division & 0xff;
+    segments.push_back({0, 0.0, 1.0 / (fps * ticksPerFrame)});
+    writer.ppq(0);
+  } else {
+    if (tempos.empty() || tempos.begin()->first != 0) {
+      tempos[0] = 120.0;
+    }
+    double seconds = 0.0;
+    for (auto &tempo : tempos) {
+      if (!segments.empty()) {
+        const Segment &last = segments.back();
+        seconds = last.seconds + (tempo.first - last.ticks) * last.secondsPerTick;
+      }
+      segments.push_back({tempo.first, seconds, 60.0 / (tempo.second * division)});
+      writer.addTempo(tempo.first, float(seconds), float(tempo.second));
+    }
+    writer.ppq(division);
+  }
+  auto toSeconds = [&segments](uint32_t ticks) {
+    size_t i = segments.size() - 1;
+    while (i > 0 && segments[i].ticks > ticks) {
+      i--;
+    }
+    return segments[i].seconds +
+           (ticks - segments[i].ticks) * segments[i].secondsPerTick;
+  };
+
+  for (auto &track : tracks) {
+    if (track.notes.empty()) {
+      continue;
+    }
+    int index = writer.addTrack(track.name, track.channel, track.program,
+                                track.channel == 9);
+    for (auto &note : track.notes) {
+      double start = toSeconds(note.start);
+      writer.addNote(index, float(start), float(toSeconds(note.end) - start),
+                     note.key, note.velocity / 127.0f);
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::printf("Usage: %s <input.json|input.mid> <output.score>\n", argv[0]);
+    return 1;
+  }
+  std::string input = argv[1];
+  std::string output = argv[2];
+  BinaryScoreWriter writer;
+  bool ok = (endsWith(input, ".mid") || endsWith(input, ".midi"))
+                ? convertMidi(input, writer)
+                : convertJson(input, writer);
+  if (!ok) {
+    std::printf("Could not convert %s\n", input.c_str());
+    return 1;
+  }
+  if (!writer.write(output)) {
+    std::printf("Could not write %s\n", output.c_str());
+    return 1;
+  }
+  std::printf("%s: %d tracks, %zu notes\n", output.c_str(), writer.numTracks(),
+              writer.numNotes());
+  return 0;
+}
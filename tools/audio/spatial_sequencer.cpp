@@ -7,12 +7,9 @@
 #include "al/io/al_Toml.hpp"
 #include "al/math/al_Spherical.hpp"
 #include "al/scene/al_DistributedScene.hpp"
-#include "al/sound/al_DownMixer.hpp"
-#include "al/sound/al_Lbap.hpp"
 #include "al/sound/al_Speaker.hpp"
 #include "al/sound/al_SpeakerAdjustment.hpp"
 #include "al/sphere/al_AlloSphereSpeakerLayout.hpp"
-#include "al/sphere/al_Meter.hpp"
 #include "al/sphere/al_SphereUtils.hpp"
 #include "al/ui/al_FileSelector.hpp"
 #include "al/ui/al_ParameterGUI.hpp"
@@ -23,10 +20,20 @@
 #include "Gamma/Analysis.h"
 #include "Gamma/scl.h"
 
+#include "../../tutorials/audiovisual/HoaSpatializer.h"
+#include "../../tutorials/audiovisual/ParallelVoices.h"
+#include "AudioWatchdog.h"
+#include "AutomationCurves.h"
+#include "BatchedLbap.h"
+#include "LevelMeter.h"
+#include "MatrixMixer.h"
+#include "SamplePool.h"
+#include "SceneSync.h"
+
 using namespace al;
 
 struct SharedState {
-  float meterValues[64] = {0};
+  uint8_t meterLevels[64] = {0};
 };
 
 struct MappedAudioFile {
@@ -40,49 +47,116 @@ struct MappedAudioFile {
 
 struct AudioObjectData {
   std::string rootPath;
-  uint16_t audioSampleRate;
-  uint16_t audioBlockSize;
+  SamplePool *samples;
+  AutomationLibrary *curves;
+  AutomationEngine *automation;
   Mesh *mesh;
 };
 
-class AudioObject : public PositionedVoice {
+class AudioObject : public PositionedVoice,
+                    public ParallelVoice,
+                    public SyncedVoice {
 public:
+  // Ranges of the parameters synced by SpatialSequencer::sceneSync
+  static constexpr float kGainMin = 0.0f, kGainMax = 4.0f;
+  static constexpr float kEnvMin = 0.00001f, kEnvMax = 10.0f;
+
   // Trigger Params
   ParameterString file{"audioFile", ""};            // in seconds
   ParameterString automation{"automationFile", ""}; // in seconds
 
   // Variable params
-  Parameter gain{"gain", "", 1.0, 0.0, 4.0};
+  Parameter gain{"gain", "", 1.0, kGainMin, kGainMax};
   ParameterBool mute{"mute", "", 0.0};
 
   // Internal
-  Parameter env{"env", "", 1.0, 0.00001, 10};
+  Parameter env{"env", "", 1.0, kEnvMin, kEnvMax};
 
   void init() override {
     registerTriggerParameters(file, automation, gain);
-    registerParameters(env);             // Propagate from audio rendering node
-    registerParameters(parameterPose()); // Update position in secondary nodes
+    // The pose, gain and env reach the secondary nodes through SceneSync
 
-    mSequencer << parameterPose();
-    mPresetHandler << parameterPose();
-    mSequencer << mPresetHandler; // For morphing
+    allocateBlock(1, kBlockFrames);
+    mBuffer.resize(size_t(kBlockFrames) * 2);
   }
 
-  void onProcess(AudioIOData &io) override {
-    float buffer[2048 * 60];
+  // Audio thread: take this block's values from the automation engine
+  void applyAutomation(const AutomationEngine &engine) {
+    const float *values =
+        engine.values(mAutomationPlayer.load(std::memory_order_acquire));
+    if (!values) {
+      return;
+    }
+    for (const AutomationTarget &target : mAutomationTargets) {
+      const float *v = values + target.offset;
+      if (target.parameter) {
+        target.parameter->set(v[0]);
+      } else {
+        Pose newPose = pose();
+        for (int d = 0; d < std::min(target.dimensions, 3); d++) {
+          newPose.pos()[d] = v[d];
+        }
+        if (target.dimensions >= 7) {
+          newPose.quat() = Quatd(v[3], v[4], v[5], v[6]).normalize();
+        }
+        setPose(newPose);
+      }
+    }
+  }
+
+  // Fields of SpatialSequencer::sceneSync
+  static void addSyncFields(SceneStateCodec &codec) {
+    codec.addField(kGainMin, kGainMax, 0.001f);
+    codec.addField(kEnvMin, kEnvMax, 0.001f);
+  }
+
+  void syncValues(float *values) override {
+    values[0] = gain;
+    values[1] = env;
+  }
+
+  void setSyncValues(const float *values, uint32_t changed) override {
+    if (changed & 1) {
+      gain = values[0];
+    }
+    if (changed & 2) {
+      env = values[1];
+    }
+  }
+
+  // Runs on a render worker, see ParallelVoices.h
+  void onRenderBlock(int frames) override {
     int numChannels = soundfile.channels();
-    assert(io.framesPerBuffer() < INT32_MAX);
-    auto framesRead =
-        soundfile.read(buffer, static_cast<int>(io.framesPerBuffer()));
-    int outIndex = 0;
     size_t inChannel = 0;
-    if (!mute) {
-      for (size_t sample = 0; sample < framesRead; sample++) {
-        io.outBuffer(outIndex)[sample] +=
-            gain * buffer[sample * numChannels + inChannel];
-        mEnvFollow(buffer[sample * numChannels + inChannel]);
+    float *out = block(0);
+    int sample = 0;
+    if (numChannels > 0 && !mute) {
+      // In pieces if the file has more channels than mBuffer was sized for
+      int chunk = std::max(1, int(mBuffer.size() / size_t(numChannels)));
+      while (sample < frames) {
+        int count = std::min(chunk, frames - sample);
+        int framesRead = int(soundfile.read(mBuffer.data(), count));
+        for (int i = 0; i < framesRead; i++) {
+          float in = mBuffer[size_t(i) * numChannels + inChannel];
+          out[sample + i] = gain * in;
+          mEnvFollow(in);
+        }
+        sample += framesRead;
+        if (framesRead < count) {
+          break;
+        }
       }
     }
+    std::fill(out + sample, out + frames, 0.0f);
+  }
+
+  void onProcess(AudioIOData &io) override {
+    useBlock(io);
+    int outIndex = 0;
+    const float *samples = block(0);
+    for (int sample = 0; sample < blockFrames(); sample++) {
+      io.outBuffer(outIndex)[sample] += samples[sample];
+    }
   }
 
   void onProcess(Graphics &g) override {
@@ -102,36 +176,103 @@ public:
 
     if (isPrimary()) {
       auto &rootPath = objData->rootPath;
-      soundfile.open(File::conformPathToOS(rootPath) + file.get());
-      if (!soundfile.opened()) {
+      // Starts from the preloaded beginning, without I/O
+      if (!soundfile.open(*objData->samples,
+                          File::conformPathToOS(rootPath) + file.get())) {
         std::cerr << "ERROR: opening audio file: "
                   << File::conformPathToOS(rootPath) + file.get() << std::endl;
       }
+      // The voice isn't rendered yet, so the read buffer can grow here
+      size_t needed = size_t(kBlockFrames) * soundfile.channels();
+      if (mBuffer.size() < needed) {
+        mBuffer.resize(needed);
+      }
 
-      float seqStep = (float)objData->audioBlockSize / objData->audioSampleRate;
-      mSequencer.setSequencerStepTime(seqStep);
-
-      mSequencer.playSequence(File::conformPathToOS(rootPath) +
-                              automation.get());
+      // Compiled once for all objects, see AutomationCurves.h
+      const AutomationCurves *curves = objData->curves->get(
+          File::conformPathToOS(rootPath) + automation.get());
+      if (curves) {
+        startAutomation(*objData->automation, *curves);
+      } else {
+        std::cerr << "ERROR: opening automation file: "
+                  << File::conformPathToOS(rootPath) + automation.get()
+                  << std::endl;
+      }
     }
     auto colorIndex = automation.get()[0] - 'A';
     c = HSV(colorIndex / 6.0f, 1.0f, 1.0f);
   }
 
+  // Runs on the sequencer's thread while render workers may still read
+  // the file, so playback only stops here. The file is closed in onFree().
   void onTriggerOff() override {
     if (isPrimary()) {
-      mPresetHandler.stopMorphing();
-      mSequencer.stopSequence();
-      soundfile.close();
+      stopAutomation();
+      soundfile.stop();
     }
   }
 
-  void onFree() override { soundfile.close(); }
+  // Audio thread, once the voice has left the active list. Stopping the
+  // automation doesn't lock and close() hands the stream to the pool's
+  // thread.
+  void onFree() override {
+    stopAutomation();
+    soundfile.close();
+  }
 
 private:
-  PresetSequencer mSequencer;
-  PresetHandler mPresetHandler{""};
-  SoundFileBuffered soundfile{8192};
+  static const int kBlockFrames = 2048;
+
+  // Where the values of a curve go, the pose if parameter is null
+  struct AutomationTarget {
+    Parameter *parameter;
+    int offset;
+    int dimensions;
+  };
+
+  void startAutomation(AutomationEngine &engine,
+                       const AutomationCurves &curves) {
+    stopAutomation();
+    mAutomationTargets.clear();
+    float initial[AutomationEngine::kMaxChannels];
+    for (const auto &curve : curves.curves()) {
+      if (curve.offset + curve.dimensions > AutomationEngine::kMaxChannels) {
+        break;
+      }
+      float *v = initial + curve.offset;
+      std::fill(v, v + curve.dimensions, 0.0f);
+      if (curve.address == "/" + parameterPose().getName() ||
+          curve.address == parameterPose().getFullAddress()) {
+        const Pose &current = pose();
+        float values[7] = {float(current.x()),      float(current.y()),
+                           float(current.z()),      float(current.quat().w),
+                           float(current.quat().x), float(current.quat().y),
+                           float(current.quat().z)};
+        std::copy_n(values, std::min(curve.dimensions, 7), v);
+        mAutomationTargets.push_back({nullptr, curve.offset, curve.dimensions});
+      } else if (curve.address == "/" + gain.getName() ||
+                 curve.address == gain.getFullAddress()) {
+        v[0] = gain.get();
+        mAutomationTargets.push_back({&gain, curve.offset, curve.dimensions});
+      }
+    }
+    mAutomationEngine = &engine;
+    mAutomationPlayer.store(engine.start(&curves, initial),
+                            std::memory_order_release);
+  }
+
+  void stopAutomation() {
+    int player = mAutomationPlayer.exchange(-1, std::memory_order_acq_rel);
+    if (player >= 0 && mAutomationEngine) {
+      mAutomationEngine->stop(player);
+    }
+  }
+
+  AutomationEngine *mAutomationEngine{nullptr};
+  std::atomic<int> mAutomationPlayer{-1};
+  std::vector<AutomationTarget> mAutomationTargets;
+  PooledSoundFile soundfile;
+  std::vector<float> mBuffer; // Interleaved frames read from soundfile
   Color c;
 
   gam::EnvFollow<> mEnvFollow;
@@ -140,6 +281,16 @@ private:
 class SpatialSequencer : public DistributedAppWithState<SharedState> {
 public:
   std::string rootDir{""};
+  // Shared by all objects, and declared before the scene so they outlive
+  // them. The beginnings of the sound files in rootDir:
+  SamplePool samplePool;
+  // Object automation, compiled once and played for all objects per block:
+  AutomationLibrary automationLibrary;
+  AutomationEngine automationEngine;
+  // Object poses and levels for the secondary nodes, once per frame:
+  SceneSync sceneSync;
+  // 3 to 5 spatializes through an Ambisonics bus of that order, 0 with LBAP
+  int ambisonicOrder{0};
 
   DistributedScene scene{"spatial_sequencer", 0,
                          TimeMasterMode::TIME_MASTER_UPDATE};
@@ -147,7 +298,9 @@ public:
   ParameterBool downMix{"downMix"};
 
   PersistentConfig config;
-  DownMixer downMixer;
+  MatrixMixer downMixer;
+  std::vector<int> stereoOutputs{0, 1};
+  ParallelVoiceRenderer voiceRenderer;
 
   void setPath(std::string path) {
     rootDir = al::File::conformDirectory(path);
@@ -158,20 +311,39 @@ public:
     // Prepare scene shared data
     mObjectData.mesh = &this->mObjectMesh;
     mObjectData.rootPath = rootDir;
-    mObjectData.audioSampleRate = audioIO().framesPerSecond();
-    mObjectData.audioBlockSize = audioIO().framesPerBuffer();
+    mObjectData.samples = &samplePool;
+    mObjectData.curves = &automationLibrary;
+    mObjectData.automation = &automationEngine;
+    if (isPrimary()) {
+      // Only the primary plays the files and their automation
+      samplePool.preload(rootDir);
+      automationLibrary.compileDirectory(rootDir);
+    }
     scene.setDefaultUserData(&mObjectData);
+    AudioObject::addSyncFields(sceneSync.codec());
+    if (!isPrimary()) {
+      sceneSync.receive(parameterServer());
+    }
 
     if (al::sphere::isSimulatorMachine()) {
     }
     auto sl = al::AlloSphereSpeakerLayoutCompensated();
-    mSpatializer = scene.setSpatializer<Lbap>(sl);
+    if (ambisonicOrder >= 5) {
+      mSpatializer = scene.setSpatializer<HoaSpatializerOrder<5>>(sl);
+    } else if (ambisonicOrder == 4) {
+      mSpatializer = scene.setSpatializer<HoaSpatializerOrder<4>>(sl);
+    } else if (ambisonicOrder > 0) {
+      mSpatializer = scene.setSpatializer<HoaSpatializerOrder<3>>(sl);
+    } else {
+      mSpatializer = scene.setSpatializer<BatchedLbap>(sl);
+    }
 
     audioIO().channelsOut(60);
     audioIO().print();
 
-    downMixer.layoutToStereo(sl, audioIO());
-    downMixer.setStereoOutput();
+    audioIO().channelsBus(2);
+    downMixer.configure(audioIO().channelsOut(), 2);
+    setLayoutToStereo(downMixer, sl);
 
     mSequencer << scene;
 
@@ -187,8 +359,6 @@ public:
       gui.drawFunction = [&]() {
         if (ParameterGUI::drawAudioIO(audioIO())) {
           scene.prepare(audioIO());
-          mObjectData.audioSampleRate = audioIO().framesPerSecond();
-          mObjectData.audioBlockSize = audioIO().framesPerBuffer();
         }
       };
     }
@@ -205,13 +375,15 @@ public:
   }
 
   void onAnimate(double dt) override {
+    AudioWatchdog::report();
     mSequencer.update(dt);
     if (isPrimary()) {
-      auto &values = mMeter.getMeterValues();
-      assert(values.size() < 65);
-      memcpy(state().meterValues, values.data(), values.size() * sizeof(float));
+      mMeter.update(dt);
+      mMeter.quantize(state().meterLevels, 64);
+      sceneSync.send(scene.getActiveVoices(), parameterServer());
     } else {
-      mMeter.setMeterValues(state().meterValues, 64);
+      mMeter.setQuantized(state().meterLevels, 64);
+      sceneSync.apply(scene.getActiveVoices());
     }
   }
 
@@ -237,10 +409,22 @@ public:
   }
 
   void onSound(AudioIOData &io) override {
+    // Checks this callback when AL_AUDIO_WATCHDOG is set
+    AudioWatchdog::Callback watchdog(io);
+    // Move every automated object to where it is at this block
+    automationEngine.process(io.framesPerBuffer() / io.framesPerSecond());
+    for (SynthVoice *voice = scene.getActiveVoices(); voice;
+         voice = voice->next) {
+      if (auto *object = dynamic_cast<AudioObject *>(voice)) {
+        object->applyAutomation(automationEngine);
+      }
+    }
+    // Object audio is rendered on all cores, then spatialized by the scene
+    voiceRenderer.render(scene.getActiveVoices(), io.framesPerBuffer());
     mSequencer.render(io);
     mMeter.processSound(io);
     // downmix to stereo to bus 0 and 1
-    downMixer.downMixToBus(io);
+    downMixer.outsToBuses(io);
     // This can be used to create a global reverb
     while (io()) {
       float lfeLevel = 0.1;
@@ -248,11 +432,11 @@ public:
       io.out(47) += io.bus(1) * lfeLevel;
     }
     if (downMix) {
-      downMixer.copyBusToOuts(io);
+      MatrixMixer::busesToOuts(io, stereoOutputs);
     }
   }
 
-  void onExit() override {}
+  void onExit() override { AudioWatchdog::summary(); }
 
 private:
   VAOMesh mObjectMesh;
@@ -261,7 +445,7 @@ private:
   SynthSequencer mSequencer{TimeMasterMode::TIME_MASTER_CPU};
   AudioObjectData mObjectData;
   SpeakerDistanceGainAdjustmentProcessor gainAdjustment;
-  Meter mMeter;
+  SpeakerMeter mMeter;
   std::shared_ptr<Spatializer> mSpatializer;
 };
 
@@ -275,6 +459,9 @@ int main(int argc, char *argv[]) {
     folder = "Morris Allosphere piece";
   }
   app.setPath(folder);
+  if (argc > 2) {
+    app.ambisonicOrder = std::atoi(argv[2]);
+  }
 
   app.start();
   return 0;
@@ -10,7 +10,6 @@
 #include "al/math/al_Spherical.hpp"
 #include "al/scene/al_DistributedScene.hpp"
 #include "al/sound/al_DownMixer.hpp"
-#include "al/sound/al_Lbap.hpp"
 #include "al/sound/al_Speaker.hpp"
 #include "al/sound/al_SpeakerAdjustment.hpp"
 #include "al/sphere/al_AlloSphereSpeakerLayout.hpp"
@@ -26,10 +25,15 @@
 #include "Gamma/Noise.h"
 #include "Gamma/scl.h"
 
+#include "AudioWatchdog.h"
+#include "BatchedLbap.h"
+#include "LevelMeter.h"
+#include "SceneSync.h"
+
 using namespace al;
 
 struct SharedState {
-  float meterValues[64] = {0};
+  uint8_t meterLevels[64] = {0};
   Pose pose;
 };
 
@@ -39,100 +43,14 @@ struct AudioObjectData {
   Mesh *mesh;
 };
 
-class Meter {
+class AudioObject : public PositionedVoice, public SyncedVoice {
 public:
-  void init(const Speakers &sl) {
-    addCube(mMesh);
-    mSl = sl;
-  }
-
-  void processSound(AudioIOData &io) {
-
-    if (tempValues.size() != io.channelsOut()) {
-      tempValues.resize(io.channelsOut());
-      values.resize(io.channelsOut());
-      std::cout << "Resizing Meter buffers" << std::endl;
-    }
-    for (int i = 0; i < io.channelsOut(); i++) {
-      tempValues[i] = FLT_MIN;
-      auto *outBuf = io.outBuffer(i);
-      auto fpb = io.framesPerBuffer();
-      for (int samp = 0; samp < fpb; samp++) {
-        float val = fabs(*outBuf);
-        if (tempValues[i] < val) {
-          tempValues[i] = val;
-        }
-        outBuf++;
-      }
-      if (tempValues[i] == 0) {
-        tempValues[i] = 0.01;
-      } else {
-        float db = 20.0 * log10(tempValues[i]);
-        if (db < -60) {
-          tempValues[i] = 0.01;
-        } else {
-          tempValues[i] = 0.01 + 0.005 * (60 + db);
-        }
-      }
-      if (values[i] > tempValues[i]) {
-        values[i] = values[i] - 0.05 * (values[i] - tempValues[i]);
-      } else {
-        values[i] = tempValues[i];
-      }
-    }
-  }
-
-  void draw(Graphics &g) {
-    g.polygonLine();
-    int index = 0;
-    auto spkrIt = mSl.begin();
-    g.color(1);
-    for (const auto &v : values) {
-      if (spkrIt != mSl.end()) {
-        // FIXME assumes speakers are sorted by device channel index
-        // Should sort inside init()
-        if (spkrIt->deviceChannel == index) {
-          g.pushMatrix();
-          g.scale(1 / 5.0f);
-          g.translate(spkrIt->vecGraphics());
-          g.scale(0.1 + v * 5);
-          g.draw(mMesh);
-          g.popMatrix();
-          spkrIt++;
-        }
-      } else {
-        spkrIt = mSl.begin();
-      }
-      index++;
-    }
-  }
-
-  const std::vector<float> &getMeterValues() { return values; }
+  // Ranges of the parameters synced by SpatialSequencer::sceneSync
+  static constexpr float kGainMin = 0.0f, kGainMax = 4.0f;
+  static constexpr float kEnvMin = 0.00001f, kEnvMax = 10.0f;
 
-  void setMeterValues(float *newValues, size_t count) {
-    if (tempValues.size() != count) {
-      tempValues.resize(count);
-      values.resize(count);
-      std::cout << "Resizing Meter buffers" << std::endl;
-    }
-    count = values.size();
-    for (int i = 0; i < count; i++) {
-      values[i] = *newValues;
-      newValues++;
-    }
-  }
-
-private:
-  Mesh mMesh;
-  std::vector<float> values;
-  std::vector<float> tempValues;
-  Speakers mSl;
-};
-
-class AudioObject : public PositionedVoice {
-public:
   // Variable params
-  Parameter gain{"gain", "", 1.0, 0.0, 4.0};
+  Parameter gain{"gain", "", 1.0, kGainMin, kGainMax};
   Parameter azimuth{"azimuth", "", 0, 0, M_2PI};
   Parameter elev{"elevation", "", 0, -M_PI_2, M_PI_2};
 
@@ -142,7 +60,7 @@ public:
   ParameterColor c{"color"};
 
   // Internal
-  Parameter env{"env", "", 1.0, 0.00001, 10};
+  Parameter env{"env", "", 1.0, kEnvMin, kEnvMax};
   Parameter hue{"hue", "", 0.0, 0.0, 1.0};
 
   gam::NoiseWhite<> noise;
@@ -151,8 +69,8 @@ public:
 
   void init() override {
     registerTriggerParameters(gain, hue, parameterPose());
-    registerParameters(env, c);          // Propagate from audio rendering node
-    registerParameters(parameterPose()); // Update position in secondary nodes
+    // The pose, gain, env and color reach the secondary nodes through
+    // SceneSync
     mEnv.decay(0.5);
     hue.setSynchronousCallbacks(false);
     azimuth.registerChangeCallback([this](float value) {
@@ -191,6 +109,36 @@ public:
     }
   }
 
+  // Fields of SpatialSequencer::sceneSync
+  static void addSyncFields(SceneStateCodec &codec) {
+    codec.addField(kGainMin, kGainMax, 0.001f);
+    codec.addField(kEnvMin, kEnvMax, 0.001f);
+    codec.addField(0.0f, 1.0f, 0.0f, 8); // color
+    codec.addField(0.0f, 1.0f, 0.0f, 8);
+    codec.addField(0.0f, 1.0f, 0.0f, 8);
+  }
+
+  void syncValues(float *values) override {
+    Color color = c.get();
+    values[0] = gain;
+    values[1] = env;
+    values[2] = color.r;
+    values[3] = color.g;
+    values[4] = color.b;
+  }
+
+  void setSyncValues(const float *values, uint32_t changed) override {
+    if (changed & 1) {
+      gain = values[0];
+    }
+    if (changed & 2) {
+      env = values[1];
+    }
+    if (changed & (4 | 8 | 16)) {
+      c = Color(values[2], values[3], values[4]);
+    }
+  }
+
   void onProcess(AudioIOData &io) override {
     while (io()) {
       io.out(0) = noise() * gain * mEnv();
@@ -231,6 +179,8 @@ public:
                          TimeMasterMode::TIME_MASTER_GRAPHICS};
 
   PersistentConfig config;
+  // Voice poses, levels and colors for the secondary nodes, once per frame
+  SceneSync sceneSync;
 
   void setPath(std::string path) {
     rootDir = path;
@@ -243,9 +193,13 @@ public:
     mObjectData.audioSampleRate = audioIO().framesPerSecond();
     mObjectData.audioBlockSize = audioIO().framesPerBuffer();
     scene.setDefaultUserData(&mObjectData);
+    AudioObject::addSyncFields(sceneSync.codec());
+    if (!isPrimary()) {
+      sceneSync.receive(parameterServer());
+    }
 
     auto sl = al::AlloSphereSpeakerLayoutCompensated();
-    mSpatializer = scene.setSpatializer<Lbap>(sl);
+    mSpatializer = scene.setSpatializer<BatchedLbap>(sl);
 
     audioIO().channelsOut(60);
     audioIO().print();
@@ -300,15 +254,17 @@ public:
   }
 
   void onAnimate(double dt) override {
+    AudioWatchdog::report();
     mSequencer.update(dt);
     if (isPrimary()) {
-      auto &values = mMeter.getMeterValues();
-      assert(values.size() < 65);
-      memcpy(state().meterValues, values.data(), values.size() * sizeof(float));
+      mMeter.update(dt);
+      mMeter.quantize(state().meterLevels, 64);
       state().pose = nav();
+      sceneSync.send(scene.getActiveVoices(), parameterServer());
     } else {
-      mMeter.setMeterValues(state().meterValues, 64);
+      mMeter.setQuantized(state().meterLevels, 64);
       nav().set(state().pose);
+      sceneSync.apply(scene.getActiveVoices());
     }
   }
 
@@ -334,6 +290,8 @@ public:
   }
 
   void onSound(AudioIOData &io) override {
+    // Checks this callback when AL_AUDIO_WATCHDOG is set
+    AudioWatchdog::Callback watchdog(io);
     if (isPrimary()) {
     mSequencer.render(io);
     mMeter.processSound(io);
@@ -354,7 +312,7 @@ public:
     return true;
   }
 
-  void onExit() override {}
+  void onExit() override { AudioWatchdog::summary(); }
 
 private:
   VAOMesh mObjectMesh;
@@ -363,7 +321,7 @@ private:
   SynthSequencer mSequencer{TimeMasterMode::TIME_MASTER_CPU};
   AudioObjectData mObjectData;
   SpeakerDistanceGainAdjustmentProcessor gainAdjustment;
-  Meter mMeter;
+  SpeakerMeter mMeter;
   std::shared_ptr<Spatializer> mSpatializer;
 };
 
@@ -22,15 +22,14 @@
 #include "al/ui/al_ControlGUI.hpp"
 #include "al/ui/al_Parameter.hpp"
 
+#include "VoiceParameters.h"
+#include "WavetableCache.h"
+
 // using namespace gam;
 using namespace al;
 using namespace std;
 #define FFT_SIZE 4048
 
-// tables for oscillator
-gam::ArrayPow2<float> tbSaw(2048), tbSqr(2048), tbImp(2048), tbSin(2048),
-    tbPls(2048), tb__1(2048), tb__2(2048), tb__3(2048), tb__4(2048);
-
 class FMWT : public SynthVoice
 {
 public:
@@ -42,7 +41,7 @@ public:
   gam::ADSR<> mVibEnv;
 
   gam::Sine<> mod, mVib; // carrier, modulator sine oscillators
-  gam::Osc<> car;
+  WavetableOsc car;
   double a = 0;
   double b = 0;
   double timepose = 10;
@@ -51,6 +50,11 @@ public:
   float mVibDepth;
   float mVibRise;
   int mtable;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pFreq, pAmplitude, pAttackTime, pReleaseTime, pSustain, pIdx1,
+      pIdx2, pIdx3, pCarMul, pModMul, pVibRate1, pVibRate2, pVibRise,
+      pVibDepth, pPan, pTable;
   static const int numb_waveform = 9;
   Mesh mMesh[numb_waveform];
   bool wireframe = false;
@@ -65,40 +69,47 @@ public:
     mAmpEnv.sustainPoint(2);
 
     // We have the mesh be a sphere
-    createInternalTriggerParameter("freq", 440, 10, 4000.0);
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 0.3, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0);
+    pFreq = mParams.add(createInternalTriggerParameter("freq", 440, 10, 4000.0));
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 0.3, 0.1, 10.0));
+    pSustain = mParams.add(
+        createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0));
 
     // FM index
-    createInternalTriggerParameter("idx1", 0.01, 0.0, 10.0);
-    createInternalTriggerParameter("idx2", 7, 0.0, 10.0);
-    createInternalTriggerParameter("idx3", 5, 0.0, 10.0);
-
-    createInternalTriggerParameter("carMul", 1, 0.0, 20.0);
-    createInternalTriggerParameter("modMul", 1.0007, 0.0, 20.0);
-
-    createInternalTriggerParameter("vibRate1", 0.01, 0.0, 10.0);
-    createInternalTriggerParameter("vibRate2", 0.5, 0.0, 10.0);
-    createInternalTriggerParameter("vibRise", 0, 0.0, 10.0);
-    createInternalTriggerParameter("vibDepth", 0, 0.0, 10.0);
-
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-    createInternalTriggerParameter("table", 0, 0, 8);
+    pIdx1 = mParams.add(createInternalTriggerParameter("idx1", 0.01, 0.0, 10.0));
+    pIdx2 = mParams.add(createInternalTriggerParameter("idx2", 7, 0.0, 10.0));
+    pIdx3 = mParams.add(createInternalTriggerParameter("idx3", 5, 0.0, 10.0));
+
+    pCarMul = mParams.add(createInternalTriggerParameter("carMul", 1, 0.0, 20.0));
+    pModMul = mParams.add(
+        createInternalTriggerParameter("modMul", 1.0007, 0.0, 20.0));
+
+    pVibRate1 = mParams.add(
+        createInternalTriggerParameter("vibRate1", 0.01, 0.0, 10.0));
+    pVibRate2 = mParams.add(
+        createInternalTriggerParameter("vibRate2", 0.5, 0.0, 10.0));
+    pVibRise = mParams.add(
+        createInternalTriggerParameter("vibRise", 0, 0.0, 10.0));
+    pVibDepth = mParams.add(
+        createInternalTriggerParameter("vibDepth", 0, 0.0, 10.0));
+
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+    pTable = mParams.add(createInternalTriggerParameter("table", 0, 0, 8));
 
     // Table & Visual meshes
+    // Tables are shared by all voices, only the first init() builds them
+    car.source(waveTable(0));
     // Now We have the mesh according to the waveform
-    gam::addSinesPow<1>(tbSaw, 9, 1);
     addCone(mMesh[0],1, Vec3f(0,0,5), 40, 1); //tbSaw
 
-    gam::addSinesPow<1>(tbSqr, 9, 2);
     addCube(mMesh[1]);  // tbSquare
 
-    gam::addSinesPow<0>(tbImp, 9, 1);
     addPrism(mMesh[2],1,1,1,100); // tbImp
 
-    gam::addSine(tbSin);
     addSphere(mMesh[3], 0.3, 16, 100); // tbSin
 
 // About: addSines (dst, amps, cycs, numh)
@@ -110,14 +121,11 @@ public:
     float hscaler = 1;
 
     { //tbPls
-      float A[] = {1, 1, 1, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tbPls, A, 8); 
       addWireBox(mMesh[4],2);    // tbPls
     }
     { // tb__1 
       float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08, 0, 0};
       float C[] = {1, 4, 7, 11, 15, 18, 0, 0 };
-      gam::addSines(tb__1, A, C, 6);
       for (int i = 0; i < 7; i++){
         addWireBox(mMesh[5], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
 
@@ -127,7 +135,6 @@ public:
     { // inharmonic partials
       float A[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
       float C[] = {3, 4, 7, 8, 11, 12, 15, 16}; 
-      gam::addSines(tb__2, A, C, 8); // tb__2
       for (int i = 0; i < 7; i++){
         addWireBox(mMesh[6], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
       }
@@ -135,14 +142,12 @@ public:
     { // inharmonic partials
       float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08, 0 , 0};
       float C[] = {10, 27, 54, 81, 108, 135, 0, 0};
-      gam::addSines(tb__3, A, C, 6); // tb__3
       for (int i = 0; i < 7; i++){
         addWireBox(mMesh[7], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
       }
     }
   { // harmonics 20-27
       float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tb__4, A, 8, 20); // tb__4
       for (int i = 0; i < 7; i++){
         addWireBox(mMesh[8], hscaler * A[i], hscaler * A[i+1], 1 + 0.3*i);
       }
@@ -169,11 +174,13 @@ public:
   //
   void onProcess(AudioIOData &io) override
   {
+    if (mParams.snapshot()) {
+      updateFromParameters();
+    }
     mVib.freq(mVibEnv());
-    float carBaseFreq =
-        getInternalParameterValue("freq") * getInternalParameterValue("carMul");
-    float modScale = getInternalParameterValue("freq") * getInternalParameterValue("modMul");
-    float amp = getInternalParameterValue("amplitude") * 0.01;
+    float carBaseFreq = mParams[pFreq] * mParams[pCarMul];
+    float modScale = mParams[pFreq] * mParams[pModMul];
+    float amp = mParams[pAmplitude] * 0.01;
     while (io())
     {
       mVib.freq(mVibEnv());
@@ -195,19 +202,21 @@ public:
     a += 0.29;
     b += 0.23;
     timepose -= 0.06;
-    int shape = getInternalParameterValue("table");
+    int shape = mParams.live(pTable);
     g.polygonMode(wireframe ? GL_LINE : GL_FILL);
     // light.pos(0, 0, 0);
     gl::depthTesting(true);
     g.pushMatrix();
     g.depthTesting(true);
     g.lighting(true);
-    g.translate(timepose, getInternalParameterValue("freq") / 200 - 3, -4);
+    g.translate(timepose, mParams.live(pFreq) / 200 - 3, -4);
     g.rotate(mVib() + a, Vec3f(0, 1, 0));
     g.rotate(mVib() * mVibDepth + b, Vec3f(1));
-    float scaling = getInternalParameterValue("amplitude") * 10;
-    g.scale(scaling + getInternalParameterValue("modMul") / 2, scaling + getInternalParameterValue("carMul") / 20, scaling + mEnvFollow.value() * 5);
-    g.color(HSV(getInternalParameterValue("modMul") / 20, getInternalParameterValue("carMul") / 20, 0.5 + getInternalParameterValue("attackTime")));
+    float scaling = mParams.live(pAmplitude) * 10;
+    float modMul = mParams.live(pModMul);
+    float carMul = mParams.live(pCarMul);
+    g.scale(scaling + modMul / 2, scaling + carMul / 20, scaling + mEnvFollow.value() * 5);
+    g.color(HSV(modMul / 20, carMul / 20, 0.5 + mParams.live(pAttackTime)));
     g.draw(mMesh[shape]);
     g.popMatrix();
   }
@@ -220,12 +229,10 @@ public:
     mModEnv.reset();
     mVib.phase(0);
     mod.phase(0);
+    mParams.invalidate();
+    mParams.snapshot();
     updateFromParameters();
     updateWaveform();
-
-    float modFreq =
-        getInternalParameterValue("freq") * getInternalParameterValue("modMul");
-    mod.freq(modFreq);
   }
   void onTriggerOff() override
   {
@@ -234,62 +241,48 @@ public:
     mVibEnv.triggerRelease();
   }
 
+  // Apply the parameters that changed in the last snapshot
   void updateFromParameters()
   {
-    mModEnv.levels()[0] = getInternalParameterValue("idx1");
-    mModEnv.levels()[1] = getInternalParameterValue("idx2");
-    mModEnv.levels()[2] = getInternalParameterValue("idx2");
-    mModEnv.levels()[3] = getInternalParameterValue("idx3");
-
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-
-    mModEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mModEnv.lengths()[3] = getInternalParameterValue("releaseTime");
-
-    mVibEnv.levels(getInternalParameterValue("vibRate1"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate1"));
-    mVibEnv.lengths()[0] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[1] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[3] = getInternalParameterValue("vibRise");
-    mVibDepth = getInternalParameterValue("vibDepth");
-    
-    mPan.pos(getInternalParameterValue("pan"));
+    if (mParams.changed(pFreq | pModMul))
+    {
+      mod.freq(mParams[pFreq] * mParams[pModMul]);
+    }
+    if (mParams.changed(pIdx1 | pIdx2 | pIdx3))
+    {
+      mModEnv.levels()[0] = mParams[pIdx1];
+      mModEnv.levels()[1] = mParams[pIdx2];
+      mModEnv.levels()[2] = mParams[pIdx2];
+      mModEnv.levels()[3] = mParams[pIdx3];
+    }
+    if (mParams.changed(pAttackTime | pReleaseTime | pSustain))
+    {
+      mAmpEnv.attack(mParams[pAttackTime]);
+      mAmpEnv.release(mParams[pReleaseTime]);
+      mAmpEnv.sustain(mParams[pSustain]);
+
+      mModEnv.lengths()[0] = mParams[pAttackTime];
+      mModEnv.lengths()[3] = mParams[pReleaseTime];
+    }
+    if (mParams.changed(pVibRate1 | pVibRate2 | pVibRise | pVibDepth))
+    {
+      mVibEnv.levels(mParams[pVibRate1], mParams[pVibRate2],
+                     mParams[pVibRate2], mParams[pVibRate1]);
+      mVibEnv.lengths()[0] = mParams[pVibRise];
+      mVibEnv.lengths()[1] = mParams[pVibRise];
+      mVibEnv.lengths()[3] = mParams[pVibRise];
+      mVibDepth = mParams[pVibDepth];
+    }
+    if (mParams.changed(pPan))
+    {
+      mPan.pos(mParams[pPan]);
+    }
   }
   void updateWaveform(){
-        // Map table number to table in memory
-    switch (int(getInternalParameterValue("table"))) {
-      case 0:
-        car.source(tbSaw);
-        break;
-      case 1:
-        car.source(tbSqr);
-        break;
-      case 2:
-        car.source(tbImp);
-        break;
-      case 3:
-        car.source(tbSin);
-        break;
-      case 4:
-        car.source(tbPls);
-        break;
-      case 5:
-        car.source(tb__1);
-        break;
-      case 6:
-        car.source(tb__2);
-        break;
-      case 7:
-        car.source(tb__3);
-        break;
-      case 8:
-        car.source(tb__4);
-        break;
-    }
+    // Map table number to table in memory
+    int table = std::max(0, std::min(int(mParams[pTable]),
+                                     WavetableCache::kStandardTables - 1));
+    car.source(waveTable(table));
   }
 
 
@@ -377,7 +370,8 @@ public:
     synthManager.drawSynthControlPanel();
     imguiEndFrame();
     // Map table number to table in memory
-    fmwt.mtable = int(synthManager.voice()->getInternalParameterValue("table"));
+    FMWT *voice = synthManager.voice();
+    fmwt.mtable = int(voice->mParams.live(voice->pTable));
   }
 
   void onDraw(Graphics &g) override
@@ -24,6 +24,8 @@
 #include "al/io/al_MIDI.hpp"
 #include "al/math/al_Random.hpp"
 
+#include "VoiceParameters.h"
+
 // using namespace gam;
 using namespace al;
 using namespace std;
@@ -49,6 +51,11 @@ public:
     gam::ADSR<> mAmpEnv;
     gam::EnvFollow<> mEnvFollow; // envelope follower to connect audio output to graphics
 
+    // Parameters resolved once in init() and snapshotted per audio block
+    VoiceParameters mParams;
+    ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+        pCurve, pPan, pTable, pTrm1, pTrm2, pTrmRise, pTrmDepth;
+
     // Additional members
     int mtable;
     static const int numb_waveform = 9;
@@ -66,18 +73,26 @@ public:
         mAmpEnv.levels(0, 0.3, 0.3, 0); // These tables are not normalized, so scale to 0.3
         mTrmEnv.curve(0);
         mTrmEnv.levels(0, 1, 1, 0);
-        createInternalTriggerParameter("amplitude", 0.03, 0.0, 1.0);
-        createInternalTriggerParameter("frequency", 60, 20, 5000);
-        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-        createInternalTriggerParameter("releaseTime", 2.0, 0.1, 10.0);
-        createInternalTriggerParameter("sustain", 0.6, 0.0, 1.0);
-        createInternalTriggerParameter("curve", 4.0, -10.0, 10.0);
-        createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-        createInternalTriggerParameter("table", 0, 0, 8);
-        createInternalTriggerParameter("trm1", 3.5, 0.2, 20);
-        createInternalTriggerParameter("trm2", 5.8, 0.2, 20);
-        createInternalTriggerParameter("trmRise", 0.5, 0.1, 2);
-        createInternalTriggerParameter("trmDepth", 0.1, 0.0, 1.0);
+        pAmplitude = mParams.add(
+            createInternalTriggerParameter("amplitude", 0.03, 0.0, 1.0));
+        pFrequency = mParams.add(
+            createInternalTriggerParameter("frequency", 60, 20, 5000));
+        pAttackTime = mParams.add(
+            createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+        pReleaseTime = mParams.add(
+            createInternalTriggerParameter("releaseTime", 2.0, 0.1, 10.0));
+        pSustain = mParams.add(
+            createInternalTriggerParameter("sustain", 0.6, 0.0, 1.0));
+        pCurve = mParams.add(
+            createInternalTriggerParameter("curve", 4.0, -10.0, 10.0));
+        pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+        pTable = mParams.add(createInternalTriggerParameter("table", 0, 0, 8));
+        pTrm1 = mParams.add(createInternalTriggerParameter("trm1", 3.5, 0.2, 20));
+        pTrm2 = mParams.add(createInternalTriggerParameter("trm2", 5.8, 0.2, 20));
+        pTrmRise = mParams.add(
+            createInternalTriggerParameter("trmRise", 0.5, 0.1, 2));
+        pTrmDepth = mParams.add(
+            createInternalTriggerParameter("trmDepth", 0.1, 0.0, 1.0));
 
         // Table & Visual meshes
         // Now We have the mesh according to the waveform
@@ -166,10 +181,12 @@ public:
     //
     virtual void onProcess(AudioIOData &io) override
     {
-        // updateFromParameters();
-        float oscFreq = getInternalParameterValue("frequency");
-        float amp = getInternalParameterValue("amplitude");
-        float trmDepth = getInternalParameterValue("trmDepth");
+        if (mParams.snapshot())
+        {
+            updateFromParameters();
+        }
+        float amp = mParams[pAmplitude];
+        float trmDepth = mParams[pTrmDepth];
         while (io())
         {
 
@@ -195,8 +212,8 @@ public:
         a_rotate += 0.81;
         b_rotate += 0.78;
         timepose -= 0.06;
-        float frequency = getInternalParameterValue("frequency");
-        int shape = getInternalParameterValue("table");
+        float frequency = mParams.live(pFrequency);
+        int shape = mParams.live(pTable);
 
         // static Light light;
         g.polygonMode(wireframe ? GL_LINE : GL_FILL);
@@ -206,7 +223,7 @@ public:
         // g.light(light);
         g.pushMatrix();
         g.depthTesting(true);
-        g.translate(timepose, getInternalParameterValue("frequency") / 200 - 3, -4);
+        g.translate(timepose, frequency / 200 - 3, -4);
         g.rotate(a_rotate, Vec3f(0, 1, 1));
         g.rotate(b_rotate, Vec3f(1));
         g.scale(0.2 + mAmpEnv() * 0.2 + 0.01 * mTrm(), 0.3 + mAmpEnv() * 0.5 + 0.01 * mTrm(), 0.1 + 0.01 * mTrm());
@@ -222,6 +239,8 @@ public:
         mAmpEnv.reset();
         mTrmEnv.reset();
         mTrm.phase(0); 
+        mParams.invalidate();
+        mParams.snapshot();
         updateFromParameters();
         updateWaveform();
         timepose = 10;
@@ -233,29 +252,39 @@ public:
         mTrmEnv.triggerRelease();
     }
 
+    // Apply the parameters that changed in the last snapshot
     void updateFromParameters()
     {
-        mOsc.freq(getInternalParameterValue("frequency"));
-        mAmpEnv.attack(getInternalParameterValue("attackTime"));
-        mAmpEnv.decay(getInternalParameterValue("attackTime"));
-        mAmpEnv.release(getInternalParameterValue("releaseTime"));
-        mAmpEnv.sustain(getInternalParameterValue("sustain"));
-        mAmpEnv.curve(getInternalParameterValue("curve"));
-        mPan.pos(getInternalParameterValue("pan"));
-
-        mTrmEnv.levels(getInternalParameterValue("trm1"),
-                       getInternalParameterValue("trm2"),
-                       getInternalParameterValue("trm2"),
-                       getInternalParameterValue("trm1"));
-
-        mTrmEnv.attack(getInternalParameterValue("trmRise"));
-        mTrmEnv.decay(getInternalParameterValue("trmRise"));
-        mTrmEnv.release(getInternalParameterValue("trmRise"));
+        if (mParams.changed(pFrequency))
+        {
+            mOsc.freq(mParams[pFrequency]);
+        }
+        if (mParams.changed(pAttackTime | pReleaseTime | pSustain | pCurve))
+        {
+            mAmpEnv.attack(mParams[pAttackTime]);
+            mAmpEnv.decay(mParams[pAttackTime]);
+            mAmpEnv.release(mParams[pReleaseTime]);
+            mAmpEnv.sustain(mParams[pSustain]);
+            mAmpEnv.curve(mParams[pCurve]);
+        }
+        if (mParams.changed(pPan))
+        {
+            mPan.pos(mParams[pPan]);
+        }
+        if (mParams.changed(pTrm1 | pTrm2 | pTrmRise))
+        {
+            mTrmEnv.levels(mParams[pTrm1], mParams[pTrm2], mParams[pTrm2],
+                           mParams[pTrm1]);
+
+            mTrmEnv.attack(mParams[pTrmRise]);
+            mTrmEnv.decay(mParams[pTrmRise]);
+            mTrmEnv.release(mParams[pTrmRise]);
+        }
     }
     void updateWaveform()
     {
         // Map table number to table in memory
-        switch (int(getInternalParameterValue("table")))
+        switch (int(mParams[pTable]))
         {
         case 0:
             mOsc.source(tbSaw);
@@ -365,7 +394,8 @@ public:
         synthManager.drawSynthControlPanel();
         imguiEndFrame();
         // Map table number to table in memory
-        osctrm.mtable = int(synthManager.voice()->getInternalParameterValue("table"));
+        OscTrm *voice = synthManager.voice();
+        osctrm.mtable = int(voice->mParams.live(voice->pTable));
     }
 
     void onDraw(Graphics &g) override
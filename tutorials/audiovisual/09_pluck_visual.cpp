@@ -23,6 +23,8 @@
 #include "al/io/al_MIDI.hpp"
 #include "al/math/al_Random.hpp"
 
+#include "SpectrumAnalyzer.h"
+
 // using namespace gam;
 using namespace al;
 using namespace std;
@@ -42,20 +44,25 @@ public:
     gam::ADSR<> mAmpEnv;
     gam::EnvFollow<> mEnvFollow;
     gam::Env<2> mPanEnv;
-    gam::STFT stft = gam::STFT(FFT_SIZE, FFT_SIZE / 4, 0, gam::HANN, gam::MAG_FREQ);
+    // Spectrum computed by the app's analyzer, taken on the first trigger
+    AnalysisChannel *mAnalysis{nullptr};
     // This time, let's use spectrograms for each notes as the visual components.
     Mesh mSpectrogram;
-    vector<float> spectrum;
     double a = 0;
     double b = 0;
     double timepose = 10;
     // Additional members
     Mesh mMesh;
 
+    // Set by the app in onInit()
+    static SpectrumAnalyzer *&analyzer()
+    {
+        static SpectrumAnalyzer *appAnalyzer = nullptr;
+        return appAnalyzer;
+    }
+
     virtual void init() override
     {
-        // Declare the size of the spectrum
-        spectrum.resize(FFT_SIZE / 2 + 1);
         // mSpectrogram.primitive(Mesh::POINTS);
         mSpectrogram.primitive(Mesh::LINE_STRIP);
         mAmpEnv.levels(0, 1, 1, 0);
@@ -99,15 +106,9 @@ public:
             mPan(s1, s1, s2);
             io.out(0) += s1;
             io.out(1) += s2;
-            // STFT for each notes
-            if (stft(s1))
-            { // Loop through all the frequency bins
-                for (unsigned k = 0; k < stft.numBins(); ++k)
-                {
-                    // Here we simply scale the complex sample
-                    spectrum[k] = tanh(pow(stft.bin(k).real(), 1.3));
-                }
-            }
+            // Spectrum for each note, analyzed off the audio thread
+            if (mAnalysis)
+                mAnalysis->write(s1);
         }
         if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
             free();
@@ -121,6 +122,9 @@ public:
         b += 0.23;
         timepose -= 0.1;
 
+        if (!mAnalysis)
+            return;
+        const vector<float> &spectrum = mAnalysis->spectrum();
         mSpectrogram.reset();
         // mSpectrogram.primitive(Mesh::LINE_STRIP);
 
@@ -141,6 +145,11 @@ public:
 
     virtual void onTriggerOn() override
     {
+        // A reused voice starts a new spectrum
+        if (!mAnalysis && analyzer())
+            mAnalysis = analyzer()->addChannel();
+        if (mAnalysis)
+            mAnalysis->reset();
         mAmpEnv.reset();
         timepose = 10;
         updateFromParameters();
@@ -174,6 +183,9 @@ public:
 class MyApp : public App, public MIDIMessageHandler
 {
 public:
+    // Spectra of the voices, analyzed at display rate. Declared before the
+    // voices so it outlives them.
+    std::unique_ptr<SpectrumAnalyzer> voiceAnalyzer;
     SynthGUIManager<PluckedString> synthManager{"plunk"};
     //    ParameterMIDI parameterMIDI;
     RtMidiIn midiIn; // MIDI input carrier
@@ -191,6 +203,8 @@ public:
                                     // will be using keyboard for note triggering
         // Set sampling rate for Gamma objects from app's audio
         gam::sampleRate(audioIO().framesPerSecond());
+        voiceAnalyzer.reset(new SpectrumAnalyzer(4096, SpectrumAnalyzer::HANN));
+        PluckedString::analyzer() = voiceAnalyzer.get();
         // Check for connected MIDI devices
         if (midiIn.getPortCount() > 0)
         {
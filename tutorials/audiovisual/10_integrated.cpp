@@ -39,6 +39,9 @@ class MyApp : public App, public MIDIMessageHandler
 public:
   // To change the default instrument, change <FMWT> to .. 
   // <SineEnv>, <OscEnv>, <Vib>, <FM>, <OscAM>, <OscTrm>, <AddSyn>, <Sub>, or <PluckedString>
+  // Spectra of the PluckedString voices, analyzed at display rate. Declared
+  // before the voices so it outlives them.
+  std::unique_ptr<SpectrumAnalyzer> voiceAnalyzer;
   // ***** This is the only line to change the default instrument
   SynthGUIManager<FMWT> synthManager{"Integrated"}; 
   //    ParameterMIDI parameterMIDI;
@@ -57,6 +60,8 @@ public:
 
   virtual void onInit() override
   {
+    voiceAnalyzer.reset(new SpectrumAnalyzer(4096, SpectrumAnalyzer::HANN));
+    PluckedString::analyzer() = voiceAnalyzer.get();
     // Check for connected MIDI devices
     if (midiIn.getPortCount() > 0)
     {
@@ -132,6 +137,8 @@ public:
     g.clear();
     // Render the synth's graphics
     synthManager.render(g);
+    // The voices only queued their shapes, draw them one call per shape
+    VoiceInstancer::flush(g);
     // // Draw Spectrum
     mSpectrogram.reset();
     mSpectrogram.primitive(Mesh::LINE_STRIP);
@@ -0,0 +1,384 @@
+#pragma once
+#ifndef BinaryScore_H
+#define BinaryScore_H
+
+// Compact binary score format that is memory-mapped instead of parsed.
+//
+// The tutorials kept their scores as Tone.js MIDI JSON, and every load
+// parsed a few hundred kilobytes of text into a DOM. A .score file holds
+// the same information in fixed-size records: a header, a tempo map, a
+// track table, the notes of all tracks (each track a contiguous run sorted
+// by time) and a block of null-terminated track names. BinaryScore maps
+// the file and hands out pointers into it. Opening checks the header and
+// the table bounds. No per-note work is done until the notes are read.
+//
+// Files are written by tools/audio/score_convert from Tone.js JSON or from
+// Standard MIDI Files. All fields are little-endian.
+//
+//   BinaryScore score;
+//   if (score.open("interstellar.score")) {
+//     for (int t = 0; t < score.numTracks(); t++) {
+//       const ScoreNoteRecord *notes = score.notes(t);
+//       for (int i = 0; i < score.numNotes(t); i++) {
+//         play(notes[i].midi, notes[i].time, notes[i].duration);
+//       }
+//     }
+//   }
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct ScoreFileHeader {
+  char magic[4];    ///< "ALSC"
+  uint32_t version; ///< BinaryScore::kVersion
+  uint32_t ppq;     ///< MIDI ticks per quarter note
+  float duration;   ///< Seconds, end of the last note
+  uint32_t numTempos, tempoOffset;
+  uint32_t numTracks, trackOffset;
+  uint32_t numNotes, noteOffset;
+  uint32_t namesSize, namesOffset;
+};
+
+/// Tempo change. The tempo map is sorted by ticks.
+struct ScoreTempoRecord {
+  uint32_t ticks;
+  float time; ///< Seconds
+  float bpm;
+};
+
+struct ScoreTrackRecord {
+  uint32_t firstNote; ///< Index of the track's first note
+  uint32_t numNotes;
+  uint32_t nameOffset; ///< Into the names block
+  uint8_t channel;
+  uint8_t program; ///< General MIDI instrument number
+  uint8_t percussion;
+  uint8_t reserved;
+};
+
+struct ScoreNoteRecord {
+  float time;     ///< Start in seconds
+  float duration; ///< Seconds
+  uint8_t midi;   ///< Note number
+  uint8_t velocity; ///< 0 - 127
+  uint8_t channel;
+  uint8_t reserved;
+
+  /// Velocity scaled to [0, 1], as in the JSON scores
+  float amplitude() const { return velocity / 127.0f; }
+};
+
+/// Read-only view of a memory-mapped .score file
+class BinaryScore {
+public:
+  static const uint32_t kVersion = 1;
+
+  BinaryScore() {}
+  BinaryScore(const std::string &path) { open(path); }
+  ~BinaryScore() { close(); }
+
+  BinaryScore(const BinaryScore &) = delete;
+  BinaryScore &operator=(const BinaryScore &) = delete;
+
+  /// Map a file. Returns false and prints the reason if it is not a valid
+  /// score.
+  bool open(const std::string &path) {
+    close();
+    if (!map(path)) {
+      std::printf("BinaryScore: could not read %s\n", path.c_str());
+      return false;
+    }
+    if (!valid()) {
+      std::printf("BinaryScore: %s is not a version %u score\n", path.c_str(),
+                  kVersion);
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+#ifndef _WIN32
+    if (mMapped) {
+      munmap(const_cast<char *>(mData), mSize);
+    }
+#endif
+    mMapped = false;
+    mBuffer.clear();
+    mData = nullptr;
+    mSize = 0;
+  }
+
+  bool isOpen() const { return mData != nullptr; }
+
+  const ScoreFileHeader &header() const { return *at<ScoreFileHeader>(0); }
+  float duration() const { return header().duration; }
+
+  int numTempos() const { return int(header().numTempos); }
+  const ScoreTempoRecord *tempos() const {
+    return at<ScoreTempoRecord>(header().tempoOffset);
+  }
+
+  int numTracks() const { return int(header().numTracks); }
+  const ScoreTrackRecord &track(int index) const {
+    return at<ScoreTrackRecord>(header().trackOffset)[index];
+  }
+  const char *trackName(int index) const {
+    return mData + header().namesOffset + track(index).nameOffset;
+  }
+
+  /// All notes, track by track
+  int numNotes() const { return int(header().numNotes); }
+  const ScoreNoteRecord *notes() const {
+    return at<ScoreNoteRecord>(header().noteOffset);
+  }
+
+  /// Notes of one track, sorted by time
+  int numNotes(int trackIndex) const {
+    return int(track(trackIndex).numNotes);
+  }
+  const ScoreNoteRecord *notes(int trackIndex) const {
+    return notes() + track(trackIndex).firstNote;
+  }
+
+private:
+  template <class T> const T *at(uint32_t offset) const {
+    return reinterpret_cast<const T *>(mData + offset);
+  }
+
+  bool map(const std::string &path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void *data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    mData = static_cast<const char *>(data);
+    mSize = size_t(info.st_size);
+    mMapped = true;
+    return true;
+#else
+    // No mmap, read the file in one go
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+      return false;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    mBuffer.resize(size > 0 ? size_t(size) : 0);
+    bool ok = size > 0 &&
+              std::fread(mBuffer.data(), 1, mBuffer.size(), file) ==
+                  mBuffer.size();
+    std::fclose(file);
+    if (!ok) {
+      return false;
+    }
+    mData = mBuffer.data();
+    mSize = mBuffer.size();
+    return true;
+#endif
+  }
+
+  // Header, table bounds and track ranges, so reads can't leave the file
+  bool valid() const {
+    if (mSize < sizeof(ScoreFileHeader)) {
+      return false;
+    }
+    const ScoreFileHeader &h = header();
+    if (std::memcmp(h.magic, "ALSC", 4) != 0 || h.version != kVersion) {
+      return false;
+    }
+    auto fits = [this](uint32_t offset, uint64_t count, size_t size) {
+      return offset % 4 == 0 && offset + count * size <= mSize;
+    };
+    if (!fits(h.tempoOffset, h.numTempos, sizeof(ScoreTempoRecord)) ||
+        !fits(h.trackOffset, h.numTracks, sizeof(ScoreTrackRecord)) ||
+        !fits(h.noteOffset, h.numNotes, sizeof(ScoreNoteRecord)) ||
+        !fits(h.namesOffset, h.namesSize, 1) || h.namesSize == 0 ||
+        mData[h.namesOffset + h.namesSize - 1] != '\0') {
+      return false;
+    }
+    for (int i = 0; i < numTracks(); i++) {
+      const ScoreTrackRecord &t = track(i);
+      if (uint64_t(t.firstNote) + t.numNotes > h.numNotes ||
+          t.nameOffset >= h.namesSize) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const char *mData{nullptr};
+  size_t mSize{0};
+  bool mMapped{false};
+  std::vector<char> mBuffer; // Used where files can't be mapped
+};
+
+/// Builds a score in memory and writes it as a .score file
+class BinaryScoreWriter {
+public:
+  void ppq(uint32_t ticksPerQuarter) { mPPQ = ticksPerQuarter; }
+
+  void addTempo(uint32_t ticks, float time, float bpm) {
+    mTempos.push_back({ticks, time, bpm});
+  }
+
+  /// Returns the index of the track
+  int addTrack(const std::string &name, int channel = 0, int program = 0,
+               bool percussion = false) {
+    ScoreTrackRecord track{};
+    track.channel = uint8_t(channel);
+    track.program = uint8_t(program);
+    track.percussion = percussion ? 1 : 0;
+    mTracks.push_back(track);
+    mNames.push_back(name);
+    mNotes.emplace_back();
+    return int(mTracks.size()) - 1;
+  }
+
+  /// velocity in [0, 1]
+  void addNote(int track, float time, float duration, int midi,
+               float velocity) {
+    ScoreNoteRecord note{};
+    note.time = time;
+    note.duration = duration;
+    note.midi = uint8_t(std::min(std::max(midi, 0), 127));
+    note.velocity =
+        uint8_t(std::min(std::max(velocity, 0.0f), 1.0f) * 127.0f + 0.5f);
+    note.channel = mTracks[track].channel;
+    mNotes[track].push_back(note);
+  }
+
+  int numTracks() const { return int(mTracks.size()); }
+  size_t numNotes() const {
+    size_t count = 0;
+    for (auto &notes : mNotes) {
+      count += notes.size();
+    }
+    return count;
+  }
+
+  bool write(const std::string &path) {
+    ScoreFileHeader h{};
+    std::memcpy(h.magic, "ALSC", 4);
+    h.version = BinaryScore::kVersion;
+    h.ppq = mPPQ;
+
+    std::sort(mTempos.begin(), mTempos.end(),
+              [](const ScoreTempoRecord &a, const ScoreTempoRecord &b) {
+                return a.ticks < b.ticks;
+              });
+    std::string names;
+    std::vector<ScoreNoteRecord> notes;
+    for (size_t t = 0; t < mTracks.size(); t++) {
+      std::vector<ScoreNoteRecord> &trackNotes = mNotes[t];
+      std::stable_sort(trackNotes.begin(), trackNotes.end(),
+                       [](const ScoreNoteRecord &a, const ScoreNoteRecord &b) {
+                         return a.time < b.time;
+                       });
+      mTracks[t].firstNote = uint32_t(notes.size());
+      mTracks[t].numNotes = uint32_t(trackNotes.size());
+      mTracks[t].nameOffset = uint32_t(names.size());
+      names += mNames[t];
+      names += '\0';
+      for (auto &note : trackNotes) {
+        h.duration = std::max(h.duration, note.time + note.duration);
+        notes.push_back(note);
+      }
+    }
+    if (names.empty()) {
+      names += '\0';
+    }
+    while (names.size() % 4 != 0) {
+      names += '\0';
+    }
+
+    // Tables follow the header in a fixed order, all 4-byte aligned
+    h.numTempos = uint32_t(mTempos.size());
+    h.tempoOffset = sizeof(ScoreFileHeader);
+    h.numTracks = uint32_t(mTracks.size());
+    h.trackOffset = h.tempoOffset + h.numTempos * sizeof(ScoreTempoRecord);
+    h.numNotes = uint32_t(notes.size());
+    h.noteOffset = h.trackOffset + h.numTracks * sizeof(ScoreTrackRecord);
+    h.namesSize = uint32_t(names.size());
+    h.namesOffset = h.noteOffset + h.numNotes * sizeof(ScoreNoteRecord);
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+    bool ok = std::fwrite(&h, sizeof(h), 1, file) == 1;
+    ok = ok && writeTable(file, mTempos);
+    ok = ok && writeTable(file, mTracks);
+    ok = ok && writeTable(file, notes);
+    ok = ok && std::fwrite(names.data(), 1, names.size(), file) == names.size();
+    return std::fclose(file) == 0 && ok;
+  }
+
+private:
+  template <class T>
+  static bool writeTable(FILE *file, const std::vector<T> &table) {
+    return table.empty() ||
+           std::fwrite(table.data(), sizeof(T), table.size(), file) ==
+               table.size();
+  }
+
+  uint32_t mPPQ{480};
+  std::vector<ScoreTempoRecord> mTempos;
+  std::vector<ScoreTrackRecord> mTracks;
+  std::vector<std::string> mNames;
+  std::vector<std::vector<ScoreNoteRecord>> mNotes;
+};
+
+/**
+ * @brief Schedule the notes of a track on a SynthSequencer
+ *
+ * makeVoice(note) returns a voice configured for the note, or nullptr to
+ * skip it. Returns the number of notes scheduled.
+ *
+ *   scheduleTrack(score, 0, synthManager.synthSequencer(),
+ *                 [&](const ScoreNoteRecord &note) {
+ *                   auto *voice = synthManager.synth().getVoice<SineEnv>();
+ *                   voice->setInternalParameterValue("frequency", ...);
+ *                   return voice;
+ *                 });
+ */
+template <class TSequencer, class TMakeVoice>
+int scheduleTrack(const BinaryScore &score, int track, TSequencer &sequencer,
+                  TMakeVoice makeVoice, double offset = 0.0) {
+  int scheduled = 0;
+  const ScoreNoteRecord *notes = score.notes(track);
+  for (int i = 0; i < score.numNotes(track); i++) {
+    auto *voice = makeVoice(notes[i]);
+    if (voice) {
+      sequencer.addVoiceFromNow(voice, offset + notes[i].time,
+                                notes[i].duration);
+      scheduled++;
+    }
+  }
+  return scheduled;
+}
+
+#endif // BinaryScore_H
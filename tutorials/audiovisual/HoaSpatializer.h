@@ -0,0 +1,426 @@
+#pragma once
+#ifndef HoaSpatializer_H
+#define HoaSpatializer_H
+
+// Higher-order Ambisonics spatialization for scenes with many sources.
+//
+// Panners such as Lbap and Vbap work out and apply speaker gains for every
+// source, so a scene's cost grows with sources times speakers. This
+// spatializer encodes each source into a shared Ambisonics bus of
+// (order + 1)^2 channels instead: one gain per bus channel, applied four bus
+// channels at a time with SSE or NEON. finalize() then decodes the bus to the
+// speakers once per buffer with a matrix computed from the layout when the
+// spatializer is made. The decode costs the same for 10 sources as for 500.
+//
+// The bus is AmbiX: ACN channel order and SN3D normalization. The decoder
+// samples the spherical harmonics at the speakers, with max-rE weights to
+// keep the energy focused on the speakers nearest a source, and is scaled
+// for unit power on average over all directions. A source's encoding gains
+// are recomputed only when it turns by more than a tolerance, and changes are
+// ramped across the buffer, as in BatchedLbap.
+//
+//   scene.setSpatializer<HoaSpatializer>(speakers);           // 3rd order
+//   scene.setSpatializer<HoaSpatializerOrder<5>>(speakers);   // 5th order
+//
+// Sources are told apart by their order in a buffer, so keep the scene's
+// audio on one thread.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1
+#include <xmmintrin.h>
+#define HOA_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOA_NEON 1
+#endif
+
+#include "al/io/al_AudioIOData.hpp"
+#include "al/sound/al_Spatializer.hpp"
+#include "al/sound/al_Speaker.hpp"
+#include "al/spatial/al_Pose.hpp"
+
+/**
+ * @brief Real SN3D spherical harmonics up to order, in ACN order
+ *
+ * x, y, z is a direction in graphics space (x right, y up, -z front). out
+ * needs (order + 1)^2 values.
+ */
+inline void sphericalHarmonics(int order, float x, float y, float z,
+                               float *out) {
+  // Ambisonics axes: front, left, up
+  double front = -z, left = -x, up = y;
+  double length = std::sqrt(front * front + left * left + up * up);
+  double azimuth = length > 0.0 ? std::atan2(left, front) : 0.0;
+  double sinElevation = length > 0.0 ? up / length : 0.0;
+  double cosElevation =
+      std::sqrt(std::max(0.0, 1.0 - sinElevation * sinElevation));
+  for (int m = 0; m <= order; m++) {
+    // Associated Legendre P(l, m) of sin(elevation), without the
+    // Condon-Shortley phase, by recurrence over l
+    double pmm = 1.0;
+    for (int k = 1; k <= m; k++) {
+      pmm *= (2 * k - 1) * cosElevation;
+    }
+    double previous = 0.0, current = pmm;
+    for (int l = m; l <= order; l++) {
+      if (l == m + 1) {
+        previous = current;
+        current = sinElevation * (2 * m + 1) * pmm;
+      } else if (l > m + 1) {
+        double next = ((2 * l - 1) * sinElevation * current -
+                       (l + m - 1) * previous) /
+                      (l - m);
+        previous = current;
+        current = next;
+      }
+      // SN3D: sqrt((2 - delta(m)) (l - m)! / (l + m)!)
+      double factorials = 1.0;
+      for (int k = l - m + 1; k <= l + m; k++) {
+        factorials *= k;
+      }
+      double norm = std::sqrt((m == 0 ? 1.0 : 2.0) / factorials);
+      int center = l * l + l;
+      out[center + m] = float(norm * current * std::cos(m * azimuth));
+      if (m > 0) {
+        out[center - m] = float(norm * current * std::sin(m * azimuth));
+      }
+    }
+  }
+}
+
+/// bus[k][i] += (gain[k] + i * step[k]) * in[i] for channels k
+inline void encodeRamp(const float *in, float *const *bus, const float *gain,
+                       const float *step, int channels, int frames) {
+  int k = 0;
+  for (; k + 4 <= channels; k += 4) {
+    float *out[4] = {bus[k], bus[k + 1], bus[k + 2], bus[k + 3]};
+    int i = 0;
+#if defined(HOA_SSE)
+    const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 s0 = _mm_set1_ps(step[k]), s1 = _mm_set1_ps(step[k + 1]);
+    __m128 s2 = _mm_set1_ps(step[k + 2]), s3 = _mm_set1_ps(step[k + 3]);
+    __m128 g0 = _mm_add_ps(_mm_set1_ps(gain[k]), _mm_mul_ps(offsets, s0));
+    __m128 g1 = _mm_add_ps(_mm_set1_ps(gain[k + 1]), _mm_mul_ps(offsets, s1));
+    __m128 g2 = _mm_add_ps(_mm_set1_ps(gain[k + 2]), _mm_mul_ps(offsets, s2));
+    __m128 g3 = _mm_add_ps(_mm_set1_ps(gain[k + 3]), _mm_mul_ps(offsets, s3));
+    const __m128 four = _mm_set1_ps(4.0f);
+    s0 = _mm_mul_ps(s0, four);
+    s1 = _mm_mul_ps(s1, four);
+    s2 = _mm_mul_ps(s2, four);
+    s3 = _mm_mul_ps(s3, four);
+    for (; i + 4 <= frames; i += 4) {
+      __m128 x = _mm_loadu_ps(in + i);
+      _mm_storeu_ps(out[0] + i,
+                    _mm_add_ps(_mm_loadu_ps(out[0] + i), _mm_mul_ps(g0, x)));
+      _mm_storeu_ps(out[1] + i,
+                    _mm_add_ps(_mm_loadu_ps(out[1] + i), _mm_mul_ps(g1, x)));
+      _mm_storeu_ps(out[2] + i,
+                    _mm_add_ps(_mm_loadu_ps(out[2] + i), _mm_mul_ps(g2, x)));
+      _mm_storeu_ps(out[3] + i,
+                    _mm_add_ps(_mm_loadu_ps(out[3] + i), _mm_mul_ps(g3, x)));
+      g0 = _mm_add_ps(g0, s0);
+      g1 = _mm_add_ps(g1, s1);
+      g2 = _mm_add_ps(g2, s2);
+      g3 = _mm_add_ps(g3, s3);
+    }
+#elif defined(HOA_NEON)
+    const float offsetValues[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    const float32x4_t offsets = vld1q_f32(offsetValues);
+    float32x4_t g0 = vmlaq_n_f32(vdupq_n_f32(gain[k]), offsets, step[k]);
+    float32x4_t g1 =
+        vmlaq_n_f32(vdupq_n_f32(gain[k + 1]), offsets, step[k + 1]);
+    float32x4_t g2 =
+        vmlaq_n_f32(vdupq_n_f32(gain[k + 2]), offsets, step[k + 2]);
+    float32x4_t g3 =
+        vmlaq_n_f32(vdupq_n_f32(gain[k + 3]), offsets, step[k + 3]);
+    float32x4_t s0 = vdupq_n_f32(4 * step[k]);
+    float32x4_t s1 = vdupq_n_f32(4 * step[k + 1]);
+    float32x4_t s2 = vdupq_n_f32(4 * step[k + 2]);
+    float32x4_t s3 = vdupq_n_f32(4 * step[k + 3]);
+    for (; i + 4 <= frames; i += 4) {
+      float32x4_t x = vld1q_f32(in + i);
+      vst1q_f32(out[0] + i, vmlaq_f32(vld1q_f32(out[0] + i), g0, x));
+      vst1q_f32(out[1] + i, vmlaq_f32(vld1q_f32(out[1] + i), g1, x));
+      vst1q_f32(out[2] + i, vmlaq_f32(vld1q_f32(out[2] + i), g2, x));
+      vst1q_f32(out[3] + i, vmlaq_f32(vld1q_f32(out[3] + i), g3, x));
+      g0 = vaddq_f32(g0, s0);
+      g1 = vaddq_f32(g1, s1);
+      g2 = vaddq_f32(g2, s2);
+      g3 = vaddq_f32(g3, s3);
+    }
+#endif
+    for (; i < frames; i++) {
+      for (int c = 0; c < 4; c++) {
+        out[c][i] += (gain[k + c] + i * step[k + c]) * in[i];
+      }
+    }
+  }
+  for (; k < channels; k++) {
+    for (int i = 0; i < frames; i++) {
+      bus[k][i] += (gain[k] + i * step[k]) * in[i];
+    }
+  }
+}
+
+/// out[i] += sum of matrix[k] * bus[k][i] over channels k
+inline void decodeSpeaker(float *out, const float *const *bus,
+                          const float *matrix, int channels, int frames) {
+  int k = 0;
+  for (; k + 4 <= channels; k += 4) {
+    const float *in[4] = {bus[k], bus[k + 1], bus[k + 2], bus[k + 3]};
+    int i = 0;
+#if defined(HOA_SSE)
+    __m128 m0 = _mm_set1_ps(matrix[k]), m1 = _mm_set1_ps(matrix[k + 1]);
+    __m128 m2 = _mm_set1_ps(matrix[k + 2]), m3 = _mm_set1_ps(matrix[k + 3]);
+    for (; i + 4 <= frames; i += 4) {
+      __m128 a = _mm_add_ps(_mm_mul_ps(m0, _mm_loadu_ps(in[0] + i)),
+                            _mm_mul_ps(m1, _mm_loadu_ps(in[1] + i)));
+      __m128 b = _mm_add_ps(_mm_mul_ps(m2, _mm_loadu_ps(in[2] + i)),
+                            _mm_mul_ps(m3, _mm_loadu_ps(in[3] + i)));
+      _mm_storeu_ps(out + i,
+                    _mm_add_ps(_mm_loadu_ps(out + i), _mm_add_ps(a, b)));
+    }
+#elif defined(HOA_NEON)
+    for (; i + 4 <= frames; i += 4) {
+      float32x4_t sum = vld1q_f32(out + i);
+      sum = vmlaq_n_f32(sum, vld1q_f32(in[0] + i), matrix[k]);
+      sum = vmlaq_n_f32(sum, vld1q_f32(in[1] + i), matrix[k + 1]);
+      sum = vmlaq_n_f32(sum, vld1q_f32(in[2] + i), matrix[k + 2]);
+      sum = vmlaq_n_f32(sum, vld1q_f32(in[3] + i), matrix[k + 3]);
+      vst1q_f32(out + i, sum);
+    }
+#endif
+    for (; i < frames; i++) {
+      out[i] += matrix[k] * in[0][i] + matrix[k + 1] * in[1][i] +
+                matrix[k + 2] * in[2][i] + matrix[k + 3] * in[3][i];
+    }
+  }
+  for (; k < channels; k++) {
+    for (int i = 0; i < frames; i++) {
+      out[i] += matrix[k] * bus[k][i];
+    }
+  }
+}
+
+/// Ambisonics bus spatializer, see the top of HoaSpatializer.h
+class HoaSpatializer : public al::Spatializer {
+public:
+  static const int kMaxOrder = 5;
+
+  /**
+   * @param order Ambisonics order, 1 to 5
+   * @param maxSources sources with cached encoding gains, later ones are
+   * encoded without ramps
+   * @param maxFrames largest audio buffer
+   * @param toleranceDegrees turn after which a source's gains are recomputed
+   */
+  HoaSpatializer(const al::Speakers &sl, int order = 3, int maxSources = 512,
+                 int maxFrames = 4096, float toleranceDegrees = 1.0f)
+      : al::Spatializer(sl), mMaxSources(maxSources), mMaxFrames(maxFrames) {
+    mOrder = std::max(1, std::min(order, int(kMaxOrder)));
+    mChannels = (mOrder + 1) * (mOrder + 1);
+    mCosTolerance = float(std::cos(toleranceDegrees * M_PI / 180.0));
+    mBusData.assign(size_t(mChannels) * maxFrames, 0.0f);
+    for (int k = 0; k < mChannels; k++) {
+      mBus.push_back(&mBusData[size_t(k) * maxFrames]);
+    }
+    mSources.resize(maxSources);
+    mGains.assign(size_t(maxSources) * mChannels * 2, 0.0f);
+    for (int s = 0; s < maxSources; s++) {
+      mSources[s].gains = &mGains[size_t(s) * mChannels * 2];
+      mSources[s].previous = mSources[s].gains + mChannels;
+    }
+    mSteps.assign(mChannels, 0.0f);
+    mScratch.assign(mChannels, 0.0f);
+    computeDecoder();
+  }
+
+  int order() const { return mOrder; }
+  /// Bus channels, (order + 1)^2
+  int channels() const { return mChannels; }
+  /// Decoder gains of bus channel k for speaker s are decoder()[s *
+  /// channels() + k]
+  const std::vector<float> &decoder() const { return mDecoder; }
+
+  /// Sources in the last buffer
+  int sources() const { return mNumSources; }
+  /// Sources whose gains were recomputed in the last buffer
+  int recomputed() const { return mNumRecomputed; }
+
+  void prepare(al::AudioIOData &io) override {
+    mFrames = std::min(int(io.framesPerBuffer()), mMaxFrames);
+    for (int k = 0; k < mChannels; k++) {
+      std::fill(mBus[k], mBus[k] + mFrames, 0.0f);
+    }
+    mNumSources = 0;
+    mNumRecomputed = 0;
+  }
+
+  void renderBuffer(al::AudioIOData &io, const al::Pose &listeningPose,
+                    const float *samples,
+                    const unsigned int &numFrames) override {
+    al::Vec3d position = listeningPose.vec();
+    encode(float(position[0]), float(position[1]), float(position[2]),
+           samples, std::min(int(numFrames), mFrames));
+  }
+
+  /// Uncached, for scenes that render a sample at a time
+  void renderSample(al::AudioIOData &io, const al::Pose &listeningPose,
+                    const float &sample,
+                    const unsigned int &frameIndex) override {
+    al::Vec3d position = listeningPose.vec();
+    sphericalHarmonics(mOrder, float(position[0]), float(position[1]),
+                       float(position[2]), mScratch.data());
+    for (int k = 0; k < mChannels; k++) {
+      mBus[k][frameIndex] += mScratch[k] * sample;
+    }
+  }
+
+  /// Decode the bus to the speakers
+  void finalize(al::AudioIOData &io) override {
+    // Slots not filled this buffer start afresh next time
+    for (int s = mNumSources; s < mMaxSources && mSources[s].valid; s++) {
+      mSources[s].valid = false;
+    }
+    for (size_t s = 0; s < mSpeakers.size(); s++) {
+      int channel = int(mSpeakers[s].deviceChannel);
+      if (channel < int(io.channelsOut())) {
+        decodeSpeaker(io.outBuffer(channel), mBus.data(),
+                      &mDecoder[s * mChannels], mChannels, mFrames);
+      }
+    }
+  }
+
+  /// Add a source heading towards x, y, z in graphics space to the bus
+  void encode(float x, float y, float z, const float *samples, int frames) {
+    if (frames <= 0) {
+      return;
+    }
+    if (mNumSources >= mMaxSources) {
+      sphericalHarmonics(mOrder, x, y, z, mScratch.data());
+      std::fill(mSteps.begin(), mSteps.end(), 0.0f);
+      encodeRamp(samples, mBus.data(), mScratch.data(), mSteps.data(),
+                 mChannels, frames);
+      return;
+    }
+    Source &source = mSources[mNumSources++];
+    float length = std::sqrt(x * x + y * y + z * z);
+    float direction[3] = {0.0f, 0.0f, -1.0f};
+    if (length > 0.0f) {
+      direction[0] = x / length;
+      direction[1] = y / length;
+      direction[2] = z / length;
+    }
+    float cosine = direction[0] * source.direction[0] +
+                   direction[1] * source.direction[1] +
+                   direction[2] * source.direction[2];
+    std::swap(source.gains, source.previous);
+    if (source.valid && cosine >= mCosTolerance) {
+      std::copy_n(source.previous, mChannels, source.gains);
+    } else {
+      sphericalHarmonics(mOrder, direction[0], direction[1], direction[2],
+                         source.gains);
+      std::copy_n(direction, 3, source.direction);
+      if (!source.valid) {
+        std::copy_n(source.gains, mChannels, source.previous);
+      }
+      source.valid = true;
+      mNumRecomputed++;
+    }
+    for (int k = 0; k < mChannels; k++) {
+      mSteps[k] = (source.gains[k] - source.previous[k]) / frames;
+    }
+    encodeRamp(samples, mBus.data(), source.previous, mSteps.data(),
+               mChannels, frames);
+  }
+
+private:
+  struct Source {
+    float direction[3]{0.0f, 0.0f, -1.0f}; // Of the current gains
+    bool valid{false};
+    float *gains{nullptr};    // At the end of this buffer
+    float *previous{nullptr}; // At the start
+  };
+
+  // Sampling decoder with max-rE weights, scaled for unit mean power
+  void computeDecoder() {
+    size_t speakers = mSpeakers.size();
+    mDecoder.assign(speakers * mChannels, 0.0f);
+    if (speakers == 0) {
+      return;
+    }
+    // max-rE: Legendre polynomials of cos(137.9 deg / (order + 1.51))
+    std::vector<double> weights(mOrder + 1);
+    double c = std::cos(137.9 * M_PI / 180.0 / (mOrder + 1.51));
+    double p0 = 1.0, p1 = c;
+    weights[0] = 1.0;
+    weights[1] = c;
+    for (int l = 2; l <= mOrder; l++) {
+      double p2 = ((2 * l - 1) * c * p1 - (l - 1) * p0) / l;
+      weights[l] = p2;
+      p0 = p1;
+      p1 = p2;
+    }
+    for (size_t s = 0; s < speakers; s++) {
+      al::Vec3d v = mSpeakers[s].vecGraphics();
+      float *row = &mDecoder[s * mChannels];
+      sphericalHarmonics(mOrder, float(v[0]), float(v[1]), float(v[2]), row);
+      for (int l = 0; l <= mOrder; l++) {
+        // SN3D to N3D, (2l + 1), applied to both harmonics
+        for (int k = l * l; k < (l + 1) * (l + 1); k++) {
+          row[k] = float(row[k] * (2 * l + 1) * weights[l]);
+        }
+      }
+    }
+    // Mean speaker power over a spiral of directions
+    const int kDirections = 2000;
+    double power = 0.0;
+    for (int d = 0; d < kDirections; d++) {
+      double up = 1.0 - (2.0 * d + 1.0) / kDirections;
+      double around = d * M_PI * (3.0 - std::sqrt(5.0));
+      double radius = std::sqrt(1.0 - up * up);
+      sphericalHarmonics(mOrder, float(radius * std::sin(around)), float(up),
+                         float(-radius * std::cos(around)), mScratch.data());
+      for (size_t s = 0; s < speakers; s++) {
+        double gain = 0.0;
+        for (int k = 0; k < mChannels; k++) {
+          gain += mDecoder[s * mChannels + k] * mScratch[k];
+        }
+        power += gain * gain;
+      }
+    }
+    float scale = power > 0.0 ? float(std::sqrt(kDirections / power)) : 0.0f;
+    for (float &gain : mDecoder) {
+      gain *= scale;
+    }
+  }
+
+  int mOrder;
+  int mChannels;
+  int mMaxSources;
+  int mMaxFrames;
+  float mCosTolerance;
+  std::vector<float> mDecoder; // Speakers by bus channels
+
+  // Audio thread
+  int mFrames{0};
+  int mNumSources{0};
+  int mNumRecomputed{0};
+  std::vector<float> mBusData;
+  std::vector<float *> mBus;
+  std::vector<Source> mSources;
+  std::vector<float> mGains; // Two sets of mChannels per source
+  std::vector<float> mSteps;
+  std::vector<float> mScratch;
+};
+
+/// HoaSpatializer of a fixed order, for DynamicScene::setSpatializer()
+template <int Order> class HoaSpatializerOrder : public HoaSpatializer {
+public:
+  HoaSpatializerOrder(const al::Speakers &sl) : HoaSpatializer(sl, Order) {}
+};
+
+#endif // HoaSpatializer_H
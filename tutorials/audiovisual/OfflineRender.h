@@ -0,0 +1,260 @@
+#pragma once
+#ifndef OfflineRender_H
+#define OfflineRender_H
+
+// Faster-than-realtime rendering to multichannel WAV files.
+//
+// An app's audio only ran through the audio device, in real time. The
+// OfflineRenderer drives the same onSound() path from a loop instead. It
+// owns an AudioIOData with the app's rate, buffer size and channel count,
+// calls the process function once per buffer and streams the output to a
+// 32-bit float WAV file. No audio device is opened, so it works on machines
+// without a sound card. Sequencers must use TIME_MASTER_AUDIO, the default,
+// so that they advance with the rendered buffers. A ScorePlayer is passed
+// to render(), which drives it with start() and update() instead of play().
+//
+//   OfflineRenderer renderer{48000, 512, 2};
+//   renderer.render(app, 60.0, "take.wav"); // calls app.onSound(io)
+//   renderer.render(app, player, 60.0, "score.wav"); // also plays a score
+//   printf("%.1fx realtime\n", renderer.speed());
+//
+// Independent renders, such as stems from separate synth instances, can run
+// on several cores with OfflineRenderer::renderAll(). Within one render,
+// ParallelVoiceRenderer (ParallelVoices.h) works as it does live.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Gamma/Domain.h"
+#include "al/io/al_AudioIOData.hpp"
+
+#include "ScorePlayer.h"
+
+/// Streams interleaved 32-bit float frames to a WAV file
+class WavWriter {
+public:
+  ~WavWriter() { close(); }
+
+  bool open(const std::string &path, int channels, double sampleRate) {
+    close();
+    mFile = std::fopen(path.c_str(), "wb");
+    if (!mFile) {
+      return false;
+    }
+    mChannels = channels;
+    mSampleRate = uint32_t(sampleRate);
+    mFrames = 0;
+    writeHeader();
+    return true;
+  }
+
+  void write(const float *interleaved, int frames) {
+    if (mFile) {
+      std::fwrite(interleaved, sizeof(float) * mChannels, frames, mFile);
+      mFrames += frames;
+    }
+  }
+
+  /// Patch the sizes into the header and close the file
+  bool close() {
+    if (!mFile) {
+      return true;
+    }
+    std::fseek(mFile, 0, SEEK_SET);
+    writeHeader();
+    bool ok = !std::ferror(mFile);
+    ok = std::fclose(mFile) == 0 && ok;
+    mFile = nullptr;
+    return ok;
+  }
+
+  uint64_t frames() const { return mFrames; }
+
+private:
+  void put16(uint16_t v) {
+    uint8_t bytes[] = {uint8_t(v), uint8_t(v >> 8)};
+    std::fwrite(bytes, 1, 2, mFile);
+  }
+  void put32(uint32_t v) {
+    uint8_t bytes[] = {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16),
+                       uint8_t(v >> 24)};
+    std::fwrite(bytes, 1, 4, mFile);
+  }
+
+  // WAVE_FORMAT_EXTENSIBLE, which players expect for more than two channels
+  void writeHeader() {
+    uint32_t dataSize = uint32_t(mFrames * mChannels * sizeof(float));
+    std::fwrite("RIFF", 1, 4, mFile);
+    put32(4 + (8 + 40) + (8 + 4) + 8 + dataSize);
+    std::fwrite("WAVE", 1, 4, mFile);
+    std::fwrite("fmt ", 1, 4, mFile);
+    put32(40);
+    put16(0xfffe);
+    put16(uint16_t(mChannels));
+    put32(mSampleRate);
+    put32(mSampleRate * mChannels * sizeof(float));
+    put16(uint16_t(mChannels * sizeof(float)));
+    put16(32);
+    put16(22);
+    put16(32);
+    put32(0); // No speaker positions
+    // KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+    const uint8_t subtype[] = {0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                               0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+    std::fwrite(subtype, 1, 16, mFile);
+    std::fwrite("fact", 1, 4, mFile);
+    put32(4);
+    put32(uint32_t(mFrames));
+    std::fwrite("data", 1, 4, mFile);
+    put32(dataSize);
+  }
+
+  FILE *mFile{nullptr};
+  int mChannels{0};
+  uint32_t mSampleRate{0};
+  uint64_t mFrames{0};
+};
+
+class OfflineRenderer {
+public:
+  /// Called once per buffer with zeroed outputs, like App::onSound()
+  typedef std::function<void(al::AudioIOData &io)> Process;
+
+  struct Job {
+    std::string path;
+    double seconds;
+    Process process;
+  };
+
+  /// Sets the Gamma sample rate, so create voices after the renderer
+  OfflineRenderer(double sampleRate = 48000, int framesPerBuffer = 512,
+                  int channels = 2, int buses = 0)
+      : mSampleRate(sampleRate), mFramesPerBuffer(framesPerBuffer),
+        mChannels(channels), mBuses(buses) {
+    gam::sampleRate(sampleRate);
+  }
+
+  /**
+   * @brief Render seconds of audio to a WAV file
+   *
+   * Returns false if the file could not be written.
+   */
+  bool render(double seconds, const Process &process,
+              const std::string &path) {
+    return renderJob({path, seconds, process}, mSpeed);
+  }
+
+  /// render() with app.onSound() as the process function
+  template <class TApp>
+  bool render(TApp &app, double seconds, const std::string &path) {
+    return render(
+        seconds, [&app](al::AudioIOData &io) { app.onSound(io); }, path);
+  }
+
+  /**
+   * @brief render() while a ScorePlayer hands out its notes
+   *
+   * Starts the player and updates it before each buffer, in place of the
+   * scheduling thread of ScorePlayer::play(). The player's clock must
+   * advance with app.onSound(), e.g. VoicePool::time().
+   */
+  template <class TApp>
+  bool render(TApp &app, ScorePlayer &score, double seconds,
+              const std::string &path) {
+    score.start();
+    return render(
+        seconds,
+        [&app, &score](al::AudioIOData &io) {
+          score.update();
+          app.onSound(io);
+        },
+        path);
+  }
+
+  /**
+   * @brief Render independent jobs on up to threads threads
+   *
+   * Jobs must not share voices or other state. Returns false if any job
+   * failed.
+   */
+  bool renderAll(const std::vector<Job> &jobs, int threads = -1) {
+    if (threads < 0) {
+      threads = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+    std::atomic<size_t> next{0};
+    std::atomic<bool> ok{true};
+    auto worker = [&]() {
+      double speed;
+      size_t job;
+      while ((job = next++) < jobs.size()) {
+        if (!renderJob(jobs[job], speed)) {
+          ok = false;
+        }
+      }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads && size_t(i) < jobs.size(); i++) {
+      pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool) {
+      thread.join();
+    }
+    return ok;
+  }
+
+  /// Seconds of audio rendered per second of wall time in the last render()
+  double speed() const { return mSpeed; }
+
+private:
+  bool renderJob(const Job &job, double &speed) const {
+    al::AudioIOData io;
+    io.framesPerSecond(mSampleRate);
+    io.framesPerBuffer(mFramesPerBuffer);
+    io.channelsIn(0);
+    io.channelsOut(mChannels);
+    io.channelsBus(mBuses);
+
+    WavWriter wav;
+    if (!wav.open(job.path, mChannels, mSampleRate)) {
+      std::printf("OfflineRenderer: could not open %s\n", job.path.c_str());
+      return false;
+    }
+    std::vector<float> interleaved(size_t(mFramesPerBuffer) * mChannels);
+    uint64_t total = uint64_t(job.seconds * mSampleRate + 0.5);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t done = 0; done < total; done += mFramesPerBuffer) {
+      io.zeroOut();
+      io.zeroBus();
+      io.frame(0);
+      job.process(io);
+      int frames = int(std::min<uint64_t>(mFramesPerBuffer, total - done));
+      for (int c = 0; c < mChannels; c++) {
+        const float *out = io.outBuffer(c);
+        for (int i = 0; i < frames; i++) {
+          interleaved[size_t(i) * mChannels + c] = out[i];
+        }
+      }
+      wav.write(interleaved.data(), frames);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    speed = elapsed.count() > 0.0 ? job.seconds / elapsed.count() : 0.0;
+    return wav.close();
+  }
+
+  double mSampleRate;
+  int mFramesPerBuffer;
+  int mChannels;
+  int mBuses;
+  double mSpeed{0.0};
+};
+
+#endif // OfflineRender_H
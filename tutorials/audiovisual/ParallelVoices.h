@@ -0,0 +1,319 @@
+#pragma once
+#ifndef ParallelVoices_H
+#define ParallelVoices_H
+
+// Multi-core voice rendering with bit-reproducible output.
+//
+// PolySynth and DynamicScene render their active voices one after another
+// on the audio thread, so a whole scene gets one core. Their render loops
+// live in allolib and can't be changed from here. The expensive part of a
+// voice, its DSP, is therefore pulled out of the render loop instead.
+//
+// A voice derives from ParallelVoice as well and moves its DSP from
+// onProcess() into onRenderBlock(), which writes into the voice's own block
+// buffer. Before the scene renders, ParallelVoiceRenderer::render() hands
+// the active voices to a persistent pool of worker threads. The workers take
+// voices from work-stealing ranges and the audio thread joins in. Then the
+// scene renders as usual. Each voice's onProcess() only adds its finished
+// block to io, so the scene still spatializes and sums the voices in its own
+// list order. Every block is computed by exactly one thread and nothing is
+// summed across threads, so the output is identical to a serial render.
+//
+//   class Agent : public PositionedVoice, public ParallelVoice {
+//     void init() override { allocateBlock(1); }
+//     void onRenderBlock(int frames) override { ...fill block(0)... }
+//     void onProcess(AudioIOData &io) override {
+//       useBlock(io);
+//       while (io()) { io.out(0) += block(0)[io.frame()]; }
+//     }
+//   };
+//
+//   void onSound(AudioIOData &io) override {
+//     voiceRenderer.render(scene.getActiveVoices(), io.framesPerBuffer());
+//     scene.render(io);
+//   }
+//
+// onRenderBlock() runs on a worker thread. It must only touch the voice's
+// own state, and must not call free() or triggerOff(): leave that to
+// onProcess(). Voices that start during a buffer are not in the active list
+// yet and render their first block inline from useBlock().
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "al/io/al_AudioIOData.hpp"
+#include "al/scene/al_SynthVoice.hpp"
+
+/**
+ * @brief Persistent worker threads running indexed tasks
+ *
+ * run() splits the tasks into one contiguous range per thread. A thread takes
+ * tasks from the front of its own range. When that is empty it steals from
+ * the back of the others. Each range is a single atomic word, so taking and
+ * stealing is one compare-and-swap. The calling thread works as well.
+ * Waiting never takes a lock, and if the workers are slow to wake the
+ * caller ends up running every task itself.
+ */
+class RenderWorkers {
+public:
+  typedef void (*Task)(void *context, int task);
+
+  /// @param threads worker threads besides the caller, -1 for one per core
+  RenderWorkers(int threads = -1) {
+    if (threads < 0) {
+      threads = std::max(0, int(std::thread::hardware_concurrency()) - 1);
+    }
+    mRanges.reset(new Range[threads + 1]);
+    mNumRanges = threads + 1;
+    for (int i = 0; i < threads; i++) {
+      mThreads.emplace_back(&RenderWorkers::workerLoop, this, i + 1);
+    }
+  }
+
+  ~RenderWorkers() {
+    mRunning = false;
+    for (auto &thread : mThreads) {
+      thread.join();
+    }
+  }
+
+  /// Threads running tasks, including the caller
+  int threads() const { return mNumRanges; }
+
+  /**
+   * @brief Run task(context, i) for i in [0, numTasks) and wait for all
+   *
+   * Call from one thread at a time, usually the audio thread.
+   */
+  void run(int numTasks, Task task, void *context) {
+    if (numTasks <= 0) {
+      return;
+    }
+    mTask.store(task, std::memory_order_relaxed);
+    mContext.store(context, std::memory_order_relaxed);
+    mRemaining.store(numTasks, std::memory_order_relaxed);
+    uint64_t generation = (mGeneration.load(std::memory_order_relaxed) + 1) &
+                          kGenerationMask;
+    for (int i = 0; i < mNumRanges; i++) {
+      uint64_t begin = uint64_t(numTasks) * i / mNumRanges;
+      uint64_t end = uint64_t(numTasks) * (i + 1) / mNumRanges;
+      mRanges[i].word.store(pack(generation, begin, end),
+                            std::memory_order_relaxed);
+    }
+    mGeneration.store(generation, std::memory_order_release);
+    work(0, generation);
+    // Only tasks already taken by a worker can be left
+    while (mRemaining.load(std::memory_order_acquire) > 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  /// run() with a callable instead of a function pointer
+  template <class TFunction> void run(int numTasks, TFunction &function) {
+    run(
+        numTasks,
+        [](void *context, int task) { (*static_cast<TFunction *>(context))(task); },
+        &function);
+  }
+
+private:
+  // generation:16 | begin:24 | end:24
+  static const uint64_t kGenerationMask = 0xffff;
+  static const uint64_t kIndexMask = 0xffffff;
+
+  // Padded to a cache line, without over-aligned new
+  struct Range {
+    std::atomic<uint64_t> word{0};
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  static uint64_t pack(uint64_t generation, uint64_t begin, uint64_t end) {
+    return (generation << 48) | (begin << 24) | end;
+  }
+
+  // Take a task of generation from range, from the front or the back
+  static int take(Range &range, uint64_t generation, bool front) {
+    uint64_t word = range.word.load(std::memory_order_acquire);
+    while (true) {
+      uint64_t begin = (word >> 24) & kIndexMask;
+      uint64_t end = word & kIndexMask;
+      if ((word >> 48) != generation || begin >= end) {
+        return -1;
+      }
+      uint64_t next = front ? pack(generation, begin + 1, end)
+                            : pack(generation, begin, end - 1);
+      if (range.word.compare_exchange_weak(word, next,
+                                           std::memory_order_acq_rel)) {
+        return int(front ? begin : end - 1);
+      }
+    }
+  }
+
+  void work(int self, uint64_t generation) {
+    Task task = mTask.load(std::memory_order_relaxed);
+    void *context = mContext.load(std::memory_order_relaxed);
+    for (int i = 0; i < mNumRanges; i++) {
+      int victim = (self + i) % mNumRanges;
+      int index;
+      while ((index = take(mRanges[victim], generation, victim == self)) >=
+             0) {
+        task(context, index);
+        mRemaining.fetch_sub(1, std::memory_order_acq_rel);
+      }
+    }
+  }
+
+  void workerLoop(int self) {
+#ifndef _WIN32
+    // Real-time priority where allowed, like the audio thread
+    sched_param param;
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+    uint64_t seen = mGeneration.load(std::memory_order_acquire);
+    int idle = 0;
+    while (mRunning) {
+      uint64_t generation = mGeneration.load(std::memory_order_acquire);
+      if (generation != seen) {
+        seen = generation;
+        idle = 0;
+        work(self, generation);
+      } else if (++idle < 4096) {
+        std::this_thread::yield();
+      } else {
+        // Idle between buffers, back off but wake well within a buffer
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+  }
+
+  std::unique_ptr<Range[]> mRanges;
+  int mNumRanges;
+  std::vector<std::thread> mThreads;
+
+  std::atomic<Task> mTask{nullptr};
+  std::atomic<void *> mContext{nullptr};
+  alignas(64) std::atomic<uint64_t> mGeneration{0};
+  alignas(64) std::atomic<int> mRemaining{0};
+  std::atomic<bool> mRunning{true};
+};
+
+/// Mixin for voices whose DSP can run on a worker thread
+class ParallelVoice {
+public:
+  virtual ~ParallelVoice() {}
+
+  /**
+   * @brief Allocate the block buffer
+   *
+   * Call from init(). maxFrames must cover the audio buffer size.
+   */
+  void allocateBlock(int channels, int maxFrames = 4096) {
+    mChannels = channels;
+    mMaxFrames = maxFrames;
+    mBlock.assign(size_t(channels) * maxFrames, 0.0f);
+  }
+
+  /// Worker thread: render frames frames of every channel into block()
+  virtual void onRenderBlock(int frames) = 0;
+
+  float *block(int channel = 0) { return mBlock.data() + channel * mMaxFrames; }
+  int blockChannels() const { return mChannels; }
+  /// Frames in the current block, the buffer size up to maxFrames
+  int blockFrames() const { return mFrames; }
+
+  /**
+   * @brief Audio thread, from onProcess(): make the current block available
+   *
+   * Renders the block inline if the renderer didn't, e.g. because the voice
+   * started during this buffer.
+   */
+  void useBlock(const al::AudioIOData &io) {
+    if (!mRendered) {
+      renderBlock(int(io.framesPerBuffer()));
+    }
+    mRendered = false;
+  }
+
+private:
+  friend class ParallelVoiceRenderer;
+
+  void renderBlock(int frames) {
+    mFrames = std::min(frames, mMaxFrames);
+    onRenderBlock(mFrames);
+  }
+
+  std::vector<float> mBlock;
+  int mChannels{0};
+  int mMaxFrames{0};
+  int mFrames{0};
+  bool mRendered{false}; // Set by a worker, read after RenderWorkers::run()
+};
+
+/// Renders the blocks of the ParallelVoices in a voice list on RenderWorkers
+class ParallelVoiceRenderer {
+public:
+  /**
+   * @param threads worker threads besides the audio thread, -1 for one per
+   * core
+   * @param maxVoices voices rendered in parallel per buffer, others render
+   * inline
+   */
+  ParallelVoiceRenderer(int threads = -1, int maxVoices = 1024)
+      : mWorkers(threads) {
+    mVoices.reserve(maxVoices);
+  }
+
+  /// Switch between parallel rendering and rendering inside the scene
+  static bool &enabled() {
+    static bool parallel = true;
+    return parallel;
+  }
+
+  /// Audio thread: render the blocks of the voices in a list such as
+  /// PolySynth::getActiveVoices(), before the synth or scene renders.
+  void render(al::SynthVoice *voices, int frames) {
+    // Blocks not used by the last buffer, e.g. of voices freed since, are
+    // stale
+    for (ParallelVoice *voice : mVoices) {
+      voice->mRendered = false;
+    }
+    mVoices.clear();
+    if (!enabled()) {
+      return;
+    }
+    for (al::SynthVoice *voice = voices; voice; voice = voice->next) {
+      ParallelVoice *parallel = dynamic_cast<ParallelVoice *>(voice);
+      if (parallel && voice->active() &&
+          mVoices.size() < mVoices.capacity()) {
+        mVoices.push_back(parallel);
+      }
+    }
+    mFrames = frames;
+    auto renderVoice = [this](int index) {
+      ParallelVoice &voice = *mVoices[index];
+      voice.renderBlock(mFrames);
+      voice.mRendered = true;
+    };
+    mWorkers.run(int(mVoices.size()), renderVoice);
+  }
+
+  int threads() const { return mWorkers.threads(); }
+
+private:
+  RenderWorkers mWorkers;
+  std::vector<ParallelVoice *> mVoices;
+  int mFrames{0};
+};
+
+#endif // ParallelVoices_H
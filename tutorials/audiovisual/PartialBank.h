@@ -0,0 +1,310 @@
+#pragma once
+#ifndef PartialBank_H
+#define PartialBank_H
+
+// Bank of sine partials for additive synthesis.
+//
+// Phases, phase increments and amplitudes are stored as separate arrays
+// (structure of arrays) padded to a multiple of kLanes, so the per-sample
+// update of kLanes partials compiles to a handful of SIMD instructions. The
+// sine itself is a branch-free polynomial that vectorizes with the loop.
+//
+// The time-domain cost grows with the partial count. Above fftThreshold()
+// partials the bank switches to inverse-FFT synthesis: every kHop samples
+// each partial is added to a spectrum as a few bins of the analysis window's
+// transform, the spectrum is inverse transformed and the frames are
+// overlap-added. The cost then depends on the frame rate, not on the number
+// of samples, so a single voice can hold thousands of partials.
+//
+// Usage:
+//
+//   void init() override {
+//     mBank.resize(64); // Allocates, keep out of the audio thread
+//   }
+//   void onTriggerOn() override {
+//     for (int i = 0; i < mBank.size(); i++) {
+//       mBank.set(i, freq * (i + 1), 1.0f / (i + 1));
+//     }
+//     mBank.reset();
+//   }
+//   void onProcess(AudioIOData &io) override {
+//     while (io()) { io.out(0) += mBank() * mAmpEnv(); }
+//   }
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "Gamma/Domain.h"
+
+#include "RadixFFT.h"
+
+class PartialBank {
+public:
+  /// Partials advanced together per step, 8 floats fill an AVX register
+  static const int kLanes = 8;
+  /// Frame size of the inverse-FFT mode
+  static const int kFFTSize = 1024;
+  static const int kHop = kFFTSize / 2;
+  /// Bins written on each side of a partial in the inverse-FFT mode
+  static const int kKernelBins = 4;
+
+  PartialBank(int partials = 0) { resize(partials); }
+
+  /**
+   * @brief Set the number of partials
+   *
+   * Allocates, so call from init() rather than from the audio thread. New
+   * partials are silent until set() is called for them.
+   */
+  void resize(int partials) {
+    mSize = partials;
+    int padded = (partials + kLanes - 1) / kLanes * kLanes;
+    mPhase.resize(padded, 0.0f);
+    mInc.resize(padded, 0.0f);
+    mAmp.resize(padded, 0.0f);
+    // Padding lanes must stay silent
+    for (int i = partials; i < padded; i++) {
+      mInc[i] = 0.0f;
+      mAmp[i] = 0.0f;
+    }
+    if (spectral()) {
+      tables();
+      mSpectrum.resize(2 * kFFTSize);
+      mOla.resize(kFFTSize);
+    }
+    reset();
+  }
+
+  int size() const { return mSize; }
+
+  /**
+   * @brief Partial count above which the inverse-FFT mode is used
+   *
+   * Like resize(), this may allocate.
+   */
+  void fftThreshold(int partials) {
+    mFFTThreshold = partials;
+    resize(mSize);
+  }
+  int fftThreshold() const { return mFFTThreshold; }
+
+  /// Whether the bank renders with the inverse-FFT mode
+  bool spectral() const { return mSize > mFFTThreshold; }
+
+  /// Set frequency (Hz) and amplitude of a partial
+  void set(int i, float frequency, float amplitude) {
+    freq(i, frequency);
+    amp(i, amplitude);
+  }
+
+  /// Set frequency of a partial in Hz. Uses the Gamma sample rate.
+  void freq(int i, float frequency) {
+    double inc = frequency / gam::sampleRate();
+    mInc[i] = float(inc - std::floor(inc));
+  }
+  float freq(int i) const { return float(mInc[i] * gam::sampleRate()); }
+
+  void amp(int i, float amplitude) { mAmp[i] = amplitude; }
+  float amp(int i) const { return mAmp[i]; }
+
+  /// Restart all partials at phase zero
+  void reset() {
+    for (auto &phase : mPhase) {
+      phase = 0.0f;
+    }
+    if (spectral()) {
+      for (auto &sample : mOla) {
+        sample = 0.0f;
+      }
+      // The first frame is centered at the start of the note. Only its
+      // second half is output, together with the next frame.
+      synthesizeFrame();
+      mReadPos = kHop;
+    }
+  }
+
+  /// Render frames samples of the sum of all partials into out
+  void render(float *out, int frames) {
+    if (spectral()) {
+      renderSpectral(out, frames);
+    } else {
+      renderPartials(out, frames);
+    }
+  }
+
+  /// Single sample, for per-sample voice loops
+  float operator()() {
+    float out;
+    render(&out, 1);
+    return out;
+  }
+
+  /**
+   * @brief sin(2 pi phase) for phase in [0, 1)
+   *
+   * Branch free, so the partial loop vectorizes. Error is below 1e-5.
+   */
+  static inline float sinCycle(float phase) {
+    // sin(2 pi p) == sin(pi t) with t = 1 - 2p in (-1, 1]
+    float t = 1.0f - 2.0f * phase;
+    float a = std::fabs(t);
+    a = a < 0.5f ? a : 1.0f - a; // sin(pi a) == sin(pi (1 - a))
+    float x = 3.14159265f * a;
+    float x2 = x * x;
+    float s = x * (1.0f + x2 * (-1.0f / 6.0f +
+                               x2 * (1.0f / 120.0f +
+                                     x2 * (-1.0f / 5040.0f +
+                                           x2 * (1.0f / 362880.0f)))));
+    return t < 0.0f ? -s : s;
+  }
+
+private:
+  // Window transform and FFT tables shared by all banks
+  struct Tables {
+    static const int kOversample = 64;
+    static const int kKernelSize = (kKernelBins + 1) * kOversample + 2;
+
+    std::vector<float> kernel; // Transform of the window, from 0 bins up
+    RadixFFT fft{kFFTSize};
+
+    Tables() {
+      const double pi = 3.14159265358979323846;
+      const int N = kFFTSize;
+      // Zero-phase periodic Hann window. Its transform is real and even.
+      kernel.resize(kKernelSize);
+      for (int i = 0; i < kKernelSize; i++) {
+        double delta = double(i) / kOversample;
+        double sum = 0.0;
+        for (int m = -N / 2; m < N / 2; m++) {
+          double w = 0.5 + 0.5 * std::cos(2.0 * pi * m / N);
+          sum += w * std::cos(2.0 * pi * delta * m / N);
+        }
+        kernel[i] = float(sum);
+      }
+    }
+
+    float window(float delta) const {
+      float pos = std::fabs(delta) * kOversample;
+      int index = int(pos);
+      float frac = pos - index;
+      return kernel[index] + (kernel[index + 1] - kernel[index]) * frac;
+    }
+  };
+
+  static const Tables &tables() {
+    static Tables sharedTables;
+    return sharedTables;
+  }
+
+  void renderPartials(float *out, int frames) {
+    const int count = int(mPhase.size());
+    float *phase = mPhase.data();
+    const float *inc = mInc.data();
+    const float *amp = mAmp.data();
+    for (int i = 0; i < frames; i++) {
+      float acc[kLanes] = {};
+      for (int k = 0; k < count; k += kLanes) {
+        // Independent lanes, vectorized without reordering the sums
+        for (int j = 0; j < kLanes; j++) {
+          float p = phase[k + j];
+          acc[j] += amp[k + j] * sinCycle(p);
+          p += inc[k + j];
+          phase[k + j] = p >= 1.0f ? p - 1.0f : p;
+        }
+      }
+      float sum = 0.0f;
+      for (int j = 0; j < kLanes; j++) {
+        sum += acc[j];
+      }
+      out[i] = sum;
+    }
+  }
+
+  void renderSpectral(float *out, int frames) {
+    for (int i = 0; i < frames; i++) {
+      if (mReadPos == kHop) {
+        synthesizeFrame();
+      }
+      out[i] = mOla[mReadPos++];
+    }
+  }
+
+  // Accumulate a bin, folding negative and above-Nyquist bins back into
+  // [0, N/2] as the complex conjugate
+  void addBin(int bin, float re, float im) {
+    if (bin >= kFFTSize) {
+      bin -= kFFTSize; // The spectrum is periodic
+    }
+    if (bin < 0) {
+      bin = -bin;
+      im = -im;
+    } else if (bin > kFFTSize / 2) {
+      bin = kFFTSize - bin;
+      im = -im;
+    }
+    mSpectrum[2 * bin] += re;
+    mSpectrum[2 * bin + 1] += im;
+  }
+
+  void synthesizeFrame() {
+    const Tables &tab = tables();
+    const int N = kFFTSize;
+    const float twoPi = 6.28318531f;
+    float *X = mSpectrum.data();
+    std::memset(X, 0, sizeof(float) * 2 * N);
+
+    for (int k = 0; k < mSize; k++) {
+      float center = mInc[k] * N; // Frequency in bins
+      if (mAmp[k] != 0.0f) {
+        // sin() is cos() a quarter cycle late
+        float phase = twoPi * (mPhase[k] - 0.25f);
+        float re = 0.5f * mAmp[k] * std::cos(phase);
+        float im = 0.5f * mAmp[k] * std::sin(phase);
+        int nearest = int(center + 0.5f);
+        for (int bin = nearest - kKernelBins; bin <= nearest + kKernelBins;
+             bin++) {
+          float w = tab.window(bin - center);
+          addBin(bin, re * w, im * w);
+        }
+      }
+      // Advance to the center of the next frame
+      float p = mPhase[k] + mInc[k] * kHop;
+      mPhase[k] = p - std::floor(p);
+    }
+
+    // DC and Nyquist hold a partial and its mirror image, both real
+    X[0] *= 2.0f;
+    X[1] = 0.0f;
+    X[N] *= 2.0f;
+    X[N + 1] = 0.0f;
+    for (int bin = 1; bin < N / 2; bin++) {
+      X[2 * (N - bin)] = X[2 * bin];
+      X[2 * (N - bin) + 1] = -X[2 * bin + 1];
+    }
+    tab.fft.inverse(X);
+
+    // Shift out the finished hop and add the new frame. The frame is zero
+    // phase, so its center is at index 0 of the transform.
+    std::memmove(mOla.data(), mOla.data() + kHop, sizeof(float) * kHop);
+    std::memset(mOla.data() + kHop, 0, sizeof(float) * kHop);
+    const float norm = 1.0f / N;
+    for (int j = 0; j < N; j++) {
+      mOla[j] += X[2 * ((j + N / 2) % N)] * norm;
+    }
+    mReadPos = 0;
+  }
+
+  std::vector<float> mPhase; // Cycles, [0, 1)
+  std::vector<float> mInc;   // Cycles per sample
+  std::vector<float> mAmp;
+  int mSize{0};
+  int mFFTThreshold{128};
+
+  // Inverse-FFT mode
+  std::vector<float> mSpectrum; // Interleaved complex
+  std::vector<float> mOla;
+  int mReadPos{kHop};
+};
+
+#endif // PartialBank_H
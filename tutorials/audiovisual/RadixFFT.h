@@ -0,0 +1,82 @@
+#pragma once
+#ifndef RadixFFT_H
+#define RadixFFT_H
+
+// Small in-place radix-2 complex FFT with precomputed tables.
+//
+// Data is interleaved complex (re, im, re, im, ...). Neither direction is
+// normalized. The constructor allocates, transforms do not.
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+class RadixFFT {
+public:
+  /// size must be a power of two
+  RadixFFT(int size) : mSize(size) {
+    const double pi = 3.14159265358979323846;
+    mCos.resize(size / 2);
+    mSin.resize(size / 2);
+    for (int i = 0; i < size / 2; i++) {
+      mCos[i] = float(std::cos(2.0 * pi * i / size));
+      mSin[i] = float(std::sin(2.0 * pi * i / size));
+    }
+    int bits = 0;
+    while ((1 << bits) < size) {
+      bits++;
+    }
+    mBitReverse.resize(size);
+    for (int i = 0; i < size; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      mBitReverse[i] = r;
+    }
+  }
+
+  int size() const { return mSize; }
+
+  /// X[k] = sum x[n] e^(-i 2 pi k n / N)
+  void forward(float *data) const { transform(data, -1.0f); }
+
+  /// x[n] = sum X[k] e^(i 2 pi k n / N)
+  void inverse(float *data) const { transform(data, 1.0f); }
+
+private:
+  void transform(float *X, float sign) const {
+    const int N = mSize;
+    for (int i = 0; i < N; i++) {
+      int r = mBitReverse[i];
+      if (r > i) {
+        std::swap(X[2 * i], X[2 * r]);
+        std::swap(X[2 * i + 1], X[2 * r + 1]);
+      }
+    }
+    for (int size = 2; size <= N; size *= 2) {
+      int half = size / 2;
+      int step = N / size;
+      for (int start = 0; start < N; start += size) {
+        for (int j = 0; j < half; j++) {
+          float wr = mCos[j * step];
+          float wi = sign * mSin[j * step];
+          float *a = X + 2 * (start + j);
+          float *b = X + 2 * (start + j + half);
+          float tr = b[0] * wr - b[1] * wi;
+          float ti = b[0] * wi + b[1] * wr;
+          b[0] = a[0] - tr;
+          b[1] = a[1] - ti;
+          a[0] += tr;
+          a[1] += ti;
+        }
+      }
+    }
+  }
+
+  int mSize;
+  std::vector<float> mCos, mSin;
+  std::vector<int> mBitReverse;
+};
+
+#endif // RadixFFT_H
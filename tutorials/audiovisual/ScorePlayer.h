@@ -0,0 +1,151 @@
+#pragma once
+#ifndef ScorePlayer_H
+#define ScorePlayer_H
+
+// Streaming score player with a lookahead window.
+//
+// Scheduling a whole piece with addVoiceFromNow() builds one voice per note
+// before the first note sounds. Here a score is a time-sorted array of
+// plain ScoreNote structs. A scheduling thread walks the array and hands a
+// note to its instrument only when it enters the lookahead window, a fraction
+// of a second ahead of the audio clock. Instruments are usually VoicePools
+// (see VoicePool.h), which take a voice when the note is due. Memory for
+// voices and queued events is bounded by polyphony and the window, not by
+// the length of the piece, and playback starts as soon as the array is
+// sorted.
+//
+//   ScorePlayer player{[this] { return sinePool.time(); }};
+//
+//   int sine = player.addInstrument(poolInstrument(sinePool));
+//   player.add({time, duration, sine, 5, {amp, freq, attack, release, pan}});
+//   player.play();
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/// One note of a score. Plain data, 48 bytes.
+struct ScoreNote {
+  static const int kMaxParams = 8;
+
+  float time;     ///< Start in seconds from the start of the score
+  float duration; ///< Seconds until release
+  int instrument; ///< Index returned by ScorePlayer::addInstrument()
+  int numParams;
+  float params[kMaxParams]; ///< Trigger parameters of the instrument
+};
+
+class ScorePlayer {
+public:
+  /// Schedules a note at an absolute time of the clock. Returns false to be
+  /// called again later, e.g. when a queue is full.
+  typedef std::function<bool(const ScoreNote &note, double time)> Instrument;
+
+  /// @param clock seconds of audio rendered, read from the scheduling thread
+  ScorePlayer(std::function<double()> clock) : mClock(clock) {}
+
+  ~ScorePlayer() { stop(); }
+
+  /// Register an instrument before play(). Returns its index.
+  int addInstrument(const Instrument &instrument) {
+    mInstruments.push_back(instrument);
+    return int(mInstruments.size()) - 1;
+  }
+
+  /// Add a note. Call before play(), in any order.
+  void add(const ScoreNote &note) {
+    mNotes.push_back(note);
+    mSorted = false;
+  }
+  void reserve(size_t notes) { mNotes.reserve(notes); }
+
+  /// Seconds ahead of the audio clock that notes are handed out
+  void lookahead(double seconds) { mLookahead = seconds; }
+  double lookahead() const { return mLookahead; }
+
+  /**
+   * @brief Start the scheduling thread
+   *
+   * The score starts one lookahead from now, so the first notes are handed
+   * out on time.
+   */
+  void play() {
+    stop();
+    start();
+    mRunning = true;
+    mThread = std::thread(&ScorePlayer::schedulingLoop, this);
+  }
+
+  /// Start without a thread, for offline rendering. Call update() before
+  /// rendering each buffer.
+  void start() {
+    if (!mSorted) {
+      std::stable_sort(mNotes.begin(), mNotes.end(),
+                       [](const ScoreNote &a, const ScoreNote &b) {
+                         return a.time < b.time;
+                       });
+      mSorted = true;
+    }
+    mNext = 0;
+    mStart = mClock() + mLookahead;
+  }
+
+  /// Hand out the notes that entered the lookahead window
+  void update() {
+    double horizon = mClock() + mLookahead;
+    while (mNext < mNotes.size() && mStart + mNotes[mNext].time < horizon) {
+      const ScoreNote &note = mNotes[mNext];
+      if (note.instrument >= 0 && note.instrument < int(mInstruments.size()) &&
+          !mInstruments[note.instrument](note, mStart + note.time)) {
+        break; // Retry on the next pass
+      }
+      mNext++;
+    }
+  }
+
+  void stop() {
+    mRunning = false;
+    if (mThread.joinable()) {
+      mThread.join();
+    }
+  }
+
+  /// Whether notes are still waiting to be handed out
+  bool playing() const { return mRunning && mNext < mNotes.size(); }
+
+  size_t size() const { return mNotes.size(); }
+
+private:
+  void schedulingLoop() {
+    // Wake a few times per window
+    auto period = std::chrono::duration<double>(mLookahead / 4);
+    while (mRunning && mNext < mNotes.size()) {
+      update();
+      std::this_thread::sleep_for(period);
+    }
+  }
+
+  std::function<double()> mClock;
+  std::vector<Instrument> mInstruments;
+  std::vector<ScoreNote> mNotes;
+  bool mSorted{true};
+
+  double mLookahead{0.2};
+  double mStart{0.0};
+  std::atomic<size_t> mNext{0};
+  std::atomic<bool> mRunning{false};
+  std::thread mThread;
+};
+
+/// Instrument scheduling notes on a VoicePool, or anything with the same
+/// scheduleAt(). The pool must outlive the player.
+template <class TPool> ScorePlayer::Instrument poolInstrument(TPool &pool) {
+  return [&pool](const ScoreNote &note, double time) {
+    return pool.scheduleAt(time, note.duration, note.params, note.numParams);
+  };
+}
+
+#endif // ScorePlayer_H
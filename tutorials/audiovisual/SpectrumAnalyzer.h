@@ -0,0 +1,272 @@
+#pragma once
+#ifndef SpectrumAnalyzer_H
+#define SpectrumAnalyzer_H
+
+// Spectrum analysis for voice visuals, computed off the audio thread.
+//
+// Voices used to run their own gam::STFT inside the sample loop and map
+// every bin through tanh(pow()) on every hop, only to draw the result at
+// frame rate. Here a voice only writes its samples into the lock-free ring
+// of an AnalysisChannel. A small pool of worker threads takes the newest
+// window of each channel at display rate, transforms it and publishes the
+// spectrum through a triple buffer. The graphics thread reads the newest
+// published spectrum without waiting on anyone.
+//
+// The analyzer allocates its channels and starts its workers when it is
+// constructed, so apps create it in onInit() rather than as a global. A
+// voice takes a channel, without allocating, when it is first triggered and
+// resets it on every trigger, so a reused voice doesn't show the spectrum of
+// its previous note.
+//
+// Usage:
+//
+//   std::unique_ptr<SpectrumAnalyzer> analyzer; // App member
+//   analyzer.reset(new SpectrumAnalyzer(4096, SpectrumAnalyzer::HANN));
+//
+//   void onTriggerOn() override {
+//     if (!mAnalysis) mAnalysis = analyzer->addChannel();
+//     if (mAnalysis) mAnalysis->reset();
+//   }
+//   void onProcess(AudioIOData &io) override {
+//     while (io()) { ...; mAnalysis->write(s); }
+//   }
+//   void onProcess(Graphics &g) override {
+//     const std::vector<float> &spectrum = mAnalysis->spectrum();
+//   }
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "RadixFFT.h"
+
+class SpectrumAnalyzer;
+
+/// Sample ring and spectrum snapshot of one voice
+class AnalysisChannel {
+public:
+  AnalysisChannel(int fftSize) {
+    // Twice the window, so the writer can run ahead while a worker copies
+    int ringSize = 1;
+    while (ringSize < 2 * fftSize) {
+      ringSize *= 2;
+    }
+    mRing.resize(ringSize, 0.0f);
+    mMask = ringSize - 1;
+    for (auto &buffer : mBuffers) {
+      buffer.resize(fftSize / 2 + 1, 0.0f);
+    }
+    mSilence.resize(fftSize / 2 + 1, 0.0f);
+  }
+
+  /**
+   * @brief Audio thread: start a new note
+   *
+   * Samples written before are left out of later windows, and spectrum()
+   * returns silence until a spectrum of the new note is published.
+   * Wait-free.
+   */
+  void reset() {
+    mStart.store(mWrite.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+    mGeneration.fetch_add(1, std::memory_order_release);
+  }
+
+  /// Audio thread: append a sample. Wait-free.
+  void write(float sample) {
+    uint64_t index = mWrite.load(std::memory_order_relaxed);
+    mRing[index & mMask] = sample;
+    mWrite.store(index + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Graphics thread: newest published spectrum
+   *
+   * fftSize / 2 + 1 bins. Must only be called from one thread. The returned
+   * buffer is not touched by the workers until the next call.
+   */
+  const std::vector<float> &spectrum() {
+    if (mState.load(std::memory_order_acquire) & kFresh) {
+      int previous = mState.exchange(mFront, std::memory_order_acq_rel);
+      mFront = previous & kIndexMask;
+    }
+    if (mBufferGeneration[mFront] !=
+        mGeneration.load(std::memory_order_acquire)) {
+      return mSilence; // Computed before the last reset()
+    }
+    return mBuffers[mFront];
+  }
+
+private:
+  friend class SpectrumAnalyzer;
+
+  static const int kFresh = 4;
+  static const int kIndexMask = 3;
+
+  // Worker side of the triple buffer
+  std::vector<float> &backBuffer() { return mBuffers[mBack]; }
+  void publish() {
+    int previous = mState.exchange(mBack | kFresh, std::memory_order_acq_rel);
+    mBack = previous & kIndexMask;
+  }
+
+  std::vector<float> mRing;
+  uint64_t mMask;
+  std::atomic<uint64_t> mWrite{0};
+  std::atomic<uint64_t> mStart{0}; // First sample of the current note
+  std::atomic<uint32_t> mGeneration{0}; // Incremented by reset()
+  uint64_t mAnalyzed{0}; // Only used by the worker owning this channel
+
+  // Triple buffer: the middle index and a fresh flag live in mState. Each
+  // buffer is tagged with the generation it was computed for.
+  std::vector<float> mBuffers[3];
+  uint32_t mBufferGeneration[3]{0, 0, 0};
+  std::vector<float> mSilence;
+  std::atomic<int> mState{1};
+  int mFront{0};
+  int mBack{2};
+};
+
+class SpectrumAnalyzer {
+public:
+  enum Window { HANN, BLACKMAN_HARRIS };
+
+  static const int kMaxChannels = 256;
+
+  /**
+   * @param fftSize window size, a power of two
+   * @param window analysis window
+   * @param workers number of worker threads
+   * @param rate spectra computed per second and channel
+   * @param maxChannels channels allocated up front, at most kMaxChannels
+   */
+  SpectrumAnalyzer(int fftSize = 4096, Window window = HANN, int workers = 2,
+                   float rate = 60.0f, int maxChannels = kMaxChannels)
+      : mFFTSize(fftSize), mRate(rate),
+        mMaxChannels(std::max(0, std::min(maxChannels, int(kMaxChannels)))) {
+    for (int i = 0; i < mMaxChannels; i++) {
+      mChannels[i].reset(new AnalysisChannel(fftSize));
+    }
+    const double pi = 3.14159265358979323846;
+    mWindow.resize(fftSize);
+    double sum = 0.0;
+    for (int i = 0; i < fftSize; i++) {
+      double phase = 2.0 * pi * i / fftSize;
+      double w;
+      if (window == BLACKMAN_HARRIS) {
+        w = 0.35875 - 0.48829 * std::cos(phase) +
+            0.14128 * std::cos(2 * phase) - 0.01168 * std::cos(3 * phase);
+      } else {
+        w = 0.5 - 0.5 * std::cos(phase);
+      }
+      mWindow[i] = float(w);
+      sum += w;
+    }
+    // Magnitude of a full scale sine is 1
+    mNormalization = float(2.0 / sum);
+    for (int i = 0; i < workers; i++) {
+      mWorkers.emplace_back(&SpectrumAnalyzer::workerLoop, this, i, workers);
+    }
+  }
+
+  ~SpectrumAnalyzer() {
+    mRunning = false;
+    for (auto &worker : mWorkers) {
+      worker.join();
+    }
+  }
+
+  /**
+   * @brief Take a channel for a voice
+   *
+   * Channels are allocated by the constructor, so this is wait-free and can
+   * be called from the audio thread, e.g. in a voice's first onTriggerOn(),
+   * and from several threads at once. Returns nullptr once all channels are
+   * taken.
+   */
+  AnalysisChannel *addChannel() {
+    int index = mNumChannels.fetch_add(1, std::memory_order_acq_rel);
+    if (index >= mMaxChannels) {
+      return nullptr;
+    }
+    return mChannels[index].get();
+  }
+
+  int fftSize() const { return mFFTSize; }
+
+private:
+  void workerLoop(int worker, int workers) {
+    RadixFFT fft(mFFTSize);
+    std::vector<float> buffer(2 * mFFTSize);
+    auto period = std::chrono::duration<double>(1.0 / mRate);
+    auto next = std::chrono::steady_clock::now();
+    while (mRunning) {
+      int numChannels = std::min(
+          mNumChannels.load(std::memory_order_acquire), mMaxChannels);
+      for (int i = worker; i < numChannels; i += workers) {
+        analyze(*mChannels[i], fft, buffer);
+      }
+      next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          period);
+      std::this_thread::sleep_until(next);
+    }
+  }
+
+  void analyze(AnalysisChannel &channel, const RadixFFT &fft,
+               std::vector<float> &buffer) {
+    const int N = mFFTSize;
+    // The generation before the start, see AnalysisChannel::reset()
+    uint32_t generation = channel.mGeneration.load(std::memory_order_acquire);
+    uint64_t start = channel.mStart.load(std::memory_order_relaxed);
+    uint64_t end = channel.mWrite.load(std::memory_order_acquire);
+    if (end == channel.mAnalyzed) {
+      return; // Nothing new, the voice is idle
+    }
+    // Newest window, zero padded before the start of the note
+    for (int i = 0; i < N; i++) {
+      int64_t index = int64_t(end) - N + i;
+      float sample = index >= int64_t(start)
+                         ? channel.mRing[uint64_t(index) & channel.mMask]
+                         : 0.0f;
+      buffer[2 * i] = sample * mWindow[i];
+      buffer[2 * i + 1] = 0.0f;
+    }
+    // Drop the window if the writer overwrote it while it was copied
+    uint64_t written = channel.mWrite.load(std::memory_order_acquire);
+    if (written - end > channel.mRing.size() - N) {
+      return;
+    }
+    channel.mAnalyzed = end;
+
+    fft.forward(buffer.data());
+    std::vector<float> &spectrum = channel.backBuffer();
+    for (int k = 0; k <= N / 2; k++) {
+      float re = buffer[2 * k];
+      float im = buffer[2 * k + 1];
+      float magnitude = std::sqrt(re * re + im * im) * mNormalization;
+      // Same display mapping the voices used on the audio thread
+      spectrum[k] = std::tanh(std::pow(magnitude, 1.3f));
+    }
+    channel.mBufferGeneration[channel.mBack] = generation;
+    channel.publish();
+  }
+
+  int mFFTSize;
+  float mRate;
+  std::vector<float> mWindow;
+  float mNormalization;
+
+  int mMaxChannels;
+  std::unique_ptr<AnalysisChannel> mChannels[kMaxChannels];
+  std::atomic<int> mNumChannels{0}; // Taken, may run past mMaxChannels
+
+  std::atomic<bool> mRunning{true};
+  std::vector<std::thread> mWorkers;
+};
+
+#endif // SpectrumAnalyzer_H
@@ -0,0 +1,286 @@
+#pragma once
+#ifndef VoiceBlock_H
+#define VoiceBlock_H
+
+// Block rendering for SynthVoice subclasses.
+//
+// The per-sample voice loop (while (io()) { ... io.out(0) += s; }) goes
+// through the io() iterator and a bounds-checked channel access for every
+// sample, which keeps the compiler from vectorizing anything. In block mode
+// a voice instead renders a whole block into contiguous scratch buffers,
+// stage by stage, and the result is mixed into io.outBuffer() with a single
+// gain-accumulate per channel.
+//
+// A voice opts in by providing
+//
+//   void renderBlock(VoiceBlock &block, int frames);
+//
+// which must overwrite block.left and block.right for [0, frames), and by
+// dispatching from its onProcess():
+//
+//   void onProcess(AudioIOData &io) override {
+//     ...per block parameter handling...
+//     if (VoiceBlock::enabled()) {
+//       renderVoiceBlocks(io, *this);
+//     } else {
+//       while (io()) { ...per sample fallback... }
+//     }
+//   }
+//
+// Oscillators render a block as a phase ramp followed by a table lookup or
+// a sine polynomial (block::phases(), block::lookup(), block::sine()), see
+// BlockSine below and WavetableOsc::render(). Other stateful generators
+// (gamma envelopes, noise and filters) are run into a buffer with
+// block::generate(). Everything downstream of that (gain, envelope
+// multiply, panning, mixing) is written as plain loops over
+// restrict-qualified arrays that the compiler vectorizes.
+
+#include <algorithm>
+#include <cmath>
+
+#include "Gamma/Domain.h"
+#include "al/io/al_AudioIOData.hpp"
+
+#if defined(_MSC_VER)
+#define VOICE_BLOCK_RESTRICT __restrict
+#else
+#define VOICE_BLOCK_RESTRICT __restrict__
+#endif
+
+struct VoiceBlock {
+  static const int kFrames = 256;
+
+  alignas(64) float left[kFrames];
+  alignas(64) float right[kFrames];
+  alignas(64) float env[kFrames];
+
+  /**
+   * @brief Scratch block for the calling thread
+   *
+   * Voices are rendered one after another, so a single block per audio
+   * thread is enough and stays in cache between voices.
+   */
+  static VoiceBlock &scratch() {
+    thread_local VoiceBlock block;
+    return block;
+  }
+
+  /// Switch between block rendering and the per-sample fallback
+  static bool &enabled() {
+    static bool blockRendering = true;
+    return blockRendering;
+  }
+};
+
+namespace block {
+
+/// Run a generator (anything with float operator()()) into out
+template <class Gen>
+inline void generate(Gen &gen, float *VOICE_BLOCK_RESTRICT out, int frames) {
+  for (int i = 0; i < frames; i++) {
+    out[i] = gen();
+  }
+}
+
+/// Run a generator and accumulate it into out
+template <class Gen>
+inline void accumulate(Gen &gen, float *VOICE_BLOCK_RESTRICT out,
+                       int frames) {
+  for (int i = 0; i < frames; i++) {
+    out[i] += gen();
+  }
+}
+
+/// Run a block in place through a unary processor (e.g. a filter)
+template <class Proc>
+inline void process(Proc &proc, float *VOICE_BLOCK_RESTRICT buf, int frames) {
+  for (int i = 0; i < frames; i++) {
+    buf[i] = proc(buf[i]);
+  }
+}
+
+/// Feed a block to a processor without keeping its output (e.g. EnvFollow)
+template <class Proc>
+inline void feed(Proc &proc, const float *VOICE_BLOCK_RESTRICT in,
+                 int frames) {
+  for (int i = 0; i < frames; i++) {
+    proc(in[i]);
+  }
+}
+
+/**
+ * @brief Phase ramp of an oscillator, wrapped to [0, 1)
+ *
+ * out[i] = phase + i * inc, then phase is advanced past the block. Each
+ * value is computed from the start phase, so the ramp doesn't accumulate
+ * rounding error within a block.
+ */
+inline void phases(float &phase, float inc, float *VOICE_BLOCK_RESTRICT out,
+                   int frames) {
+  const float start = phase;
+  for (int i = 0; i < frames; i++) {
+    float p = start + inc * float(i);
+    float wrapped = p - float(int(p));
+    out[i] = wrapped + float(wrapped < 0.0f);
+  }
+  float next = start + inc * float(frames);
+  next -= std::floor(next);
+  phase = next < 1.0f ? next : 0.0f;
+}
+
+/**
+ * @brief Linearly interpolated table lookup at phases in [0, 1)
+ *
+ * table holds size + 1 samples, the last one repeating the first.
+ */
+inline void lookup(const float *VOICE_BLOCK_RESTRICT table, int size,
+                   const float *VOICE_BLOCK_RESTRICT phases,
+                   float *VOICE_BLOCK_RESTRICT out, int frames) {
+  for (int i = 0; i < frames; i++) {
+    float pos = phases[i] * float(size);
+    int index = std::min(int(pos), size - 1);
+    float frac = pos - float(index);
+    out[i] = table[index] + (table[index + 1] - table[index]) * frac;
+  }
+}
+
+/// Replace phases in [0, 1) in buf by sin(2 pi phase)
+inline void sine(float *buf, int frames) {
+  const float twoPi = 6.283185307f;
+  for (int i = 0; i < frames; i++) {
+    // Fold to [-1/4, 1/4] of a cycle around 0, where sin is odd
+    float t = buf[i] - 0.5f;
+    float half = std::copysign(0.5f, t);
+    float fold = float(std::fabs(t) > 0.25f);
+    float u = t + (half - 2.0f * t) * fold;
+    float x = -twoPi * u; // sin(2 pi (t + 1/2)) = -sin(2 pi t)
+    float x2 = x * x;
+    // Taylor series to x^11, error below 1e-7 over [-pi/2, pi/2]
+    buf[i] =
+        x * (1.0f +
+             x2 * (-1.0f / 6 +
+                   x2 * (1.0f / 120 +
+                         x2 * (-1.0f / 5040 +
+                               x2 * (1.0f / 362880 +
+                                     x2 * (-1.0f / 39916800))))));
+  }
+}
+
+inline void scale(float *VOICE_BLOCK_RESTRICT buf, float gain, int frames) {
+  for (int i = 0; i < frames; i++) {
+    buf[i] *= gain;
+  }
+}
+
+/// buf[i] *= env[i] * gain
+inline void multiply(float *VOICE_BLOCK_RESTRICT buf,
+                     const float *VOICE_BLOCK_RESTRICT env, float gain,
+                     int frames) {
+  for (int i = 0; i < frames; i++) {
+    buf[i] *= env[i] * gain;
+  }
+}
+
+/**
+ * @brief Pan a mono block with a fixed position
+ *
+ * The left channel is panned in place, the right channel is written to
+ * right. The pan gains are taken from the gamma panner once per block.
+ */
+template <class Pan>
+inline void pan(Pan &panner, float *VOICE_BLOCK_RESTRICT left,
+                float *VOICE_BLOCK_RESTRICT right, int frames) {
+  float gainL, gainR;
+  panner(1.0f, gainL, gainR);
+  for (int i = 0; i < frames; i++) {
+    right[i] = left[i] * gainR;
+    left[i] *= gainL;
+  }
+}
+
+/// dst[i] += src[i] * gain
+inline void mix(float *VOICE_BLOCK_RESTRICT dst,
+                const float *VOICE_BLOCK_RESTRICT src, float gain,
+                int frames) {
+  for (int i = 0; i < frames; i++) {
+    dst[i] += src[i] * gain;
+  }
+}
+
+} // namespace block
+
+/**
+ * @brief Sine oscillator rendering whole blocks
+ *
+ * Replaces gam::Sine<> in voices with a block path: render() fills a block
+ * with block::phases() and block::sine(). operator()() keeps the per-sample
+ * fallback on the same phase.
+ */
+class BlockSine {
+public:
+  /// Set frequency in Hz at the Gamma sample rate
+  void freq(float freq) {
+    mFreq = freq;
+    mInc = float(freq / gam::sampleRate());
+  }
+  float freq() const { return mFreq; }
+
+  /// Set phase in cycles, [0, 1)
+  void phase(float phase) { mPhase = phase; }
+
+  void render(float *out, int frames) {
+    block::phases(mPhase, mInc, out, frames);
+    block::sine(out, frames);
+  }
+
+  float operator()() {
+    float out = mPhase;
+    block::sine(&out, 1);
+    mPhase += mInc;
+    mPhase -= std::floor(mPhase);
+    if (mPhase >= 1.0f) {
+      mPhase = 0.0f;
+    }
+    return out;
+  }
+
+private:
+  float mFreq{440.0f};
+  float mInc{440.0f / 44100.0f};
+  float mPhase{0.0f};
+};
+
+/**
+ * @brief Render a voice in blocks and mix it into the output buffers
+ * @param io audio data passed to the voice's onProcess()
+ * @param voice voice providing renderBlock(VoiceBlock &, int)
+ * @param gain gain applied while mixing
+ *
+ * Rendering starts at the frame the io() iterator would produce next, so
+ * voices triggered with a frame offset start at the right sample. On return
+ * the iterator is exhausted, as after a while (io()) loop.
+ */
+template <class Voice>
+void renderVoiceBlocks(al::AudioIOData &io, Voice &voice, float gain = 1.0f) {
+  VoiceBlock &block = VoiceBlock::scratch();
+  const int framesPerBuffer = io.framesPerBuffer();
+  const int channels = io.channelsOut();
+  int frame = std::max(io.frame() + 1, 0);
+  while (frame < framesPerBuffer) {
+    int frames = framesPerBuffer - frame;
+    if (frames > VoiceBlock::kFrames) {
+      frames = VoiceBlock::kFrames;
+    }
+    voice.renderBlock(block, frames);
+    if (channels > 0) {
+      block::mix(io.outBuffer(0) + frame, block.left, gain, frames);
+    }
+    if (channels > 1) {
+      block::mix(io.outBuffer(1) + frame, block.right, gain, frames);
+    }
+    frame += frames;
+  }
+  io.frame(framesPerBuffer);
+}
+
+#endif // VoiceBlock_H
@@ -0,0 +1,305 @@
+#pragma once
+#ifndef VoiceGeometry_H
+#define VoiceGeometry_H
+
+// Shared voice geometry and instanced drawing of active voices.
+//
+// Voices used to build their own meshes in init(). Allocating polyphony
+// rebuilt the same spheres and waveform shapes for every voice, and each
+// active voice issued its own draw call with its own lighting and depth
+// state. Meshes now come from GeometryCache, keyed by the shape and its
+// parameters. A mesh is built once, shared read-only by all voices and
+// uploaded to the GPU once.
+//
+// In onProcess(Graphics) a voice sets up its transform as before, and its
+// polygon mode with VoiceInstancer::polygonMode() instead of g.polygonMode().
+// It then calls VoiceInstancer::draw() instead of g.draw(). That call only
+// records the current model matrix, polygon mode and the color. After the
+// synth has rendered, the app calls VoiceInstancer::flush(g), which uploads
+// the instances of each shape and draws every shape with a single instanced
+// call per polygon mode, so wireframe voices stay wireframe.
+//
+//   void onDraw(Graphics &g) override {
+//     g.clear();
+//     synthManager.render(g);
+//     VoiceInstancer::flush(g);
+//   }
+//
+// With VoiceInstancer::enabled() false, draw() renders right away, one call
+// per voice, still from the shared mesh.
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_Shader.hpp"
+#include "al/graphics/al_Shapes.hpp"
+#include "al/graphics/al_VAOMesh.hpp"
+
+/// Shape name and the parameters it was built with
+struct ShapeKey {
+  std::string name;
+  std::vector<float> params;
+
+  bool operator<(const ShapeKey &other) const {
+    return std::tie(name, params) < std::tie(other.name, other.params);
+  }
+};
+
+/// Per-instance data, laid out as the instance attributes of the shader
+struct VoiceInstance {
+  al::Mat4f model; // Column major
+  al::Color color;
+};
+
+/// Immutable mesh shared by all voices, with its instances of this frame
+class SharedMesh {
+public:
+  /// Polygon modes instances are sorted by: GL_FILL, GL_LINE, GL_POINT
+  static const int kPolygonModes = 3;
+
+  const al::Mesh &mesh() const { return mMesh; }
+
+  /// GPU mesh, uploaded on first use. Needs the GL context.
+  al::VAOMesh &gpuMesh() {
+    if (!mUploaded) {
+      mMesh.update();
+      mUploaded = true;
+    }
+    return mMesh;
+  }
+
+private:
+  friend class GeometryCache;
+  friend class VoiceInstancer;
+
+  al::VAOMesh mMesh;
+  bool mUploaded{false};
+
+  std::vector<VoiceInstance> mInstances[kPolygonModes];
+  al::BufferObject mInstanceBuffer;
+  bool mInstancing{false};
+};
+
+class GeometryCache {
+public:
+  /**
+   * @brief Mesh for a key, built by build() the first time it is requested
+   *
+   * Thread-safe, but locks and may allocate, so call from init(). Meshes are
+   * never removed. The reference stays valid for the life of the process.
+   */
+  static SharedMesh &get(const ShapeKey &key,
+                         const std::function<void(al::Mesh &)> &build) {
+    GeometryCache &cache = instance();
+    std::lock_guard<std::mutex> lock(cache.mMutex);
+    auto it = cache.mShapes.find(key);
+    if (it == cache.mShapes.end()) {
+      std::unique_ptr<SharedMesh> shape(new SharedMesh);
+      build(shape->mMesh);
+      // Instanced draws use glDrawArraysInstanced()
+      if (!shape->mMesh.indices().empty()) {
+        shape->mMesh.decompress();
+      }
+      shape->mInstances[0].reserve(64);
+      cache.mOrder.push_back(shape.get());
+      it = cache.mShapes.emplace(key, std::move(shape)).first;
+    }
+    return *it->second;
+  }
+
+  /// Sphere with flat shading normals, like addSphere() + decompress()
+  static SharedMesh &sphere(float radius, int slices, int stacks) {
+    return get({"sphere", {radius, float(slices), float(stacks)}},
+               [=](al::Mesh &m) {
+                 al::addSphere(m, radius, slices, stacks);
+                 m.decompress();
+                 m.generateNormals();
+               });
+  }
+
+private:
+  friend class VoiceInstancer;
+
+  static GeometryCache &instance() {
+    static GeometryCache cache;
+    return cache;
+  }
+
+  std::mutex mMutex;
+  std::map<ShapeKey, std::unique_ptr<SharedMesh>> mShapes;
+  std::vector<SharedMesh *> mOrder; // Creation order, for flush()
+};
+
+class VoiceInstancer {
+public:
+  // Instance attributes start above the ones used by al::VAOMesh
+  static const int kModelAttrib = 8; // Four columns, 8 to 11
+  static const int kColorAttrib = 12;
+
+  /// Whether draw() gathers instances for flush() or draws right away
+  static bool &enabled() {
+    static bool instancing = true;
+    return instancing;
+  }
+
+  /**
+   * @brief Set the polygon mode of g and of the voices drawn after
+   *
+   * GL_FILL, GL_LINE or GL_POINT. draw() sorts instances by the mode set
+   * here, so voices set it with this rather than g.polygonMode(). Reading it
+   * back from GL would stall, and isn't allowed in core profile on macOS.
+   */
+  static void polygonMode(al::Graphics &g, GLenum mode) {
+    currentMode() = mode == GL_LINE ? 1 : (mode == GL_POINT ? 2 : 0);
+    g.polygonMode(mode);
+  }
+
+  /// Draw a shape with the current transform of g. Graphics thread only.
+  static void draw(al::Graphics &g, SharedMesh &shape, const al::Color &color) {
+    if (enabled()) {
+      shape.mInstances[currentMode()].push_back({g.modelMatrix(), color});
+    } else {
+      g.color(color);
+      g.draw(shape.gpuMesh());
+    }
+  }
+
+  /**
+   * @brief Draw all instances gathered since the last flush
+   *
+   * One draw call per shape and polygon mode. Call where the model matrix is
+   * the identity, after the synth's graphics have been rendered. g is left
+   * in the polygon mode last set with polygonMode().
+   */
+  static void flush(al::Graphics &g) {
+    VoiceInstancer &self = instance();
+    GeometryCache &cache = GeometryCache::instance();
+    std::vector<SharedMesh *> shapes;
+    {
+      std::lock_guard<std::mutex> lock(cache.mMutex);
+      shapes = cache.mOrder;
+    }
+    const GLenum modes[SharedMesh::kPolygonModes] = {GL_FILL, GL_LINE,
+                                                     GL_POINT};
+    bool drawn = false;
+    for (int mode = 0; mode < SharedMesh::kPolygonModes; mode++) {
+      bool drawing = false;
+      for (SharedMesh *shape : shapes) {
+        std::vector<VoiceInstance> &instances = shape->mInstances[mode];
+        if (instances.empty()) {
+          continue;
+        }
+        if (!drawn) {
+          drawn = true;
+          if (!self.mShaderCompiled) {
+            self.mShader.compile(vertexShader(), fragmentShader());
+            self.mShaderCompiled = true;
+          }
+          g.depthTesting(true);
+          g.shader(self.mShader);
+          g.update();
+        }
+        if (!drawing) {
+          g.polygonMode(modes[mode]);
+          drawing = true;
+        }
+        al::VAOMesh &mesh = shape->gpuMesh();
+        if (!shape->mInstancing) {
+          enableInstancing(*shape);
+        }
+        shape->mInstanceBuffer.bind();
+        shape->mInstanceBuffer.data(sizeof(VoiceInstance) * instances.size(),
+                                    instances.data());
+        mesh.vao().bind();
+        glDrawArraysInstanced(GLenum(mesh.primitive()), 0,
+                              GLsizei(mesh.vertices().size()),
+                              GLsizei(instances.size()));
+        instances.clear();
+      }
+    }
+    if (drawn) {
+      g.polygonMode(modes[currentMode()]);
+    }
+  }
+
+private:
+  static VoiceInstancer &instance() {
+    static VoiceInstancer instancer;
+    return instancer;
+  }
+
+  // Index in SharedMesh::mInstances of the mode set with polygonMode()
+  static int &currentMode() {
+    static int mode = 0;
+    return mode;
+  }
+
+  // Attach the instance buffer to the mesh's vertex array
+  static void enableInstancing(SharedMesh &shape) {
+    al::BufferObject &buffer = shape.mInstanceBuffer;
+    buffer.bufferType(GL_ARRAY_BUFFER);
+    buffer.usage(GL_DYNAMIC_DRAW);
+    buffer.create();
+    auto &vao = shape.gpuMesh().vao();
+    vao.bind();
+    const int stride = sizeof(VoiceInstance);
+    for (int column = 0; column < 4; column++) {
+      vao.enableAttrib(kModelAttrib + column);
+      vao.attribPointer(kModelAttrib + column, buffer, 4, GL_FLOAT, GL_FALSE,
+                        stride,
+                        (void *)(sizeof(float) * 4 * column));
+      glVertexAttribDivisor(kModelAttrib + column, 1);
+    }
+    vao.enableAttrib(kColorAttrib);
+    vao.attribPointer(kColorAttrib, buffer, 4, GL_FLOAT, GL_FALSE, stride,
+                      (void *)(sizeof(al::Mat4f)));
+    glVertexAttribDivisor(kColorAttrib, 1);
+    shape.mInstancing = true;
+  }
+
+  // Instance color with a headlight, close to the default lighting the
+  // voices used to enable one by one. Lines have no normals and stay unlit.
+  static const char *vertexShader() {
+    return R"(
+#version 330
+uniform mat4 al_ModelViewMatrix;
+uniform mat4 al_ProjectionMatrix;
+layout (location = 0) in vec3 position;
+layout (location = 3) in vec3 normal;
+layout (location = 8) in mat4 instanceModel;
+layout (location = 12) in vec4 instanceColor;
+out vec4 color;
+void main() {
+  mat4 modelView = al_ModelViewMatrix * instanceModel;
+  vec3 n = mat3(modelView) * normal;
+  float shade = 1.0;
+  if (dot(n, n) > 1e-12) {
+    shade = 0.3 + 0.7 * abs(normalize(n).z);
+  }
+  color = vec4(instanceColor.rgb * shade, instanceColor.a);
+  gl_Position = al_ProjectionMatrix * modelView * vec4(position, 1.0);
+}
+)";
+  }
+
+  static const char *fragmentShader() {
+    return R"(
+#version 330
+in vec4 color;
+layout (location = 0) out vec4 fragColor;
+void main() { fragColor = color; }
+)";
+  }
+
+  al::ShaderProgram mShader;
+  bool mShaderCompiled{false};
+};
+
+#endif // VoiceGeometry_H
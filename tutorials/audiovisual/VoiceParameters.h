@@ -0,0 +1,125 @@
+#pragma once
+#ifndef VoiceParameters_H
+#define VoiceParameters_H
+
+// Index-resolved handles for SynthVoice internal parameters.
+//
+// getInternalParameterValue("name") looks the parameter up by string on
+// every call, which is expensive inside the audio loop. VoiceParameters
+// resolves each parameter once in init() and copies all values into one
+// contiguous, cache-aligned array once per audio block. A dirty bitmask tells
+// the voice which values changed since the previous snapshot, so envelope
+// and oscillator setup only needs to be redone for those.
+//
+// Usage:
+//
+//   void init() override {
+//     pFreq = mParams.add(createInternalTriggerParameter("frequency", 60, 20, 5000));
+//     pAmp = mParams.add(createInternalTriggerParameter("amplitude", 0.1, 0, 1));
+//   }
+//   void onProcess(AudioIOData &io) override {
+//     if (mParams.snapshot()) {
+//       if (mParams.changed(pFreq)) mOsc.freq(mParams[pFreq]);
+//     }
+//     float amp = mParams[pAmp];
+//     while (io()) { ... }
+//   }
+//   void onTriggerOn() override {
+//     mParams.invalidate(); // Treat every value as changed for a new note
+//     mParams.snapshot();
+//   }
+
+#include <cassert>
+#include <cstdint>
+
+#include "al/ui/al_Parameter.hpp"
+
+// Handle to a parameter registered in a VoiceParameters set. Handles can be
+// or'ed together to build masks for VoiceParameters::changed().
+struct ParamHandle {
+  uint8_t index{0};
+
+  uint32_t mask() const { return uint32_t(1) << index; }
+};
+
+inline uint32_t operator|(ParamHandle a, ParamHandle b) {
+  return a.mask() | b.mask();
+}
+inline uint32_t operator|(uint32_t mask, ParamHandle h) {
+  return mask | h.mask();
+}
+
+class VoiceParameters {
+public:
+  static const int kMaxParameters = 32;
+
+  /**
+   * @brief Register a parameter and return its handle
+   *
+   * Call from init() with the reference returned by
+   * createInternalTriggerParameter(). Handles are assigned in registration
+   * order.
+   */
+  ParamHandle add(al::Parameter &param) {
+    assert(mCount < kMaxParameters);
+    ParamHandle handle;
+    handle.index = static_cast<uint8_t>(mCount);
+    mParameters[mCount] = &param;
+    mValues[mCount] = param.get();
+    mCount++;
+    mForceDirty = allMask();
+    return handle;
+  }
+
+  /**
+   * @brief Copy current parameter values into the snapshot
+   * @return mask of the parameters that changed since the last snapshot
+   *
+   * Call once per audio block, outside the sample loop.
+   */
+  uint32_t snapshot() {
+    uint32_t dirty = mForceDirty;
+    for (int i = 0; i < mCount; i++) {
+      float value = mParameters[i]->get();
+      if (value != mValues[i]) {
+        mValues[i] = value;
+        dirty |= uint32_t(1) << i;
+      }
+    }
+    mForceDirty = 0;
+    mDirty = dirty;
+    return dirty;
+  }
+
+  /// Mark all parameters as changed for the next snapshot()
+  void invalidate() { mForceDirty = allMask(); }
+
+  /// Snapshot value. Only valid after snapshot() has been called.
+  float operator[](ParamHandle handle) const { return mValues[handle.index]; }
+
+  /// Current parameter value, bypassing the snapshot (e.g. for graphics)
+  float live(ParamHandle handle) const {
+    return mParameters[handle.index]->get();
+  }
+
+  bool changed(ParamHandle handle) const {
+    return (mDirty & handle.mask()) != 0;
+  }
+  bool changed(uint32_t mask) const { return (mDirty & mask) != 0; }
+
+  uint32_t dirtyMask() const { return mDirty; }
+  int size() const { return mCount; }
+
+private:
+  uint32_t allMask() const {
+    return mCount >= 32 ? ~uint32_t(0) : (uint32_t(1) << mCount) - 1;
+  }
+
+  alignas(64) float mValues[kMaxParameters]{};
+  al::Parameter *mParameters[kMaxParameters]{};
+  uint32_t mDirty{0};
+  uint32_t mForceDirty{0};
+  int mCount{0};
+};
+
+#endif // VoiceParameters_H
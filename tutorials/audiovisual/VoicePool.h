@@ -0,0 +1,311 @@
+#pragma once
+#ifndef VoicePool_H
+#define VoicePool_H
+
+// Bounded, preallocated voice pool with voice stealing.
+//
+// Generative passages used to call synth.getVoice<T>() once per scheduled
+// note. PolySynth allocates a new voice whenever no idle one exists, so a
+// dense passage allocated voices, and ran their init(), while audio was
+// running. A VoicePool owns a fixed number of voices of one class, all
+// created by allocatePolyphony(). Notes are scheduled as plain events into
+// a preallocated lock-free queue. The audio thread assigns them to voices
+// as they become due. When every voice is busy, the steal policy picks the
+// voice to take over. With NONE, or when the victim outranks the new note,
+// the note is dropped. Neither the scheduling nor the audio path touches
+// the heap.
+//
+//   VoicePool<SineEnv> sinePool{VoicePool<SineEnv>::QUIETEST,
+//                               [](SineEnv &v) { return v.mEnvFollow.value(); }};
+//
+//   void onCreate() override { sinePool.allocatePolyphony(32); }
+//   void onSound(AudioIOData &io) override { sinePool.render(io); }
+//   void onDraw(Graphics &g) override { sinePool.render(g); }
+//
+//   float params[] = {amp, freq, attack, release, pan};
+//   sinePool.scheduleFromNow(time, duration, params, 5);
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Gamma/Domain.h"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/io/al_AudioIOData.hpp"
+
+template <class TVoice> class VoicePool {
+public:
+  enum Steal {
+    NONE,           ///< Drop notes while all voices are busy
+    OLDEST,         ///< Take the voice that started first
+    QUIETEST,       ///< Take the voice with the lowest level()
+    LOWEST_PRIORITY ///< Take the lowest priority voice, if it ranks lower
+  };
+
+  /// Trigger parameters carried by an event
+  static const int kMaxParams = 32;
+
+  /// Current level of a voice, usually its envelope follower
+  typedef float (*LevelFunction)(TVoice &);
+
+  VoicePool(Steal policy = OLDEST, LevelFunction level = nullptr)
+      : mPolicy(policy), mLevel(level) {}
+
+  /**
+   * @brief Create the voices and the event queue
+   *
+   * Calls init() on every voice. Allocates, so call it once from onCreate(),
+   * after the Gamma sample rate has been set.
+   * @param voices number of voices, the most that can sound at once
+   * @param maxEvents notes that can be scheduled ahead
+   */
+  void allocatePolyphony(int voices, int maxEvents = 4096) {
+    mSlots.resize(voices);
+    for (auto &slot : mSlots) {
+      slot.voice.reset(new TVoice);
+      slot.voice->init();
+    }
+    int capacity = 1;
+    while (capacity < maxEvents) {
+      capacity *= 2;
+    }
+    mQueue.resize(capacity);
+    mQueueMask = capacity - 1;
+    mPending.reserve(capacity);
+  }
+
+  void policy(Steal policy) { mPolicy = policy; }
+  Steal policy() const { return mPolicy; }
+
+  /**
+   * @brief Schedule a note relative to the audio clock
+   *
+   * Wait-free, call from a single scheduling thread.
+   * @param time start in seconds from now
+   * @param duration seconds until the note is released
+   * @param params trigger parameters, in the order the voice creates them
+   * @param numParams number of params, at most kMaxParams
+   * @param priority rank used by LOWEST_PRIORITY
+   * @return false if the queue is full and the note was not scheduled
+   */
+  bool scheduleFromNow(double time, double duration, const float *params,
+                       int numParams, float priority = 0.0f) {
+    uint64_t now = mFrame.load(std::memory_order_acquire);
+    return push(now + frames(time), frames(duration), params, numParams,
+                priority);
+  }
+
+  /// Like scheduleFromNow(), at an absolute time of the pool's clock
+  bool scheduleAt(double time, double duration, const float *params,
+                  int numParams, float priority = 0.0f) {
+    return push(frames(time), frames(duration), params, numParams, priority);
+  }
+
+  /// Seconds of audio rendered by the pool so far
+  double time() const {
+    return mFrame.load(std::memory_order_acquire) / gam::sampleRate();
+  }
+
+  /// Audio thread: start and release due notes and render active voices
+  void render(al::AudioIOData &io) {
+    const uint64_t start = mFrame.load(std::memory_order_relaxed);
+    const uint64_t end = start + io.framesPerBuffer();
+    drainQueue();
+    while (!mPending.empty() && mPending.front().onFrame < end) {
+      std::pop_heap(mPending.begin(), mPending.end(), Later());
+      const Event &event = mPending.back();
+      int offset = event.onFrame > start ? int(event.onFrame - start) : 0;
+      startNote(event, offset);
+      mPending.pop_back();
+    }
+    for (auto &slot : mSlots) {
+      TVoice &voice = *slot.voice;
+      if (!voice.active()) {
+        continue;
+      }
+      // Releases are quantized to the start of the block
+      if (!slot.released && slot.offFrame < end) {
+        voice.triggerOff();
+        slot.released = true;
+      }
+      io.frame(slot.offset);
+      voice.onProcess(io);
+      slot.offset = 0;
+    }
+    io.frame(0);
+    mFrame.store(end, std::memory_order_release);
+  }
+
+  /// Graphics thread: draw active voices
+  void render(al::Graphics &g) {
+    for (auto &slot : mSlots) {
+      if (slot.voice->active()) {
+        slot.voice->onProcess(g);
+      }
+    }
+  }
+
+  /// Notes that took over a busy voice
+  uint64_t steals() const { return mSteals.load(std::memory_order_relaxed); }
+  /// Notes dropped because no voice could be taken
+  uint64_t exhausted() const {
+    return mExhausted.load(std::memory_order_relaxed);
+  }
+
+  int activeVoices() const {
+    int count = 0;
+    for (auto &slot : mSlots) {
+      count += slot.voice->active() ? 1 : 0;
+    }
+    return count;
+  }
+  int size() const { return int(mSlots.size()); }
+
+private:
+  struct Event {
+    uint64_t onFrame;
+    uint64_t offFrame;
+    float priority;
+    int numParams;
+    float params[kMaxParams];
+  };
+
+  // Min-heap on start frame
+  struct Later {
+    bool operator()(const Event &a, const Event &b) const {
+      return a.onFrame > b.onFrame;
+    }
+  };
+
+  struct Slot {
+    std::unique_ptr<TVoice> voice;
+    uint64_t onFrame{0};
+    uint64_t offFrame{0};
+    float priority{0.0f};
+    int offset{0};
+    bool released{true};
+  };
+
+  static uint64_t frames(double seconds) {
+    return uint64_t(std::max(0.0, seconds) * gam::sampleRate() + 0.5);
+  }
+
+  bool push(uint64_t onFrame, uint64_t length, const float *params,
+            int numParams, float priority) {
+    uint64_t write = mWrite.load(std::memory_order_relaxed);
+    if (mQueue.empty() ||
+        write - mRead.load(std::memory_order_acquire) > mQueueMask) {
+      return false;
+    }
+    Event &event = mQueue[write & mQueueMask];
+    event.onFrame = onFrame;
+    event.offFrame = onFrame + length;
+    event.priority = priority;
+    event.numParams = std::min(numParams, int(kMaxParams));
+    std::copy(params, params + event.numParams, event.params);
+    mWrite.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Move queued events into the pending heap, as far as it has room
+  void drainQueue() {
+    uint64_t read = mRead.load(std::memory_order_relaxed);
+    uint64_t write = mWrite.load(std::memory_order_acquire);
+    while (read != write && mPending.size() < mPending.capacity()) {
+      mPending.push_back(mQueue[read & mQueueMask]);
+      std::push_heap(mPending.begin(), mPending.end(), Later());
+      read++;
+    }
+    mRead.store(read, std::memory_order_release);
+  }
+
+  void startNote(const Event &event, int offset) {
+    Slot *slot = freeSlot();
+    if (!slot) {
+      slot = victim(event);
+      if (!slot) {
+        mExhausted.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      mSteals.fetch_add(1, std::memory_order_relaxed);
+    }
+    TVoice &voice = *slot->voice;
+    voice.setTriggerParams(const_cast<float *>(event.params), event.numParams);
+    voice.triggerOn();
+    slot->onFrame = event.onFrame;
+    slot->offFrame = event.offFrame;
+    slot->priority = event.priority;
+    slot->offset = offset;
+    slot->released = false;
+  }
+
+  Slot *freeSlot() {
+    for (auto &slot : mSlots) {
+      if (!slot.voice->active()) {
+        return &slot;
+      }
+    }
+    return nullptr;
+  }
+
+  // Busy voice to take over for event, or nullptr to drop it
+  Slot *victim(const Event &event) {
+    Steal policy = mPolicy;
+    if (policy == QUIETEST && !mLevel) {
+      policy = OLDEST;
+    }
+    Slot *best = nullptr;
+    float bestLevel = 0.0f;
+    for (auto &slot : mSlots) {
+      switch (policy) {
+      case NONE:
+        return nullptr;
+      case OLDEST:
+        if (!best || slot.onFrame < best->onFrame) {
+          best = &slot;
+        }
+        break;
+      case QUIETEST: {
+        float level = mLevel(*slot.voice);
+        if (!best || level < bestLevel) {
+          best = &slot;
+          bestLevel = level;
+        }
+        break;
+      }
+      case LOWEST_PRIORITY:
+        if (!best || slot.priority < best->priority ||
+            (slot.priority == best->priority &&
+             slot.onFrame < best->onFrame)) {
+          best = &slot;
+        }
+        break;
+      }
+    }
+    if (policy == LOWEST_PRIORITY && best &&
+        best->priority > event.priority) {
+      return nullptr;
+    }
+    return best;
+  }
+
+  Steal mPolicy;
+  LevelFunction mLevel;
+  std::vector<Slot> mSlots;
+
+  // Single producer, single consumer event queue
+  std::vector<Event> mQueue;
+  uint64_t mQueueMask{0};
+  std::atomic<uint64_t> mWrite{0};
+  std::atomic<uint64_t> mRead{0};
+
+  std::vector<Event> mPending; // Audio thread only
+  std::atomic<uint64_t> mFrame{0};
+
+  std::atomic<uint64_t> mSteals{0};
+  std::atomic<uint64_t> mExhausted{0};
+};
+
+#endif // VoicePool_H
@@ -0,0 +1,307 @@
+#pragma once
+#ifndef WavetableCache_H
+#define WavetableCache_H
+
+// Process-wide cache of band-limited, mipmapped wavetables.
+//
+// Voices used to fill global gam::ArrayPow2 tables with gam::addSines() in
+// every init(), so allocating polyphony repeated the same harmonic sums for
+// each voice. Tables are now described by a Spectrum, built the first time
+// a spectrum is requested and shared, immutable, by every oscillator.
+//
+// Each table holds one mip level per octave of fundamental frequency. A
+// level only contains the harmonics that stay below Nyquist for the highest
+// fundamental it is used for, so high notes do not alias. WavetableOsc
+// picks the level from its frequency.
+//
+// WavetableCache::get() locks and may allocate, call it from init(). The
+// returned reference stays valid for the life of the process and can be
+// read from any thread without locking.
+//
+// waveTable(index) returns the nine tables the tutorial voices select with
+// their "table" parameter, built for the current Gamma sample rate.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "Gamma/Domain.h"
+
+#include "VoiceBlock.h"
+
+/// Harmonic content of a wavetable: sines at harmonic numbers with amplitudes
+struct Spectrum {
+  std::vector<float> harmonics;
+  std::vector<float> amplitudes;
+
+  /// Single sine
+  static Spectrum sine() { return partials(1, 1.0f, 1.0f); }
+
+  /// count partials at harmonics first, first + step, ... with amplitude
+  /// 1 / h^power, like gam::addSinesPow<power>()
+  static Spectrum series(int count, float step, int power, float first = 1) {
+    Spectrum s;
+    for (int i = 0; i < count; i++) {
+      float h = first + i * step;
+      s.harmonics.push_back(h);
+      s.amplitudes.push_back(1.0f / std::pow(h, float(power)));
+    }
+    return s;
+  }
+
+  /// Partials at explicit harmonic numbers, like gam::addSines(dst, A, C, n)
+  static Spectrum partials(const float *amps, const float *harmonics,
+                           int count) {
+    Spectrum s;
+    s.harmonics.assign(harmonics, harmonics + count);
+    s.amplitudes.assign(amps, amps + count);
+    return s;
+  }
+
+  /// Consecutive harmonics starting at first
+  static Spectrum partials(const float *amps, int count, float first = 1) {
+    Spectrum s;
+    for (int i = 0; i < count; i++) {
+      s.harmonics.push_back(first + i);
+      s.amplitudes.push_back(amps[i]);
+    }
+    return s;
+  }
+
+  static Spectrum partials(int count, float first, float amp) {
+    Spectrum s;
+    for (int i = 0; i < count; i++) {
+      s.harmonics.push_back(first + i);
+      s.amplitudes.push_back(amp);
+    }
+    return s;
+  }
+
+  bool operator<(const Spectrum &other) const {
+    return std::tie(harmonics, amplitudes) <
+           std::tie(other.harmonics, other.amplitudes);
+  }
+};
+
+/// Immutable mipmapped table built from a Spectrum
+class Wavetable {
+public:
+  static const int kSize = 2048;
+  static const int kLevels = 10;
+  /// Level 0 is used for fundamentals below 2 * kBaseFreq
+  static constexpr float kBaseFreq = 20.0f;
+
+  Wavetable(const Spectrum &spectrum, double sampleRate) {
+    const double twoPi = 6.283185307179586;
+    double nyquist = sampleRate / 2;
+    mData.resize(kLevels * (kSize + 1), 0.0f);
+    for (int level = 0; level < kLevels; level++) {
+      // Highest fundamental this level is used for
+      double topFreq = kBaseFreq * std::pow(2.0, level + 1);
+      float *table = mData.data() + level * (kSize + 1);
+      for (size_t p = 0; p < spectrum.harmonics.size(); p++) {
+        double h = spectrum.harmonics[p];
+        if (h * topFreq >= nyquist) {
+          continue;
+        }
+        double amp = spectrum.amplitudes[p];
+        for (int i = 0; i < kSize; i++) {
+          table[i] += float(amp * std::sin(twoPi * h * i / kSize));
+        }
+      }
+      table[kSize] = table[0]; // Guard point for interpolation
+    }
+  }
+
+  /// Mip level for a fundamental frequency in Hz
+  static int levelFor(float freq) {
+    int level = std::ilogb(std::fabs(freq) / kBaseFreq + 1e-9f);
+    return level < 0 ? 0 : (level >= kLevels ? kLevels - 1 : level);
+  }
+
+  /// kSize + 1 samples, the last one repeats the first
+  const float *level(int level) const {
+    return mData.data() + level * (kSize + 1);
+  }
+
+private:
+  std::vector<float> mData;
+};
+
+class WavetableCache {
+public:
+  /**
+   * @brief Table for a spectrum at the current Gamma sample rate
+   *
+   * Built on first use. Thread-safe, but locks and may allocate.
+   */
+  static const Wavetable &get(const Spectrum &spectrum) {
+    WavetableCache &cache = instance();
+    double sampleRate = gam::sampleRate();
+    std::lock_guard<std::mutex> lock(cache.mMutex);
+    auto key = std::make_pair(sampleRate, spectrum);
+    auto it = cache.mTables.find(key);
+    if (it == cache.mTables.end()) {
+      std::unique_ptr<const Wavetable> table(
+          new Wavetable(spectrum, sampleRate));
+      it = cache.mTables.emplace(key, std::move(table)).first;
+    }
+    return *it->second;
+  }
+
+  static const int kStandardTables = 9;
+
+  /**
+   * @brief The tutorials' tables at the current Gamma sample rate
+   *
+   * Saw, square, impulse, sine, pulse, then four partial sets. The set for a
+   * sample rate is built the first time it is asked for, which locks and
+   * allocates, so call this from init() first. Later calls at the same rate
+   * only read an atomic pointer.
+   */
+  static const Wavetable &standard(int index) {
+    WavetableCache &cache = instance();
+    double sampleRate = gam::sampleRate();
+    const StandardSet *set = cache.mStandard.load(std::memory_order_acquire);
+    if (!set || set->sampleRate != sampleRate) {
+      set = cache.buildStandard(sampleRate);
+    }
+    if (index < 0 || index >= kStandardTables) {
+      index = 0;
+    }
+    return *set->tables[index];
+  }
+
+private:
+  struct StandardSet {
+    double sampleRate;
+    const Wavetable *tables[kStandardTables];
+  };
+
+  const StandardSet *buildStandard(double sampleRate) {
+    std::lock_guard<std::mutex> lock(mStandardMutex);
+    for (const auto &set : mStandardSets) {
+      if (set->sampleRate == sampleRate) {
+        mStandard.store(set.get(), std::memory_order_release);
+        return set.get();
+      }
+    }
+    static const float plsA[] = {1, 1, 1, 1, 0.7, 0.5, 0.3, 0.1};
+    static const float a1[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08};
+    static const float c1[] = {1, 4, 7, 11, 15, 18};
+    // inharmonic partials
+    static const float a2[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
+    static const float c2[] = {3, 4, 7, 8, 11, 12, 15, 16};
+    static const float a3[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08};
+    static const float c3[] = {10, 27, 54, 81, 108, 135};
+    // harmonics 20-27
+    static const float a4[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
+    const Spectrum spectra[kStandardTables] = {
+        Spectrum::series(9, 1, 1), // tbSaw
+        Spectrum::series(9, 2, 1), // tbSqr
+        Spectrum::series(9, 1, 0), // tbImp
+        Spectrum::sine(),          // tbSin
+        Spectrum::partials(plsA, 8),
+        Spectrum::partials(a1, c1, 6),
+        Spectrum::partials(a2, c2, 8),
+        Spectrum::partials(a3, c3, 6),
+        Spectrum::partials(a4, 8, 20)};
+    std::unique_ptr<StandardSet> set(new StandardSet);
+    set->sampleRate = sampleRate;
+    for (int i = 0; i < kStandardTables; i++) {
+      set->tables[i] = &get(spectra[i]);
+    }
+    mStandardSets.push_back(std::move(set));
+    mStandard.store(mStandardSets.back().get(), std::memory_order_release);
+    return mStandardSets.back().get();
+  }
+
+  static WavetableCache &instance() {
+    static WavetableCache cache;
+    return cache;
+  }
+
+  std::mutex mMutex;
+  std::map<std::pair<double, Spectrum>, std::unique_ptr<const Wavetable>>
+      mTables;
+
+  // Kept for the life of the process, voices hold pointers into them
+  std::mutex mStandardMutex;
+  std::vector<std::unique_ptr<StandardSet>> mStandardSets;
+  std::atomic<const StandardSet *> mStandard{nullptr};
+};
+
+/// Table selected by the tutorial voices' "table" parameter, 0 to 8
+inline const Wavetable &waveTable(int index) {
+  return WavetableCache::standard(index);
+}
+
+/// Interpolating oscillator reading a shared Wavetable
+class WavetableOsc {
+public:
+  WavetableOsc() {}
+  WavetableOsc(const Wavetable &table) { source(table); }
+
+  void source(const Wavetable &table) {
+    mTable = &table;
+    mLevel = mTable->level(Wavetable::levelFor(mFreq));
+  }
+
+  /// Set frequency in Hz, also selecting the mip level
+  void freq(float freq) {
+    mFreq = freq;
+    mInc = float(freq / gam::sampleRate());
+    if (mTable) {
+      mLevel = mTable->level(Wavetable::levelFor(freq));
+    }
+  }
+  float freq() const { return mFreq; }
+
+  /// Set phase in cycles, [0, 1)
+  void phase(float phase) { mPhase = phase; }
+
+  /// Render a block as a phase ramp and a table lookup, see VoiceBlock.h
+  void render(float *out, int frames) {
+    if (!mLevel) {
+      std::fill(out, out + frames, 0.0f);
+      return;
+    }
+    alignas(64) float phases[VoiceBlock::kFrames];
+    for (int done = 0; done < frames; done += VoiceBlock::kFrames) {
+      int n = std::min(frames - done, int(VoiceBlock::kFrames));
+      block::phases(mPhase, mInc, phases, n);
+      block::lookup(mLevel, Wavetable::kSize, phases, out + done, n);
+    }
+  }
+
+  float operator()() {
+    if (!mLevel) {
+      return 0.0f;
+    }
+    float pos = mPhase * Wavetable::kSize;
+    int index = int(pos);
+    float frac = pos - index;
+    float out = mLevel[index] + (mLevel[index + 1] - mLevel[index]) * frac;
+    mPhase += mInc;
+    mPhase -= std::floor(mPhase);
+    if (mPhase >= 1.0f) {
+      mPhase = 0.0f; // Rounding of tiny negative phases
+    }
+    return out;
+  }
+
+private:
+  const Wavetable *mTable{nullptr};
+  const float *mLevel{nullptr};
+  float mFreq{440.0f};
+  float mInc{0.0f};
+  float mPhase{0.0f};
+};
+
+#endif // WavetableCache_H
@@ -19,13 +19,91 @@
 #include "al/io/al_MIDI.hpp"
 #include "al/math/al_Random.hpp"
 
+#include "PartialBank.h"
+#include "SpectrumAnalyzer.h"
+#include "VoiceBlock.h"
+#include "VoiceGeometry.h"
+#include "VoiceParameters.h"
+#include "WavetableCache.h"
+
 using namespace gam;
 using namespace al;
 using namespace std;
 #define FFT_SIZE 4048
-// tables for oscillator
-gam::ArrayPow2<float> tbSaw(2048), tbSqr(2048), tbImp(2048), tbSin(2048), tbDin(2048),
-    tbPls(2048), tb__1(2048), tb__2(2048), tb__3(2048), tb__4(2048);
+// Visual shape of each waveform table, shared by all voices (see
+// VoiceGeometry.h). Indices match the "table" parameter.
+SharedMesh &waveformShape(int index)
+{
+  if (index < 0 || index > 8)
+  {
+    index = 0;
+  }
+  return GeometryCache::get({"waveform", {float(index)}}, [index](Mesh &m) {
+    float scaler = 0.15;
+    float hscaler = 1;
+    switch (index)
+    {
+    case 0: // tbSaw
+      addCone(m, 1, Vec3f(0, 0, 5), 40, 1);
+      break;
+    case 1: // tbSquare
+      addCube(m);
+      break;
+    case 2: // tbImp
+      addPrism(m, 1, 1, 1, 100);
+      break;
+    case 3: // tbSin
+      addSphere(m, 0.3, 16, 100);
+      break;
+    case 4: // tbPls
+      addWireBox(m, 2);
+      break;
+    case 5: // tb__1
+    {
+      float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08, 0, 0};
+      float C[] = {1, 4, 7, 11, 15, 18, 0, 0};
+      for (int i = 0; i < 7; i++)
+        addWireBox(m, scaler * A[i] * C[i], scaler * A[i + 1] * C[i + 1], 1 + 0.3 * i);
+      break;
+    }
+    case 6: // inharmonic partials
+    {
+      float A[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
+      float C[] = {3, 4, 7, 8, 11, 12, 15, 16};
+      for (int i = 0; i < 7; i++)
+        addWireBox(m, scaler * A[i] * C[i], scaler * A[i + 1] * C[i + 1], 1 + 0.3 * i);
+      break;
+    }
+    case 7: // inharmonic partials
+    {
+      float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08, 0, 0};
+      float C[] = {10, 27, 54, 81, 108, 135, 0, 0};
+      for (int i = 0; i < 7; i++)
+        addWireBox(m, scaler * A[i] * C[i], scaler * A[i + 1] * C[i + 1], 1 + 0.3 * i);
+      break;
+    }
+    default: // harmonics 20-27
+    {
+      float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
+      for (int i = 0; i < 7; i++)
+        addWireBox(m, hscaler * A[i], hscaler * A[i + 1], 1 + 0.3 * i);
+      break;
+    }
+    }
+    // Scale and generate normals
+    m.scale(0.4);
+    int Nv = m.vertices().size();
+    for (int k = 0; k < Nv; ++k)
+    {
+      m.color(HSV(float(k) / Nv, 0.3, 1));
+    }
+    if (m.primitive() == Mesh::TRIANGLES)
+    {
+      m.decompress();
+    }
+    m.generateNormals();
+  });
+}
 Vec3f randomVec3f(float scale)
 {
   return Vec3f(al::rnd::uniformS(), al::rnd::uniformS(), al::rnd::uniformS()) * scale;
@@ -36,12 +114,15 @@ class SineEnv : public SynthVoice
 public:
   // Unit generators
   gam::Pan<> mPan;
-  gam::Sine<> mOsc;
+  BlockSine mOsc; // gam::Sine<> with a block path, see VoiceBlock.h
   gam::Env<3> mAmpEnv;
   // envelope follower to connect audio output to graphics
   gam::EnvFollow<> mEnvFollow;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pPan;
   // Draw parameters
-  Mesh mMesh;
+  SharedMesh *mMesh; // Shared, see VoiceGeometry.h
   double a = 0;
   double b = 0;
   double timepose = 0;
@@ -59,9 +140,7 @@ public:
     mAmpEnv.sustainPoint(2); // Make point 2 sustain until a release is issued
 
     // We have the mesh be a sphere
-    addSphere(mMesh, 0.3, 50, 50);
-    mMesh.decompress();
-    mMesh.generateNormals();
+    mMesh = &GeometryCache::sphere(0.3, 50, 50);
 
     // This is a quick way to create parameters for the voice. Trigger
     // parameters are meant to be set only when the voice starts, i.e. they
@@ -69,11 +148,15 @@ public:
     // change them while you are prototyping, but their changes will only be
     // stored and aplied when a note is triggered.)
 
-    createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 1.0, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 1.0, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
 
     // Initalize MIDI device input
   }
@@ -86,19 +169,35 @@ public:
     // but placing them here allows for realtime prototyping on a running
     // voice, rather than having to trigger a new voice to hear the changes.
     // Parameters will update values once per audio callback because they
-    // are outside the sample processing loop.
-    mOsc.freq(getInternalParameterValue("frequency"));
-    mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mAmpEnv.lengths()[2] = getInternalParameterValue("releaseTime");
-    mPan.pos(getInternalParameterValue("pan"));
-    while (io())
+    // are outside the sample processing loop. Only the ones that changed
+    // since the last block are applied.
+    if (mParams.snapshot())
     {
-      float s1 = mOsc() * mAmpEnv() * getInternalParameterValue("amplitude");
-      float s2;
-      mEnvFollow(s1);
-      mPan(s1, s1, s2);
-      io.out(0) += s1;
-      io.out(1) += s2;
+      if (mParams.changed(pFrequency))
+        mOsc.freq(mParams[pFrequency]);
+      if (mParams.changed(pAttackTime))
+        mAmpEnv.lengths()[0] = mParams[pAttackTime];
+      if (mParams.changed(pReleaseTime))
+        mAmpEnv.lengths()[2] = mParams[pReleaseTime];
+      if (mParams.changed(pPan))
+        mPan.pos(mParams[pPan]);
+    }
+    if (VoiceBlock::enabled())
+    {
+      renderVoiceBlocks(io, *this);
+    }
+    else
+    {
+      float amp = mParams[pAmplitude];
+      while (io())
+      {
+        float s1 = mOsc() * mAmpEnv() * amp;
+        float s2;
+        mEnvFollow(s1);
+        mPan(s1, s1, s2);
+        io.out(0) += s1;
+        io.out(1) += s2;
+      }
     }
     // We need to let the synth know that this voice is done
     // by calling the free(). This takes the voice out of the
@@ -107,6 +206,16 @@ public:
       free();
   }
 
+  // Block rendering path, see VoiceBlock.h
+  void renderBlock(VoiceBlock &block, int frames)
+  {
+    mOsc.render(block.left, frames);
+    block::generate(mAmpEnv, block.env, frames);
+    block::multiply(block.left, block.env, mParams[pAmplitude], frames);
+    block::feed(mEnvFollow, block.left, frames);
+    block::pan(mPan, block.left, block.right, frames);
+  }
+
   // The graphics processing function
   void onProcess(Graphics &g) override
   {
@@ -115,8 +224,8 @@ public:
     timepose += 0.02;
     // Get the paramter values on every video frame, to apply changes to the
     // current instance
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
     // Now draw
     g.pushMatrix();
     g.depthTesting(true);
@@ -125,8 +234,7 @@ public:
     g.rotate(a, Vec3f(0, 1, 0));
     g.rotate(b, Vec3f(1));
     g.scale(0.3 + mAmpEnv() * 0.2, 0.3 + mAmpEnv() * 0.5, amplitude);
-    g.color(HSV(frequency / 1000, 0.5 + mAmpEnv() * 0.1, 0.3 + 0.5 * mAmpEnv()));
-    g.draw(mMesh);
+    VoiceInstancer::draw(g, *mMesh, HSV(frequency / 1000, 0.5 + mAmpEnv() * 0.1, 0.3 + 0.5 * mAmpEnv()));
     g.popMatrix();
   }
 
@@ -135,8 +243,9 @@ public:
   // the voice from the processing chain.
   void onTriggerOn() override
   {
-    float angle = getInternalParameterValue("frequency") / 200;
+    float angle = mParams.live(pFrequency) / 200;
     mAmpEnv.reset();
+    mParams.invalidate();
     a = al::rnd::uniform();
     b = al::rnd::uniform();
     timepose = 0;
@@ -152,14 +261,18 @@ class OscEnv : public SynthVoice {
  public:
   // Unit generators
   gam::Pan<> mPan;
-  gam::Osc<> mOsc;
+  WavetableOsc mOsc;
   gam::ADSR<> mAmpEnv;
   gam::EnvFollow<>
       mEnvFollow;  // envelope follower to connect audio output to graphics
   int mtable;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+      pCurve, pPan, pTable;
   // Additional members
   static const int numb_waveform = 9;
-  Mesh mMesh[numb_waveform];
+  SharedMesh *mMesh[numb_waveform]; // Shared, see VoiceGeometry.h
   bool wireframe = false;
   bool vertexLight = false;
   double a_rotate = 0;
@@ -174,114 +287,46 @@ class OscEnv : public SynthVoice {
                    0);  // These tables are not normalized, so scale to 0.3
     mAmpEnv.sustainPoint(2);  // Make point 2 sustain until a release is issued
 
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 1.0, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0);
-    createInternalTriggerParameter("curve", 4.0, -10.0, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-    createInternalTriggerParameter("table", 0, 0, 8);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 1.0, 0.1, 10.0));
+    pSustain = mParams.add(
+        createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0));
+    pCurve = mParams.add(
+        createInternalTriggerParameter("curve", 4.0, -10.0, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+    pTable = mParams.add(createInternalTriggerParameter("table", 0, 0, 8));
 
     // Table & Visual meshes
+    // Tables are shared by all voices, only the first init() builds them
+    mOsc.source(waveTable(0));
     // Now We have the mesh according to the waveform
-    gam::addSinesPow<1>(tbSaw, 9, 1);
-    addCone(mMesh[0],1, Vec3f(0,0,5), 40, 1); //tbSaw
-
-    gam::addSinesPow<1>(tbSqr, 9, 2);
-    addCube(mMesh[1]);  // tbSquare
-
-    gam::addSinesPow<0>(tbImp, 9, 1);
-    addPrism(mMesh[2],1,1,1,100); // tbImp
-
-    gam::addSine(tbSin);
-    addSphere(mMesh[3], 0.3, 16, 100); // tbSin
-
-// About: addSines (dst, amps, cycs, numh)
-// \param[out] dst		destination array
-// \param[in] amps		harmonic amplitudes of series, size must be numh - A[]
-// \param[in] cycs		harmonic numbers of series, size must be numh - C[]
-// \param[in] numh		total number of harmonics
-    float scaler = 0.15;
-    float hscaler = 1;
-
-    { //tbPls
-      float A[] = {1, 1, 1, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tbPls, A, 8); 
-      addWireBox(mMesh[4],2);    // tbPls
-    }
-    { // tb__1 
-      float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08, 0, 0};
-      float C[] = {1, 4, 7, 11, 15, 18, 0, 0 };
-      gam::addSines(tb__1, A, C, 6);
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[5], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-
-        // addSphere(mMesh[5],scaler * A[i], 16, 30); // tb__1
-      }
-    }
-    { // inharmonic partials
-      float A[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
-      float C[] = {3, 4, 7, 8, 11, 12, 15, 16}; 
-      gam::addSines(tb__2, A, C, 8); // tb__2
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[6], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-      }
-    }
-    { // inharmonic partials
-      float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08, 0 , 0};
-      float C[] = {10, 27, 54, 81, 108, 135, 0, 0};
-      gam::addSines(tb__3, A, C, 6); // tb__3
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[7], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-      }
-    }
-  { // harmonics 20-27
-      float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tb__4, A, 8, 20); // tb__4
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[8], hscaler * A[i], hscaler * A[i+1], 1 + 0.3*i);
-      }
-    }
-    // { // Write your own waveform!
-    //   float A[] = {1, 1, 1, 1, 1, 1};
-    //   float C[] = {2, 3, 5, 7, 11, 13}; // prime numbers?
-    //   gam::addSines(tb__3, A, C, 6);
-    //   addPrism(mMesh[7], scaler * A[0]*C[0], scaler * A[1]*C[1], 1, 100, 27);// tb__2
-    //   addPrism(mMesh[7], scaler * A[2]*C[2], scaler * A[3]*C[3], 2, 100, 27*2);// tb__2
-    //   addPrism(mMesh[7], scaler * A[4]*C[4], scaler * A[5]*C[5], 3, 100, 27*3); // tb__3
-    // }
-
-
-//int addSurfaceLoop(Mesh& m, int Nx, int Ny, int loopMode, double width, double height, double x, double y) 
-
-
-    // Scale and generate normals
     for (int i = 0; i < numb_waveform; ++i) {
-      mMesh[i].scale(0.4);
-
-      int Nv = mMesh[i].vertices().size();
-      for (int k = 0; k < Nv; ++k) {
-        mMesh[i].color(HSV(float(k) / Nv, 0.3, 1));
-      }
-
-      if (!vertexLight && mMesh[i].primitive() == Mesh::TRIANGLES) {
-        mMesh[i].decompress();
-      }
-      mMesh[i].generateNormals();
+      mMesh[i] = &waveformShape(i);
     }
   }
 
   virtual void onProcess(AudioIOData& io) override {
-    updateFromParameters();
-    while (io()) {
-      float s1 =
-          0.1 * mOsc() * mAmpEnv() * getInternalParameterValue("amplitude");
-      float s2;
-      mEnvFollow(s1);
-      mPan(s1, s1, s2);
-      io.out(0) += s1;
-      io.out(1) += s2;
+    if (mParams.snapshot()) {
+      updateFromParameters();
+    }
+    if (VoiceBlock::enabled()) {
+      renderVoiceBlocks(io, *this);
+    } else {
+      float amp = 0.1 * mParams[pAmplitude];
+      while (io()) {
+        float s1 = mOsc() * mAmpEnv() * amp;
+        float s2;
+        mEnvFollow(s1);
+        mPan(s1, s1, s2);
+        io.out(0) += s1;
+        io.out(1) += s2;
+      }
     }
     // We need to let the synth know that this voice is done
     // by calling the free(). This takes the voice out of the
@@ -289,33 +334,43 @@ class OscEnv : public SynthVoice {
     if (mAmpEnv.done() && (mEnvFollow.value() < 0.001f)) free();
   }
 
+  // Block rendering path, see VoiceBlock.h
+  void renderBlock(VoiceBlock& block, int frames) {
+    mOsc.render(block.left, frames);
+    block::generate(mAmpEnv, block.env, frames);
+    block::multiply(block.left, block.env, 0.1f * mParams[pAmplitude], frames);
+    block::feed(mEnvFollow, block.left, frames);
+    block::pan(mPan, block.left, block.right, frames);
+  }
+
   void onProcess(Graphics& g) override {
     a_rotate += 0.81;
     b_rotate += 0.78;
     timepose -= 0.06;
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
-    int shape = getInternalParameterValue("table");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
+    int shape = mParams.live(pTable);
 
     // static Light light;
-    g.polygonMode(wireframe ? GL_LINE : GL_FILL);
+    VoiceInstancer::polygonMode(g, wireframe ? GL_LINE : GL_FILL);
     // light.pos(0, 0, 0);
     gl::depthTesting(true);
     g.lighting(true);
     // g.light(light);
     g.pushMatrix();
     g.depthTesting(true);
-    g.translate( timepose, getInternalParameterValue("frequency") / 200 - 3 , -15);
+    g.translate( timepose, mParams.live(pFrequency) / 200 - 3 , -15);
     g.rotate(a_rotate, Vec3f(0, 1, 1));
     g.rotate(b_rotate, Vec3f(1));    
     g.scale(0.5 + mAmpEnv() * 2, 0.5 + mAmpEnv() * 2, 0.03 + 0.1*mAmpEnv() );
-    g.color(HSV(frequency / 1000, 0.6 + mAmpEnv() * 0.1, 0.6 + 0.5 * mAmpEnv()));
-    g.draw(mMesh[shape]);
+    VoiceInstancer::draw(g, *mMesh[shape], HSV(frequency / 1000, 0.6 + mAmpEnv() * 0.1, 0.6 + 0.5 * mAmpEnv()));
     g.popMatrix();
   } 
 
   virtual void onTriggerOn() override {
     mAmpEnv.reset();
+    mParams.invalidate();
+    mParams.snapshot();
     updateFromParameters();
     updateWaveform();
     timepose = 10;
@@ -323,46 +378,33 @@ class OscEnv : public SynthVoice {
 
   virtual void onTriggerOff() override { mAmpEnv.triggerRelease(); }
 
+  // Apply the parameters that changed in the last snapshot
   void updateFromParameters() {
-    mOsc.freq(getInternalParameterValue("frequency"));
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.decay(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-    mAmpEnv.curve(getInternalParameterValue("curve"));
-    mPan.pos(getInternalParameterValue("pan"));
+    if (mParams.changed(pFrequency)) {
+      mOsc.freq(mParams[pFrequency]);
+    }
+    if (mParams.changed(pAttackTime)) {
+      mAmpEnv.attack(mParams[pAttackTime]);
+      mAmpEnv.decay(mParams[pAttackTime]);
+    }
+    if (mParams.changed(pReleaseTime)) {
+      mAmpEnv.release(mParams[pReleaseTime]);
+    }
+    if (mParams.changed(pSustain)) {
+      mAmpEnv.sustain(mParams[pSustain]);
+    }
+    if (mParams.changed(pCurve)) {
+      mAmpEnv.curve(mParams[pCurve]);
+    }
+    if (mParams.changed(pPan)) {
+      mPan.pos(mParams[pPan]);
+    }
   }
   void updateWaveform(){
-        // Map table number to table in memory
-    switch (int(getInternalParameterValue("table"))) {
-      case 0:
-        mOsc.source(tbSaw);
-        break;
-      case 1:
-        mOsc.source(tbSqr);
-        break;
-      case 2:
-        mOsc.source(tbImp);
-        break;
-      case 3:
-        mOsc.source(tbSin);
-        break;
-      case 4:
-        mOsc.source(tbPls);
-        break;
-      case 5:
-        mOsc.source(tb__1);
-        break;
-      case 6:
-        mOsc.source(tb__2);
-        break;
-      case 7:
-        mOsc.source(tb__3);
-        break;
-      case 8:
-        mOsc.source(tb__4);
-        break;
-    }
+    // Map table number to table in memory
+    int table = std::max(0, std::min(int(mParams[pTable]),
+                                     WavetableCache::kStandardTables - 1));
+    mOsc.source(waveTable(table));
   }
 
 };
@@ -372,15 +414,19 @@ class Vib : public SynthVoice {
  public:
   // Unit generators
   gam::Pan<> mPan;
-  gam::Osc<> mOsc;
+  WavetableOsc mOsc;
   gam::Sine<> mVib;
   gam::ADSR<> mAmpEnv;
   gam::ADSR<> mVibEnv;
   gam::EnvFollow<> mEnvFollow;  // envelope follower to connect audio output to graphics
   int mtable;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+      pCurve, pPan, pTable, pVibRate1, pVibRate2, pVibRise, pVibDepth;
   // Additional members
   static const int numb_waveform = 9;
-  Mesh mMesh[numb_waveform];
+  SharedMesh *mMesh[numb_waveform]; // Shared, see VoiceGeometry.h
   bool wireframe = false;
   bool vertexLight = false;
   double a_rotate = 0;
@@ -398,108 +444,52 @@ class Vib : public SynthVoice {
     mAmpEnv.sustainPoint(2);  // Make point 2 sustain until a release is issued
     mVibEnv.curve(0);
 
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 1.0, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0);
-    createInternalTriggerParameter("curve", 4.0, -10.0, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-    createInternalTriggerParameter("table", 0, 0, 8);
-    createInternalTriggerParameter("vibRate1", 3.5, 0.2, 20);
-    createInternalTriggerParameter("vibRate2", 5.8, 0.2, 20);
-    createInternalTriggerParameter("vibRise", 0.5, 0.1, 2);
-    createInternalTriggerParameter("vibDepth", 0.005, 0.0, 0.3);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 1.0, 0.1, 10.0));
+    pSustain = mParams.add(
+        createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0));
+    pCurve = mParams.add(
+        createInternalTriggerParameter("curve", 4.0, -10.0, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+    pTable = mParams.add(createInternalTriggerParameter("table", 0, 0, 8));
+    pVibRate1 = mParams.add(
+        createInternalTriggerParameter("vibRate1", 3.5, 0.2, 20));
+    pVibRate2 = mParams.add(
+        createInternalTriggerParameter("vibRate2", 5.8, 0.2, 20));
+    pVibRise = mParams.add(
+        createInternalTriggerParameter("vibRise", 0.5, 0.1, 2));
+    pVibDepth = mParams.add(
+        createInternalTriggerParameter("vibDepth", 0.005, 0.0, 0.3));
 
     // Table & Visual meshes
+    // Tables are shared by all voices, only the first init() builds them
+    mOsc.source(waveTable(0));
     // Now We have the mesh according to the waveform
-    gam::addSinesPow<1>(tbSaw, 9, 1);
-    addCone(mMesh[0],1, Vec3f(0,0,5), 40, 1); //tbSaw
-
-    gam::addSinesPow<1>(tbSqr, 9, 2);
-    addCube(mMesh[1]);  // tbSquare
-
-    gam::addSinesPow<0>(tbImp, 9, 1);
-    addPrism(mMesh[2],1,1,1,100); // tbImp
-
-    gam::addSine(tbSin);
-    addSphere(mMesh[3], 0.3, 16, 100); // tbSin
-
-// About: addSines (dst, amps, cycs, numh)
-// \param[out] dst		destination array
-// \param[in] amps		harmonic amplitudes of series, size must be numh - A[]
-// \param[in] cycs		harmonic numbers of series, size must be numh - C[]
-// \param[in] numh		total number of harmonics
-    float scaler = 0.15;
-    float hscaler = 1;
-
-    { //tbPls
-      float A[] = {1, 1, 1, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tbPls, A, 8); 
-      addWireBox(mMesh[4],2);    // tbPls
-    }
-    { // tb__1 
-      float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08, 0, 0};
-      float C[] = {1, 4, 7, 11, 15, 18, 0, 0 };
-      gam::addSines(tb__1, A, C, 6);
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[5], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-
-        // addSphere(mMesh[5],scaler * A[i], 16, 30); // tb__1
-      }
-    }
-    { // inharmonic partials
-      float A[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
-      float C[] = {3, 4, 7, 8, 11, 12, 15, 16}; 
-      gam::addSines(tb__2, A, C, 8); // tb__2
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[6], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-      }
-    }
-    { // inharmonic partials
-      float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08, 0 , 0};
-      float C[] = {10, 27, 54, 81, 108, 135, 0, 0};
-      gam::addSines(tb__3, A, C, 6); // tb__3
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[7], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-      }
-    }
-  { // harmonics 20-27
-      float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tb__4, A, 8, 20); // tb__4
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[8], hscaler * A[i], hscaler * A[i+1], 1 + 0.3*i);
-      }
-    }
-
-    // Scale and generate normals
     for (int i = 0; i < numb_waveform; ++i) {
-      mMesh[i].scale(0.4);
-
-      int Nv = mMesh[i].vertices().size();
-      for (int k = 0; k < Nv; ++k) {
-        mMesh[i].color(HSV(float(k) / Nv, 0.3, 1));
-      }
-
-      if (!vertexLight && mMesh[i].primitive() == Mesh::TRIANGLES) {
-        mMesh[i].decompress();
-      }
-      mMesh[i].generateNormals();
+      mMesh[i] = &waveformShape(i);
     }
   }
 
   //
   virtual void onProcess(AudioIOData& io) override {
-    updateFromParameters();
-    float oscFreq = getInternalParameterValue("frequency");
-    float vibDepth = getInternalParameterValue("vibDepth");
+    if (mParams.snapshot()) {
+      updateFromParameters();
+    }
+    float oscFreq = mParams[pFrequency];
+    float vibDepth = mParams[pVibDepth];
+    float amp = 0.1 * mParams[pAmplitude];
     outFreq = oscFreq + vibValue * vibDepth * oscFreq;
     while (io()) {
       mVib.freq(mVibEnv());
       vibValue = mVib();
        mOsc.freq(outFreq);
-      float s1 =
-          0.1 * mOsc() * mAmpEnv() * getInternalParameterValue("amplitude");
+      float s1 = mOsc() * mAmpEnv() * amp;
       float s2;
       mEnvFollow(s1);
       mPan(s1, s1, s2);
@@ -516,9 +506,9 @@ class Vib : public SynthVoice {
     a_rotate += 0.81;
     b_rotate += 0.78;
     timepose -= 0.06;
-    int shape = getInternalParameterValue("table");
+    int shape = mParams.live(pTable);
     // static Light light;
-    g.polygonMode(wireframe ? GL_LINE : GL_FILL);
+    VoiceInstancer::polygonMode(g, wireframe ? GL_LINE : GL_FILL);
     // light.pos(0, 0, 0);
     gl::depthTesting(true);
     g.lighting(true);
@@ -529,14 +519,15 @@ class Vib : public SynthVoice {
     g.rotate(a_rotate, Vec3f(0, 1, 1));
     g.rotate(b_rotate, Vec3f(1));    
     g.scale(0.5 + mAmpEnv() * 2, 0.5 + mAmpEnv() * 2, 0.03 + 0.1*mAmpEnv() );
-    g.color(HSV(outFreq / 1000, 0.6 + mAmpEnv() * 0.1, 0.6 + 0.5 * mAmpEnv()));
-    g.draw(mMesh[shape]);
+    VoiceInstancer::draw(g, *mMesh[shape], HSV(outFreq / 1000, 0.6 + mAmpEnv() * 0.1, 0.6 + 0.5 * mAmpEnv()));
     g.popMatrix();
   } 
 
   virtual void onTriggerOn() override {
     mAmpEnv.reset();
     mVibEnv.reset();
+    mParams.invalidate();
+    mParams.snapshot();
     updateFromParameters();
     updateWaveform();
     timepose = 10;
@@ -547,53 +538,42 @@ class Vib : public SynthVoice {
     mVibEnv.triggerRelease();
   }
 
+  // Apply the parameters that changed in the last snapshot
   void updateFromParameters() {
-    mOsc.freq(getInternalParameterValue("frequency"));
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.decay(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-    mAmpEnv.curve(getInternalParameterValue("curve"));
-    mPan.pos(getInternalParameterValue("pan"));
-    mVibEnv.levels(getInternalParameterValue("vibRate1"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate1"));
-    mVibEnv.lengths()[0] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[1] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[3] = getInternalParameterValue("vibRise");
+    if (mParams.changed(pFrequency)) {
+      mOsc.freq(mParams[pFrequency]);
+    }
+    if (mParams.changed(pAttackTime)) {
+      mAmpEnv.attack(mParams[pAttackTime]);
+      mAmpEnv.decay(mParams[pAttackTime]);
+    }
+    if (mParams.changed(pReleaseTime)) {
+      mAmpEnv.release(mParams[pReleaseTime]);
+    }
+    if (mParams.changed(pSustain)) {
+      mAmpEnv.sustain(mParams[pSustain]);
+    }
+    if (mParams.changed(pCurve)) {
+      mAmpEnv.curve(mParams[pCurve]);
+    }
+    if (mParams.changed(pPan)) {
+      mPan.pos(mParams[pPan]);
+    }
+    if (mParams.changed(pVibRate1 | pVibRate2)) {
+      mVibEnv.levels(mParams[pVibRate1], mParams[pVibRate2],
+                     mParams[pVibRate2], mParams[pVibRate1]);
+    }
+    if (mParams.changed(pVibRise)) {
+      mVibEnv.lengths()[0] = mParams[pVibRise];
+      mVibEnv.lengths()[1] = mParams[pVibRise];
+      mVibEnv.lengths()[3] = mParams[pVibRise];
+    }
   }
   void updateWaveform(){
-        // Map table number to table in memory
-    switch (int(getInternalParameterValue("table"))) {
-      case 0:
-        mOsc.source(tbSaw);
-        break;
-      case 1:
-        mOsc.source(tbSqr);
-        break;
-      case 2:
-        mOsc.source(tbImp);
-        break;
-      case 3:
-        mOsc.source(tbSin);
-        break;
-      case 4:
-        mOsc.source(tbPls);
-        break;
-      case 5:
-        mOsc.source(tb__1);
-        break;
-      case 6:
-        mOsc.source(tb__2);
-        break;
-      case 7:
-        mOsc.source(tb__3);
-        break;
-      case 8:
-        mOsc.source(tb__4);
-        break;
-    }
+    // Map table number to table in memory
+    int table = std::max(0, std::min(int(mParams[pTable]),
+                                     WavetableCache::kStandardTables - 1));
+    mOsc.source(waveTable(table));
   }
 
 };
@@ -610,10 +590,15 @@ public:
   gam::ADSR<> mVibEnv;
 
   gam::Sine<> car, mod, mVib; // carrier, modulator sine oscillators
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pFrequency, pAmplitude, pAttackTime, pReleaseTime, pSustain,
+      pIdx1, pIdx2, pIdx3, pCarMul, pModMul, pVibRate1, pVibRate2, pVibRise,
+      pVibDepth, pPan;
   double a = 0;
   double b = 0;
   double timepose = 10;
-  Mesh ball;
+  SharedMesh *ball; // Shared, see VoiceGeometry.h
 
   // Additional members
   float mVibFrq;
@@ -629,56 +614,91 @@ public:
     mModEnv.levels(0, 1, 1, 0);
     mVibEnv.levels(0, 1, 1, 0);
     //      mVibEnv.curve(0);
-    addSphere(ball, 1, 100, 100);
-    ball.decompress();
-    ball.generateNormals();
+    ball = &GeometryCache::sphere(1, 100, 100);
 
     // We have the mesh be a sphere
-    createInternalTriggerParameter("frequency", 440, 10, 4000.0);
-    createInternalTriggerParameter("amplitude", 0.05, 0.0, 1.0);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 0.5, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0);
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 440, 10, 4000.0));
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.05, 0.0, 1.0));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 0.5, 0.1, 10.0));
+    pSustain = mParams.add(
+        createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0));
 
     // FM index
-    createInternalTriggerParameter("idx1", 0.01, 0.0, 10.0);
-    createInternalTriggerParameter("idx2", 7, 0.0, 10.0);
-    createInternalTriggerParameter("idx3", 5, 0.0, 10.0);
-
-    createInternalTriggerParameter("carMul", 1, 0.0, 20.0);
-    createInternalTriggerParameter("modMul", 1.0007, 0.0, 20.0);
-
-    createInternalTriggerParameter("vibRate1", 0.01, 0.0, 10.0);
-    createInternalTriggerParameter("vibRate2", 0.5, 0.0, 10.0);
-    createInternalTriggerParameter("vibRise", 0, 0.0, 10.0);
-    createInternalTriggerParameter("vibDepth", 0, 0.0, 10.0);
-
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    pIdx1 = mParams.add(
+        createInternalTriggerParameter("idx1", 0.01, 0.0, 10.0));
+    pIdx2 = mParams.add(createInternalTriggerParameter("idx2", 7, 0.0, 10.0));
+    pIdx3 = mParams.add(createInternalTriggerParameter("idx3", 5, 0.0, 10.0));
+
+    pCarMul = mParams.add(
+        createInternalTriggerParameter("carMul", 1, 0.0, 20.0));
+    pModMul = mParams.add(
+        createInternalTriggerParameter("modMul", 1.0007, 0.0, 20.0));
+
+    pVibRate1 = mParams.add(
+        createInternalTriggerParameter("vibRate1", 0.01, 0.0, 10.0));
+    pVibRate2 = mParams.add(
+        createInternalTriggerParameter("vibRate2", 0.5, 0.0, 10.0));
+    pVibRise = mParams.add(
+        createInternalTriggerParameter("vibRise", 0, 0.0, 10.0));
+    pVibDepth = mParams.add(
+        createInternalTriggerParameter("vibDepth", 0, 0.0, 10.0));
+
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
   }
 
   //
   void onProcess(AudioIOData &io) override
   {
+    mParams.snapshot();
     mVib.freq(mVibEnv());
-    float carBaseFreq =
-        getInternalParameterValue("frequency") * getInternalParameterValue("carMul");
-    float modScale =
-        getInternalParameterValue("frequency") * getInternalParameterValue("modMul");
-    float amp = getInternalParameterValue("amplitude");
-    while (io())
+    if (VoiceBlock::enabled())
+    {
+      renderVoiceBlocks(io, *this);
+    }
+    else
+    {
+      float carBaseFreq = mParams[pFrequency] * mParams[pCarMul];
+      float modScale = mParams[pFrequency] * mParams[pModMul];
+      float amp = mParams[pAmplitude];
+      while (io())
+      {
+        mVib.freq(mVibEnv());
+        car.freq((1 + mVib() * mVibDepth) * carBaseFreq +
+                 mod() * mModEnv() * modScale);
+        float s1 = car() * mAmpEnv() * amp;
+        float s2;
+        mEnvFollow(s1);
+        mPan(s1, s1, s2);
+        io.out(0) += s1;
+        io.out(1) += s2;
+      }
+    }
+    if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
+      free();
+  }
+
+  // Block rendering path, see VoiceBlock.h
+  void renderBlock(VoiceBlock &block, int frames)
+  {
+    float carBaseFreq = mParams[pFrequency] * mParams[pCarMul];
+    float modScale = mParams[pFrequency] * mParams[pModMul];
+    // The carrier frequency depends on the modulator every sample
+    for (int i = 0; i < frames; i++)
     {
       mVib.freq(mVibEnv());
       car.freq((1 + mVib() * mVibDepth) * carBaseFreq +
                mod() * mModEnv() * modScale);
-      float s1 = car() * mAmpEnv() * amp;
-      float s2;
-      mEnvFollow(s1);
-      mPan(s1, s1, s2);
-      io.out(0) += s1;
-      io.out(1) += s2;
+      block.left[i] = car();
     }
-    if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
-      free();
+    block::generate(mAmpEnv, block.env, frames);
+    block::multiply(block.left, block.env, mParams[pAmplitude], frames);
+    block::feed(mEnvFollow, block.left, frames);
+    block::pan(mPan, block.left, block.right, frames);
   }
 
   void onProcess(Graphics &g) override
@@ -689,13 +709,12 @@ public:
     g.pushMatrix();
     g.depthTesting(true);
     g.lighting(true);
-    g.translate(timepose, getInternalParameterValue("frequency") / 200 - 3, -15);
+    g.translate(timepose, mParams.live(pFrequency) / 200 - 3, -15);
     g.rotate(mVib() + a, Vec3f(0, 1, 0));
     g.rotate(mVibDepth + b, Vec3f(1));
-    float scaling = getInternalParameterValue("amplitude") / 10;
-    g.scale(scaling + getInternalParameterValue("modMul") / 10, scaling + getInternalParameterValue("carMul") / 30, scaling + mEnvFollow.value() * 5);
-    g.color(HSV(getInternalParameterValue("modMul") / 20, getInternalParameterValue("carMul") / 20, 0.5 + getInternalParameterValue("attackTime")));
-    g.draw(ball);
+    float scaling = mParams.live(pAmplitude) / 10;
+    g.scale(scaling + mParams.live(pModMul) / 10, scaling + mParams.live(pCarMul) / 30, scaling + mEnvFollow.value() * 5);
+    VoiceInstancer::draw(g, *ball, HSV(mParams.live(pModMul) / 20, mParams.live(pCarMul) / 20, 0.5 + mParams.live(pAttackTime)));
     g.popMatrix();
   }
 
@@ -707,10 +726,11 @@ public:
     mModEnv.reset();
     mVib.phase(0);
     mod.phase(0);
+    mParams.invalidate();
+    mParams.snapshot();
     updateFromParameters();
 
-    float modFreq =
-        getInternalParameterValue("frequency") * getInternalParameterValue("modMul");
+    float modFreq = mParams[pFrequency] * mParams[pModMul];
     mod.freq(modFreq);
   }
   void onTriggerOff() override
@@ -722,28 +742,28 @@ public:
 
   void updateFromParameters()
   {
-    mModEnv.levels()[0] = getInternalParameterValue("idx1");
-    mModEnv.levels()[1] = getInternalParameterValue("idx2");
-    mModEnv.levels()[2] = getInternalParameterValue("idx2");
-    mModEnv.levels()[3] = getInternalParameterValue("idx3");
-
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-
-    mModEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mModEnv.lengths()[3] = getInternalParameterValue("releaseTime");
-
-    mVibEnv.levels(getInternalParameterValue("vibRate1"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate1"));
-    mVibEnv.lengths()[0] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[1] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[3] = getInternalParameterValue("vibRise");
-    mVibDepth = getInternalParameterValue("vibDepth");
+    mModEnv.levels()[0] = mParams[pIdx1];
+    mModEnv.levels()[1] = mParams[pIdx2];
+    mModEnv.levels()[2] = mParams[pIdx2];
+    mModEnv.levels()[3] = mParams[pIdx3];
+
+    mAmpEnv.attack(mParams[pAttackTime]);
+    mAmpEnv.release(mParams[pReleaseTime]);
+    mAmpEnv.sustain(mParams[pSustain]);
+
+    mModEnv.lengths()[0] = mParams[pAttackTime];
+    mModEnv.lengths()[3] = mParams[pReleaseTime];
+
+    mVibEnv.levels(mParams[pVibRate1],
+                   mParams[pVibRate2],
+                   mParams[pVibRate2],
+                   mParams[pVibRate1]);
+    mVibEnv.lengths()[0] = mParams[pVibRise];
+    mVibEnv.lengths()[1] = mParams[pVibRise];
+    mVibEnv.lengths()[3] = mParams[pVibRise];
+    mVibDepth = mParams[pVibDepth];
     
-    mPan.pos(getInternalParameterValue("pan"));
+    mPan.pos(mParams[pPan]);
   }
 };
 
@@ -759,7 +779,12 @@ public:
   gam::ADSR<> mVibEnv;
 
   gam::Sine<> mod, mVib; // carrier, modulator sine oscillators
-  gam::Osc<> car;
+  WavetableOsc car;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pFrequency, pAmplitude, pAttackTime, pReleaseTime, pSustain,
+      pIdx1, pIdx2, pIdx3, pCarMul, pModMul, pVibRate1, pVibRate2, pVibRise,
+      pVibDepth, pPan, pTable;
   double a = 0;
   double b = 0;
   double timepose = 10;
@@ -769,7 +794,7 @@ public:
   float mVibRise;
   int mtable;
   static const int numb_waveform = 9;
-  Mesh mMesh[numb_waveform];
+  SharedMesh *mMesh[numb_waveform]; // Shared, see VoiceGeometry.h
   bool wireframe = false;
   bool vertexLight = false;
 
@@ -782,102 +807,46 @@ public:
     mAmpEnv.sustainPoint(2);
 
     // We have the mesh be a sphere
-    createInternalTriggerParameter("frequency", 440, 10, 4000.0);
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 0.3, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0);
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 440, 10, 4000.0));
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 0.3, 0.1, 10.0));
+    pSustain = mParams.add(
+        createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0));
 
     // FM index
-    createInternalTriggerParameter("idx1", 0.01, 0.0, 10.0);
-    createInternalTriggerParameter("idx2", 7, 0.0, 10.0);
-    createInternalTriggerParameter("idx3", 5, 0.0, 10.0);
-
-    createInternalTriggerParameter("carMul", 1, 0.0, 20.0);
-    createInternalTriggerParameter("modMul", 1.0007, 0.0, 20.0);
-
-    createInternalTriggerParameter("vibRate1", 0.01, 0.0, 10.0);
-    createInternalTriggerParameter("vibRate2", 0.5, 0.0, 10.0);
-    createInternalTriggerParameter("vibRise", 0, 0.0, 10.0);
-    createInternalTriggerParameter("vibDepth", 0, 0.0, 10.0);
-
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-    createInternalTriggerParameter("table", 0, 0, 8);
+    pIdx1 = mParams.add(
+        createInternalTriggerParameter("idx1", 0.01, 0.0, 10.0));
+    pIdx2 = mParams.add(createInternalTriggerParameter("idx2", 7, 0.0, 10.0));
+    pIdx3 = mParams.add(createInternalTriggerParameter("idx3", 5, 0.0, 10.0));
+
+    pCarMul = mParams.add(
+        createInternalTriggerParameter("carMul", 1, 0.0, 20.0));
+    pModMul = mParams.add(
+        createInternalTriggerParameter("modMul", 1.0007, 0.0, 20.0));
+
+    pVibRate1 = mParams.add(
+        createInternalTriggerParameter("vibRate1", 0.01, 0.0, 10.0));
+    pVibRate2 = mParams.add(
+        createInternalTriggerParameter("vibRate2", 0.5, 0.0, 10.0));
+    pVibRise = mParams.add(
+        createInternalTriggerParameter("vibRise", 0, 0.0, 10.0));
+    pVibDepth = mParams.add(
+        createInternalTriggerParameter("vibDepth", 0, 0.0, 10.0));
+
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+    pTable = mParams.add(createInternalTriggerParameter("table", 0, 0, 8));
 
     // Table & Visual meshes
+    // Tables are shared by all voices, only the first init() builds them
+    car.source(waveTable(0));
     // Now We have the mesh according to the waveform
-    gam::addSinesPow<1>(tbSaw, 9, 1);
-    addCone(mMesh[0],1, Vec3f(0,0,5), 40, 1); //tbSaw
-
-    gam::addSinesPow<1>(tbSqr, 9, 2);
-    addCube(mMesh[1]);  // tbSquare
-
-    gam::addSinesPow<0>(tbImp, 9, 1);
-    addPrism(mMesh[2],1,1,1,100); // tbImp
-
-    gam::addSine(tbSin);
-    addSphere(mMesh[3], 0.3, 16, 100); // tbSin
-
-// About: addSines (dst, amps, cycs, numh)
-// \param[out] dst		destination array
-// \param[in] amps		harmonic amplitudes of series, size must be numh - A[]
-// \param[in] cycs		harmonic numbers of series, size must be numh - C[]
-// \param[in] numh		total number of harmonics
-    float scaler = 0.15;
-    float hscaler = 1;
-
-    { //tbPls
-      float A[] = {1, 1, 1, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tbPls, A, 8); 
-      addWireBox(mMesh[4],2);    // tbPls
-    }
-    { // tb__1 
-      float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08, 0, 0};
-      float C[] = {1, 4, 7, 11, 15, 18, 0, 0 };
-      gam::addSines(tb__1, A, C, 6);
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[5], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-
-        // addSphere(mMesh[5],scaler * A[i], 16, 30); // tb__1
-      }
-    }
-    { // inharmonic partials
-      float A[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
-      float C[] = {3, 4, 7, 8, 11, 12, 15, 16}; 
-      gam::addSines(tb__2, A, C, 8); // tb__2
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[6], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-      }
-    }
-    { // inharmonic partials
-      float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08, 0 , 0};
-      float C[] = {10, 27, 54, 81, 108, 135, 0, 0};
-      gam::addSines(tb__3, A, C, 6); // tb__3
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[7], scaler * A[i]*C[i], scaler * A[i+1]*C[i+1], 1 + 0.3*i);
-      }
-    }
-  { // harmonics 20-27
-      float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
-      gam::addSines(tb__4, A, 8, 20); // tb__4
-      for (int i = 0; i < 7; i++){
-        addWireBox(mMesh[8], hscaler * A[i], hscaler * A[i+1], 1 + 0.3*i);
-      }
-    }
-
-    // Scale and generate normals
     for (int i = 0; i < numb_waveform; ++i) {
-      mMesh[i].scale(0.4);
-
-      int Nv = mMesh[i].vertices().size();
-      for (int k = 0; k < Nv; ++k) {
-        mMesh[i].color(HSV(float(k) / Nv, 0.3, 1));
-      }
-
-      if (!vertexLight && mMesh[i].primitive() == Mesh::TRIANGLES) {
-        mMesh[i].decompress();
-      }
-      mMesh[i].generateNormals();
+      mMesh[i] = &waveformShape(i);
     }
 
 
@@ -886,11 +855,11 @@ public:
   //
   void onProcess(AudioIOData &io) override
   {
+    mParams.snapshot();
     mVib.freq(mVibEnv());
-    float carBaseFreq =
-        getInternalParameterValue("frequency") * getInternalParameterValue("carMul");
-    float modScale = getInternalParameterValue("frequency") * getInternalParameterValue("modMul");
-    float amp = getInternalParameterValue("amplitude") * 0.01;
+    float carBaseFreq = mParams[pFrequency] * mParams[pCarMul];
+    float modScale = mParams[pFrequency] * mParams[pModMul];
+    float amp = mParams[pAmplitude] * 0.01;
     while (io())
     {
       mVib.freq(mVibEnv());
@@ -912,20 +881,19 @@ public:
     a += 0.29;
     b += 0.23;
     timepose -= 0.06;
-    int shape = getInternalParameterValue("table");
-    g.polygonMode(wireframe ? GL_LINE : GL_FILL);
+    int shape = mParams.live(pTable);
+    VoiceInstancer::polygonMode(g, wireframe ? GL_LINE : GL_FILL);
     // light.pos(0, 0, 0);
     gl::depthTesting(true);
     g.pushMatrix();
     g.depthTesting(true);
     g.lighting(true);
-    g.translate(timepose, getInternalParameterValue("frequency") / 200 - 3, -15);
+    g.translate(timepose, mParams.live(pFrequency) / 200 - 3, -15);
     g.rotate(mVib() + a, Vec3f(0, 1, 0));
     g.rotate(mVib() * mVibDepth + b, Vec3f(1));
-    float scaling = getInternalParameterValue("amplitude") * 10;
-    g.scale(scaling + getInternalParameterValue("modMul") / 2, scaling + getInternalParameterValue("carMul") / 20, scaling + mEnvFollow.value() * 5);
-    g.color(HSV(getInternalParameterValue("modMul") / 20, getInternalParameterValue("carMul") / 20, 0.5 + getInternalParameterValue("attackTime")));
-    g.draw(mMesh[shape]);
+    float scaling = mParams.live(pAmplitude) * 10;
+    g.scale(scaling + mParams.live(pModMul) / 2, scaling + mParams.live(pCarMul) / 20, scaling + mEnvFollow.value() * 5);
+    VoiceInstancer::draw(g, *mMesh[shape], HSV(mParams.live(pModMul) / 20, mParams.live(pCarMul) / 20, 0.5 + mParams.live(pAttackTime)));
     g.popMatrix();
   }
 
@@ -937,11 +905,12 @@ public:
     mModEnv.reset();
     mVib.phase(0);
     mod.phase(0);
+    mParams.invalidate();
+    mParams.snapshot();
     updateFromParameters();
     updateWaveform();
 
-    float modFreq =
-        getInternalParameterValue("frequency") * getInternalParameterValue("modMul");
+    float modFreq = mParams[pFrequency] * mParams[pModMul];
     mod.freq(modFreq);
   }
   void onTriggerOff() override
@@ -953,60 +922,34 @@ public:
 
   void updateFromParameters()
   {
-    mModEnv.levels()[0] = getInternalParameterValue("idx1");
-    mModEnv.levels()[1] = getInternalParameterValue("idx2");
-    mModEnv.levels()[2] = getInternalParameterValue("idx2");
-    mModEnv.levels()[3] = getInternalParameterValue("idx3");
-
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-
-    mModEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mModEnv.lengths()[3] = getInternalParameterValue("releaseTime");
-
-    mVibEnv.levels(getInternalParameterValue("vibRate1"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate2"),
-                   getInternalParameterValue("vibRate1"));
-    mVibEnv.lengths()[0] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[1] = getInternalParameterValue("vibRise");
-    mVibEnv.lengths()[3] = getInternalParameterValue("vibRise");
-    mVibDepth = getInternalParameterValue("vibDepth");
+    mModEnv.levels()[0] = mParams[pIdx1];
+    mModEnv.levels()[1] = mParams[pIdx2];
+    mModEnv.levels()[2] = mParams[pIdx2];
+    mModEnv.levels()[3] = mParams[pIdx3];
+
+    mAmpEnv.attack(mParams[pAttackTime]);
+    mAmpEnv.release(mParams[pReleaseTime]);
+    mAmpEnv.sustain(mParams[pSustain]);
+
+    mModEnv.lengths()[0] = mParams[pAttackTime];
+    mModEnv.lengths()[3] = mParams[pReleaseTime];
+
+    mVibEnv.levels(mParams[pVibRate1],
+                   mParams[pVibRate2],
+                   mParams[pVibRate2],
+                   mParams[pVibRate1]);
+    mVibEnv.lengths()[0] = mParams[pVibRise];
+    mVibEnv.lengths()[1] = mParams[pVibRise];
+    mVibEnv.lengths()[3] = mParams[pVibRise];
+    mVibDepth = mParams[pVibDepth];
     
-    mPan.pos(getInternalParameterValue("pan"));
+    mPan.pos(mParams[pPan]);
   }
   void updateWaveform(){
-        // Map table number to table in memory
-    switch (int(getInternalParameterValue("table"))) {
-      case 0:
-        car.source(tbSaw);
-        break;
-      case 1:
-        car.source(tbSqr);
-        break;
-      case 2:
-        car.source(tbImp);
-        break;
-      case 3:
-        car.source(tbSin);
-        break;
-      case 4:
-        car.source(tbPls);
-        break;
-      case 5:
-        car.source(tb__1);
-        break;
-      case 6:
-        car.source(tb__2);
-        break;
-      case 7:
-        car.source(tb__3);
-        break;
-      case 8:
-        car.source(tb__4);
-        break;
-    }
+    // Map table number to table in memory
+    int table = std::max(0, std::min(int(mParams[pTable]),
+                                     WavetableCache::kStandardTables - 1));
+    car.source(waveTable(table));
   }
 
 
@@ -1019,15 +962,19 @@ public:
     // Unit generators
     gam::Pan<> mPan;
     gam::Sine<> mTrm;
-    gam::Osc<> mOsc;
+    WavetableOsc mOsc;
     gam::ADSR<> mTrmEnv;
     gam::ADSR<> mAmpEnv;
     gam::EnvFollow<> mEnvFollow; // envelope follower to connect audio output to graphics
 
+    // Parameters resolved once in init() and snapshotted per audio block
+    VoiceParameters mParams;
+    ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+        pCurve, pPan, pTable, pTrm1, pTrm2, pTrmRise, pTrmDepth;
     // Additional members
     int mtable;
     static const int numb_waveform = 9;
-    Mesh mMesh[numb_waveform];
+    SharedMesh *mMesh[numb_waveform]; // Shared, see VoiceGeometry.h
     bool wireframe = false;
     bool vertexLight = false;
     double a_rotate = 0;
@@ -1041,110 +988,46 @@ public:
         mAmpEnv.levels(0, 0.3, 0.3, 0); // These tables are not normalized, so scale to 0.3
         mTrmEnv.curve(0);
         mTrmEnv.levels(0, 1, 1, 0);
-        createInternalTriggerParameter("amplitude", 0.03, 0.0, 1.0);
-        createInternalTriggerParameter("frequency", 60, 20, 5000);
-        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-        createInternalTriggerParameter("releaseTime", 2.0, 0.1, 10.0);
-        createInternalTriggerParameter("sustain", 0.6, 0.0, 1.0);
-        createInternalTriggerParameter("curve", 4.0, -10.0, 10.0);
-        createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-        createInternalTriggerParameter("table", 0, 0, 8);
-        createInternalTriggerParameter("trm1", 3.5, 0.2, 20);
-        createInternalTriggerParameter("trm2", 5.8, 0.2, 20);
-        createInternalTriggerParameter("trmRise", 0.5, 0.1, 2);
-        createInternalTriggerParameter("trmDepth", 0.1, 0.0, 1.0);
+        pAmplitude = mParams.add(
+            createInternalTriggerParameter("amplitude", 0.03, 0.0, 1.0));
+        pFrequency = mParams.add(
+            createInternalTriggerParameter("frequency", 60, 20, 5000));
+        pAttackTime = mParams.add(
+            createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+        pReleaseTime = mParams.add(
+            createInternalTriggerParameter("releaseTime", 2.0, 0.1, 10.0));
+        pSustain = mParams.add(
+            createInternalTriggerParameter("sustain", 0.6, 0.0, 1.0));
+        pCurve = mParams.add(
+            createInternalTriggerParameter("curve", 4.0, -10.0, 10.0));
+        pPan = mParams.add(
+            createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+        pTable = mParams.add(createInternalTriggerParameter("table", 0, 0, 8));
+        pTrm1 = mParams.add(
+            createInternalTriggerParameter("trm1", 3.5, 0.2, 20));
+        pTrm2 = mParams.add(
+            createInternalTriggerParameter("trm2", 5.8, 0.2, 20));
+        pTrmRise = mParams.add(
+            createInternalTriggerParameter("trmRise", 0.5, 0.1, 2));
+        pTrmDepth = mParams.add(
+            createInternalTriggerParameter("trmDepth", 0.1, 0.0, 1.0));
 
         // Table & Visual meshes
+        // Tables are shared by all voices, only the first init() builds them
+        mOsc.source(waveTable(0));
         // Now We have the mesh according to the waveform
-        gam::addSinesPow<1>(tbSaw, 9, 1);
-        addCone(mMesh[0], 1, Vec3f(0, 0, 5), 40, 1); // tbSaw
-
-        gam::addSinesPow<1>(tbSqr, 9, 2);
-        addCube(mMesh[1]); // tbSquare
-
-        gam::addSinesPow<0>(tbImp, 9, 1);
-        addPrism(mMesh[2], 1, 1, 1, 100); // tbImp
-
-        gam::addSine(tbSin);
-        addSphere(mMesh[3], 0.3, 16, 100); // tbSin
-
-        // About: addSines (dst, amps, cycs, numh)
-        // \param[out] dst		destination array
-        // \param[in] amps		harmonic amplitudes of series, size must be numh - A[]
-        // \param[in] cycs		harmonic numbers of series, size must be numh - C[]
-        // \param[in] numh		total number of harmonics
-        float scaler = 0.15;
-        float hscaler = 1;
-
-        { // tbPls
-            float A[] = {1, 1, 1, 1, 0.7, 0.5, 0.3, 0.1};
-            gam::addSines(tbPls, A, 8);
-            addWireBox(mMesh[4], 2); // tbPls
-        }
-        { // tb__1
-            float A[] = {1, 0.4, 0.65, 0.3, 0.18, 0.08, 0, 0};
-            float C[] = {1, 4, 7, 11, 15, 18, 0, 0};
-            gam::addSines(tb__1, A, C, 6);
-            for (int i = 0; i < 7; i++)
-            {
-                addWireBox(mMesh[5], scaler * A[i] * C[i], scaler * A[i + 1] * C[i + 1], 1 + 0.3 * i);
-
-                // addSphere(mMesh[5],scaler * A[i], 16, 30); // tb__1
-            }
-        }
-        { // inharmonic partials
-            float A[] = {0.5, 0.8, 0.7, 1, 0.3, 0.4, 0.2, 0.12};
-            float C[] = {3, 4, 7, 8, 11, 12, 15, 16};
-            gam::addSines(tb__2, A, C, 8); // tb__2
-            for (int i = 0; i < 7; i++)
-            {
-                addWireBox(mMesh[6], scaler * A[i] * C[i], scaler * A[i + 1] * C[i + 1], 1 + 0.3 * i);
-            }
-        }
-        { // inharmonic partials
-            float A[] = {1, 0.7, 0.45, 0.3, 0.15, 0.08, 0, 0};
-            float C[] = {10, 27, 54, 81, 108, 135, 0, 0};
-            gam::addSines(tb__3, A, C, 6); // tb__3
-            for (int i = 0; i < 7; i++)
-            {
-                addWireBox(mMesh[7], scaler * A[i] * C[i], scaler * A[i + 1] * C[i + 1], 1 + 0.3 * i);
-            }
-        }
-        { // harmonics 20-27
-            float A[] = {0.2, 0.4, 0.6, 1, 0.7, 0.5, 0.3, 0.1};
-            gam::addSines(tb__4, A, 8, 20); // tb__4
-            for (int i = 0; i < 7; i++)
-            {
-                addWireBox(mMesh[8], hscaler * A[i], hscaler * A[i + 1], 1 + 0.3 * i);
-            }
-        }
-
-        // Scale and generate normals
         for (int i = 0; i < numb_waveform; ++i)
         {
-            mMesh[i].scale(0.4);
-
-            int Nv = mMesh[i].vertices().size();
-            for (int k = 0; k < Nv; ++k)
-            {
-                mMesh[i].color(HSV(float(k) / Nv, 0.3, 1));
-            }
-
-            if (!vertexLight && mMesh[i].primitive() == Mesh::TRIANGLES)
-            {
-                mMesh[i].decompress();
-            }
-            mMesh[i].generateNormals();
+            mMesh[i] = &waveformShape(i);
         }
     }
 
     //
     virtual void onProcess(AudioIOData &io) override
     {
-        // updateFromParameters();
-        float oscFreq = getInternalParameterValue("frequency");
-        float amp = getInternalParameterValue("amplitude");
-        float trmDepth = getInternalParameterValue("trmDepth");
+        mParams.snapshot();
+        float amp = mParams[pAmplitude];
+        float trmDepth = mParams[pTrmDepth];
         while (io())
         {
 
@@ -1170,24 +1053,23 @@ public:
         a_rotate += 0.81;
         b_rotate += 0.78;
         timepose -= 0.06;
-        float frequency = getInternalParameterValue("frequency");
-        int shape = getInternalParameterValue("table");
+        float frequency = mParams.live(pFrequency);
+        int shape = mParams.live(pTable);
 
         // static Light light;
-        g.polygonMode(wireframe ? GL_LINE : GL_FILL);
+        VoiceInstancer::polygonMode(g, wireframe ? GL_LINE : GL_FILL);
         // light.pos(0, 0, 0);
         gl::depthTesting(true);
         g.lighting(true);
         // g.light(light);
         g.pushMatrix();
         g.depthTesting(true);
-        g.translate(timepose, getInternalParameterValue("frequency") / 200 - 3, -15);
+        g.translate(timepose, mParams.live(pFrequency) / 200 - 3, -15);
         g.rotate(a_rotate, Vec3f(0, 1, 1));
         g.rotate(b_rotate, Vec3f(1));
         g.scale(0.2 + mAmpEnv() * 0.2 + 0.01 * mTrm(), 0.3 + mAmpEnv() * 0.5 + 0.01 * mTrm(), 0.1 + 0.01 * mTrm());
         g.scale(3 + mAmpEnv() * 0.5, 3 + mAmpEnv() * 0.5, 5 + mAmpEnv());
-        g.color(HSV(frequency / 1000, 0.6 + mAmpEnv() * 0.1, 0.6 + 0.5 * mAmpEnv()));
-        g.draw(mMesh[shape]);
+        VoiceInstancer::draw(g, *mMesh[shape], HSV(frequency / 1000, 0.6 + mAmpEnv() * 0.1, 0.6 + 0.5 * mAmpEnv()));
         g.popMatrix();
     }
 
@@ -1197,6 +1079,8 @@ public:
         mAmpEnv.reset();
         mTrmEnv.reset();
         mTrm.phase(0); 
+        mParams.invalidate();
+        mParams.snapshot();
         updateFromParameters();
         updateWaveform();
         timepose = 10;
@@ -1210,56 +1094,29 @@ public:
 
     void updateFromParameters()
     {
-        mOsc.freq(getInternalParameterValue("frequency"));
-        mAmpEnv.attack(getInternalParameterValue("attackTime"));
-        mAmpEnv.decay(getInternalParameterValue("attackTime"));
-        mAmpEnv.release(getInternalParameterValue("releaseTime"));
-        mAmpEnv.sustain(getInternalParameterValue("sustain"));
-        mAmpEnv.curve(getInternalParameterValue("curve"));
-        mPan.pos(getInternalParameterValue("pan"));
-
-        mTrmEnv.levels(getInternalParameterValue("trm1"),
-                       getInternalParameterValue("trm2"),
-                       getInternalParameterValue("trm2"),
-                       getInternalParameterValue("trm1"));
-
-        mTrmEnv.attack(getInternalParameterValue("trmRise"));
-        mTrmEnv.decay(getInternalParameterValue("trmRise"));
-        mTrmEnv.release(getInternalParameterValue("trmRise"));
+        mOsc.freq(mParams[pFrequency]);
+        mAmpEnv.attack(mParams[pAttackTime]);
+        mAmpEnv.decay(mParams[pAttackTime]);
+        mAmpEnv.release(mParams[pReleaseTime]);
+        mAmpEnv.sustain(mParams[pSustain]);
+        mAmpEnv.curve(mParams[pCurve]);
+        mPan.pos(mParams[pPan]);
+
+        mTrmEnv.levels(mParams[pTrm1],
+                       mParams[pTrm2],
+                       mParams[pTrm2],
+                       mParams[pTrm1]);
+
+        mTrmEnv.attack(mParams[pTrmRise]);
+        mTrmEnv.decay(mParams[pTrmRise]);
+        mTrmEnv.release(mParams[pTrmRise]);
     }
     void updateWaveform()
     {
         // Map table number to table in memory
-        switch (int(getInternalParameterValue("table")))
-        {
-        case 0:
-            mOsc.source(tbSaw);
-            break;
-        case 1:
-            mOsc.source(tbSqr);
-            break;
-        case 2:
-            mOsc.source(tbImp);
-            break;
-        case 3:
-            mOsc.source(tbSin);
-            break;
-        case 4:
-            mOsc.source(tbPls);
-            break;
-        case 5:
-            mOsc.source(tb__1);
-            break;
-        case 6:
-            mOsc.source(tb__2);
-            break;
-        case 7:
-            mOsc.source(tb__3);
-            break;
-        case 8:
-            mOsc.source(tb__4);
-            break;
-        }
+        int table = std::max(0, std::min(int(mParams[pTable]),
+                                         WavetableCache::kStandardTables - 1));
+        mOsc.source(waveTable(table));
     }
 };
 
@@ -1267,14 +1124,18 @@ public:
 class OscAM : public SynthVoice
 {
 public:
-  gam::Osc<> mAM;
+  WavetableOsc mAM;
   gam::ADSR<> mAMEnv;
   gam::Sine<> mOsc;
   gam::ADSR<> mAmpEnv;
   gam::EnvFollow<> mEnvFollow;
   gam::Pan<> mPan;
   int mtable;
-  Mesh mMesh;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain, pPan,
+      pAmFunc, pAm1, pAm2, pAmRise, pAmRatio;
+  SharedMesh *mMesh; // Shared, see VoiceGeometry.h
   float a = 0.f; // current rotation angle
   bool wireframe = false;
   bool vertexLight = false;
@@ -1285,9 +1146,7 @@ public:
   // Initialize voice. This function will nly be called once per voice
   virtual void init()
   {
-    addSphere(mMesh, 1, 100, 100);
-    mMesh.decompress();
-    mMesh.generateNormals();
+    mMesh = &GeometryCache::sphere(1, 100, 100);
     mAmpEnv.levels(0, 1, 1, 0);
     //    mAmpEnv.sustainPoint(1);
 
@@ -1295,27 +1154,40 @@ public:
     mAMEnv.levels(0, 1, 1, 0);
     //    mAMEnv.sustainPoint(1);
 
+    // AM function tables are shared with the wavetable voices
+    mAM.source(waveTable(3));
+
     // We have the mesh be a sphere
 
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 440, 10, 4000.0);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 4, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.3, 0.1, 1.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-    createInternalTriggerParameter("amFunc", 0.0, 0.0, 3.0);
-    createInternalTriggerParameter("am1", 0.75, 0.0, 1.0);
-    createInternalTriggerParameter("am2", 0.75, 0.0, 1.0);
-    createInternalTriggerParameter("amRise", 0.75, 0.1, 1.0);
-    createInternalTriggerParameter("amRatio", 0.75, 0.0, 2.0);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 440, 10, 4000.0));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 4, 0.1, 10.0));
+    pSustain = mParams.add(
+        createInternalTriggerParameter("sustain", 0.3, 0.1, 1.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
+    pAmFunc = mParams.add(
+        createInternalTriggerParameter("amFunc", 0.0, 0.0, 3.0));
+    pAm1 = mParams.add(createInternalTriggerParameter("am1", 0.75, 0.0, 1.0));
+    pAm2 = mParams.add(createInternalTriggerParameter("am2", 0.75, 0.0, 1.0));
+    pAmRise = mParams.add(
+        createInternalTriggerParameter("amRise", 0.75, 0.1, 1.0));
+    pAmRatio = mParams.add(
+        createInternalTriggerParameter("amRatio", 0.75, 0.0, 2.0));
   }
 
   virtual void onProcess(AudioIOData &io) override
   {
-    mOsc.freq(getInternalParameterValue("frequency"));
-
-    float amp = getInternalParameterValue("amplitude");
-    float amRatio = getInternalParameterValue("amRatio");
+    if (mParams.snapshot() && mParams.changed(pFrequency))
+    {
+      mOsc.freq(mParams[pFrequency]);
+    }
+    float amp = mParams[pAmplitude];
+    float amRatio = mParams[pAmRatio];
     while (io())
     {
 
@@ -1342,10 +1214,9 @@ public:
 
   virtual void onProcess(Graphics &g)
   {
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
-    float pan = getInternalParameterValue("pan");
-    int shape = getInternalParameterValue("table");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
+    float pan = mParams.live(pPan);
     float radius = frequency / 300;
     b_rotate += 1.1;
     timepose -= 0.04;
@@ -1362,29 +1233,30 @@ public:
     g.rotate(b_rotate, spinner);
     g.scale(0.05 * mAM() + 0.3);
     // center the model
-    g.color(HSV(mOsc.freq() * getInternalParameterValue("amRatio") / 1000 + mAM() * 0.01, 0.5 + mAmpEnv() * 0.5, 0.05 + 5 * mAmpEnv()));
-    g.draw(mMesh);
+    VoiceInstancer::draw(g, *mMesh, HSV(mOsc.freq() * mParams.live(pAmRatio) / 1000 + mAM() * 0.01, 0.5 + mAmpEnv() * 0.5, 0.05 + 5 * mAmpEnv()));
     g.popMatrix();
   }
 
   virtual void onTriggerOn() override
   {
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
+    mParams.invalidate();
+    mParams.snapshot();
+    mAmpEnv.attack(mParams[pAttackTime]);
     mAmpEnv.lengths()[1] = 0.001;
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
+    mAmpEnv.release(mParams[pReleaseTime]);
 
-    mAmpEnv.levels()[1] = getInternalParameterValue("sustain");
-    mAmpEnv.levels()[2] = getInternalParameterValue("sustain");
+    mAmpEnv.levels()[1] = mParams[pSustain];
+    mAmpEnv.levels()[2] = mParams[pSustain];
 
-    mAMEnv.levels(getInternalParameterValue("am1"),
-                  getInternalParameterValue("am2"),
-                  getInternalParameterValue("am2"),
-                  getInternalParameterValue("am1"));
+    mAMEnv.levels(mParams[pAm1],
+                  mParams[pAm2],
+                  mParams[pAm2],
+                  mParams[pAm1]);
 
-    mAMEnv.lengths(getInternalParameterValue("amRise"),
-                   1 - getInternalParameterValue("amRise"));
+    mAMEnv.lengths(mParams[pAmRise],
+                   1 - mParams[pAmRise]);
 
-    mPan.pos(getInternalParameterValue("pan"));
+    mPan.pos(mParams[pPan]);
 
     mAmpEnv.reset();
     mAMEnv.reset();
@@ -1392,19 +1264,19 @@ public:
     b_rotate = al::rnd::uniform(0, 360);
     spinner = randomVec3f(1);
     // Map table number to table in memory
-    switch (int(getInternalParameterValue("amFunc")))
+    switch (int(mParams[pAmFunc]))
     {
     case 0:
-      mAM.source(tbSin);
+      mAM.source(waveTable(3));
       break;
     case 1:
-      mAM.source(tbSqr);
+      mAM.source(waveTable(1));
       break;
     case 2:
-      mAM.source(tbPls);
+      mAM.source(waveTable(4));
       break;
     case 3:
-      mAM.source(tbDin);
+      mAM.source(waveTable(7));
       break;
     }
   }
@@ -1420,24 +1292,24 @@ public:
 class AddSyn : public SynthVoice
 {
 public:
-  gam::Sine<> mOsc;
-  gam::Sine<> mOsc1;
-  gam::Sine<> mOsc2;
-  gam::Sine<> mOsc3;
-  gam::Sine<> mOsc4;
-  gam::Sine<> mOsc5;
-  gam::Sine<> mOsc6;
-  gam::Sine<> mOsc7;
-  gam::Sine<> mOsc8;
-  gam::Sine<> mOsc9;
+  // Partials grouped by the envelope that shapes them
+  PartialBank mStri{3};
+  PartialBank mLow{2};
+  PartialBank mUp{4};
   gam::ADSR<> mEnvStri;
   gam::ADSR<> mEnvLow;
   gam::ADSR<> mEnvUp;
   gam::Pan<> mPan;
   gam::EnvFollow<> mEnvFollow;
 
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmp, pFrequency, pAmpStri, pAttackStri, pReleaseStri,
+      pSustainStri, pAmpLow, pAttackLow, pReleaseLow, pSustainLow, pAmpUp,
+      pAttackUp, pReleaseUp, pSustainUp, pFreqStri1, pFreqStri2, pFreqStri3,
+      pFreqLow1, pFreqLow2, pFreqUp1, pFreqUp2, pFreqUp3, pFreqUp4, pPan;
   // Additional members
-  Mesh ball;
+  SharedMesh *ball; // Shared, see VoiceGeometry.h
   double a = 0;
   double b = 0;
   double timepose = 0;
@@ -1461,72 +1333,115 @@ public:
     mEnvUp.sustain(2); // Make point 2 sustain until a release is issued
 
     // We have the mesh be a sphere
-    addSphere(ball, 1, 100, 100);
-    ball.decompress();
-    ball.generateNormals();
-
-    createInternalTriggerParameter("amp", 0.01, 0.0, 0.3);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("ampStri", 0.5, 0.0, 1.0);
-    createInternalTriggerParameter("attackStri", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseStri", 0.1, 0.1, 10.0);
-    createInternalTriggerParameter("sustainStri", 0.8, 0.0, 1.0);
-    createInternalTriggerParameter("ampLow", 0.5, 0.0, 1.0);
-    createInternalTriggerParameter("attackLow", 0.001, 0.01, 3.0);
-    createInternalTriggerParameter("releaseLow", 0.1, 0.1, 10.0);
-    createInternalTriggerParameter("sustainLow", 0.8, 0.0, 1.0);
-    createInternalTriggerParameter("ampUp", 0.6, 0.0, 1.0);
-    createInternalTriggerParameter("attackUp", 0.01, 0.01, 3.0);
-    createInternalTriggerParameter("releaseUp", 0.075, 0.1, 10.0);
-    createInternalTriggerParameter("sustainUp", 0.9, 0.0, 1.0);
-    createInternalTriggerParameter("freqStri1", 1.0, 0.1, 10);
-    createInternalTriggerParameter("freqStri2", 2.001, 0.1, 10);
-    createInternalTriggerParameter("freqStri3", 3.0, 0.1, 10);
-    createInternalTriggerParameter("freqLow1", 4.009, 0.1, 10);
-    createInternalTriggerParameter("freqLow2", 5.002, 0.1, 10);
-    createInternalTriggerParameter("freqUp1", 6.0, 0.1, 10);
-    createInternalTriggerParameter("freqUp2", 7.0, 0.1, 10);
-    createInternalTriggerParameter("freqUp3", 8.0, 0.1, 10);
-    createInternalTriggerParameter("freqUp4", 9.0, 0.1, 10);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    ball = &GeometryCache::sphere(1, 100, 100);
+
+    pAmp = mParams.add(createInternalTriggerParameter("amp", 0.01, 0.0, 0.3));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAmpStri = mParams.add(
+        createInternalTriggerParameter("ampStri", 0.5, 0.0, 1.0));
+    pAttackStri = mParams.add(
+        createInternalTriggerParameter("attackStri", 0.1, 0.01, 3.0));
+    pReleaseStri = mParams.add(
+        createInternalTriggerParameter("releaseStri", 0.1, 0.1, 10.0));
+    pSustainStri = mParams.add(
+        createInternalTriggerParameter("sustainStri", 0.8, 0.0, 1.0));
+    pAmpLow = mParams.add(
+        createInternalTriggerParameter("ampLow", 0.5, 0.0, 1.0));
+    pAttackLow = mParams.add(
+        createInternalTriggerParameter("attackLow", 0.001, 0.01, 3.0));
+    pReleaseLow = mParams.add(
+        createInternalTriggerParameter("releaseLow", 0.1, 0.1, 10.0));
+    pSustainLow = mParams.add(
+        createInternalTriggerParameter("sustainLow", 0.8, 0.0, 1.0));
+    pAmpUp = mParams.add(
+        createInternalTriggerParameter("ampUp", 0.6, 0.0, 1.0));
+    pAttackUp = mParams.add(
+        createInternalTriggerParameter("attackUp", 0.01, 0.01, 3.0));
+    pReleaseUp = mParams.add(
+        createInternalTriggerParameter("releaseUp", 0.075, 0.1, 10.0));
+    pSustainUp = mParams.add(
+        createInternalTriggerParameter("sustainUp", 0.9, 0.0, 1.0));
+    pFreqStri1 = mParams.add(
+        createInternalTriggerParameter("freqStri1", 1.0, 0.1, 10));
+    pFreqStri2 = mParams.add(
+        createInternalTriggerParameter("freqStri2", 2.001, 0.1, 10));
+    pFreqStri3 = mParams.add(
+        createInternalTriggerParameter("freqStri3", 3.0, 0.1, 10));
+    pFreqLow1 = mParams.add(
+        createInternalTriggerParameter("freqLow1", 4.009, 0.1, 10));
+    pFreqLow2 = mParams.add(
+        createInternalTriggerParameter("freqLow2", 5.002, 0.1, 10));
+    pFreqUp1 = mParams.add(
+        createInternalTriggerParameter("freqUp1", 6.0, 0.1, 10));
+    pFreqUp2 = mParams.add(
+        createInternalTriggerParameter("freqUp2", 7.0, 0.1, 10));
+    pFreqUp3 = mParams.add(
+        createInternalTriggerParameter("freqUp3", 8.0, 0.1, 10));
+    pFreqUp4 = mParams.add(
+        createInternalTriggerParameter("freqUp4", 9.0, 0.1, 10));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
   }
 
   virtual void onProcess(AudioIOData &io) override
   {
-    // Parameters will update values once per audio callback
-    float freq = getInternalParameterValue("frequency");
-    mOsc.freq(freq);
-    mOsc1.freq(getInternalParameterValue("freqStri1") * freq);
-    mOsc2.freq(getInternalParameterValue("freqStri2") * freq);
-    mOsc3.freq(getInternalParameterValue("freqStri3") * freq);
-    mOsc4.freq(getInternalParameterValue("freqLow1") * freq);
-    mOsc5.freq(getInternalParameterValue("freqLow2") * freq);
-    mOsc6.freq(getInternalParameterValue("freqUp1") * freq);
-    mOsc7.freq(getInternalParameterValue("freqUp2") * freq);
-    mOsc8.freq(getInternalParameterValue("freqUp3") * freq);
-    mOsc9.freq(getInternalParameterValue("freqUp4") * freq);
-    mPan.pos(getInternalParameterValue("pan"));
-    float ampStri = getInternalParameterValue("ampStri");
-    float ampUp = getInternalParameterValue("ampUp");
-    float ampLow = getInternalParameterValue("ampLow");
-    float amp = getInternalParameterValue("amp");
-    while (io())
+    // Parameters will update values once per audio callback, and the
+    // oscillators are only retuned when one of their parameters changed
+    if (mParams.snapshot())
     {
-      float s1 = (mOsc1() + mOsc2() + mOsc3()) * mEnvStri() * ampStri;
-      s1 += (mOsc4() + mOsc5()) * mEnvLow() * ampLow;
-      s1 += (mOsc6() + mOsc7() + mOsc8() + mOsc9()) * mEnvUp() * ampUp;
-      s1 *= amp;
-      float s2;
-      mEnvFollow(s1);
-      mPan(s1, s1, s2);
-      io.out(0) += s1;
-      io.out(1) += s2;
+      updateFromParameters();
+    }
+    if (VoiceBlock::enabled())
+    {
+      renderVoiceBlocks(io, *this);
+    }
+    else
+    {
+      float ampStri = mParams[pAmpStri];
+      float ampUp = mParams[pAmpUp];
+      float ampLow = mParams[pAmpLow];
+      float amp = mParams[pAmp];
+      while (io())
+      {
+        float s1 = mStri() * mEnvStri() * ampStri;
+        s1 += mLow() * mEnvLow() * ampLow;
+        s1 += mUp() * mEnvUp() * ampUp;
+        s1 *= amp;
+        float s2;
+        mEnvFollow(s1);
+        mPan(s1, s1, s2);
+        io.out(0) += s1;
+        io.out(1) += s2;
+      }
     }
     // if(mEnvStri.done()) free();
     if (mEnvStri.done() && mEnvUp.done() && mEnvLow.done() && (mEnvFollow.value() < 0.001))
       free();
   }
 
+  // Block rendering path, see VoiceBlock.h. The right channel holds each
+  // partial bank until it is mixed into the left one.
+  void renderBlock(VoiceBlock &block, int frames)
+  {
+    float amp = mParams[pAmp];
+    mStri.render(block.left, frames);
+    block::generate(mEnvStri, block.env, frames);
+    block::multiply(block.left, block.env, mParams[pAmpStri] * amp, frames);
+
+    mLow.render(block.right, frames);
+    block::generate(mEnvLow, block.env, frames);
+    block::multiply(block.right, block.env, mParams[pAmpLow] * amp, frames);
+    block::mix(block.left, block.right, 1.0f, frames);
+
+    mUp.render(block.right, frames);
+    block::generate(mEnvUp, block.env, frames);
+    block::multiply(block.right, block.env, mParams[pAmpUp] * amp, frames);
+    block::mix(block.left, block.right, 1.0f, frames);
+
+    block::feed(mEnvFollow, block.left, frames);
+    block::pan(mPan, block.left, block.right, frames);
+  }
+
   virtual void onProcess(Graphics &g)
   {
     a += 0.29;
@@ -1534,8 +1449,8 @@ public:
     timepose += 0.02;
     // Get the paramter values on every video frame, to apply changes to the
     // current instance
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmp);
     // Now draw
     g.pushMatrix();
     g.depthTesting(true);
@@ -1545,35 +1460,40 @@ public:
     g.rotate(a, Vec3f(0, 1, 0));
     g.rotate(b, Vec3f(1));
     g.scale(0.3 + mEnvStri() * 0.2, 0.3 + mEnvStri() * 0.5, 1);
-    g.color(HSV(frequency / 1000, 0.5 + mEnvStri() * 0.1, 0.3 + 0.5 * mEnvStri()));
-    g.draw(ball);
+    VoiceInstancer::draw(g, *ball, HSV(frequency / 1000, 0.5 + mEnvStri() * 0.1, 0.3 + 0.5 * mEnvStri()));
     g.popMatrix();
   }
 
   virtual void onTriggerOn() override
   {
+    mParams.invalidate();
+    mParams.snapshot();
+    updateFromParameters();
 
-    mEnvStri.attack(getInternalParameterValue("attackStri"));
-    mEnvStri.decay(getInternalParameterValue("attackStri"));
-    mEnvStri.sustain(getInternalParameterValue("sustainStri"));
-    mEnvStri.release(getInternalParameterValue("releaseStri"));
+    mEnvStri.attack(mParams[pAttackStri]);
+    mEnvStri.decay(mParams[pAttackStri]);
+    mEnvStri.sustain(mParams[pSustainStri]);
+    mEnvStri.release(mParams[pReleaseStri]);
 
-    mEnvLow.attack(getInternalParameterValue("attackLow"));
-    mEnvLow.decay(getInternalParameterValue("attackLow"));
-    mEnvLow.sustain(getInternalParameterValue("sustainLow"));
-    mEnvLow.release(getInternalParameterValue("releaseLow"));
+    mEnvLow.attack(mParams[pAttackLow]);
+    mEnvLow.decay(mParams[pAttackLow]);
+    mEnvLow.sustain(mParams[pSustainLow]);
+    mEnvLow.release(mParams[pReleaseLow]);
 
-    mEnvUp.attack(getInternalParameterValue("attackUp"));
-    mEnvUp.decay(getInternalParameterValue("attackUp"));
-    mEnvUp.sustain(getInternalParameterValue("sustainUp"));
-    mEnvUp.release(getInternalParameterValue("releaseUp"));
+    mEnvUp.attack(mParams[pAttackUp]);
+    mEnvUp.decay(mParams[pAttackUp]);
+    mEnvUp.sustain(mParams[pSustainUp]);
+    mEnvUp.release(mParams[pReleaseUp]);
 
-    mPan.pos(getInternalParameterValue("pan"));
+    mPan.pos(mParams[pPan]);
 
     mEnvStri.reset();
     mEnvLow.reset();
     mEnvUp.reset();
-    float angle = getInternalParameterValue("frequency") / 200;
+    mStri.reset();
+    mLow.reset();
+    mUp.reset();
+    float angle = mParams[pFrequency] / 200;
 
     a = al::rnd::uniform();
     b = al::rnd::uniform();
@@ -1588,6 +1508,30 @@ public:
     mEnvLow.triggerRelease();
     mEnvUp.triggerRelease();
   }
+
+  void updateFromParameters()
+  {
+    const uint32_t freqMask = pFrequency | pFreqStri1 | pFreqStri2 |
+                              pFreqStri3 | pFreqLow1 | pFreqLow2 | pFreqUp1 |
+                              pFreqUp2 | pFreqUp3 | pFreqUp4;
+    if (mParams.changed(freqMask))
+    {
+      float freq = mParams[pFrequency];
+      mStri.set(0, mParams[pFreqStri1] * freq, 1);
+      mStri.set(1, mParams[pFreqStri2] * freq, 1);
+      mStri.set(2, mParams[pFreqStri3] * freq, 1);
+      mLow.set(0, mParams[pFreqLow1] * freq, 1);
+      mLow.set(1, mParams[pFreqLow2] * freq, 1);
+      mUp.set(0, mParams[pFreqUp1] * freq, 1);
+      mUp.set(1, mParams[pFreqUp2] * freq, 1);
+      mUp.set(2, mParams[pFreqUp3] * freq, 1);
+      mUp.set(3, mParams[pFreqUp4] * freq, 1);
+    }
+    if (mParams.changed(pPan))
+    {
+      mPan.pos(mParams[pPan]);
+    }
+  }
 };
 
 // 08 Subtractive_synth
@@ -1604,8 +1548,13 @@ public:
     gam::Reson<> mRes;
     gam::Env<2> mCFEnv;
     gam::Env<2> mBWEnv;
+    // Parameters resolved once in init() and snapshotted per audio block
+    VoiceParameters mParams;
+    ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+        pCurve, pNoise, pEnvDur, pCf1, pCf2, pCfRise, pBw1, pBw2, pBwRise,
+        pHmnum, pHmamp, pPan;
     // Additional members
-    Mesh mMesh;
+    SharedMesh *mMesh; // Shared, see VoiceGeometry.h
     double a = 0;
     double b = 0;
     double timepose = 0;
@@ -1621,58 +1570,106 @@ public:
         mBWEnv.curve(0);
         mOsc.harmonics(12);
         // We have the mesh be a sphere
-        addSphere(mMesh, 1, 100, 100);
-        mMesh.decompress();
-        mMesh.generateNormals();
-
-        createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0);
-        createInternalTriggerParameter("frequency", 60, 20, 5000);
-        createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-        createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0);
-        createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0);
-        createInternalTriggerParameter("curve", 4.0, -10.0, 10.0);
-        createInternalTriggerParameter("noise", 0.0, 0.0, 1.0);
-        createInternalTriggerParameter("envDur", 1, 0.0, 5.0);
-        createInternalTriggerParameter("cf1", 400.0, 10.0, 5000);
-        createInternalTriggerParameter("cf2", 400.0, 10.0, 5000);
-        createInternalTriggerParameter("cfRise", 0.5, 0.1, 2);
-        createInternalTriggerParameter("bw1", 700.0, 10.0, 5000);
-        createInternalTriggerParameter("bw2", 900.0, 10.0, 5000);
-        createInternalTriggerParameter("bwRise", 0.5, 0.1, 2);
-        createInternalTriggerParameter("hmnum", 12.0, 5.0, 20.0);
-        createInternalTriggerParameter("hmamp", 1.0, 0.0, 1.0);
-        createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+        mMesh = &GeometryCache::sphere(1, 100, 100);
+
+        pAmplitude = mParams.add(
+            createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0));
+        pFrequency = mParams.add(
+            createInternalTriggerParameter("frequency", 60, 20, 5000));
+        pAttackTime = mParams.add(
+            createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0));
+        pReleaseTime = mParams.add(
+            createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0));
+        pSustain = mParams.add(
+            createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0));
+        pCurve = mParams.add(
+            createInternalTriggerParameter("curve", 4.0, -10.0, 10.0));
+        pNoise = mParams.add(
+            createInternalTriggerParameter("noise", 0.0, 0.0, 1.0));
+        pEnvDur = mParams.add(
+            createInternalTriggerParameter("envDur", 1, 0.0, 5.0));
+        pCf1 = mParams.add(
+            createInternalTriggerParameter("cf1", 400.0, 10.0, 5000));
+        pCf2 = mParams.add(
+            createInternalTriggerParameter("cf2", 400.0, 10.0, 5000));
+        pCfRise = mParams.add(
+            createInternalTriggerParameter("cfRise", 0.5, 0.1, 2));
+        pBw1 = mParams.add(
+            createInternalTriggerParameter("bw1", 700.0, 10.0, 5000));
+        pBw2 = mParams.add(
+            createInternalTriggerParameter("bw2", 900.0, 10.0, 5000));
+        pBwRise = mParams.add(
+            createInternalTriggerParameter("bwRise", 0.5, 0.1, 2));
+        pHmnum = mParams.add(
+            createInternalTriggerParameter("hmnum", 12.0, 5.0, 20.0));
+        pHmamp = mParams.add(
+            createInternalTriggerParameter("hmamp", 1.0, 0.0, 1.0));
+        pPan = mParams.add(
+            createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
     }
 
     //
 
     virtual void onProcess(AudioIOData &io) override
     {
-        updateFromParameters();
-        float amp = getInternalParameterValue("amplitude");
-        float noiseMix = getInternalParameterValue("noise");
-        while (io())
+        if (mParams.snapshot())
         {
-            // mix oscillator with noise
-            float s1 = mOsc() * (1 - noiseMix) + mNoise() * noiseMix;
+            updateFromParameters();
+        }
+        if (VoiceBlock::enabled())
+        {
+            renderVoiceBlocks(io, *this);
+        }
+        else
+        {
+            float amp = mParams[pAmplitude];
+            float noiseMix = mParams[pNoise];
+            while (io())
+            {
+                // mix oscillator with noise
+                float s1 = mOsc() * (1 - noiseMix) + mNoise() * noiseMix;
 
-            // apply resonant filter
-            mRes.set(mCFEnv(), mBWEnv());
-            s1 = mRes(s1);
+                // apply resonant filter
+                mRes.set(mCFEnv(), mBWEnv());
+                s1 = mRes(s1);
 
-            // appy amplitude envelope
-            s1 *= mAmpEnv() * amp;
+                // appy amplitude envelope
+                s1 *= mAmpEnv() * amp;
 
-            float s2;
-            mPan(s1, s1, s2);
-            io.out(0) += s1;
-            io.out(1) += s2;
+                float s2;
+                mPan(s1, s1, s2);
+                io.out(0) += s1;
+                io.out(1) += s2;
+            }
         }
 
         if (mAmpEnv.done() && (mEnvFollow.value() < 0.001f))
             free();
     }
 
+    // Block rendering path, see VoiceBlock.h
+    void renderBlock(VoiceBlock &block, int frames)
+    {
+        float noiseMix = mParams[pNoise];
+        // mix oscillator with noise
+        block::generate(mOsc, block.left, frames);
+        block::scale(block.left, 1 - noiseMix, frames);
+        block::generate(mNoise, block.right, frames);
+        block::mix(block.left, block.right, noiseMix, frames);
+
+        // apply resonant filter, its coefficients follow the envelopes
+        for (int i = 0; i < frames; i++)
+        {
+            mRes.set(mCFEnv(), mBWEnv());
+            block.left[i] = mRes(block.left[i]);
+        }
+
+        // appy amplitude envelope
+        block::generate(mAmpEnv, block.env, frames);
+        block::multiply(block.left, block.env, mParams[pAmplitude], frames);
+        block::pan(mPan, block.left, block.right, frames);
+    }
+
     virtual void onProcess(Graphics &g)
     {
         a += 0.29;
@@ -1680,8 +1677,8 @@ public:
         timepose += 0.02;
         // Get the paramter values on every video frame, to apply changes to the
         // current instance
-        float frequency = getInternalParameterValue("frequency");
-        float amplitude = getInternalParameterValue("amplitude");
+        float frequency = mParams.live(pFrequency);
+        float amplitude = mParams.live(pAmplitude);
         // Now draw
         g.pushMatrix();
         g.depthTesting(true);
@@ -1691,12 +1688,13 @@ public:
         g.rotate(a, Vec3f(mCFEnv(), mBWEnv(), 0));
         g.rotate(b, Vec3f(mNoise()));
         g.scale(mCFEnv()/ 10000, mBWEnv()/ 10000,  0.3 + 0.1*mNoise());
-        g.color(HSV(frequency / 1000, 0.5 + mOsc() * 0.1, 0.3 + 0.1*mNoise()));
-        g.draw(mMesh);
+        VoiceInstancer::draw(g, *mMesh, HSV(frequency / 1000, 0.5 + mOsc() * 0.1, 0.3 + 0.1*mNoise()));
         g.popMatrix();
     }
     virtual void onTriggerOn() override
     {
+        mParams.invalidate();
+        mParams.snapshot();
         updateFromParameters();
         mAmpEnv.reset();
         mCFEnv.reset();
@@ -1705,7 +1703,7 @@ public:
         b = al::rnd::uniform();
         timepose = 0;
         note_position = {0, 0, -15};
-        float angle = getInternalParameterValue("frequency") / 200;
+        float angle = mParams[pFrequency] / 200;
         note_direction = {sin(angle), cos(angle), 0};
     }
 
@@ -1718,31 +1716,31 @@ public:
 
     void updateFromParameters()
     {
-        mOsc.freq(getInternalParameterValue("frequency"));
-        mOsc.harmonics(getInternalParameterValue("hmnum"));
-        mOsc.ampRatio(getInternalParameterValue("hmamp"));
-        mAmpEnv.attack(getInternalParameterValue("attackTime"));
-        //    mAmpEnv.decay(getInternalParameterValue("attackTime"));
-        mAmpEnv.release(getInternalParameterValue("releaseTime"));
-        mAmpEnv.levels()[1] = getInternalParameterValue("sustain");
-        mAmpEnv.levels()[2] = getInternalParameterValue("sustain");
-
-        mAmpEnv.curve(getInternalParameterValue("curve"));
-        mPan.pos(getInternalParameterValue("pan"));
-        mCFEnv.levels(getInternalParameterValue("cf1"),
-                      getInternalParameterValue("cf2"),
-                      getInternalParameterValue("cf1"));
-
-        mCFEnv.lengths()[0] = getInternalParameterValue("cfRise");
-        mCFEnv.lengths()[1] = 1 - getInternalParameterValue("cfRise");
-        mBWEnv.levels(getInternalParameterValue("bw1"),
-                      getInternalParameterValue("bw2"),
-                      getInternalParameterValue("bw1"));
-        mBWEnv.lengths()[0] = getInternalParameterValue("bwRise");
-        mBWEnv.lengths()[1] = 1 - getInternalParameterValue("bwRise");
-
-        mCFEnv.totalLength(getInternalParameterValue("envDur"));
-        mBWEnv.totalLength(getInternalParameterValue("envDur"));
+        mOsc.freq(mParams[pFrequency]);
+        mOsc.harmonics(mParams[pHmnum]);
+        mOsc.ampRatio(mParams[pHmamp]);
+        mAmpEnv.attack(mParams[pAttackTime]);
+        //    mAmpEnv.decay(mParams[pAttackTime]);
+        mAmpEnv.release(mParams[pReleaseTime]);
+        mAmpEnv.levels()[1] = mParams[pSustain];
+        mAmpEnv.levels()[2] = mParams[pSustain];
+
+        mAmpEnv.curve(mParams[pCurve]);
+        mPan.pos(mParams[pPan]);
+        mCFEnv.levels(mParams[pCf1],
+                      mParams[pCf2],
+                      mParams[pCf1]);
+
+        mCFEnv.lengths()[0] = mParams[pCfRise];
+        mCFEnv.lengths()[1] = 1 - mParams[pCfRise];
+        mBWEnv.levels(mParams[pBw1],
+                      mParams[pBw2],
+                      mParams[pBw1]);
+        mBWEnv.lengths()[0] = mParams[pBwRise];
+        mBWEnv.lengths()[1] = 1 - mParams[pBwRise];
+
+        mCFEnv.totalLength(mParams[pEnvDur]);
+        mBWEnv.totalLength(mParams[pEnvDur]);
     }
 };
 
@@ -1761,20 +1759,29 @@ public:
     gam::ADSR<> mAmpEnv;
     gam::EnvFollow<> mEnvFollow;
     gam::Env<2> mPanEnv;
-    gam::STFT stft = gam::STFT(FFT_SIZE, FFT_SIZE / 4, 0, gam::HANN, gam::MAG_FREQ);
+    // Spectrum computed by the app's analyzer, taken on the first trigger
+    AnalysisChannel *mAnalysis{nullptr};
     // This time, let's use spectrograms for each notes as the visual components.
     Mesh mSpectrogram;
-    vector<float> spectrum;
     double a = 0;
     double b = 0;
     double timepose = 10;
+    // Parameters resolved once in init() and snapshotted per audio block
+    VoiceParameters mParams;
+    ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+        pPan1, pPan2, pPanRise;
     // Additional members
     Mesh mMesh;
 
+    // Set by the app in onInit()
+    static SpectrumAnalyzer *&analyzer()
+    {
+        static SpectrumAnalyzer *appAnalyzer = nullptr;
+        return appAnalyzer;
+    }
+
     virtual void init() override
     {
-        // Declare the size of the spectrum
-        spectrum.resize(FFT_SIZE / 2 + 1);
         mSpectrogram.primitive(Mesh::POINTS);
         mAmpEnv.levels(0, 1, 1, 0);
         mPanEnv.curve(4);
@@ -1783,14 +1790,22 @@ public:
         delay.delay(1. / 440.0);
 
         addDisc(mMesh, 1.0, 30);
-        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-        createInternalTriggerParameter("frequency", 60, 20, 5000);
-        createInternalTriggerParameter("attackTime", 0.001, 0.001, 1.0);
-        createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0);
-        createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0);
-        createInternalTriggerParameter("Pan1", 0.0, -1.0, 1.0);
-        createInternalTriggerParameter("Pan2", 0.0, -1.0, 1.0);
-        createInternalTriggerParameter("PanRise", 0.0, 0, 3.0); // range check
+        pAmplitude = mParams.add(
+            createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+        pFrequency = mParams.add(
+            createInternalTriggerParameter("frequency", 60, 20, 5000));
+        pAttackTime = mParams.add(
+            createInternalTriggerParameter("attackTime", 0.001, 0.001, 1.0));
+        pReleaseTime = mParams.add(
+            createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0));
+        pSustain = mParams.add(
+            createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0));
+        pPan1 = mParams.add(
+            createInternalTriggerParameter("Pan1", 0.0, -1.0, 1.0));
+        pPan2 = mParams.add(
+            createInternalTriggerParameter("Pan2", 0.0, -1.0, 1.0));
+        pPanRise = mParams.add(
+            createInternalTriggerParameter("PanRise", 0.0, 0, 3.0)); // range check
     }
 
     //    void reset(){ env.reset(); }
@@ -1807,38 +1822,65 @@ public:
 
     virtual void onProcess(AudioIOData &io) override
     {
-
-        while (io())
+        if (VoiceBlock::enabled())
         {
-            mPan.pos(mPanEnv());
-            float s1 = (*this)() * mAmpEnv() * mAmp;
-            float s2;
-            mEnvFollow(s1);
-            mPan(s1, s1, s2);
-            io.out(0) += s1;
-            io.out(1) += s2;
-            // STFT for each notes
-            if (stft(s1))
-            { // Loop through all the frequency bins
-                for (unsigned k = 0; k < stft.numBins(); ++k)
-                {
-                    // Here we simply scale the complex sample
-                    spectrum[k] = tanh(pow(stft.bin(k).real(), 1.3));
-                }
+            renderVoiceBlocks(io, *this);
+        }
+        else
+        {
+            while (io())
+            {
+                mPan.pos(mPanEnv());
+                float s1 = (*this)() * mAmpEnv() * mAmp;
+                float s2;
+                mEnvFollow(s1);
+                mPan(s1, s1, s2);
+                io.out(0) += s1;
+                io.out(1) += s2;
+                analyze(s1);
             }
         }
         if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
             free();
     }
 
+    // Block rendering path, see VoiceBlock.h
+    void renderBlock(VoiceBlock &block, int frames)
+    {
+        block::generate(*this, block.left, frames);
+        block::generate(mAmpEnv, block.env, frames);
+        block::multiply(block.left, block.env, mAmp, frames);
+        block::feed(mEnvFollow, block.left, frames);
+        for (int i = 0; i < frames; i++)
+        {
+            analyze(block.left[i]);
+        }
+        // The pan position moves every sample
+        for (int i = 0; i < frames; i++)
+        {
+            mPan.pos(mPanEnv());
+            mPan(block.left[i], block.left[i], block.right[i]);
+        }
+    }
+
+    // Spectrum for each note, analyzed off the audio thread
+    void analyze(float s)
+    {
+        if (mAnalysis)
+            mAnalysis->write(s);
+    }
+
     virtual void onProcess(Graphics &g) override
     {
-        float frequency = getInternalParameterValue("frequency");
-        float amplitude = getInternalParameterValue("amplitude");
+        float frequency = mParams.live(pFrequency);
+        float amplitude = mParams.live(pAmplitude);
         a += 0.29;
         b += 0.23;
         timepose -= 0.1;
 
+        if (!mAnalysis)
+            return;
+        const vector<float> &spectrum = mAnalysis->spectrum();
         mSpectrogram.reset();
         // mSpectrogram.primitive(Mesh::LINE_STRIP);
 
@@ -1860,8 +1902,15 @@ public:
 
     virtual void onTriggerOn() override
     {
+        // A reused voice starts a new spectrum
+        if (!mAnalysis && analyzer())
+            mAnalysis = analyzer()->addChannel();
+        if (mAnalysis)
+            mAnalysis->reset();
         mAmpEnv.reset();
         timepose = 10;
+        mParams.invalidate();
+        mParams.snapshot();
         updateFromParameters();
         env.reset();
         delay.zero();
@@ -1875,16 +1924,16 @@ public:
 
     void updateFromParameters()
     {
-        mPanEnv.levels(getInternalParameterValue("Pan1"),
-                       getInternalParameterValue("Pan2"),
-                       getInternalParameterValue("Pan1"));
-        mPanRise = getInternalParameterValue("PanRise");
-        delay.freq(getInternalParameterValue("frequency"));
-        mAmp = getInternalParameterValue("amplitude");
+        mPanEnv.levels(mParams[pPan1],
+                       mParams[pPan2],
+                       mParams[pPan1]);
+        mPanRise = mParams[pPanRise];
+        delay.freq(mParams[pFrequency]);
+        mAmp = mParams[pAmplitude];
         mAmpEnv.levels()[1] = 1.0;
-        mAmpEnv.levels()[2] = getInternalParameterValue("sustain");
-        mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-        mAmpEnv.lengths()[3] = getInternalParameterValue("releaseTime");
+        mAmpEnv.levels()[2] = mParams[pSustain];
+        mAmpEnv.lengths()[0] = mParams[pAttackTime];
+        mAmpEnv.lengths()[3] = mParams[pReleaseTime];
         mPanEnv.lengths()[0] = mPanRise;
         mPanEnv.lengths()[1] = mPanRise;
     }
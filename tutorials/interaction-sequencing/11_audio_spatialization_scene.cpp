@@ -15,6 +15,9 @@
 #include "al/ui/al_Parameter.hpp"
 #include "al/ui/al_PresetSequencer.hpp"
 
+#include "../audiovisual/HoaSpatializer.h"
+#include "../audiovisual/ParallelVoices.h"
+
 //#include "al/util/sound/al_OutputMaster.hpp"
 
 using namespace al;
@@ -33,23 +36,38 @@ using namespace al;
 //#define SpatializerType Vbap
 //#define SpatializerType Dbap
 //#define SpatializerType AmbisonicsSpatializer
+// Higher order Ambisonics, with a decode cost independent of the voice count
+//#define SpatializerType HoaSpatializer
+//#define SpatializerType HoaSpatializerOrder<5>
 
 //
-class MyAgent : public PositionedVoice {
+class MyAgent : public PositionedVoice, public ParallelVoice {
 public:
   MyAgent() {
     mEnvelope.lengths(5.0f, 5.0f);
     mEnvelope.levels(0, 1, 0);
     mEnvelope.sustainPoint(1);
     mModulator.freq(1.9);
+    allocateBlock(1);
   }
 
-  void onProcess(AudioIOData &io) override {
-    while (io()) {
+  // The samples are computed here, on one of the render worker threads
+  void onRenderBlock(int frames) override {
+    float *out = block(0);
+    for (int i = 0; i < frames; i++) {
       mModulatorValue = mModulator();
-      io.out(0) +=
+      out[i] =
           mEnvelope() * mSource() * mModulatorValue * 0.05; // compute sample
     }
+  }
+
+  // and only added to the scene's buffer here
+  void onProcess(AudioIOData &io) override {
+    useBlock(io);
+    const float *samples = block(0);
+    while (io()) {
+      io.out(0) += samples[io.frame()];
+    }
 
     if (mEnvelope.done()) {
       free();
@@ -106,6 +124,9 @@ struct MyApp : public App {
   rnd::Random<> randomGenerator; // Random number generator
 
   DynamicScene scene;
+  // Renders the agents on all cores before the scene spatializes them
+  ParallelVoiceRenderer voiceRenderer;
+
   virtual void onInit() override {
     // Configure spatializer for the scene
     auto speakers = StereoSpeakerLayout();
@@ -183,6 +204,7 @@ struct MyApp : public App {
   virtual void onSound(AudioIOData &io) override {
     // The spatializer must be "prepared" and "finalized" on every block.
     // We do it here once, independently of the number of voices.
+    voiceRenderer.render(scene.getActiveVoices(), io.framesPerBuffer());
     scene.render(io);
   }
 
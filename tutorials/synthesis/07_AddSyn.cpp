@@ -13,22 +13,18 @@
 #include "al/ui/al_ControlGUI.hpp"
 #include "al/ui/al_Parameter.hpp"
 
+#include "../audiovisual/PartialBank.h"
+
 using namespace gam;
 using namespace al;
 using namespace std;
 
 class AddSyn : public SynthVoice {
 public:
-  gam::Sine<> mOsc;
-  gam::Sine<> mOsc1;
-  gam::Sine<> mOsc2;
-  gam::Sine<> mOsc3;
-  gam::Sine<> mOsc4;
-  gam::Sine<> mOsc5;
-  gam::Sine<> mOsc6;
-  gam::Sine<> mOsc7;
-  gam::Sine<> mOsc8;
-  gam::Sine<> mOsc9;
+  // Partials grouped by the envelope that shapes them
+  PartialBank mStri{3};
+  PartialBank mLow{2};
+  PartialBank mUp{4};
   gam::ADSR<> mEnvStri;
   gam::ADSR<> mEnvLow;
   gam::ADSR<> mEnvUp;
@@ -86,25 +82,24 @@ public:
   virtual void onProcess(AudioIOData &io) override {
     // Parameters will update values once per audio callback
     float freq = getInternalParameterValue("frequency");
-    mOsc.freq(freq);
-    mOsc1.freq(getInternalParameterValue("freqStri1") * freq);
-    mOsc2.freq(getInternalParameterValue("freqStri2") * freq);
-    mOsc3.freq(getInternalParameterValue("freqStri3") * freq);
-    mOsc4.freq(getInternalParameterValue("freqLow1") * freq);
-    mOsc5.freq(getInternalParameterValue("freqLow2") * freq);
-    mOsc6.freq(getInternalParameterValue("freqUp1") * freq);
-    mOsc7.freq(getInternalParameterValue("freqUp2") * freq);
-    mOsc8.freq(getInternalParameterValue("freqUp3") * freq);
-    mOsc9.freq(getInternalParameterValue("freqUp4") * freq);
+    mStri.set(0, getInternalParameterValue("freqStri1") * freq, 1);
+    mStri.set(1, getInternalParameterValue("freqStri2") * freq, 1);
+    mStri.set(2, getInternalParameterValue("freqStri3") * freq, 1);
+    mLow.set(0, getInternalParameterValue("freqLow1") * freq, 1);
+    mLow.set(1, getInternalParameterValue("freqLow2") * freq, 1);
+    mUp.set(0, getInternalParameterValue("freqUp1") * freq, 1);
+    mUp.set(1, getInternalParameterValue("freqUp2") * freq, 1);
+    mUp.set(2, getInternalParameterValue("freqUp3") * freq, 1);
+    mUp.set(3, getInternalParameterValue("freqUp4") * freq, 1);
     mPan.pos(getInternalParameterValue("pan"));
     float ampStri = getInternalParameterValue("ampStri");
     float ampUp = getInternalParameterValue("ampUp");
     float ampLow = getInternalParameterValue("ampLow");
     float amp = getInternalParameterValue("amp");
     while (io()) {
-      float s1 = (mOsc1() + mOsc2() + mOsc3()) * mEnvStri() * ampStri;
-      s1 += (mOsc4() + mOsc5()) * mEnvLow() * ampLow;
-      s1 += (mOsc6() + mOsc7() + mOsc8() + mOsc9()) * mEnvUp() * ampUp;
+      float s1 = mStri() * mEnvStri() * ampStri;
+      s1 += mLow() * mEnvLow() * ampLow;
+      s1 += mUp() * mEnvUp() * ampUp;
       s1 *= amp;
       float s2;
       mEnvFollow(s1);
@@ -153,6 +148,9 @@ public:
     mEnvStri.reset();
     mEnvLow.reset();
     mEnvUp.reset();
+    mStri.reset();
+    mLow.reset();
+    mUp.reset();
   }
 
   virtual void onTriggerOff() override {
@@ -12,6 +12,11 @@
 #include "al/ui/al_ControlGUI.hpp"
 #include "al/ui/al_Parameter.hpp"
 
+#include "../audiovisual/BinaryScore.h"
+#include "../audiovisual/OfflineRender.h"
+#include "../audiovisual/ScorePlayer.h"
+#include "../audiovisual/VoicePool.h"
+
 // using namespace gam;
 using namespace al;
 using namespace std;
@@ -1038,6 +1043,11 @@ public:
 class MyApp : public App {
 public:
   SynthGUIManager<OscTrm> synthManager{"integrated_inst"};
+  // Voices for the generated passages of fillTime(), preallocated in
+  // onCreate(). The quietest voice is taken over when all are busy.
+  VoicePool<AddSyn> addSynPool{
+      VoicePool<AddSyn>::QUIETEST,
+      [](AddSyn &voice) { return voice.mEnvFollow.value(); }};
   //    ParameterMIDI parameterMIDI;
   int midiNote;
   //    ParameterMIDI parameterMIDI;
@@ -1051,6 +1061,10 @@ public:
                                 // will be using keyboard for note triggering
     // Set sampling rate for Gamma objects from app's audio
     gam::sampleRate(audioIO().framesPerSecond());
+    initTables();
+  }
+
+  void initTables() {
     // Additive Synth Related
     initScaleToHarmonicSeries();
     initScaleTo12TET(110);
@@ -1101,6 +1115,10 @@ public:
     // Play example sequence. Comment this line to start from scratch
     //    synthManager.synthSequencer().playSequence("synth2.synthSequence");
     synthManager.synthRecorder().verbose(true);
+    initSynth();
+  }
+
+  void initSynth() {
     // Add another class used
     synthManager.synth().registerSynthClass<OscEnv>();
     synthManager.synth().registerSynthClass<Vib>();
@@ -1111,10 +1129,63 @@ public:
     synthManager.synth().registerSynthClass<Sub>();
     synthManager.synth().registerSynthClass<AddSyn>();
     synthManager.synth().registerSynthClass<PluckedString>();
+    addSynPool.allocatePolyphony(32);
   }
 
   void onSound(AudioIOData &io) override {
     synthManager.render(io); // Render audio
+    addSynPool.render(io);
+  }
+
+  // Render to a WAV file as fast as possible, without audio device or
+  // window. Plays a .synthSequence or a .score (converted from a JSON score
+  // by tools/audio/score_convert) if one is given, otherwise a fillTime()
+  // passage.
+  bool renderOffline(const std::string &path, double seconds,
+                     const std::string &sequence) {
+    // Same settings as configureAudio() in main()
+    OfflineRenderer renderer{48000., 512, 2};
+    initTables();
+    initSynth();
+    bool ok;
+    if (endsWith(sequence, ".score")) {
+      BinaryScore score;
+      if (!score.open(sequence)) {
+        return false;
+      }
+      ScorePlayer player{[this] { return addSynPool.time(); }};
+      int addSyn = player.addInstrument(poolInstrument(addSynPool));
+      player.reserve(score.numNotes());
+      for (int t = 0; t < score.numTracks(); t++) {
+        const ScoreNoteRecord *notes = score.notes(t);
+        for (int i = 0; i < score.numNotes(t); i++) {
+          const ScoreNoteRecord &note = notes[i];
+          float freq = ::pow(2.f, (note.midi - 69.f) / 12.f) * 440.f;
+          // amp and frequency, AddSyn's defaults for the rest
+          player.add({note.time, note.duration, addSyn, 2,
+                      {0.03f * note.amplitude(), freq}});
+        }
+      }
+      ok = renderer.render(*this, player, seconds, path);
+    } else {
+      if (!sequence.empty()) {
+        synthManager.synthSequencer().playSequence(sequence);
+      } else {
+        fillTime(0, seconds - 1, 0.1, 0.1, 0.1, 0.4, 0.4, 0.4, 110, 880);
+      }
+      ok = renderer.render(*this, seconds, path);
+    }
+    if (!ok) {
+      return false;
+    }
+    std::cout << "Rendered " << path << " at " << renderer.speed()
+              << "x realtime" << std::endl;
+    return true;
+  }
+
+  static bool endsWith(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
   }
 
   void onAnimate(double dt) override {
@@ -1126,6 +1197,7 @@ public:
   void onDraw(Graphics &g) override {
     g.clear();
     synthManager.render(g);
+    addSynPool.render(g);
 
     // Draw GUI
     imguiDraw();
@@ -1194,15 +1266,13 @@ public:
       float nextAtt =
           gam::rnd::uni((minattackStri + minattackLow + minattackUp),
                         (maxattackStri + maxattackLow + maxattackUp));
-      auto *voice = synthManager.synth().getVoice<AddSyn>();
-      voice->setTriggerParams(
-          std::vector<float>{0.03, 440,  0.5,  0.0001, 3.8, 0.3,  0.4,  0.0001,
-                             6.0,  0.99, 0.3,  0.0001, 6.0, 0.9,  2,    3,
-                             4.07, 0.56, 0.92, 1.19,   1.7, 2.75, 3.36, 0.0});
-      voice->setInternalParameterValue("attackStr", nextAtt);
-      voice->setInternalParameterValue("frequency",
-                                       gam::rnd::uni(minFreq, maxFreq));
-      synthManager.synthSequencer().addVoiceFromNow(voice, from, 0.2);
+      // Trigger parameters in the order AddSyn creates them
+      float params[] = {0.03, 440,  0.5,  0.0001, 3.8, 0.3,  0.4,  0.0001,
+                        6.0,  0.99, 0.3,  0.0001, 6.0, 0.9,  2,    3,
+                        4.07, 0.56, 0.92, 1.19,   1.7, 2.75, 3.36, 0.0};
+      params[3] = nextAtt; // attackStri
+      params[1] = gam::rnd::uni(minFreq, maxFreq); // frequency
+      addSynPool.scheduleFromNow(from, 0.2, params, 24);
       std::cout << "old from " << from << " plus nextnextAtt " << nextAtt
                 << std::endl;
       from += nextAtt;
@@ -1218,14 +1288,13 @@ public:
       float nextAtt =
           gam::rnd::uni((minattackStri + minattackLow + minattackUp),
                         (maxattackStri + maxattackLow + maxattackUp));
-      auto *voice = synthManager.synth().getVoice<AddSyn>();
-      voice->setTriggerParams(
-          std::vector<float>{0.03, 440,  0.5,  0.0001, 3.8, 0.3,  0.4,  0.0001,
-                             6.0,  0.99, 0.3,  0.0001, 6.0, 0.9,  2,    3,
-                             4.07, 0.56, 0.92, 1.19,   1.7, 2.75, 3.36, 0.0});
-      voice->setInternalParameterValue("attackStr", nextAtt);
-      voice->setInternalParameterValue("frequency", randomFrom12TET());
-      synthManager.synthSequencer().addVoiceFromNow(voice, from, 0.2);
+      // Trigger parameters in the order AddSyn creates them
+      float params[] = {0.03, 440,  0.5,  0.0001, 3.8, 0.3,  0.4,  0.0001,
+                        6.0,  0.99, 0.3,  0.0001, 6.0, 0.9,  2,    3,
+                        4.07, 0.56, 0.92, 1.19,   1.7, 2.75, 3.36, 0.0};
+      params[3] = nextAtt; // attackStri
+      params[1] = randomFrom12TET(); // frequency
+      addSynPool.scheduleFromNow(from, 0.2, params, 24);
       std::cout << "12 old from " << from << " plus nextAtt " << nextAtt
                 << std::endl;
       from += nextAtt;
@@ -1233,9 +1302,16 @@ public:
   }
 };
 
-int main() {
+int main(int argc, char *argv[]) {
   MyApp app;
 
+  // 10_Integrated --render out.wav [seconds] [name.synthSequence|name.score]
+  if (argc > 2 && std::string(argv[1]) == "--render") {
+    double seconds = argc > 3 ? std::atof(argv[3]) : 30.0;
+    std::string sequence = argc > 4 ? argv[4] : "";
+    return app.renderOffline(argv[2], seconds, sequence) ? 0 : 1;
+  }
+
   // Set up audio
   app.configureAudio(48000., 512, 2, 0);
 
@@ -26,11 +26,7 @@
 #include "al/io/al_MIDI.hpp"
 #include "al/math/al_Random.hpp"
 
-// #include <json/json.h>
-// #include "json.hpp"
-#include <nlohmann/json.hpp>
-#include <fstream>
-using json = nlohmann::json;
+#include "../audiovisual/BinaryScore.h"
 
 // using namespace gam;
 using namespace al;
@@ -673,57 +669,37 @@ public:
     }
 
 
+    // Loads the binary score written by tools/audio/score_convert from
+    // passionfruit.json. Tracks missing from the score are skipped.
     void playTune(){
-        // read json file
-        std::ifstream f("/Users/architgupta/allolib/demo1-archit-gpt/tutorials/synthesis/passionfruit.json");
-        // cout << "FILE" << endl;
-        // cout << f.rdbuf();
-        json music = json::parse(f);
-
-        json violin = music["tracks"][0]["notes"];
-        json ensemble_violin = music["tracks"][1]["notes"];
-        json piano = music["tracks"][2]["notes"];
-        json bass_piano = music["tracks"][3]["notes"];
-        // json notes = music["tracks"];
-
-    auto v = violin.begin();
-    auto ev = ensemble_violin.begin();
-    auto p = piano.begin();
-    auto bp = bass_piano.begin();
-
-
-    while(v != violin.end() || ev != ensemble_violin.end() || p != piano.end() || bp != bass_piano.end())
-    {
-        if(v != violin.end())
-        {
-            auto note = *v;
-            playNote(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++v;
-            hihatBeat(note["time"], 113);
-            kickBeat(note["time"], 113/2);
-        }
-        if(p != piano.end())
-        {
-            auto note = *p;
-            playGuitar(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++p;
+        BinaryScore music;
+        if (!music.open("passionfruit.score") &&
+            !music.open("../passionfruit.score")) {
+            return;
         }
-        if(bp != bass_piano.end())
-        {
-            auto note = *bp;
-            playGuitar(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++bp;
-        }
-        if(ev != ensemble_violin.end())
-        {
-            auto note = *ev;
-            playNote(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++ev;
+        for (int t = 0; t < music.numTracks(); t++) {
+            const ScoreNoteRecord *notes = music.notes(t);
+            for (int i = 0; i < music.numNotes(t); i++) {
+                const ScoreNoteRecord &note = notes[i];
+                float freq = freq_of(note.midi);
+                switch (t) {
+                case 0: // violin, with the beat
+                    playNote(freq, note.time, note.duration, note.amplitude());
+                    hihatBeat(note.time, 113);
+                    kickBeat(note.time, 113/2);
+                    break;
+                case 1: // ensemble violin
+                    playNote(freq, note.time, note.duration, note.amplitude());
+                    break;
+                case 2: // piano
+                case 3: // bass piano
+                    playGuitar(freq, note.time, note.duration, note.amplitude());
+                    break;
+                }
+            }
         }
     }
 
-    }
-
     void onCreate() override
     {
         // Play example sequence. Comment this line to start from scratch
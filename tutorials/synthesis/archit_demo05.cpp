@@ -17,12 +17,11 @@
 #include "al/io/al_MIDI.hpp"
 #include "al/math/al_Random.hpp"
 
-
-// #include <json/json.h>
-// #include "json.hpp"
-#include <nlohmann/json.hpp>
-#include <fstream>
-using json = nlohmann::json;
+#include "../audiovisual/BinaryScore.h"
+#include "../audiovisual/ScorePlayer.h"
+#include "../audiovisual/SpectrumAnalyzer.h"
+#include "../audiovisual/VoiceParameters.h"
+#include "../audiovisual/VoicePool.h"
 
 // using namespace gam;
 using namespace al;
@@ -47,6 +46,9 @@ public:
   gam::Env<3> mAmpEnv;
 
   gam::EnvFollow<> mEnvFollow;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pPan;
   Mesh mMesh;
   double time = 1;
   double time2 = 0;
@@ -70,11 +72,15 @@ public:
     addDodecahedron(mMesh,0.4);
     addCircle(mMesh, 0.7);
 
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 1, 0.1, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 1, 0.1, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
   }
 
   // The audio processing function
@@ -86,24 +92,27 @@ public:
     // voice, rather than having to trigger a new voice to hear the changes.
     // Parameters will update values once per audio callback because they
     // are outside the sample processing loop.
-    mOsc1.freq(getInternalParameterValue("frequency"));
-    mOsc3.freq(3*getInternalParameterValue("frequency"));
-    mSaw1.freq(getInternalParameterValue("frequency"));
-    mSaw3.freq(3*getInternalParameterValue("frequency"));
-    mSaw2.freq(2*getInternalParameterValue("frequency"));
-  
-
-    mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mAmpEnv.lengths()[2] = getInternalParameterValue("releaseTime");
-    mPan.pos(getInternalParameterValue("pan"));
+    // Only recompute when a parameter changed since the last block.
+    if (mParams.snapshot())
+    {
+      mOsc1.freq(mParams[pFrequency]);
+      mOsc3.freq(3*mParams[pFrequency]);
+      mSaw1.freq(mParams[pFrequency]);
+      mSaw3.freq(3*mParams[pFrequency]);
+      mSaw2.freq(2*mParams[pFrequency]);
+
+      mAmpEnv.lengths()[0] = mParams[pAttackTime];
+      mAmpEnv.lengths()[2] = mParams[pReleaseTime];
+      mPan.pos(mParams[pPan]);
+    }
     while (io())
     {
       
-      float s1 =  // mSaw1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-              // + mSaw3() * (1.0/6.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-              mSaw2() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc3() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude");
+      float s1 =  // mSaw1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+              // + mSaw3() * (1.0/6.0) * mAmpEnv() * mParams[pAmplitude]
+              mSaw2() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc3() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude];
       float s2;
       mPan(s1, s1, s2);
       io.out(0) += s1;
@@ -123,8 +132,8 @@ public:
     // empty if there are no graphics to draw
     // Get the paramter values on every video frame, to apply changes to the
     // current instance
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
     time += 0.02;
     // Now draw
     g.pushMatrix();
@@ -144,7 +153,11 @@ public:
   // The triggering functions just need to tell the envelope to start or release
   // The audio processing function checks when the envelope is done to remove
   // the voice from the processing chain.
-  void onTriggerOn() override { mAmpEnv.reset(); }
+  void onTriggerOn() override
+  {
+    mAmpEnv.reset();
+    mParams.invalidate();
+  }
 
   void onTriggerOff() override { mAmpEnv.release(); }
 };
@@ -162,6 +175,9 @@ public:
   gam::Env<3> mAmpEnv;
 
   gam::EnvFollow<> mEnvFollow;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pPan;
   Mesh mMesh;
   double time = 1;
   double time2 = 0;
@@ -185,11 +201,15 @@ public:
     addDodecahedron(mMesh,0.4);
     addCircle(mMesh, 0.7);
 
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 1, 0.1, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 1, 0.1, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
   }
 
   // The audio processing function
@@ -201,24 +221,27 @@ public:
     // voice, rather than having to trigger a new voice to hear the changes.
     // Parameters will update values once per audio callback because they
     // are outside the sample processing loop.
-    mOsc1.freq(getInternalParameterValue("frequency"));
-    mOsc3.freq(3*getInternalParameterValue("frequency"));
-    mSaw1.freq(getInternalParameterValue("frequency"));
-    mSaw3.freq(3*getInternalParameterValue("frequency"));
-    mSaw2.freq(2*getInternalParameterValue("frequency"));
-  
-
-    mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mAmpEnv.lengths()[2] = getInternalParameterValue("releaseTime");
-    mPan.pos(getInternalParameterValue("pan"));
+    // Only recompute when a parameter changed since the last block.
+    if (mParams.snapshot())
+    {
+      mOsc1.freq(mParams[pFrequency]);
+      mOsc3.freq(3*mParams[pFrequency]);
+      mSaw1.freq(mParams[pFrequency]);
+      mSaw3.freq(3*mParams[pFrequency]);
+      mSaw2.freq(2*mParams[pFrequency]);
+
+      mAmpEnv.lengths()[0] = mParams[pAttackTime];
+      mAmpEnv.lengths()[2] = mParams[pReleaseTime];
+      mPan.pos(mParams[pPan]);
+    }
     while (io())
     {
       
-      float s1 =  // mSaw1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-              // + mSaw3() * (1.0/6.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-              0.4*(mSaw2() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc3() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude"));
+      float s1 =  // mSaw1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+              // + mSaw3() * (1.0/6.0) * mAmpEnv() * mParams[pAmplitude]
+              0.4*(mSaw2() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc3() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude]);
       float s2;
       mPan(s1, s1, s2);
       io.out(0) += s1;
@@ -238,8 +261,8 @@ public:
     // empty if there are no graphics to draw
     // Get the paramter values on every video frame, to apply changes to the
     // current instance
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
     time += 0.02;
     // Now draw
     g.pushMatrix();
@@ -259,7 +282,11 @@ public:
   // The triggering functions just need to tell the envelope to start or release
   // The audio processing function checks when the envelope is done to remove
   // the voice from the processing chain.
-  void onTriggerOn() override { mAmpEnv.reset(); }
+  void onTriggerOn() override
+  {
+    mAmpEnv.reset();
+    mParams.invalidate();
+  }
 
   void onTriggerOff() override { mAmpEnv.release(); }
 };
@@ -277,6 +304,9 @@ public:
   gam::Env<3> mAmpEnv;
 
   gam::EnvFollow<> mEnvFollow;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pPan;
   Mesh mMesh;
   double time = 1;
   double time2 = 0;
@@ -300,11 +330,15 @@ public:
     // addDodecahedron(mMesh,0.4);
     addRect(mMesh, 2.5,0.25);
 
-    createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 1, 0.1, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.1, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 1, 0.1, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
   }
 
   // The audio processing function
@@ -316,24 +350,27 @@ public:
     // voice, rather than having to trigger a new voice to hear the changes.
     // Parameters will update values once per audio callback because they
     // are outside the sample processing loop.
-    mOsc1.freq(getInternalParameterValue("frequency"));
-    mOsc3.freq(2*getInternalParameterValue("frequency"));
-    mSaw1.freq(getInternalParameterValue("frequency"));
-    mSaw3.freq(3*getInternalParameterValue("frequency"));
-    mSaw2.freq(2*getInternalParameterValue("frequency"));
-  
-
-    mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mAmpEnv.lengths()[2] = getInternalParameterValue("releaseTime");
-    mPan.pos(getInternalParameterValue("pan"));
+    // Only recompute when a parameter changed since the last block.
+    if (mParams.snapshot())
+    {
+      mOsc1.freq(mParams[pFrequency]);
+      mOsc3.freq(2*mParams[pFrequency]);
+      mSaw1.freq(mParams[pFrequency]);
+      mSaw3.freq(3*mParams[pFrequency]);
+      mSaw2.freq(2*mParams[pFrequency]);
+
+      mAmpEnv.lengths()[0] = mParams[pAttackTime];
+      mAmpEnv.lengths()[2] = mParams[pReleaseTime];
+      mPan.pos(mParams[pPan]);
+    }
     while (io())
     {
       
-      float s1 =  // mSaw1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-              // + mSaw3() * (1.0/6.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-              //mSaw2() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-                mOsc1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc3() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude");
+      float s1 =  // mSaw1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+              // + mSaw3() * (1.0/6.0) * mAmpEnv() * mParams[pAmplitude]
+              //mSaw2() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude]
+                mOsc1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc3() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude];
       float s2;
       mPan(s1, s1, s2);
       io.out(0) += s1;
@@ -353,8 +390,8 @@ public:
     // empty if there are no graphics to draw
     // Get the paramter values on every video frame, to apply changes to the
     // current instance
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
     time += 0.02;
     // Now draw
     g.pushMatrix();
@@ -375,7 +412,11 @@ public:
   // The triggering functions just need to tell the envelope to start or release
   // The audio processing function checks when the envelope is done to remove
   // the voice from the processing chain.
-  void onTriggerOn() override { mAmpEnv.reset(); }
+  void onTriggerOn() override
+  {
+    mAmpEnv.reset();
+    mParams.invalidate();
+  }
 
   void onTriggerOff() override { mAmpEnv.release(); }
 };
@@ -393,6 +434,9 @@ public:
   gam::Env<3> mAmpEnv;
 
   gam::EnvFollow<> mEnvFollow;
+  // Parameters resolved once in init() and snapshotted per audio block
+  VoiceParameters mParams;
+  ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pPan;
   Mesh mMesh;
   double time = 3.5;
   double time2 = 0;
@@ -416,11 +460,15 @@ public:
     //addAnnulus(mMesh, 1.2,1.5);
     addWireBox(mMesh, 0.01);
 
-    createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0);
-    createInternalTriggerParameter("frequency", 60, 20, 5000);
-    createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 0.2, 0.1, 10.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
+    pAmplitude = mParams.add(
+        createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0));
+    pFrequency = mParams.add(
+        createInternalTriggerParameter("frequency", 60, 20, 5000));
+    pAttackTime = mParams.add(
+        createInternalTriggerParameter("attackTime", 0.2, 0.01, 3.0));
+    pReleaseTime = mParams.add(
+        createInternalTriggerParameter("releaseTime", 0.2, 0.1, 10.0));
+    pPan = mParams.add(createInternalTriggerParameter("pan", 0.0, -1.0, 1.0));
   }
 
   // The audio processing function
@@ -432,24 +480,27 @@ public:
     // voice, rather than having to trigger a new voice to hear the changes.
     // Parameters will update values once per audio callback because they
     // are outside the sample processing loop.
-    mOsc1.freq(getInternalParameterValue("frequency"));
-    mOsc3.freq(3*getInternalParameterValue("frequency"));
-    mOsc5.freq(5*getInternalParameterValue("frequency"));
-    mOsc7.freq(7*getInternalParameterValue("frequency"));
-    mOsc9.freq(9*getInternalParameterValue("frequency"));
-  
-
-    mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-    mAmpEnv.lengths()[2] = getInternalParameterValue("releaseTime");
-    mPan.pos(getInternalParameterValue("pan"));
+    // Only recompute when a parameter changed since the last block.
+    if (mParams.snapshot())
+    {
+      mOsc1.freq(mParams[pFrequency]);
+      mOsc3.freq(3*mParams[pFrequency]);
+      mOsc5.freq(5*mParams[pFrequency]);
+      mOsc7.freq(7*mParams[pFrequency]);
+      mOsc9.freq(9*mParams[pFrequency]);
+
+      mAmpEnv.lengths()[0] = mParams[pAttackTime];
+      mAmpEnv.lengths()[2] = mParams[pReleaseTime];
+      mPan.pos(mParams[pPan]);
+    }
     while (io())
     {
       
-      float s1 =  0.4*(mOsc1() * (1.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc3() * (1.0/3.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc5() * (1.0/5.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc7() * (1.0/7.0) * mAmpEnv() * getInternalParameterValue("amplitude")
-               + mOsc9() * (1.0/9.0) * mAmpEnv() * getInternalParameterValue("amplitude"));
+      float s1 =  0.4*(mOsc1() * (1.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc3() * (1.0/3.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc5() * (1.0/5.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc7() * (1.0/7.0) * mAmpEnv() * mParams[pAmplitude]
+               + mOsc9() * (1.0/9.0) * mAmpEnv() * mParams[pAmplitude]);
       float s2;
       mPan(s1, s1, s2);
       io.out(0) += s1;
@@ -469,8 +520,8 @@ public:
     // empty if there are no graphics to draw
     // Get the paramter values on every video frame, to apply changes to the
     // current instance
-    float frequency = getInternalParameterValue("frequency");
-    float amplitude = getInternalParameterValue("amplitude");
+    float frequency = mParams.live(pFrequency);
+    float amplitude = mParams.live(pAmplitude);
     time += 0.03;
     time2 -= 0.02;
     // Now draw
@@ -491,7 +542,11 @@ public:
   // The triggering functions just need to tell the envelope to start or release
   // The audio processing function checks when the envelope is done to remove
   // the voice from the processing chain.
-  void onTriggerOn() override { mAmpEnv.reset(); }
+  void onTriggerOn() override
+  {
+    mAmpEnv.reset();
+    mParams.invalidate();
+  }
 
   void onTriggerOff() override { mAmpEnv.release(); }
 };
@@ -511,20 +566,29 @@ public:
     gam::ADSR<> mAmpEnv;
     gam::EnvFollow<> mEnvFollow;
     gam::Env<2> mPanEnv;
-    gam::STFT stft = gam::STFT(FFT_SIZE, FFT_SIZE / 4, 0, gam::BLACKMAN_HARRIS, gam::MAG_FREQ);
+    // Spectrum computed by the app's analyzer, taken on the first trigger
+    AnalysisChannel *mAnalysis{nullptr};
     // This time, let's use spectrograms for each notes as the visual components.
     Mesh mSpectrogram;
-    vector<float> spectrum;
     double a = 0;
     double b = 0;
     double timepose = 10;
+    // Parameters resolved once in init() and snapshotted per audio block
+    VoiceParameters mParams;
+    ParamHandle pAmplitude, pFrequency, pAttackTime, pReleaseTime, pSustain,
+        pPan1, pPan2, pPanRise;
     // Additional members
     Mesh mMesh;
 
+    // Set by the app in onInit()
+    static SpectrumAnalyzer *&analyzer()
+    {
+        static SpectrumAnalyzer *appAnalyzer = nullptr;
+        return appAnalyzer;
+    }
+
     virtual void init() override
     {
-        // Declare the size of the spectrum
-        spectrum.resize(FFT_SIZE / 2 + 1);
         // mSpectrogram.primitive(Mesh::POINTS);
         mSpectrogram.primitive(Mesh::LINE_STRIP);
         mAmpEnv.levels(0, 1, 1, 0);
@@ -536,14 +600,22 @@ public:
         //delay.delay(1. / 2);
 
         addDisc(mMesh, 1.0, 30);
-        createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0);
-        createInternalTriggerParameter("frequency", 60, 20, 5000);
-        createInternalTriggerParameter("attackTime", 0.001, 0.001, 1.0);
-        createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0);
-        createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0);
-        createInternalTriggerParameter("Pan1", 0.0, -1.0, 1.0);
-        createInternalTriggerParameter("Pan2", 0.0, -1.0, 1.0);
-        createInternalTriggerParameter("PanRise", 0.0, 0, 3.0); // range check
+        pAmplitude = mParams.add(
+            createInternalTriggerParameter("amplitude", 0.3, 0.0, 1.0));
+        pFrequency = mParams.add(
+            createInternalTriggerParameter("frequency", 60, 20, 5000));
+        pAttackTime = mParams.add(
+            createInternalTriggerParameter("attackTime", 0.001, 0.001, 1.0));
+        pReleaseTime = mParams.add(
+            createInternalTriggerParameter("releaseTime", 3.0, 0.1, 10.0));
+        pSustain = mParams.add(
+            createInternalTriggerParameter("sustain", 0.7, 0.0, 1.0));
+        pPan1 = mParams.add(
+            createInternalTriggerParameter("Pan1", 0.0, -1.0, 1.0));
+        pPan2 = mParams.add(
+            createInternalTriggerParameter("Pan2", 0.0, -1.0, 1.0));
+        pPanRise = mParams.add(
+            createInternalTriggerParameter("PanRise", 0.0, 0, 3.0)); // range check
     }
 
     //    void reset(){ env.reset(); }
@@ -570,15 +642,9 @@ public:
             mPan(s1, s1, s2);
             io.out(0) += s1;
             io.out(1) += s2;
-            // STFT for each notes
-            if (stft(s1))
-            { // Loop through all the frequency bins
-                for (unsigned k = 0; k < stft.numBins(); ++k)
-                {
-                    // Here we simply scale the complex sample
-                    spectrum[k] = tanh(pow(stft.bin(k).real(), 1.3));
-                }
-            }
+            // Spectrum for each note, analyzed off the audio thread
+            if (mAnalysis)
+                mAnalysis->write(s1);
         }
         if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
             free();
@@ -586,12 +652,15 @@ public:
 
     virtual void onProcess(Graphics &g) override
     {
-        float frequency = getInternalParameterValue("frequency");
-        float amplitude = getInternalParameterValue("amplitude");
+        float frequency = mParams.live(pFrequency);
+        float amplitude = mParams.live(pAmplitude);
         a += 0.6;
         b += 0.28;
         timepose -= 0.09;
 
+        if (!mAnalysis)
+            return;
+        const vector<float> &spectrum = mAnalysis->spectrum();
         mSpectrogram.reset();
         // mSpectrogram.primitive(Mesh::LINE_STRIP);
 
@@ -613,8 +682,15 @@ public:
 
     virtual void onTriggerOn() override
     {
+        // A reused voice starts a new spectrum
+        if (!mAnalysis && analyzer())
+            mAnalysis = analyzer()->addChannel();
+        if (mAnalysis)
+            mAnalysis->reset();
         mAmpEnv.reset();
         timepose = 10;
+        mParams.invalidate();
+        mParams.snapshot();
         updateFromParameters();
         env.reset();
         delay.zero();
@@ -628,16 +704,16 @@ public:
 
     void updateFromParameters()
     {
-        mPanEnv.levels(getInternalParameterValue("Pan1"),
-                       getInternalParameterValue("Pan2"),
-                       getInternalParameterValue("Pan1"));
-        mPanRise = getInternalParameterValue("PanRise");
-        delay.freq(getInternalParameterValue("frequency"));
-        mAmp = getInternalParameterValue("amplitude");
+        mPanEnv.levels(mParams[pPan1],
+                       mParams[pPan2],
+                       mParams[pPan1]);
+        mPanRise = mParams[pPanRise];
+        delay.freq(mParams[pFrequency]);
+        mAmp = mParams[pAmplitude];
         mAmpEnv.levels()[1] = 1.0;
-        mAmpEnv.levels()[2] = getInternalParameterValue("sustain");
-        mAmpEnv.lengths()[0] = getInternalParameterValue("attackTime");
-        mAmpEnv.lengths()[3] = getInternalParameterValue("releaseTime");
+        mAmpEnv.levels()[2] = mParams[pSustain];
+        mAmpEnv.lengths()[0] = mParams[pAttackTime];
+        mAmpEnv.lengths()[3] = mParams[pReleaseTime];
         mPanEnv.lengths()[0] = mPanRise;
         mPanEnv.lengths()[1] = mPanRise;
     }
@@ -647,6 +723,9 @@ public:
 class MyApp : public App, public MIDIMessageHandler
 {
 public:
+  // Spectra of the PluckedString voices, analyzed at display rate. Declared
+  // before the voices so it outlives them.
+  std::unique_ptr<SpectrumAnalyzer> voiceAnalyzer;
   SynthGUIManager<SineEnv> synthManager{"SineEnv"};
   // GUI manager for SineEnv voices
   // The name provided determines the name of the directory
@@ -659,11 +738,37 @@ public:
   bool navi = false;
   gam::STFT stft = gam::STFT(FFT_SIZE, FFT_SIZE / 4, 0, gam::HANN, gam::MAG_FREQ);
 
+  // Preallocated voices for the notes of playTune(). When all voices of a
+  // pool are busy, the quietest one is taken over.
+  VoicePool<SineEnv> sinePool{
+      VoicePool<SineEnv>::QUIETEST,
+      [](SineEnv &voice) { return voice.mEnvFollow.value(); }};
+  VoicePool<SineEnv2> sine2Pool{
+      VoicePool<SineEnv2>::QUIETEST,
+      [](SineEnv2 &voice) { return voice.mEnvFollow.value(); }};
+  VoicePool<SineEnv3> sine3Pool{
+      VoicePool<SineEnv3>::QUIETEST,
+      [](SineEnv3 &voice) { return voice.mEnvFollow.value(); }};
+  VoicePool<SquareWave> squarePool{
+      VoicePool<SquareWave>::QUIETEST,
+      [](SquareWave &voice) { return voice.mEnvFollow.value(); }};
+  VoicePool<PluckedString> pluckPool{
+      VoicePool<PluckedString>::QUIETEST,
+      [](PluckedString &voice) { return voice.mEnvFollow.value(); }};
+  // playTune() fills the score, which hands its notes to the pools only
+  // shortly before they are due
+  ScorePlayer score{[this] { return sinePool.time(); }};
+  int sineInstrument, sine2Instrument, sine3Instrument, squareInstrument,
+      pluckInstrument;
+
   void onInit() override
     {
         imguiInit();
         // Set sampling rate for Gamma objects from app's audio
         gam::sampleRate(audioIO().framesPerSecond());
+        voiceAnalyzer.reset(
+            new SpectrumAnalyzer(4096, SpectrumAnalyzer::BLACKMAN_HARRIS));
+        PluckedString::analyzer() = voiceAnalyzer.get();
         // Check for connected MIDI devices
         if (midiIn.getPortCount() > 0)
         {
@@ -726,6 +831,18 @@ public:
 
     imguiInit();
 
+    // Only the lookahead window of the score is queued at a time
+    sinePool.allocatePolyphony(16, 256);
+    sine2Pool.allocatePolyphony(16, 256);
+    sine3Pool.allocatePolyphony(16, 256);
+    squarePool.allocatePolyphony(16, 256);
+    pluckPool.allocatePolyphony(16, 256);
+    sineInstrument = score.addInstrument(poolInstrument(sinePool));
+    sine2Instrument = score.addInstrument(poolInstrument(sine2Pool));
+    sine3Instrument = score.addInstrument(poolInstrument(sine3Pool));
+    squareInstrument = score.addInstrument(poolInstrument(squarePool));
+    pluckInstrument = score.addInstrument(poolInstrument(pluckPool));
+
     // Play example sequence. Comment this line to start from scratch
     playTune();
     // synthManager.synthSequencer().playSequence("synth1.synthSequence");
@@ -735,6 +852,11 @@ public:
   // The audio callback function. Called when audio hardware requires data
   void onSound(AudioIOData &io) override {
     synthManager.render(io); // Render audio
+    sinePool.render(io);
+    sine2Pool.render(io);
+    sine3Pool.render(io);
+    squarePool.render(io);
+    pluckPool.render(io);
   }
 
   void onAnimate(double dt) override {
@@ -750,6 +872,11 @@ public:
     g.clear();
     // Render the synth's graphics
     synthManager.render(g);
+    sinePool.render(g);
+    sine2Pool.render(g);
+    sine3Pool.render(g);
+    squarePool.render(g);
+    pluckPool.render(g);
 
     // GUI is drawn here
     imguiDraw();
@@ -791,101 +918,67 @@ public:
 
   void playSineEnv(float freq, float time, float duration, float amp = .001, float attack = 0.3, float release = 0.3)
   {
-    auto *voice = synthManager.synth().getVoice<SineEnv>();
     // amp, freq, attack, release, pan
-    vector<float> params = vector<float>({amp, freq, attack, release ,0.0});
-    voice->setTriggerParams(params);
-    synthManager.synthSequencer().addVoiceFromNow(voice, time, duration);
+    score.add({time, duration, sineInstrument, 5, {amp, freq, attack, release, 0.0f}});
   }
 
   void playSineEnv2(float freq, float time, float duration, float amp = .001, float attack = 0.3, float release = 0.2)
   {
-    auto *voice = synthManager.synth().getVoice<SineEnv2>();
     // amp, freq, attack, release, pan
-    vector<float> params = vector<float>({amp, freq, attack, release ,0.0});
-    voice->setTriggerParams(params);
-    synthManager.synthSequencer().addVoiceFromNow(voice, time, duration);
+    score.add({time, duration, sine2Instrument, 5, {amp, freq, attack, release, 0.0f}});
   }
 
   void playSineEnv3(float freq, float time, float duration, float amp = .001, float attack = 0.3, float release = 0.1)
   {
-    auto *voice = synthManager.synth().getVoice<SineEnv3>();
     // amp, freq, attack, release, pan
-    vector<float> params = vector<float>({amp, freq, attack, release ,0.0});
-    voice->setTriggerParams(params);
-    synthManager.synthSequencer().addVoiceFromNow(voice, time, duration);
+    score.add({time, duration, sine3Instrument, 5, {amp, freq, attack, release, 0.0f}});
   }
 
   void playSquareWave(float freq, float time, float duration, float amp = .07, float attack = 0.1, float release = 0.2)
   {
-    auto *voice = synthManager.synth().getVoice<SquareWave>();
     // amp, freq, attack, release, pan
-    vector<float> params = vector<float>({amp, freq, attack, release, 0.0});
-    voice->setTriggerParams(params);
-    synthManager.synthSequencer().addVoiceFromNow(voice, time, duration);
+    score.add({time, duration, squareInstrument, 5, {amp, freq, attack, release, 0.0f}});
   }
 
   void playPluckString(float freq, float time, float duration, float amp = 0.5)
   {
-    
-    auto *voice = synthManager.synth().getVoice<PluckedString>();
-    //vector<VariantValue> params = vector<VariantValue>({amp, freq, attack, decay, 0.0});
-    //voice->setTriggerParams(params);
-
-    voice->setInternalParameterValue("frequency", freq);
-    voice->setInternalParameterValue("amplitude", amp);
-
-    synthManager.synthSequencer().addVoiceFromNow(voice, time, duration);
+    // amplitude, frequency
+    score.add({time, duration, pluckInstrument, 2, {amp, freq}});
   }
 
+  // Loads the binary score written by tools/audio/score_convert from
+  // interstellar.json. Tracks missing from the score are skipped.
   void playTune(){
-        // read json file
-        std::ifstream f("/Users/architgupta/allolib/demo1-archit-gpt/tutorials/synthesis/interstellar.json");
-        // cout << "FILE" << endl;
-        // cout << f.rdbuf();
-        json music = json::parse(f);
-
-        json violin = music["tracks"][0]["notes"];
-        json ensemble_violin = music["tracks"][1]["notes"];
-        json piano = music["tracks"][2]["notes"];
-        json bass_piano = music["tracks"][3]["notes"];
-        // json notes = music["tracks"];
-
-    auto v = violin.begin();
-    auto ev = ensemble_violin.begin();
-    auto p = piano.begin();
-    auto bp = bass_piano.begin();
-
-
-    while(v != violin.end() || ev != ensemble_violin.end() || p != piano.end() || bp != bass_piano.end())
-    {
-        if(v != violin.end())
-        {
-            auto note = *v;
-            playSineEnv(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++v;
-        }
-        if(p != piano.end())
-        {
-            auto note = *p;
-            playSineEnv2(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++p;
-        }
-        if(bp != bass_piano.end())
-        {
-            auto note = *bp;
-            playSineEnv3(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++bp;
-        }
-        if(ev != ensemble_violin.end())
-        {
-            auto note = *ev;
-            playPluckString(freq_of(note["midi"]), note["time"], note["duration"], note["velocity"]);
-            ++ev;
-        }
+    BinaryScore music;
+    if (!music.open("interstellar.score") &&
+        !music.open("../interstellar.score")) {
+      return;
     }
-
+    score.reserve(music.numNotes());
+    for (int t = 0; t < music.numTracks(); t++) {
+      const ScoreNoteRecord *notes = music.notes(t);
+      for (int i = 0; i < music.numNotes(t); i++) {
+        const ScoreNoteRecord &note = notes[i];
+        float freq = freq_of(note.midi);
+        switch (t) {
+        case 0: // violin
+          playSineEnv(freq, note.time, note.duration, note.amplitude());
+          break;
+        case 1: // ensemble violin
+          playPluckString(freq, note.time, note.duration, note.amplitude());
+          break;
+        case 2: // piano
+          playSineEnv2(freq, note.time, note.duration, note.amplitude());
+          break;
+        case 3: // bass piano
+          playSineEnv3(freq, note.time, note.duration, note.amplitude());
+          break;
+        }
+      }
     }
+    // Notes are handed to the voice pools as they enter the lookahead window
+    score.play();
+  }
 
 };
 